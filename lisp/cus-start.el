@@ -89,6 +89,8 @@
 	     (gc-cons-threshold alloc integer)
 	     (gc-cons-percentage alloc float)
 	     (garbage-collection-messages alloc boolean)
+	     (gc-minor-collections alloc boolean "28.1")
+	     (gc-full-collection-interval alloc integer "28.1")
 	     ;; buffer.c
 	     (cursor-type display ,cursor-type-types)
 	     (mode-line-format mode-line sexp) ;Hard to do right.
@@ -650,6 +652,10 @@ since it could result in memory overflow and make Emacs crash."
 					(choice integer
 						(const :tag "No limit" nil)))
 	     (line-number-display-limit-width display integer "22.1")
+	     (long-line-threshold display
+				  (choice integer
+					  (const :tag "No limit" nil))
+				  "28.1")
 	     (highlight-nonselected-windows display boolean)
 	     (message-log-max debug (choice (const :tag "Disable" nil)
 					    (integer :menu-tag "lines"
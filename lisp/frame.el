@@ -2786,7 +2786,12 @@ See also `toggle-frame-maximized'."
         display-fill-column-indicator-character
         bidi-paragraph-direction
         bidi-display-reordering
-        bidi-inhibit-bpa))
+        bidi-inhibit-bpa
+        buffer-invisibility-spec
+        face-remapping-alist
+        glyphless-char-display
+        nobreak-char-display
+        char-width-table))
 
 (provide 'frame)
 
@@ -141,6 +141,18 @@ If nil, fontification is not deferred.
 If 0, then fontification is only deferred while there is input pending."
   :type '(choice (const :tag "never" nil)
 	         (number :tag "seconds")))
+
+(defcustom jit-lock-async nil
+  "If non-nil, fontify in a separate thread rather than during redisplay.
+Redisplay then shows text that is not fontified yet without faces,
+and a background thread fontifies it one chunk at a time whenever
+Emacs waits for input.  The faces appear as each chunk is done.
+Since only one Lisp thread runs at a time, input is handled between
+chunks; this keeps typing and scrolling responsive when fontification
+is slow.
+This has no effect if Emacs was built without thread support."
+  :type 'boolean
+  :version "28.1")
 
 ;;; Variables that are not customizable.
 
@@ -360,11 +372,15 @@ Only applies to the current buffer."
 This function is added to `fontification-functions' when `jit-lock-mode'
 is active."
   (when (and jit-lock-mode (not memory-full))
-    (if (not (and jit-lock-defer-timer
-                  (or (not (eq jit-lock-defer-time 0))
-                      (input-pending-p))))
-	;; No deferral.
-	(jit-lock-fontify-now start (+ start jit-lock-chunk-size))
+    (cond
+     ((and jit-lock-async (featurep 'threads))
+      (jit-lock--async-request start))
+     ((not (and jit-lock-defer-timer
+                (or (not (eq jit-lock-defer-time 0))
+                    (input-pending-p))))
+      ;; No deferral.
+      (jit-lock-fontify-now start (+ start jit-lock-chunk-size)))
+     (t
       ;; Record the buffer for later fontification.
       (unless (memq (current-buffer) jit-lock-defer-buffers)
 	(push (current-buffer) jit-lock-defer-buffers))
@@ -375,7 +391,7 @@ is active."
 			  (next-single-property-change
 			   start 'fontified nil
 			   (min (point-max) (+ start jit-lock-chunk-size)))
-			  'fontified 'defer)))))
+			  'fontified 'defer))))))
 
 (defun jit-lock--run-functions (beg end)
   (let ((tight-beg nil) (tight-end nil)
@@ -615,6 +631,74 @@ non-nil in a repeated invocation of this function."
       ;; (message "Jit-Defer Done")
       )))
 
+
+;;; Asynchronous fontification.
+
+(defvar jit-lock--async-queue nil
+  "Markers at the start of text waiting to be fontified asynchronously.
+The text that redisplay asked for most recently comes first.")
+(defvar jit-lock--async-thread nil
+  "Thread doing asynchronous fontification, or nil.")
+(defvar jit-lock--async-timer nil
+  "Timer for asynchronous fontification.")
+(defvar jit-lock--async-refresh-time 0.05
+  "Seconds between redisplays that show asynchronous fontification.")
+
+(defun jit-lock--async-request (start)
+  "Arrange for the current buffer to be fontified from START in a thread."
+  ;; Mark the area as defer-fontified so that the redisplay engine
+  ;; is happy, and so that the thread can tell it is still to be done.
+  (with-buffer-prepared-for-jit-lock
+   (put-text-property start
+		      (next-single-property-change
+		       start 'fontified nil
+		       (min (point-max) (+ start jit-lock-chunk-size)))
+		      'fontified 'defer))
+  (push (copy-marker start) jit-lock--async-queue)
+  ;; Don't start the thread from within redisplay; the timer does it.
+  (unless jit-lock--async-timer
+    (setq jit-lock--async-timer
+          (run-with-timer 0 jit-lock--async-refresh-time
+                          #'jit-lock--async-refresh))))
+
+(defun jit-lock--async-fontify ()
+  "Fontify the text in `jit-lock--async-queue', a chunk at a time.
+This runs in a thread of its own, and yields after each chunk."
+  (while jit-lock--async-queue
+    (let* ((start (pop jit-lock--async-queue))
+           (buffer (marker-buffer start)))
+      (when buffer
+        (with-current-buffer buffer
+          (when (and jit-lock-mode
+                     (not memory-full)
+                     (<= (point-min) start)
+                     (< start (point-max))
+                     ;; Text changed since then has been marked for
+                     ;; fontification anew by `jit-lock-after-change'.
+                     (eq (get-text-property start 'fontified) 'defer))
+            (with-demoted-errors "Error during asynchronous fontification: %S"
+              (jit-lock-fontify-now start (+ start jit-lock-chunk-size))))))
+      (set-marker start nil))
+    ;; No other thread runs until this one yields, so each chunk is
+    ;; fontified from a consistent state of its buffer.  Yield now, so
+    ;; that the main thread can handle input and show the new faces.
+    (thread-yield)))
+
+(defun jit-lock--async-refresh ()
+  "Start the asynchronous fontification thread if needed.
+This is run by `jit-lock--async-timer', and each run makes redisplay
+show what the thread fontified since the previous one.  Cancel the
+timer when there is nothing left to do."
+  (cond
+   ((and jit-lock--async-thread (thread-live-p jit-lock--async-thread)))
+   (jit-lock--async-queue
+    (setq jit-lock--async-thread
+          (make-thread #'jit-lock--async-fontify "jit-lock")))
+   (t
+    (cancel-timer jit-lock--async-timer)
+    (setq jit-lock--async-timer nil
+          jit-lock--async-thread nil))))
+
 
 (defun jit-lock-context-fontify ()
   "Refresh fontification to take new context into account."
@@ -4,7 +4,7 @@
 
 ;; Author: João Távora <joaotavora@gmail.com>
 ;; Keywords: processes, languages, extensions
-;; Version: 1.0.14
+;; Version: 1.0.15
 ;; Package-Requires: ((emacs "25.2"))
 
 ;; This is a GNU ELPA :core package.  Avoid functionality that is not
@@ -409,7 +409,14 @@ connection object, called when the process dies .")
           (read-only-mode t))))
     (setf (jsonrpc--process conn) proc)
     (set-process-buffer proc (get-buffer-create (format " *%s output*" name)))
-    (set-process-filter proc #'jsonrpc--process-filter)
+    (if (fboundp 'set-process-message-framing)
+        (progn
+          (set-process-message-framing proc 'content-length
+                                       :object-type 'plist
+                                       :null-object nil
+                                       :false-object :json-false)
+          (set-process-filter proc #'jsonrpc--process-message-filter))
+      (set-process-filter proc #'jsonrpc--process-filter))
     (set-process-sentinel proc #'jsonrpc--process-sentinel)
     (with-current-buffer (process-buffer proc)
       (buffer-disable-undo)
@@ -617,6 +624,19 @@ With optional CLEANUP, kill any associated buffers."
           ;;
           (setf (jsonrpc--expected-bytes connection) expected-bytes))))))
 
+(defun jsonrpc--process-message-filter (proc message)
+  "Called when a new MESSAGE has arrived for PROC.
+This is the filter when PROC splits its output into messages
+itself, see `set-process-message-framing'."
+  (when (buffer-live-p (process-buffer proc))
+    (if (stringp message)
+        (jsonrpc--warn "Invalid JSON: %s" message)
+      ;; Process content in another buffer, shielding the current
+      ;; buffer from tamper
+      (with-temp-buffer
+        (jsonrpc-connection-receive (process-get proc 'jsonrpc-connection)
+                                    message)))))
+
 (cl-defun jsonrpc--async-request-1 (connection
                                     method
                                     params
@@ -1349,7 +1349,8 @@ rather than line counts."
                (goto-char (point-min))
                (if (eq selective-display t)
                    (re-search-forward "[\n\C-m]" nil 'end (1- line))
-                 (forward-line (1- line)))
+                 (goto-char (or (buffer-line-position (max line 1))
+                                (point-max))))
                (point))))
     (when (and (not relative)
                (buffer-narrowed-p)
@@ -1485,26 +1486,6 @@ included in the count."
 		    invisible-count))))
 	    (t (- (buffer-size) (forward-line (buffer-size))))))))
 
-(defun line-number-at-pos (&optional pos absolute)
-  "Return buffer line number at position POS.
-If POS is nil, use current buffer location.
-
-If ABSOLUTE is nil, the default, counting starts
-at (point-min), so the value refers to the contents of the
-accessible portion of the (potentially narrowed) buffer.  If
-ABSOLUTE is non-nil, ignore any narrowing and return the
-absolute line number."
-  (save-restriction
-    (when absolute
-      (widen))
-    (let ((opoint (or pos (point))) start)
-      (save-excursion
-        (goto-char (point-min))
-        (setq start (point))
-        (goto-char opoint)
-        (forward-line 0)
-        (1+ (count-lines start (point)))))))
-
 (defcustom what-cursor-show-names nil
   "Whether to show character names in `what-cursor-position'."
   :type 'boolean
@@ -284,8 +284,7 @@ See the documentation of `create-fontset-from-fontset-spec' for the format.")
 	 '(gnutls "libgnutls-28.dll" "libgnutls-26.dll"))
        '(libxml2 "libxml2-2.dll" "libxml2.dll")
        '(zlib "zlib1.dll" "libz-1.dll")
-       '(lcms2 "liblcms2-2.dll")
-       '(json "libjansson-4.dll")))
+       '(lcms2 "liblcms2-2.dll")))
 
 ;;; multi-tty support
 (defvar w32-initialized nil
@@ -50,6 +50,7 @@ along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
 #include TERM_HEADER
 #endif /* HAVE_WINDOW_SYSTEM */
 
+#include <count-one-bits.h>
 #include <flexmember.h>
 #include <verify.h>
 #include <execinfo.h>           /* For backtrace.  */
@@ -296,6 +297,39 @@ int number_finalizers_run;
 
 bool gc_in_progress;
 
+/* When `gc-minor-collections' is non-nil, the conses and floats that
+   survive a garbage collection stay marked until the next full
+   collection; call them old.  A minor collection marks only the young
+   (unmarked) conses and floats that are reachable, and frees the
+   others, without tracing through the old ones.  This is not a
+   generational collector: only conses and floats are ever young, and
+   a minor collection still marks and unmarks every symbol, string,
+   vector and dumped object (see mark_minor_gc_roots).
+
+   This is true while the old conses and floats are marked, which is
+   also when stores into old conses must be recorded by the write
+   barrier.  */
+
+bool gc_write_barrier;
+
+/* Number of minor collections since the last full one.  */
+
+static EMACS_INT minor_gcs_since_full;
+
+/* The garbage collector can use helper threads to mark conses and to
+   sweep cons and float blocks; see `gc-parallel-threads'.  This needs
+   POSIX threads and the GCC atomic builtins.  */
+
+#if (defined THREADS_ENABLED && defined HAVE_PTHREAD \
+     && (GNUC_PREREQ (4, 7, 0) || defined __clang__))
+# define HAVE_GC_THREADS true
+
+/* True while helper threads may be marking objects.  The main thread
+   must then set the mark bits of conses and floats atomically.  */
+
+static bool parallel_marking;
+#endif
+
 /* System byte and object counts reported by GC.  */
 
 /* Assume byte counts fit in uintptr_t and object counts fit into
@@ -433,7 +467,18 @@ no_sanitize_memcpy (void *dest, void const *src, size_t size)
 
 static void unchain_finalizer (struct Lisp_Finalizer *);
 static void mark_terminals (void);
-static void gc_sweep (void);
+static void gc_sweep (bool);
+static void unmark_old_conses (void);
+static void mark_minor_gc_roots (void);
+static void gc_sweep_young (void);
+static void garbage_collect_1 (bool);
+static void lazy_sweep_cons_block (void);
+static void lazy_sweep_float_block (void);
+#ifdef HAVE_GC_THREADS
+static int gc_helper_count (void);
+static void pmark_start (int);
+static void pmark_finish (void);
+#endif
 static Lisp_Object make_pure_vector (ptrdiff_t);
 static void mark_buffer (struct buffer *);
 
@@ -2529,6 +2574,19 @@ make_formatted_string (char *buf, const char *format, ...)
   ((block)->gcmarkbits[(n) / BITS_PER_BITS_WORD]	\
    &= ~((bits_word) 1 << ((n) % BITS_PER_BITS_WORD)))
 
+#ifdef HAVE_GC_THREADS
+/* Like SETMARKBIT, for mark bits that other threads may be setting
+   concurrently.  Return true if the bit was not already set.  */
+static bool
+set_mark_bit_atomically (bits_word *bits, int n)
+{
+  bits_word bit = (bits_word) 1 << (n % BITS_PER_BITS_WORD);
+  return ! (__atomic_fetch_or (&bits[n / BITS_PER_BITS_WORD], bit,
+			       __ATOMIC_RELAXED)
+	    & bit);
+}
+#endif
+
 #define FLOAT_BLOCK(fptr) \
   (eassert (!pdumper_object_p (fptr)),                                  \
    ((struct float_block *) (((uintptr_t) (fptr)) & ~(BLOCK_ALIGN - 1))))
@@ -2565,6 +2623,11 @@ static int float_block_index = FLOAT_BLOCK_SIZE;
 
 static struct Lisp_Float *float_free_list;
 
+/* The next float block to sweep, if the last collection left some
+   unswept; see cons_sweep_next.  */
+
+static struct float_block **float_sweep_next;
+
 /* Return a new float object with value FLOAT_VALUE.  */
 
 Lisp_Object
@@ -2574,6 +2637,9 @@ make_float (double float_value)
 
   MALLOC_BLOCK_INPUT;
 
+  while (!float_free_list && float_sweep_next)
+    lazy_sweep_float_block ();
+
   if (float_free_list)
     {
       XSETFLOAT (val, float_free_list);
@@ -2661,11 +2727,62 @@ static int cons_block_index = CONS_BLOCK_SIZE;
 
 static struct Lisp_Cons *cons_free_list;
 
-/* Explicitly free a cons cell by putting it on the free-list.  */
+/* When `gc-lazy-sweep' is non-nil, full collections sweep only the
+   current cons block, and leave the others to be swept one at a time
+   later: when Fcons runs out of free conses, when Emacs is idle, and
+   at the latest at the start of the next collection.  This points to
+   the link to the next block to sweep; all the blocks after it are
+   unswept too.  It is NULL when all the cons blocks are swept.  */
+
+static struct cons_block **cons_sweep_next;
+
+/* Numbers of free conses and floats in the blocks swept since the last
+   collection, and number of cons and float blocks still to sweep.  */
+
+static object_ct lazy_free_conses, lazy_free_floats;
+static ptrdiff_t unswept_blocks;
+
+/* Old conses that were modified to point to objects that might be
+   young since the last garbage collection.  See remember_cons_store.  */
+
+static struct Lisp_Cons **remembered_conses;
+static ptrdiff_t remembered_conses_used, remembered_conses_size;
+
+/* Called by the write barrier after a cons or a float was stored
+   into the cons C.  If C is an old cons, the next
+   minor collection would not look at its contents, so remember it.
+
+   C is unmarked, which makes it look young: further stores into it
+   don't need to be recorded again, and the next minor collection
+   marks it again when it scans remembered_conses.  */
+
+void
+remember_cons_store (struct Lisp_Cons *c)
+{
+  if (gc_in_progress || PURE_P (c) || pdumper_object_p (c)
+      || !XCONS_MARKED_P (c))
+    return;
+  XUNMARK_CONS (c);
+  if (remembered_conses_used == remembered_conses_size)
+    remembered_conses = xpalloc (remembered_conses, &remembered_conses_size,
+				 1, -1, sizeof *remembered_conses);
+  remembered_conses[remembered_conses_used++] = c;
+}
+
+/* Explicitly free a cons cell by putting it on the free-list.
+   If PTR is in a block that the last collection left unswept, leave
+   it alone: it is still marked there, and freeing it now would free
+   it twice.  It is freed by the next collection instead.  */
 
 void
 free_cons (struct Lisp_Cons *ptr)
 {
+  /* Only the blocks still to be swept keep the marks of the last
+     collection; sweeping a block unmarks the conses it keeps.  */
+  if (cons_sweep_next && XCONS_MARKED_P (ptr))
+    return;
+  /* PTR may be an old cons, which stays marked.  */
+  XUNMARK_CONS (ptr);
   ptr->u.s.u.chain = cons_free_list;
   ptr->u.s.car = dead_object ();
   cons_free_list = ptr;
@@ -2681,6 +2798,9 @@ DEFUN ("cons", Fcons, Scons, 2, 2, 0,
 
   MALLOC_BLOCK_INPUT;
 
+  while (!cons_free_list && cons_sweep_next)
+    lazy_sweep_cons_block ();
+
   if (cons_free_list)
     {
       XSETCONS (val, cons_free_list);
@@ -2703,8 +2823,9 @@ DEFUN ("cons", Fcons, Scons, 2, 2, 0,
 
   MALLOC_UNBLOCK_INPUT;
 
-  XSETCAR (val, car);
-  XSETCDR (val, cdr);
+  /* VAL is young, so bypass the write barrier.  */
+  *xcar_addr (val) = car;
+  *xcdr_addr (val) = cdr;
   eassert (!XCONS_MARKED_P (XCONS (val)));
   consing_until_gc -= sizeof (struct Lisp_Cons);
   cons_cells_consed++;
@@ -3106,6 +3227,14 @@ cleanup_vector (struct Lisp_Vector *vector)
     mpz_clear (PSEUDOVEC_STRUCT (vector, Lisp_Bignum)->value);
   else if (PSEUDOVECTOR_TYPEP (&vector->header, PVEC_FINALIZER))
     unchain_finalizer (PSEUDOVEC_STRUCT (vector, Lisp_Finalizer));
+  else if (PSEUDOVECTOR_TYPEP (&vector->header, PVEC_OVERLAY))
+    {
+      /* An overlay that is garbage can't be in any buffer, since
+	 buffers mark their overlays.  */
+      struct Lisp_Overlay *ol = PSEUDOVEC_STRUCT (vector, Lisp_Overlay);
+      eassert (! ol->buffer);
+      xfree (ol->interval);
+    }
   else if (PSEUDOVECTOR_TYPEP (&vector->header, PVEC_FONT))
     {
       if ((vector->header.size & PSEUDOVECTOR_SIZE_MASK) == FONT_OBJECT_MAX)
@@ -3132,7 +3261,15 @@ cleanup_vector (struct Lisp_Vector *vector)
   else if (PSEUDOVECTOR_TYPEP (&vector->header, PVEC_MARKER))
     {
       /* sweep_buffer should already have unchained this from its buffer.  */
-      eassert (! PSEUDOVEC_STRUCT (vector, Lisp_Marker)->buffer);
+      struct Lisp_Marker *m = PSEUDOVEC_STRUCT (vector, Lisp_Marker);
+      eassert (! m->buffer);
+      xfree (m->interval);
+    }
+  else if (PSEUDOVECTOR_TYPEP (&vector->header, PVEC_HASH_TABLE))
+    {
+      struct Lisp_Hash_Table *h = PSEUDOVEC_STRUCT (vector, Lisp_Hash_Table);
+      xfree (h->next);
+      xfree (h->index);
     }
   else if (PSEUDOVECTOR_TYPEP (&vector->header, PVEC_USER_PTR))
     {
@@ -3603,18 +3740,21 @@ make_misc_ptr (void *a)
   return make_lisp_ptr (p, Lisp_Vectorlike);
 }
 
-/* Return a new overlay with specified START, END and PLIST.  */
+/* Return a new overlay with the insertion types FRONT_ADVANCE and
+   REAR_ADVANCE and with PLIST.  The overlay doesn't belong to any
+   buffer yet.  */
 
 Lisp_Object
-build_overlay (Lisp_Object start, Lisp_Object end, Lisp_Object plist)
+build_overlay (bool front_advance, bool rear_advance, Lisp_Object plist)
 {
   struct Lisp_Overlay *p = ALLOCATE_PSEUDOVECTOR (struct Lisp_Overlay, plist,
 						  PVEC_OVERLAY);
   Lisp_Object overlay = make_lisp_ptr (p, Lisp_Vectorlike);
-  OVERLAY_START (overlay) = start;
-  OVERLAY_END (overlay) = end;
+  struct itree_node *node = xmalloc (sizeof *node);
+  itree_node_init (node, front_advance, rear_advance, overlay);
+  p->interval = node;
+  p->buffer = NULL;
   set_overlay_plist (overlay, plist);
-  p->next = NULL;
   return overlay;
 }
 
@@ -3624,13 +3764,14 @@ DEFUN ("make-marker", Fmake_marker, Smake_marker, 0, 0, 0,
 {
   struct Lisp_Marker *p = ALLOCATE_PLAIN_PSEUDOVECTOR (struct Lisp_Marker,
 						       PVEC_MARKER);
+  Lisp_Object marker = make_lisp_ptr (p, Lisp_Vectorlike);
   p->buffer = 0;
-  p->bytepos = 0;
-  p->charpos = 0;
-  p->next = NULL;
+  p->next = p->prev = NULL;
   p->insertion_type = 0;
   p->need_adjustment = 0;
-  return make_lisp_ptr (p, Lisp_Vectorlike);
+  p->interval = xmalloc (sizeof *p->interval);
+  itree_node_init (p->interval, false, false, marker);
+  return marker;
 }
 
 /* Return a newly allocated marker which points into BUF
@@ -3645,16 +3786,9 @@ build_marker (struct buffer *buf, ptrdiff_t charpos, ptrdiff_t bytepos)
   /* Every character is at least one byte.  */
   eassert (charpos <= bytepos);
 
-  struct Lisp_Marker *m = ALLOCATE_PLAIN_PSEUDOVECTOR (struct Lisp_Marker,
-						       PVEC_MARKER);
-  m->buffer = buf;
-  m->charpos = charpos;
-  m->bytepos = bytepos;
-  m->insertion_type = 0;
-  m->need_adjustment = 0;
-  m->next = BUF_MARKERS (buf);
-  BUF_MARKERS (buf) = m;
-  return make_lisp_ptr (m, Lisp_Vectorlike);
+  Lisp_Object marker = Fmake_marker ();
+  attach_marker (XMARKER (marker), buf, charpos, bytepos);
+  return marker;
 }
 
 
@@ -3896,6 +4030,10 @@ set_cons_marked (struct Lisp_Cons *c)
 {
   if (pdumper_object_p (c))
     pdumper_set_marked (c);
+#ifdef HAVE_GC_THREADS
+  else if (parallel_marking)
+    set_mark_bit_atomically (CONS_BLOCK (c)->gcmarkbits, CONS_INDEX (c));
+#endif
   else
     XMARK_CONS (c);
 }
@@ -5448,18 +5586,26 @@ purecopy_hash_table (struct Lisp_Hash_Table *table)
 
   pure->header = table->header;
   pure->weak = purecopy (Qnil);
-  pure->hash = purecopy (table->hash);
-  pure->next = purecopy (table->next);
-  pure->index = purecopy (table->index);
   pure->count = table->count;
   pure->next_free = table->next_free;
   pure->purecopy = table->purecopy;
   eassert (!pure->mutable);
+  pure->scramble_hash = table->scramble_hash;
+  pure->index_size = table->index_size;
   pure->rehash_threshold = table->rehash_threshold;
   pure->rehash_size = table->rehash_size;
   pure->key_and_value = purecopy (table->key_and_value);
   pure->test = pure_test;
 
+  /* The arrays of TABLE are freed along with it, so copy them.  */
+  ptrdiff_t size = HASH_TABLE_SIZE (table);
+  pure->next = xnmalloc (size, sizeof *pure->next);
+  memcpy (pure->next, table->next, size * sizeof *pure->next);
+  ptrdiff_t index_size = table->index_size;
+  pure->index = xnmalloc (index_size, sizeof *pure->index);
+  memcpy (pure->index, table->index, index_size * sizeof *pure->index);
+  pure->next_weak = NULL;
+
   return pure;
 }
 
@@ -5809,8 +5955,7 @@ visit_buffer_root (struct gc_root_visitor visitor,
   /* Buffers that are roots don't have intervals, an undo list, or
      other constructs that real buffers have.  */
   eassert (buffer->base_buffer == NULL);
-  eassert (buffer->overlays_before == NULL);
-  eassert (buffer->overlays_after == NULL);
+  eassert (buffer->overlays == NULL);
 
   /* Visit the buffer-locals.  */
   visit_vectorlike_root (visitor, (struct Lisp_Vector *) buffer, type);
@@ -5958,12 +6103,22 @@ void
 maybe_garbage_collect (void)
 {
   if (bump_consing_until_gc (gc_cons_threshold, Vgc_cons_percentage) < 0)
-    garbage_collect ();
+    garbage_collect_1 (gc_minor_collections && gc_write_barrier
+		       && minor_gcs_since_full < gc_full_collection_interval
+		       && NILP (Vmemory_full));
 }
 
 /* Subroutine of Fgarbage_collect that does most of the work.  */
 void
 garbage_collect (void)
+{
+  garbage_collect_1 (false);
+}
+
+/* Collect garbage.  If MINOR, do a minor collection, which frees
+   only young conses and floats; see gc_write_barrier.  */
+static void
+garbage_collect_1 (bool minor)
 {
   Lisp_Object tail, buffer;
   char stack_top_variable;
@@ -5972,6 +6127,7 @@ garbage_collect (void)
   struct timespec start;
 
   eassert (weak_hash_tables == NULL);
+  eassert (!minor || gc_write_barrier);
 
   if (garbage_collection_inhibited)
     return;
@@ -6038,12 +6194,26 @@ garbage_collect (void)
 
   block_input ();
 
+  /* Finish the sweep of the previous collection.  */
+  while (lazy_sweep_some_blocks ())
+    continue;
+
   shrink_regexp_cache ();
 
   gc_in_progress = 1;
 
+  /* A full collection starts from scratch.  */
+  if (!minor && gc_write_barrier)
+    unmark_old_conses ();
+
   /* Mark all the special slots that serve as the roots of accessibility.  */
 
+#ifdef HAVE_GC_THREADS
+  int helpers = gc_helper_count ();
+  if (helpers > 0)
+    pmark_start (helpers);
+#endif
+
   struct gc_root_visitor visitor = { .visit = mark_object_root_visitor };
   visit_static_gc_roots (visitor);
 
@@ -6052,6 +6222,7 @@ garbage_collect (void)
   mark_terminals ();
   mark_kboards ();
   mark_threads ();
+  mark_regexp_cache ();
 #ifdef HAVE_PGTK
   mark_pgtkterm();
 #endif
@@ -6068,6 +6239,14 @@ garbage_collect (void)
   mark_modules ();
 #endif
 
+  if (minor)
+    mark_minor_gc_roots ();
+
+#ifdef HAVE_GC_THREADS
+  if (parallel_marking)
+    pmark_finish ();
+#endif
+
   /* Everything is now marked, except for the data in font caches,
      undo lists, and finalizers.  The first two are compacted by
      removing an items which aren't reachable otherwise.  */
@@ -6098,10 +6277,17 @@ garbage_collect (void)
   mark_and_sweep_weak_table_contents ();
   eassert (weak_hash_tables == NULL);
 
-  gc_sweep ();
+  if (minor)
+    gc_sweep_young ();
+  else
+    gc_sweep (gc_minor_collections);
 
   unmark_main_thread ();
 
+  /* The surviving conses and floats are now old.  */
+  gc_write_barrier = minor || gc_minor_collections;
+  minor_gcs_since_full = minor ? minor_gcs_since_full + 1 : 0;
+
   gc_in_progress = 0;
 
   unblock_input ();
@@ -6130,16 +6316,27 @@ garbage_collect (void)
     }
 
   /* Accumulate statistics.  */
+  struct timespec elapsed = timespec_sub (current_timespec (), start);
   if (FLOATP (Vgc_elapsed))
     {
       static struct timespec gc_elapsed;
-      gc_elapsed = timespec_add (gc_elapsed,
-				 timespec_sub (current_timespec (), start));
+      gc_elapsed = timespec_add (gc_elapsed, elapsed);
       Vgc_elapsed = make_float (timespectod (gc_elapsed));
     }
 
   gcs_done++;
 
+  if (minor)
+    {
+      if (FLOATP (Vgc_minor_elapsed))
+	{
+	  static struct timespec gc_minor_elapsed;
+	  gc_minor_elapsed = timespec_add (gc_minor_elapsed, elapsed);
+	  Vgc_minor_elapsed = make_float (timespectod (gc_minor_elapsed));
+	}
+      gcs_minor_done++;
+    }
+
   /* Collect profiling data.  */
   if (tot_before != (byte_ct) -1)
     {
@@ -6161,6 +6358,16 @@ where each entry has the form (NAME SIZE USED FREE), where:
 - FREE is the number of those objects that are not live but that Emacs
   keeps around for future allocations (maybe because it does not know how
   to return them to the OS).
+If `gc-lazy-sweep' is non-nil, the list also has an entry of the form
+\(unswept-blocks SIZE COUNT), where COUNT is the number of blocks of
+conses and floats that are still to be swept, and SIZE their size in
+bytes.  The numbers of used and free conses and floats include the
+contents of those blocks.
+If `gc-minor-collections' is non-nil, the list also has an entry of
+the form \(collections MINOR MINOR-TIME FULL FULL-TIME), where MINOR and FULL
+are the numbers of minor and full collections done so far, and
+MINOR-TIME and FULL-TIME the seconds they took in total, as in
+`gcs-minor-done' and `gc-minor-elapsed'.
 However, if there was overflow in pure space, and Emacs was dumped
 using the 'unexec' method, `garbage-collect' returns nil, because
 real GC can't be done.
@@ -6206,7 +6413,19 @@ See Info node `(elisp)Garbage Collection'.  */)
 	   make_int ((mallinfo ().fordblks + 1023) >> 10)),
 #endif
   };
-  return CALLMANY (Flist, total);
+  Lisp_Object value = CALLMANY (Flist, total);
+  if (gc_lazy_sweep)
+    value = nconc2 (value, list1 (list3 (Qunswept_blocks,
+					 make_fixnum (BLOCK_BYTES),
+					 make_int (unswept_blocks))));
+  if (gc_minor_collections && FLOATP (Vgc_elapsed) && FLOATP (Vgc_minor_elapsed))
+    value = nconc2 (value,
+		    list1 (list5 (Qcollections, make_int (gcs_minor_done),
+				  Vgc_minor_elapsed,
+				  make_int (gcs_done - gcs_minor_done),
+				  make_float (XFLOAT_DATA (Vgc_elapsed)
+					      - XFLOAT_DATA (Vgc_minor_elapsed)))));
+  return value;
 }
 
 /* Mark Lisp objects in glyph matrix MATRIX.  Currently the
@@ -6310,19 +6529,27 @@ mark_compiled (struct Lisp_Vector *ptr)
   return size > COMPILED_CONSTANTS ? ptr->contents[COMPILED_CONSTANTS] : Qnil;
 }
 
-/* Mark the chain of overlays starting at PTR.  */
+/* Mark the overlay OV.  Its interval tree node is not a Lisp object
+   and is freed together with the overlay; see cleanup_vector.  */
 
 static void
-mark_overlay (struct Lisp_Overlay *ptr)
+mark_overlay (struct Lisp_Overlay *ov)
 {
-  for (; ptr && !vectorlike_marked_p (&ptr->header); ptr = ptr->next)
-    {
-      set_vectorlike_marked (&ptr->header);
-      /* These two are always markers and can be marked fast.  */
-      set_vectorlike_marked (&XMARKER (ptr->start)->header);
-      set_vectorlike_marked (&XMARKER (ptr->end)->header);
-      mark_object (ptr->plist);
-    }
+  eassert (EQ (ov->interval->data, make_lisp_ptr (ov, Lisp_Vectorlike)));
+  set_vectorlike_marked (&ov->header);
+  mark_object (ov->plist);
+}
+
+/* Mark the overlays in the interval tree TREE.  */
+
+static void
+mark_overlays (struct itree_tree *tree)
+{
+  struct itree_node *node;
+
+  ITREE_FOREACH (node, tree, PTRDIFF_MIN, PTRDIFF_MAX, ASCENDING)
+    if (! vectorlike_marked_p (&XOVERLAY (node->data)->header))
+      mark_overlay (XOVERLAY (node->data));
 }
 
 /* Mark Lisp_Objects and special pointers in BUFFER.  */
@@ -6346,8 +6573,7 @@ mark_buffer (struct buffer *buffer)
   if (!BUFFER_LIVE_P (buffer))
       mark_object (BVAR (buffer, undo_list));
 
-  mark_overlay (buffer->overlays_before);
-  mark_overlay (buffer->overlays_after);
+  mark_overlays (buffer->overlays);
 
   /* If this is an indirect buffer, mark its base buffer.  */
   if (buffer->base_buffer &&
@@ -6375,6 +6601,14 @@ mark_face_cache (struct face_cache *c)
 	      mark_objects (face->lface, LFACE_VECTOR_SIZE);
 	    }
 	}
+
+      if (c->merge_cache)
+	for (int i = 0; i < ARRAYELTS (c->merge_cache->entries); i++)
+	  {
+	    struct face_merge *m = &c->merge_cache->entries[i];
+	    if (m->base_face_id >= 0)
+	      mark_objects (m->specs, m->nspecs);
+	  }
     }
 }
 
@@ -6492,6 +6726,518 @@ mark_objects (Lisp_Object *obj, ptrdiff_t n)
     mark_object (obj[i]);
 }
 
+#ifdef HAVE_GC_THREADS
+
+/* Helper threads for the garbage collector.
+
+   When `gc-parallel-threads' is positive, that many helper threads
+   are created when first needed, and they then wait for tasks.  They
+   never run Lisp code, allocate memory or handle signals.
+
+   While the main thread marks the roots, the helpers trace the conses
+   it reaches: instead of recursing into a cons it marks, the main
+   thread hands it over to them through a pool of marked conses whose
+   contents are still to be traced.  The helpers mark only the objects
+   whose mark bits they can set atomically, that is conses and floats
+   allocated in blocks, and strings without intervals.  They defer any
+   other object they find, unless it is already marked, to the main
+   thread, which marks it with mark_object once it is done with the
+   roots.  Objects of the dump image are always deferred, since their
+   mark bits are not set atomically.
+
+   The helpers also sweep cons and float blocks, while the main thread
+   sweeps strings.  */
+
+/* Maximum number of helper threads.  */
+enum { GC_MAX_HELPERS = 64 };
+
+/* Capacities of the pool of conses to trace and of the queue of
+   deferred objects.  */
+enum { PMARK_POOL_SIZE = 1 << 16, PMARK_DEFERRED_SIZE = 1 << 16 };
+
+/* Number of objects that a thread hands over at once.  */
+enum { PMARK_BATCH = 256 };
+
+/* Size of the stack of conses to trace of each helper thread.  */
+enum { PMARK_STACK_SIZE = 4096 };
+
+/* Number of helper threads created so far, and whether creating one
+   failed, in which case no more are tried.  */
+static int gc_helpers;
+static bool gc_helpers_failed;
+
+/* Protects the variables below.  */
+static sys_mutex_t gc_helper_lock;
+
+/* Signaled when helpers have a new task.  */
+static sys_cond_t gc_helper_cond;
+
+/* Signaled when a helper finishes its task, and during marking when
+   the main thread may have something to do.  */
+static sys_cond_t gc_main_cond;
+
+/* The current task of the helpers: helpers 1 to GC_HELPER_TASK_COUNT
+   each call GC_HELPER_TASK with their number.  The task is new for a
+   helper when GC_HELPER_TASK_SERIAL differs from its entry in
+   GC_HELPER_SERIAL.  GC_HELPERS_BUSY is the number of helpers that
+   have not finished it yet.  */
+static void (*gc_helper_task) (int);
+static int gc_helper_task_count;
+static EMACS_UINT gc_helper_task_serial;
+static EMACS_UINT gc_helper_serial[GC_MAX_HELPERS + 1];
+static int gc_helpers_busy;
+
+/* Signaled when there are conses to trace in the pool, when there is
+   room again in the deferred queue, and when marking is over.  */
+static sys_cond_t pmark_cond;
+
+/* The pool of marked conses whose contents remain to be traced.  */
+static struct Lisp_Cons **pmark_pool;
+static int pmark_pool_used;
+
+/* The queue of objects deferred to the main thread.  The main thread
+   swaps it with PMARK_DEFERRED_SPARE before marking its contents.  */
+static Lisp_Object *pmark_deferred, *pmark_deferred_spare;
+static int pmark_deferred_used;
+
+/* Number of helpers tracing conses, and waiting for conses to trace.  */
+static int pmark_busy, pmark_idle;
+
+/* True when marking is over, and the helpers should stop.  */
+static bool pmark_done;
+
+/* Conses that the main thread marked, but did not put into the pool
+   yet.  Used only by the main thread.  */
+static struct Lisp_Cons *pmark_pending[PMARK_BATCH];
+static int pmark_pending_used;
+
+/* True while the main thread marks deferred objects.  */
+static bool pmark_draining;
+
+static void *
+gc_helper_thread (void *arg)
+{
+  int id = (intptr_t) arg;
+
+  sys_thread_set_name ("emacs-gc");
+  sys_mutex_lock (&gc_helper_lock);
+  for (;;)
+    {
+      while (gc_helper_serial[id] == gc_helper_task_serial)
+	sys_cond_wait (&gc_helper_cond, &gc_helper_lock);
+      gc_helper_serial[id] = gc_helper_task_serial;
+      if (id <= gc_helper_task_count)
+	{
+	  void (*task) (int) = gc_helper_task;
+	  sys_mutex_unlock (&gc_helper_lock);
+	  task (id);
+	  sys_mutex_lock (&gc_helper_lock);
+	  if (--gc_helpers_busy == 0)
+	    sys_cond_broadcast (&gc_main_cond);
+	}
+    }
+  return NULL;
+}
+
+/* Return the number of helper threads to use for the current garbage
+   collection, creating them if needed.  */
+
+static int
+gc_helper_count (void)
+{
+  int n = clip_to_bounds (0, gc_parallel_threads, GC_MAX_HELPERS);
+
+  if (gc_helpers < n && !gc_helpers_failed)
+    {
+      if (gc_helpers == 0)
+	{
+	  pmark_pool = malloc (PMARK_POOL_SIZE * sizeof *pmark_pool);
+	  pmark_deferred
+	    = malloc (PMARK_DEFERRED_SIZE * sizeof *pmark_deferred);
+	  pmark_deferred_spare
+	    = malloc (PMARK_DEFERRED_SIZE * sizeof *pmark_deferred_spare);
+	  if (! (pmark_pool && pmark_deferred && pmark_deferred_spare))
+	    {
+	      free (pmark_pool);
+	      free (pmark_deferred);
+	      free (pmark_deferred_spare);
+	      gc_helpers_failed = true;
+	      return 0;
+	    }
+	  sys_mutex_init (&gc_helper_lock);
+	  sys_cond_init (&gc_helper_cond);
+	  sys_cond_init (&gc_main_cond);
+	  sys_cond_init (&pmark_cond);
+	}
+
+      /* The helpers inherit this signal mask, so that signals are
+	 never delivered to them.  */
+      sigset_t blocked, oldset;
+      sigfillset (&blocked);
+      pthread_sigmask (SIG_BLOCK, &blocked, &oldset);
+      while (gc_helpers < n)
+	{
+	  sys_thread_t thread;
+	  int id = gc_helpers + 1;
+	  gc_helper_serial[id] = gc_helper_task_serial;
+	  if (!sys_thread_create (&thread, gc_helper_thread,
+				  (void *) (intptr_t) id))
+	    {
+	      gc_helpers_failed = true;
+	      break;
+	    }
+	  gc_helpers = id;
+	}
+      pthread_sigmask (SIG_SETMASK, &oldset, 0);
+    }
+
+  return min (n, gc_helpers);
+}
+
+/* Make helpers 1 to N run TASK.  */
+
+static void
+gc_start_helpers (void (*task) (int), int n)
+{
+  sys_mutex_lock (&gc_helper_lock);
+  gc_helper_task = task;
+  gc_helper_task_count = n;
+  gc_helpers_busy = n;
+  gc_helper_task_serial++;
+  sys_cond_broadcast (&gc_helper_cond);
+  sys_mutex_unlock (&gc_helper_lock);
+}
+
+/* Wait until the helpers have finished their task.  */
+
+static void
+gc_wait_helpers (void)
+{
+  sys_mutex_lock (&gc_helper_lock);
+  while (gc_helpers_busy > 0)
+    sys_cond_wait (&gc_main_cond, &gc_helper_lock);
+  sys_mutex_unlock (&gc_helper_lock);
+}
+
+/* The local state of a helper thread during marking: the objects it
+   deferred, but did not put into the queue yet, and its stack of
+   marked conses whose contents are still to be traced.  */
+
+struct pmark_state
+{
+  int ndeferred, nstack;
+  Lisp_Object deferred[PMARK_BATCH];
+  struct Lisp_Cons *stack[PMARK_STACK_SIZE];
+};
+
+static void
+pmark_flush_deferred (struct pmark_state *s)
+{
+  sys_mutex_lock (&gc_helper_lock);
+  while (PMARK_DEFERRED_SIZE - pmark_deferred_used < s->ndeferred)
+    sys_cond_wait (&pmark_cond, &gc_helper_lock);
+  memcpy (pmark_deferred + pmark_deferred_used, s->deferred,
+	  s->ndeferred * sizeof *s->deferred);
+  pmark_deferred_used += s->ndeferred;
+  s->ndeferred = 0;
+  sys_cond_signal (&gc_main_cond);
+  sys_mutex_unlock (&gc_helper_lock);
+}
+
+static void
+pmark_defer (struct pmark_state *s, Lisp_Object obj)
+{
+  if (s->ndeferred == PMARK_BATCH)
+    pmark_flush_deferred (s);
+  s->deferred[s->ndeferred++] = obj;
+}
+
+/* Mark OBJ in a helper thread.  If it is a cons that was not marked
+   yet, return it, as its contents must now be traced.  */
+
+static struct Lisp_Cons *
+pmark_mark (struct pmark_state *s, Lisp_Object obj)
+{
+  void *po = XPNTR (obj);
+  bool marked;
+
+  if (PURE_P (po))
+    return NULL;
+
+  /* Checking whether OBJ is marked before deferring it is racy, but
+     a stale answer only costs a useless deferral.  */
+  switch (XTYPE (obj))
+    {
+    case Lisp_Cons:
+      if (pdumper_object_p (po))
+	{
+	  marked = pdumper_marked_p (po);
+	  break;
+	}
+      return (set_mark_bit_atomically (CONS_BLOCK (po)->gcmarkbits,
+				       CONS_INDEX (po))
+	      ? po : NULL);
+
+    case Lisp_Float:
+      if (!pdumper_object_p (po))
+	set_mark_bit_atomically (FLOAT_BLOCK (po)->gcmarkbits,
+				 FLOAT_INDEX (po));
+      return NULL;
+
+    case Lisp_String:
+      {
+	struct Lisp_String *str = po;
+	if (!pdumper_object_p (str) && !str->u.s.intervals)
+	  {
+	    __atomic_fetch_or (&str->u.s.size, ARRAY_MARK_FLAG,
+			       __ATOMIC_RELAXED);
+	    return NULL;
+	  }
+	marked = string_marked_p (str);
+      }
+      break;
+
+    case Lisp_Symbol:
+      /* Built-in symbols are always marked by the main thread.  */
+      if (c_symbol_p (po))
+	return NULL;
+      marked = symbol_marked_p (po);
+      break;
+
+    case_Lisp_Int:
+      return NULL;
+
+    default:
+      marked = vector_marked_p (po);
+      break;
+    }
+
+  if (!marked)
+    pmark_defer (s, obj);
+  return NULL;
+}
+
+/* Move the bottom half of the stack of a helper thread into the pool,
+   so that other helpers can trace those conses.  Return false if the
+   pool is full.  */
+
+static bool
+pmark_spill (struct pmark_state *s)
+{
+  sys_mutex_lock (&gc_helper_lock);
+  int n = min (s->nstack / 2, PMARK_POOL_SIZE - pmark_pool_used);
+  memcpy (pmark_pool + pmark_pool_used, s->stack, n * sizeof *s->stack);
+  pmark_pool_used += n;
+  if (n > 0)
+    sys_cond_broadcast (&pmark_cond);
+  sys_mutex_unlock (&gc_helper_lock);
+
+  s->nstack -= n;
+  memmove (s->stack, s->stack + n, s->nstack * sizeof *s->stack);
+  return n > 0;
+}
+
+static void pmark_scan (struct pmark_state *, struct Lisp_Cons *);
+
+/* Push the marked cons C on the stack of a helper thread.  */
+
+static void
+pmark_push (struct pmark_state *s, struct Lisp_Cons *c)
+{
+  if (s->nstack == PMARK_STACK_SIZE && !pmark_spill (s))
+    /* There is no room anywhere, so trace C right now.  */
+    pmark_scan (s, c);
+  else
+    s->stack[s->nstack++] = c;
+}
+
+/* Trace the contents of the marked cons C in a helper thread.  */
+
+static void
+pmark_scan (struct pmark_state *s, struct Lisp_Cons *c)
+{
+  do
+    {
+      struct Lisp_Cons *car = pmark_mark (s, c->u.s.car);
+      if (car)
+	pmark_push (s, car);
+      c = pmark_mark (s, c->u.s.u.cdr);
+    }
+  while (c);
+}
+
+/* Trace the contents of the conses on the stack of a helper thread,
+   until it is empty.  */
+
+static void
+pmark_trace (struct pmark_state *s)
+{
+  for (int n = 1; s->nstack > 0; n++)
+    {
+      pmark_scan (s, s->stack[--s->nstack]);
+
+      /* Now and then, give work to helpers that have none.  */
+      if (n % PMARK_BATCH == 0 && s->nstack > 1
+	  && __atomic_load_n (&pmark_idle, __ATOMIC_RELAXED) > 0)
+	pmark_spill (s);
+    }
+}
+
+/* The marking task of helper threads.  */
+
+static void
+pmark_helper (int id)
+{
+  struct pmark_state state;
+  struct pmark_state *s = &state;
+  s->ndeferred = s->nstack = 0;
+
+  sys_mutex_lock (&gc_helper_lock);
+  for (;;)
+    {
+      if (pmark_pool_used == 0)
+	{
+	  if (pmark_done)
+	    break;
+	  pmark_idle++;
+	  sys_cond_wait (&pmark_cond, &gc_helper_lock);
+	  pmark_idle--;
+	  continue;
+	}
+
+      int n = min (pmark_pool_used,
+		   max (1, pmark_pool_used / gc_helper_task_count));
+      n = min (n, PMARK_BATCH);
+      pmark_pool_used -= n;
+      memcpy (s->stack, pmark_pool + pmark_pool_used, n * sizeof *s->stack);
+      s->nstack = n;
+      pmark_busy++;
+      sys_mutex_unlock (&gc_helper_lock);
+
+      pmark_trace (s);
+      if (s->ndeferred > 0)
+	pmark_flush_deferred (s);
+
+      sys_mutex_lock (&gc_helper_lock);
+      if (--pmark_busy == 0 && pmark_pool_used == 0)
+	sys_cond_signal (&gc_main_cond);
+    }
+  sys_mutex_unlock (&gc_helper_lock);
+}
+
+/* Start marking with the help of N helper threads.  */
+
+static void
+pmark_start (int n)
+{
+  pmark_pool_used = pmark_deferred_used = pmark_pending_used = 0;
+  pmark_busy = pmark_idle = 0;
+  pmark_done = false;
+  parallel_marking = true;
+  gc_start_helpers (pmark_helper, n);
+}
+
+/* Mark the objects deferred to the main thread so far.  */
+
+static void
+pmark_drain (void)
+{
+  sys_mutex_lock (&gc_helper_lock);
+  Lisp_Object *objs = pmark_deferred;
+  int n = pmark_deferred_used;
+  pmark_deferred = pmark_deferred_spare;
+  pmark_deferred_spare = objs;
+  pmark_deferred_used = 0;
+  sys_cond_broadcast (&pmark_cond);
+  sys_mutex_unlock (&gc_helper_lock);
+
+  pmark_draining = true;
+  mark_objects (objs, n);
+  pmark_draining = false;
+}
+
+/* Put the conses marked by the main thread into the pool.  */
+
+static void
+pmark_flush_pending (void)
+{
+  int n = pmark_pending_used;
+  pmark_pending_used = 0;
+
+  sys_mutex_lock (&gc_helper_lock);
+  int shared = min (n, PMARK_POOL_SIZE - pmark_pool_used);
+  memcpy (pmark_pool + pmark_pool_used, pmark_pending,
+	  shared * sizeof *pmark_pool);
+  pmark_pool_used += shared;
+  sys_cond_broadcast (&pmark_cond);
+  bool drain = (!pmark_draining
+		&& pmark_deferred_used >= PMARK_DEFERRED_SIZE / 2);
+  sys_mutex_unlock (&gc_helper_lock);
+
+  /* If the pool is full, trace the rest here.  */
+  if (shared < n)
+    {
+      struct Lisp_Cons *rest[PMARK_BATCH];
+      memcpy (rest, pmark_pending + shared, (n - shared) * sizeof *rest);
+      for (int i = 0; i < n - shared; i++)
+	{
+	  mark_object (rest[i]->u.s.car);
+	  mark_object (rest[i]->u.s.u.cdr);
+	}
+    }
+
+  /* Don't let the helpers wait too long for the main thread to
+     process what they deferred.  */
+  if (drain)
+    pmark_drain ();
+}
+
+/* Let the helper threads trace the contents of C, which the main
+   thread just marked.  */
+
+static void
+pmark_hand_over (struct Lisp_Cons *c)
+{
+  pmark_pending[pmark_pending_used++] = c;
+  if (pmark_pending_used == PMARK_BATCH)
+    pmark_flush_pending ();
+}
+
+/* Finish marking with helper threads: wait for them to trace all the
+   conses, while marking what they defer.  */
+
+static void
+pmark_finish (void)
+{
+  for (;;)
+    {
+      /* Flushing can mark deferred objects, and hand over more.  */
+      while (pmark_pending_used > 0)
+	pmark_flush_pending ();
+
+      sys_mutex_lock (&gc_helper_lock);
+      while (pmark_deferred_used == 0
+	     && (pmark_pool_used > 0 || pmark_busy > 0))
+	sys_cond_wait (&gc_main_cond, &gc_helper_lock);
+      bool done = pmark_deferred_used == 0;
+      if (done)
+	{
+	  pmark_done = true;
+	  sys_cond_broadcast (&pmark_cond);
+	}
+      sys_mutex_unlock (&gc_helper_lock);
+      if (done)
+	break;
+
+      pmark_drain ();
+    }
+
+  gc_wait_helpers ();
+  parallel_marking = false;
+}
+
+#endif	/* HAVE_GC_THREADS */
+
 /* Determine type of generic Lisp_Object and mark it accordingly.
 
    This function implements a straightforward depth-first marking
@@ -6725,6 +7471,15 @@ mark_object (Lisp_Object arg)
 	if (cons_marked_p (ptr))
 	  break;
 	CHECK_ALLOCATED_AND_LIVE (live_cons_p, MEM_TYPE_CONS);
+#ifdef HAVE_GC_THREADS
+	if (parallel_marking && !pdumper_object_p (ptr))
+	  {
+	    if (set_mark_bit_atomically (CONS_BLOCK (ptr)->gcmarkbits,
+					 CONS_INDEX (ptr)))
+	      pmark_hand_over (ptr);
+	    break;
+	  }
+#endif
         set_cons_marked (ptr);
 	/* If the cdr is nil, avoid recursion for the car.  */
 	if (NILP (ptr->u.s.u.cdr))
@@ -6747,6 +7502,11 @@ mark_object (Lisp_Object arg)
          "cold" and do not have mark bits.  */
       if (pdumper_object_p (XFLOAT (obj)))
         eassert (pdumper_cold_object_p (XFLOAT (obj)));
+#ifdef HAVE_GC_THREADS
+      else if (parallel_marking)
+	set_mark_bit_atomically (FLOAT_BLOCK (XFLOAT (obj))->gcmarkbits,
+				 FLOAT_INDEX (XFLOAT (obj)));
+#endif
       else if (!XFLOAT_MARKED_P (XFLOAT (obj)))
         XFLOAT_MARK (XFLOAT (obj));
       break;
@@ -6830,76 +7590,286 @@ survives_gc_p (Lisp_Object obj)
 
 
 
+/* The result of sweeping a cons or float block: its free objects,
+   chained together from FREE_HEAD to FREE_TAIL, and the numbers of
+   its free and used objects.  */
+
+struct block_sweep
+{
+  void *block;
+  void *free_head, *free_tail;
+  int nfree, nused;
+};
+
+/* Sweep the first LIM conses of CBLK, and store the result in R.  If
+   KEEP_MARKS, leave the marked conses marked.  */
+
+static void
+sweep_cons_block (struct cons_block *cblk, int lim, bool keep_marks,
+		  struct block_sweep *r)
+{
+  struct Lisp_Cons *head = NULL, *tail = NULL;
+  int this_free = 0, this_used = 0;
+  int ilim = (lim + BITS_PER_BITS_WORD - 1) / BITS_PER_BITS_WORD;
+
+  /* Scan the mark bits an int at a time.  */
+  for (int i = 0; i < ilim; i++)
+    {
+      if (cblk->gcmarkbits[i] == BITS_WORD_MAX)
+	{
+	  /* Fast path - all cons cells for this int are marked.  */
+	  if (!keep_marks)
+	    cblk->gcmarkbits[i] = 0;
+	  this_used += BITS_PER_BITS_WORD;
+	}
+      else
+	{
+	  /* Some cons cells for this int are not marked.
+	     Find which ones, and free them.  */
+	  int start, pos, stop;
+
+	  start = i * BITS_PER_BITS_WORD;
+	  stop = lim - start;
+	  if (stop > BITS_PER_BITS_WORD)
+	    stop = BITS_PER_BITS_WORD;
+	  stop += start;
+
+	  for (pos = start; pos < stop; pos++)
+	    {
+	      struct Lisp_Cons *acons = &cblk->conses[pos];
+	      if (!XCONS_MARKED_P (acons))
+		{
+		  this_free++;
+		  if (!tail)
+		    tail = acons;
+		  acons->u.s.u.chain = head;
+		  head = acons;
+		  acons->u.s.car = dead_object ();
+		}
+	      else
+		{
+		  this_used++;
+		  if (!keep_marks)
+		    XUNMARK_CONS (acons);
+		}
+	    }
+	}
+    }
+
+  *r = (struct block_sweep) { .block = cblk, .free_head = head,
+			      .free_tail = tail, .nfree = this_free,
+			      .nused = this_used };
+}
+
+/* Likewise for floats.  */
+
+static void
+sweep_float_block (struct float_block *fblk, int lim, bool keep_marks,
+		   struct block_sweep *r)
+{
+  struct Lisp_Float *head = NULL, *tail = NULL;
+  int this_free = 0, this_used = 0;
+
+  for (int i = 0; i < lim; i++)
+    {
+      struct Lisp_Float *afloat = &fblk->floats[i];
+      if (!XFLOAT_MARKED_P (afloat))
+	{
+	  this_free++;
+	  if (!tail)
+	    tail = afloat;
+	  afloat->u.chain = head;
+	  head = afloat;
+	}
+      else
+	{
+	  this_used++;
+	  if (!keep_marks)
+	    XFLOAT_UNMARK (afloat);
+	}
+    }
+
+  *r = (struct block_sweep) { .block = fblk, .free_head = head,
+			      .free_tail = tail, .nfree = this_free,
+			      .nused = this_used };
+}
+
+/* When helper threads sweep cons and float blocks in advance, the
+   results for all cons blocks and then all float blocks, in list
+   order.  NULL otherwise.  */
+static struct block_sweep *block_sweeps;
+static ptrdiff_t block_sweeps_conses;
+
+#ifdef HAVE_GC_THREADS
+
+/* Sweep only in the main thread if there are fewer blocks than this.  */
+enum { PARALLEL_SWEEP_MIN_BLOCKS = 64 };
+
+/* Number of blocks that a thread sweeps at once.  */
+enum { PARALLEL_SWEEP_CHUNK = 16 };
+
+/* The number of entries of BLOCK_SWEEPS, the index of the next block
+   to sweep, and whether to keep the marks.  */
+static ptrdiff_t block_sweeps_total;
+static ptrdiff_t block_sweeps_next;
+static bool block_sweeps_keep_marks;
+
+/* Sweep blocks in advance until there are none left.  This runs both
+   in helper threads and in the main thread.  */
+
+static void
+presweep_blocks (int id)
+{
+  for (;;)
+    {
+      ptrdiff_t i = __atomic_fetch_add (&block_sweeps_next,
+					PARALLEL_SWEEP_CHUNK,
+					__ATOMIC_RELAXED);
+      if (i >= block_sweeps_total)
+	break;
+      ptrdiff_t lim = min (i + PARALLEL_SWEEP_CHUNK, block_sweeps_total);
+      for (; i < lim; i++)
+	{
+	  struct block_sweep *r = &block_sweeps[i];
+	  if (i < block_sweeps_conses)
+	    sweep_cons_block (r->block,
+			      i == 0 ? cons_block_index : CONS_BLOCK_SIZE,
+			      block_sweeps_keep_marks, r);
+	  else
+	    sweep_float_block (r->block,
+			       (i == block_sweeps_conses
+				? float_block_index : FLOAT_BLOCK_SIZE),
+			       block_sweeps_keep_marks, r);
+	}
+    }
+}
+
+/* Make the helper threads start sweeping cons and float blocks in
+   advance, if worthwhile, and return the number of helpers used.  */
+
+static int
+start_presweep (bool keep_marks)
+{
+  int helpers = gc_helper_count ();
+  if (helpers == 0)
+    return 0;
+
+  ptrdiff_t nconses = 0, total = 0;
+  for (struct cons_block *cblk = cons_block; cblk; cblk = cblk->next)
+    nconses++;
+  total = nconses;
+  for (struct float_block *fblk = float_block; fblk; fblk = fblk->next)
+    total++;
+  if (total < PARALLEL_SWEEP_MIN_BLOCKS)
+    return 0;
+
+  block_sweeps = malloc (total * sizeof *block_sweeps);
+  if (!block_sweeps)
+    return 0;
+  ptrdiff_t i = 0;
+  for (struct cons_block *cblk = cons_block; cblk; cblk = cblk->next)
+    block_sweeps[i++].block = cblk;
+  for (struct float_block *fblk = float_block; fblk; fblk = fblk->next)
+    block_sweeps[i++].block = fblk;
+  block_sweeps_conses = nconses;
+  block_sweeps_total = total;
+  block_sweeps_next = 0;
+  block_sweeps_keep_marks = keep_marks;
+
+  gc_start_helpers (presweep_blocks, helpers);
+  return helpers;
+}
+
+/* Help the helper threads sweep blocks in advance, and wait for them
+   to finish.  */
+
+static void
+finish_presweep (void)
+{
+  presweep_blocks (0);
+  gc_wait_helpers ();
+}
+
+#endif	/* HAVE_GC_THREADS */
+
+/* Return the number of marked objects in a cons or float block whose
+   mark bits are the N words at BITS.  */
+
+static int
+count_marks (bits_word const *bits, int n)
+{
+  int count = 0;
+  for (int i = 0; i < n; i++)
+    count += (BITS_WORD_MAX <= ULONG_MAX
+	      ? count_one_bits_l (bits[i])
+	      : count_one_bits_ll (bits[i]));
+  return count;
+}
+
+/* Free the unmarked conses.  If KEEP_MARKS, leave the marked ones
+   marked, so that they become old.  If LAZY, sweep only
+   the current block, and leave the others to lazy_sweep_cons_block.  */
+
 NO_INLINE /* For better stack traces */
 static void
-sweep_conses (void)
+sweep_conses (bool keep_marks, bool lazy)
 {
   struct cons_block **cprev = &cons_block;
   int lim = cons_block_index;
   object_ct num_free = 0, num_used = 0;
+  struct block_sweep *swept = block_sweeps;
 
   cons_free_list = 0;
 
   for (struct cons_block *cblk; (cblk = *cprev); )
     {
-      int i = 0;
-      int this_free = 0;
-      int ilim = (lim + BITS_PER_BITS_WORD - 1) / BITS_PER_BITS_WORD;
-
-      /* Scan the mark bits an int at a time.  */
-      for (i = 0; i < ilim; i++)
-        {
-          if (cblk->gcmarkbits[i] == BITS_WORD_MAX)
-            {
-              /* Fast path - all cons cells for this int are marked.  */
-              cblk->gcmarkbits[i] = 0;
-              num_used += BITS_PER_BITS_WORD;
-            }
-          else
-            {
-              /* Some cons cells for this int are not marked.
-                 Find which ones, and free them.  */
-              int start, pos, stop;
-
-              start = i * BITS_PER_BITS_WORD;
-              stop = lim - start;
-              if (stop > BITS_PER_BITS_WORD)
-                stop = BITS_PER_BITS_WORD;
-              stop += start;
+      if (lazy && cprev != &cons_block)
+	{
+	  /* Count the live conses of the unswept blocks from their
+	     mark bits, taking into account the blocks that
+	     lazy_sweep_cons_block will free.  */
+	  cons_sweep_next = cprev;
+	  lazy_free_conses = num_free;
+	  for (; cblk; cblk = cblk->next)
+	    {
+	      int used = count_marks (cblk->gcmarkbits,
+				      ARRAYELTS (cblk->gcmarkbits));
+	      if (! (used == 0 && num_free > CONS_BLOCK_SIZE))
+		{
+		  num_free += CONS_BLOCK_SIZE - used;
+		  num_used += used;
+		}
+	      unswept_blocks++;
+	    }
+	  break;
+	}
 
-              for (pos = start; pos < stop; pos++)
-                {
-		  struct Lisp_Cons *acons = &cblk->conses[pos];
-		  if (!XCONS_MARKED_P (acons))
-                    {
-                      this_free++;
-                      cblk->conses[pos].u.s.u.chain = cons_free_list;
-                      cons_free_list = &cblk->conses[pos];
-                      cons_free_list->u.s.car = dead_object ();
-                    }
-                  else
-                    {
-                      num_used++;
-		      XUNMARK_CONS (acons);
-                    }
-                }
-            }
-        }
+      struct block_sweep r;
+      if (swept)
+	r = *swept++;
+      else
+	sweep_cons_block (cblk, lim, keep_marks, &r);
+      eassert (r.block == cblk);
+      num_used += r.nused;
 
       lim = CONS_BLOCK_SIZE;
       /* If this block contains only free conses and we have already
          seen more than two blocks worth of free conses then deallocate
          this block.  */
-      if (this_free == CONS_BLOCK_SIZE && num_free > CONS_BLOCK_SIZE)
+      if (r.nfree == CONS_BLOCK_SIZE && num_free > CONS_BLOCK_SIZE)
         {
           *cprev = cblk->next;
-          /* Unhook from the free list.  */
-          cons_free_list = cblk->conses[0].u.s.u.chain;
           lisp_align_free (cblk);
         }
       else
         {
-          num_free += this_free;
+          num_free += r.nfree;
+	  if (r.nfree > 0)
+	    {
+	      struct Lisp_Cons *tail = r.free_tail;
+	      tail->u.s.u.chain = cons_free_list;
+	      cons_free_list = r.free_head;
+	    }
           cprev = &cblk->next;
         }
     }
@@ -6907,48 +7877,66 @@ sweep_conses (void)
   gcstat.total_free_conses = num_free;
 }
 
+/* Likewise for floats.  */
+
 NO_INLINE /* For better stack traces */
 static void
-sweep_floats (void)
+sweep_floats (bool keep_marks, bool lazy)
 {
   struct float_block **fprev = &float_block;
   int lim = float_block_index;
   object_ct num_free = 0, num_used = 0;
+  struct block_sweep *swept
+    = block_sweeps ? block_sweeps + block_sweeps_conses : NULL;
 
   float_free_list = 0;
 
   for (struct float_block *fblk; (fblk = *fprev); )
     {
-      int this_free = 0;
-      for (int i = 0; i < lim; i++)
+      if (lazy && fprev != &float_block)
 	{
-	  struct Lisp_Float *afloat = &fblk->floats[i];
-	  if (!XFLOAT_MARKED_P (afloat))
-	    {
-	      this_free++;
-	      fblk->floats[i].u.chain = float_free_list;
-	      float_free_list = &fblk->floats[i];
-	    }
-	  else
+	  float_sweep_next = fprev;
+	  lazy_free_floats = num_free;
+	  for (; fblk; fblk = fblk->next)
 	    {
-	      num_used++;
-	      XFLOAT_UNMARK (afloat);
+	      int used = count_marks (fblk->gcmarkbits,
+				      ARRAYELTS (fblk->gcmarkbits));
+	      if (! (used == 0 && num_free > FLOAT_BLOCK_SIZE))
+		{
+		  num_free += FLOAT_BLOCK_SIZE - used;
+		  num_used += used;
+		}
+	      unswept_blocks++;
 	    }
+	  break;
 	}
+
+      struct block_sweep r;
+      if (swept)
+	r = *swept++;
+      else
+	sweep_float_block (fblk, lim, keep_marks, &r);
+      eassert (r.block == fblk);
+      num_used += r.nused;
+
       lim = FLOAT_BLOCK_SIZE;
       /* If this block contains only free floats and we have already
          seen more than two blocks worth of free floats then deallocate
          this block.  */
-      if (this_free == FLOAT_BLOCK_SIZE && num_free > FLOAT_BLOCK_SIZE)
+      if (r.nfree == FLOAT_BLOCK_SIZE && num_free > FLOAT_BLOCK_SIZE)
         {
           *fprev = fblk->next;
-          /* Unhook from the free list.  */
-          float_free_list = fblk->floats[0].u.chain;
           lisp_align_free (fblk);
         }
       else
         {
-          num_free += this_free;
+          num_free += r.nfree;
+	  if (r.nfree > 0)
+	    {
+	      struct Lisp_Float *tail = r.free_tail;
+	      tail->u.chain = float_free_list;
+	      float_free_list = r.free_head;
+	    }
           fprev = &fblk->next;
         }
     }
@@ -6956,6 +7944,84 @@ sweep_floats (void)
   gcstat.total_free_floats = num_free;
 }
 
+/* Sweep the next cons block that the last collection left unswept.  */
+
+static void
+lazy_sweep_cons_block (void)
+{
+  struct cons_block *cblk = *cons_sweep_next;
+  struct block_sweep r;
+
+  sweep_cons_block (cblk, CONS_BLOCK_SIZE, false, &r);
+  if (r.nfree == CONS_BLOCK_SIZE && lazy_free_conses > CONS_BLOCK_SIZE)
+    {
+      *cons_sweep_next = cblk->next;
+      lisp_align_free (cblk);
+    }
+  else
+    {
+      lazy_free_conses += r.nfree;
+      if (r.nfree > 0)
+	{
+	  struct Lisp_Cons *tail = r.free_tail;
+	  tail->u.s.u.chain = cons_free_list;
+	  cons_free_list = r.free_head;
+	}
+      cons_sweep_next = &cblk->next;
+    }
+  if (!*cons_sweep_next)
+    cons_sweep_next = NULL;
+  unswept_blocks--;
+}
+
+/* Likewise for floats.  */
+
+static void
+lazy_sweep_float_block (void)
+{
+  struct float_block *fblk = *float_sweep_next;
+  struct block_sweep r;
+
+  sweep_float_block (fblk, FLOAT_BLOCK_SIZE, false, &r);
+  if (r.nfree == FLOAT_BLOCK_SIZE && lazy_free_floats > FLOAT_BLOCK_SIZE)
+    {
+      *float_sweep_next = fblk->next;
+      lisp_align_free (fblk);
+    }
+  else
+    {
+      lazy_free_floats += r.nfree;
+      if (r.nfree > 0)
+	{
+	  struct Lisp_Float *tail = r.free_tail;
+	  tail->u.chain = float_free_list;
+	  float_free_list = r.free_head;
+	}
+      float_sweep_next = &fblk->next;
+    }
+  if (!*float_sweep_next)
+    float_sweep_next = NULL;
+  unswept_blocks--;
+}
+
+/* Sweep a few of the blocks that the last garbage collection left
+   unswept.  Return true if some remain.  */
+
+bool
+lazy_sweep_some_blocks (void)
+{
+  for (int i = 0; i < 16; i++)
+    {
+      if (cons_sweep_next)
+	lazy_sweep_cons_block ();
+      else if (float_sweep_next)
+	lazy_sweep_float_block ();
+      else
+	return false;
+    }
+  return cons_sweep_next || float_sweep_next;
+}
+
 NO_INLINE /* For better stack traces */
 static void
 sweep_intervals (void)
@@ -7079,16 +8145,14 @@ sweep_symbols (void)
 static void
 unchain_dead_markers (struct buffer *buffer)
 {
-  struct Lisp_Marker *this, **prev = &BUF_MARKERS (buffer);
+  struct Lisp_Marker *this, *next;
 
-  while ((this = *prev))
-    if (vectorlike_marked_p (&this->header))
-      prev = &this->next;
-    else
-      {
-        this->buffer = NULL;
-        *prev = this->next;
-      }
+  for (this = BUF_MARKERS (buffer); this; this = next)
+    {
+      next = this->next;
+      if (!vectorlike_marked_p (&this->header))
+	unchain_marker (this);
+    }
 }
 
 NO_INLINE /* For better stack traces */
@@ -7108,14 +8172,28 @@ sweep_buffers (void)
     }
 }
 
-/* Sweep: find all structures not marked, and free them.  */
+/* Sweep: find all structures not marked, and free them.  If
+   KEEP_MARKS, the surviving conses and floats stay marked and become
+   old.  */
 static void
-gc_sweep (void)
+gc_sweep (bool keep_marks)
 {
+  /* Lazy sweeping would free the old conses that the write barrier
+     unmarks, so it is not used with minor collections.  */
+  bool lazy = gc_lazy_sweep && !keep_marks;
+#ifdef HAVE_GC_THREADS
+  bool presweep = !lazy && start_presweep (keep_marks) > 0;
+#endif
   sweep_strings ();
   check_string_bytes (!noninteractive);
-  sweep_conses ();
-  sweep_floats ();
+#ifdef HAVE_GC_THREADS
+  if (presweep)
+    finish_presweep ();
+#endif
+  sweep_conses (keep_marks, lazy);
+  sweep_floats (keep_marks, lazy);
+  free (block_sweeps);
+  block_sweeps = NULL;
   sweep_intervals ();
   sweep_symbols ();
   sweep_buffers ();
@@ -7124,12 +8202,126 @@ gc_sweep (void)
   check_string_bytes (!noninteractive);
 }
 
-DEFUN ("memory-info", Fmemory_info, Smemory_info, 0, 0, 0,
-       doc: /* Return a list of (TOTAL-RAM FREE-RAM TOTAL-SWAP FREE-SWAP).
-All values are in Kbytes.  If there is no swap space,
-last two values are zero.  If the system is not supported
-or memory information can't be obtained, return nil.  */)
-  (void)
+/* Clear the marks of the old conses and floats, before a full
+   collection.  */
+
+static void
+unmark_old_conses (void)
+{
+  for (struct cons_block *cblk = cons_block; cblk; cblk = cblk->next)
+    memset (cblk->gcmarkbits, 0, sizeof cblk->gcmarkbits);
+  for (struct float_block *fblk = float_block; fblk; fblk = fblk->next)
+    memset (fblk->gcmarkbits, 0, sizeof fblk->gcmarkbits);
+  remembered_conses_used = 0;
+}
+
+/* In a minor collection, mark everything that can refer to young
+   objects but is not reached by tracing from young objects: the old
+   conses recorded by the write barrier, and all the objects that are
+   never allocated young.  The latter are freed only by full
+   collections, so they are marked whether they are reachable or not;
+   otherwise they could keep pointers to freed conses.  */
+
+static void
+mark_minor_gc_roots (void)
+{
+  for (ptrdiff_t i = 0; i < remembered_conses_used; i++)
+    {
+      struct Lisp_Cons *c = remembered_conses[i];
+      /* C might have been freed by free_cons since.  */
+      if (!deadp (c->u.s.car))
+	mark_object (make_lisp_ptr (c, Lisp_Cons));
+    }
+  remembered_conses_used = 0;
+
+  for (int i = 0; i < ARRAYELTS (lispsym); i++)
+    mark_object (builtin_lisp_symbol (i));
+  int lim = symbol_block_index;
+  for (struct symbol_block *sblk = symbol_block; sblk; sblk = sblk->next)
+    {
+      for (int i = 0; i < lim; i++)
+	if (!deadp (sblk->symbols[i].u.s.function))
+	  mark_object (make_lisp_symbol (&sblk->symbols[i]));
+      lim = SYMBOL_BLOCK_SIZE;
+    }
+
+  /* Strings refer only to their intervals.  */
+  for (struct string_block *b = string_blocks; b; b = b->next)
+    for (int i = 0; i < STRING_BLOCK_SIZE; i++)
+      if (b->strings[i].u.s.data)
+	mark_interval_tree (b->strings[i].u.s.intervals);
+
+  for (struct vector_block *block = vector_blocks; block; block = block->next)
+    for (struct Lisp_Vector *vector = (struct Lisp_Vector *) block->data,
+	   *next; VECTOR_IN_BLOCK (vector, block); vector = next)
+      {
+	next = ADVANCE (vector, vector_nbytes (vector));
+	if (!PSEUDOVECTOR_TYPEP (&vector->header, PVEC_FREE))
+	  mark_object (make_lisp_ptr (vector, Lisp_Vectorlike));
+      }
+  for (struct large_vector *lv = large_vectors; lv; lv = lv->next)
+    mark_object (make_lisp_ptr (large_vector_vec (lv), Lisp_Vectorlike));
+
+  pdumper_visit_live_objects (mark_object);
+}
+
+/* Sweep after a minor collection.  Free the young conses and floats
+   that were not reached, and unmark the objects of all the other
+   types without freeing any of them.  */
+
+static void
+gc_sweep_young (void)
+{
+#ifdef HAVE_GC_THREADS
+  if (start_presweep (true) > 0)
+    finish_presweep ();
+#endif
+  sweep_conses (true, false);
+  sweep_floats (true, false);
+  free (block_sweeps);
+  block_sweeps = NULL;
+
+  for (struct string_block *b = string_blocks; b; b = b->next)
+    for (int i = 0; i < STRING_BLOCK_SIZE; i++)
+      if (b->strings[i].u.s.data)
+	XUNMARK_STRING (&b->strings[i]);
+
+  int lim = interval_block_index;
+  for (struct interval_block *iblk = interval_block; iblk; iblk = iblk->next)
+    {
+      for (int i = 0; i < lim; i++)
+	iblk->intervals[i].gcmarkbit = 0;
+      lim = INTERVAL_BLOCK_SIZE;
+    }
+
+  for (int i = 0; i < ARRAYELTS (lispsym); i++)
+    lispsym[i].u.s.gcmarkbit = 0;
+  lim = symbol_block_index;
+  for (struct symbol_block *sblk = symbol_block; sblk; sblk = sblk->next)
+    {
+      for (int i = 0; i < lim; i++)
+	sblk->symbols[i].u.s.gcmarkbit = 0;
+      lim = SYMBOL_BLOCK_SIZE;
+    }
+
+  sweep_buffers ();
+
+  for (struct vector_block *block = vector_blocks; block; block = block->next)
+    for (struct Lisp_Vector *vector = (struct Lisp_Vector *) block->data;
+	 VECTOR_IN_BLOCK (vector, block);
+	 vector = ADVANCE (vector, vector_nbytes (vector)))
+      XUNMARK_VECTOR (vector);
+  for (struct large_vector *lv = large_vectors; lv; lv = lv->next)
+    XUNMARK_VECTOR (large_vector_vec (lv));
+
+  pdumper_clear_marks ();
+}
+
+/* Return a list of (TOTAL-RAM FREE-RAM TOTAL-SWAP FREE-SWAP), or nil;
+   see `memory-info'.  */
+
+static Lisp_Object
+system_memory_info (void)
 {
 #if defined HAVE_LINUX_SYSINFO
   struct sysinfo si;
@@ -7172,6 +8364,23 @@ or memory information can't be obtained, return nil.  */)
 #endif /* HAVE_LINUX_SYSINFO, not WINDOWSNT, not MSDOS */
 }
 
+DEFUN ("memory-info", Fmemory_info, Smemory_info, 0, 0, 0,
+       doc: /* Return a list of (TOTAL-RAM FREE-RAM TOTAL-SWAP FREE-SWAP).
+All values are in Kbytes.  If there is no swap space,
+last two values are zero.  If the system is not supported
+or memory information can't be obtained, return nil.
+If `gc-lazy-sweep' is non-nil, the list has a fifth element UNSWEPT,
+the size in Kbytes of the blocks of conses and floats that the last
+garbage collection left to be swept.  */)
+  (void)
+{
+  Lisp_Object info = system_memory_info ();
+  if (CONSP (info) && gc_lazy_sweep)
+    info = nconc2 (info, list1 (make_int (unswept_blocks * BLOCK_BYTES
+					  / 1024)));
+  return info;
+}
+
 /* Debugging aids.  */
 
 DEFUN ("memory-use-counts", Fmemory_use_counts, Smemory_use_counts, 0, 0, 0,
@@ -7433,6 +8642,8 @@ init_alloc (void)
 {
   Vgc_elapsed = make_float (0.0);
   gcs_done = 0;
+  Vgc_minor_elapsed = make_float (0.0);
+  gcs_minor_done = 0;
 }
 
 void
@@ -7520,6 +8731,8 @@ do hash-consing of the objects allocated to pure space.  */);
   DEFSYM (Qstring_bytes, "string-bytes");
   DEFSYM (Qvector_slots, "vector-slots");
   DEFSYM (Qheap, "heap");
+  DEFSYM (Qunswept_blocks, "unswept-blocks");
+  DEFSYM (Qcollections, "collections");
   DEFSYM (QAutomatic_GC, "Automatic GC");
 
   DEFSYM (Qgc_cons_percentage, "gc-cons-percentage");
@@ -7532,6 +8745,59 @@ The time is in seconds as a floating point value.  */);
   DEFVAR_INT ("gcs-done", gcs_done,
               doc: /* Accumulated number of garbage collections done.  */);
 
+  DEFVAR_INT ("gc-parallel-threads", gc_parallel_threads,
+	      doc: /* Number of helper threads for garbage collection.
+If positive, the garbage collector uses up to this many threads, in
+addition to the main thread, to mark conses and to sweep conses and
+floats.  This can make garbage collection faster on machines with
+several processors.  Zero means to collect garbage in the main thread
+only.  The helper threads are created when first needed, and never run
+Lisp code.  This has no effect if Emacs was built without support for
+threads.  */);
+  gc_parallel_threads = 0;
+
+  DEFVAR_BOOL ("gc-lazy-sweep", gc_lazy_sweep,
+	       doc: /* Non-nil means sweep most cons and float blocks lazily.
+Garbage collection then frees the unreachable conses and floats of each
+block only when new conses or floats are needed, when Emacs is idle, or
+at the latest at the start of the next garbage collection, instead of
+freeing them all before returning.  This shortens garbage collection
+pauses.  See `garbage-collect' for how to know how many blocks remain
+to be swept.  This has no effect on minor garbage collections; see
+`gc-minor-collections'.  */);
+  gc_lazy_sweep = false;
+
+  DEFVAR_BOOL ("gc-minor-collections", gc_minor_collections,
+	       doc: /* Non-nil means most garbage collections free only conses and floats.
+Most automatic garbage collections are then minor collections, which
+only free the cons cells and floats allocated since the previous
+collection.  They do not trace through the conses and floats that
+survived a previous collection, but they still mark every symbol,
+string, vector and object in the dump file, as a full collection does,
+so they are only faster when most of the heap is made of old conses.
+Objects of other types, and the objects that survived a collection,
+are only freed by full collections; see `gc-full-collection-interval'.
+
+Calling `garbage-collect' always performs a full collection.
+
+This is best set early during startup, e.g. in the early init file.  */);
+  gc_minor_collections = false;
+
+  DEFVAR_INT ("gc-full-collection-interval", gc_full_collection_interval,
+	      doc: /* Number of minor collections between two full collections.
+This is used when `gc-minor-collections' is non-nil.  Larger values make
+full collections rarer, but let more memory be used by objects that
+are no longer reachable.  */);
+  gc_full_collection_interval = 10;
+
+  DEFVAR_LISP ("gc-minor-elapsed", Vgc_minor_elapsed,
+	       doc: /* Accumulated time elapsed in minor garbage collections.
+The time is in seconds as a floating point value.  It is included in
+`gc-elapsed'.  See `gc-minor-collections'.  */);
+  DEFVAR_INT ("gcs-minor-done", gcs_minor_done,
+	      doc: /* Accumulated number of minor garbage collections done.
+These are included in `gcs-done'.  See `gc-minor-collections'.  */);
+
   DEFVAR_INT ("integer-width", integer_width,
 	      doc: /* Maximum number N of bits in safely-calculated integers.
 Integers with absolute values less than 2**N do not signal a range error.
@@ -26,6 +26,7 @@ along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
 
 #include "character.h"
 #include "lisp.h"
+#include "itree.h"
 
 INLINE_HEADER_BEGIN
 
@@ -117,6 +118,9 @@ enum { BEG = 1, BEG_BYTE = BEG };
 /* Character modification count.  */
 #define BUF_CHARS_MODIFF(buf) ((buf)->text->chars_modiff)
 
+/* Count of character modifications other than insertions at the end.  */
+#define BUF_INNER_MODIFF(buf) ((buf)->text->inner_modiff)
+
 /* Modification count as of last visit or save.  */
 #define BUF_SAVE_MODIFF(buf) ((buf)->text->save_modiff)
 
@@ -133,6 +137,9 @@ enum { BEG = 1, BEG_BYTE = BEG };
 /* Marker chain of buffer.  */
 #define BUF_MARKERS(buf) ((buf)->text->markers)
 
+/* Tree of the positions of the markers of buffer BUF.  */
+#define BUF_MARKER_TREE(buf) ((buf)->text->marker_tree)
+
 #define BUF_UNCHANGED_MODIFIED(buf) \
   ((buf)->text->unchanged_modified)
 
@@ -236,6 +243,11 @@ struct buffer_text
 				   events for this buffer.  It is set to
 				   modiff for each such event, and never
 				   otherwise changed.  */
+    modiff_count inner_modiff;	/* This is set to the value chars_modiff
+				   will have after each character change
+				   other than an insertion at the end of
+				   the buffer, and never otherwise
+				   changed.  */
     modiff_count save_modiff;	/* Previous value of modiff, as of last
 				   time buffer visited or saved a file.  */
 
@@ -266,11 +278,14 @@ struct buffer_text
        This is actually a single marker ---
        successive elements in its marker `chain'
        are the other markers referring to this buffer.
-       This is a singly linked unordered list, which means that it's
-       very cheap to add a marker to the list and it's also very cheap
-       to move a marker within a buffer.  */
+       This is a doubly linked unordered list, which means that it's
+       very cheap to add a marker to the list or to remove one.  */
     struct Lisp_Marker *markers;
 
+    /* The positions of the same markers, in a tree ordered by
+       position, or NULL if there are no markers yet.  */
+    struct itree_tree *marker_tree;
+
     /* Usually false.  Temporarily true in decode_coding_gap to
        prevent Fgarbage_collect from shrinking the gap and losing
        not-yet-decoded bytes.  */
@@ -656,6 +671,10 @@ struct buffer
   struct region_cache *width_run_cache;
   struct region_cache *bidi_paragraph_cache;
 
+  /* The line index of the buffer, or NULL if there is none yet.  See
+     line-index.h.  Indirect buffers use that of their base buffer.  */
+  struct line_index *line_index;
+
   /* Non-zero means disable redisplay optimizations when rebuilding the glyph
      matrices (but not when redrawing).  */
   bool_bf prevent_redisplay_optimizations_p : 1;
@@ -670,16 +689,9 @@ struct buffer
      defined.  */
   bool_bf inhibit_buffer_hooks : 1;
 
-  /* List of overlays that end at or before the current center,
-     in order of end-position.  */
-  struct Lisp_Overlay *overlays_before;
-
-  /* List of overlays that end after  the current center,
-     in order of start-position.  */
-  struct Lisp_Overlay *overlays_after;
-
-  /* Position where the overlay lists are centered.  */
-  ptrdiff_t overlay_center;
+  /* The interval tree containing this buffer's overlays, or NULL if
+     the buffer has never had any.  */
+  struct itree_tree *overlays;
 
   /* Changes in the buffer are recorded here for undo, and t means
      don't record anything.  This information belongs to the base
@@ -1141,18 +1153,21 @@ extern void delete_all_overlays (struct buffer *);
 extern void reset_buffer (struct buffer *);
 extern void compact_buffer (struct buffer *);
 extern void evaporate_overlays (ptrdiff_t);
-extern ptrdiff_t overlays_at (EMACS_INT, bool, Lisp_Object **,
-			      ptrdiff_t *, ptrdiff_t *, ptrdiff_t *, bool);
+extern ptrdiff_t overlays_at (ptrdiff_t, bool, Lisp_Object **,
+			      ptrdiff_t *, ptrdiff_t *);
+extern ptrdiff_t next_overlay_change (ptrdiff_t);
+extern ptrdiff_t previous_overlay_change (ptrdiff_t);
 extern ptrdiff_t sort_overlays (Lisp_Object *, ptrdiff_t, struct window *);
-extern void recenter_overlay_lists (struct buffer *, ptrdiff_t);
 extern ptrdiff_t overlay_strings (ptrdiff_t, struct window *, unsigned char **);
+extern void transpose_overlays_in_tree (struct itree_tree *,
+					ptrdiff_t, ptrdiff_t,
+					ptrdiff_t, ptrdiff_t);
 extern void validate_region (Lisp_Object *, Lisp_Object *);
 extern void set_buffer_internal_1 (struct buffer *);
 extern void set_buffer_internal_2 (struct buffer *);
 extern void set_buffer_temp (struct buffer *);
 extern Lisp_Object buffer_local_value (Lisp_Object, Lisp_Object);
 extern void record_buffer (Lisp_Object);
-extern void fix_overlays_before (struct buffer *, ptrdiff_t, ptrdiff_t);
 extern void mmap_set_vars (bool);
 extern void restore_buffer (Lisp_Object);
 extern void set_buffer_if_live (Lisp_Object);
@@ -1191,23 +1206,22 @@ record_unwind_current_buffer (void)
 }
 
 /* Get overlays at POSN into array OVERLAYS with NOVERLAYS elements.
-   If NEXTP is non-NULL, return next overlay there.
-   See overlay_at arg CHANGE_REQ for meaning of CHRQ arg.
+   If NEXTP is non-NULL, return next overlay change there.
    This macro might evaluate its args multiple times,
    and it treat some args as lvalues.  */
 
-#define GET_OVERLAYS_AT(posn, overlays, noverlays, nextp, chrq)		\
+#define GET_OVERLAYS_AT(posn, overlays, noverlays, nextp)		\
   do {									\
     ptrdiff_t maxlen = 40;						\
     SAFE_NALLOCA (overlays, 1, maxlen);					\
     (noverlays) = overlays_at (posn, false, &(overlays), &maxlen,	\
-			       nextp, NULL, chrq);			\
+			       nextp);					\
     if ((noverlays) > maxlen)						\
       {									\
 	maxlen = noverlays;						\
 	SAFE_NALLOCA (overlays, 1, maxlen);				\
 	(noverlays) = overlays_at (posn, false, &(overlays), &maxlen,	\
-				   nextp, NULL, chrq);			\
+				   nextp);				\
       }									\
   } while (false)
 
@@ -1242,7 +1256,8 @@ set_buffer_intervals (struct buffer *b, INTERVAL i)
 INLINE bool
 buffer_has_overlays (void)
 {
-  return current_buffer->overlays_before || current_buffer->overlays_after;
+  return current_buffer->overlays
+	 && current_buffer->overlays->root != NULL;
 }
 
 /* Functions for accessing a character or byte,
@@ -1360,25 +1375,74 @@ buffer_window_count (struct buffer *b)
 
 /* Overlays */
 
-/* Return the marker that stands for where OV starts in the buffer.  */
+/* Return the start of OV in its buffer, or -1 if OV is not associated
+   with any buffer.  */
 
-#define OVERLAY_START(OV) XOVERLAY (OV)->start
+INLINE ptrdiff_t
+overlay_start (struct Lisp_Overlay *ov)
+{
+  if (! ov->buffer)
+    return -1;
+  return itree_node_begin (ov->buffer->overlays, ov->interval);
+}
 
-/* Return the marker that stands for where OV ends in the buffer.  */
+/* Return the end of OV in its buffer, or -1 if OV is not associated
+   with any buffer.  */
 
-#define OVERLAY_END(OV) XOVERLAY (OV)->end
+INLINE ptrdiff_t
+overlay_end (struct Lisp_Overlay *ov)
+{
+  if (! ov->buffer)
+    return -1;
+  return itree_node_end (ov->buffer->overlays, ov->interval);
+}
 
-/* Return the plist of overlay OV.  */
+/* Return the position where OV starts in its buffer.  */
 
-#define OVERLAY_PLIST(OV) XOVERLAY (OV)->plist
+INLINE ptrdiff_t
+OVERLAY_START (Lisp_Object ov)
+{
+  return overlay_start (XOVERLAY (ov));
+}
 
-/* Return the actual buffer position for the marker P.
-   We assume you know which buffer it's pointing into.  */
+/* Return the position where OV ends in its buffer.  */
 
 INLINE ptrdiff_t
-OVERLAY_POSITION (Lisp_Object p)
+OVERLAY_END (Lisp_Object ov)
+{
+  return overlay_end (XOVERLAY (ov));
+}
+
+/* Return the plist of overlay OV.  */
+
+INLINE Lisp_Object
+OVERLAY_PLIST (Lisp_Object ov)
+{
+  return XOVERLAY (ov)->plist;
+}
+
+/* Return the buffer of overlay OV, or NULL if it has been deleted.  */
+
+INLINE struct buffer *
+OVERLAY_BUFFER (Lisp_Object ov)
+{
+  return XOVERLAY (ov)->buffer;
+}
+
+/* Return true if text inserted at the start of OV goes after it.  */
+
+INLINE bool
+OVERLAY_FRONT_ADVANCE_P (Lisp_Object ov)
+{
+  return XOVERLAY (ov)->interval->front_advance;
+}
+
+/* Return true if text inserted at the end of OV goes inside it.  */
+
+INLINE bool
+OVERLAY_REAR_ADVANCE_P (Lisp_Object ov)
 {
-  return marker_position (p);
+  return XOVERLAY (ov)->interval->rear_advance;
 }
 
 
@@ -52,6 +52,11 @@ static const int chartab_bits[4] =
 #define CHARTAB_IDX(c, depth, min_char)		\
   (((c) - (min_char)) >> chartab_bits[(depth)])
 
+/* Incremented whenever Lisp code changes the contents of a
+   char-table in place.  The display code uses this to notice changes
+   to tables such as glyphless-char-display.  */
+EMACS_INT char_table_modiff;
+
 
 /* Preamble for uniprop (Unicode character property) tables.  See the
    comment of "Unicode character property tables".  */
@@ -558,6 +563,7 @@ Return PARENT.  PARENT must be either nil or another char-table.  */)
     }
 
   set_char_table_parent (char_table, parent);
+  char_table_modiff++;
 
   return parent;
 }
@@ -589,6 +595,7 @@ DEFUN ("set-char-table-extra-slot", Fset_char_table_extra_slot,
     args_out_of_range (char_table, n);
 
   set_char_table_extras (char_table, XFIXNUM (n), value);
+  char_table_modiff++;
   return value;
 }
 
@@ -652,6 +659,7 @@ or a character code.  Return VALUE.  */)
     }
   else
     error ("Invalid RANGE argument to `set-char-table-range'");
+  char_table_modiff++;
 
   return value;
 }
@@ -6275,14 +6275,14 @@ check_utf_8 (struct coding_system *coding)
       else if (UTF_8_2_OCTET_LEADING_P (c))
 	{
 	  if (c < 0xC2		/* overlong sequence */
-	      || src + 1 >= end
+	      || src + 1 > end
 	      || ! UTF_8_EXTRA_OCTET_P (src[1]))
 	    return -1;
 	  src += 2;
 	}
       else if (UTF_8_3_OCTET_LEADING_P (c))
 	{
-	  if (src + 2 >= end
+	  if (src + 2 > end
 	      || ! (UTF_8_EXTRA_OCTET_P (src[1])
 		    && UTF_8_EXTRA_OCTET_P (src[2])))
 	    return -1;
@@ -6295,7 +6295,7 @@ check_utf_8 (struct coding_system *coding)
 	}
       else if (UTF_8_4_OCTET_LEADING_P (c))
 	{
-	  if (src + 3 >= end
+	  if (src + 3 > end
 	      || ! (UTF_8_EXTRA_OCTET_P (src[1])
 		    && UTF_8_EXTRA_OCTET_P (src[2])
 		    && UTF_8_EXTRA_OCTET_P (src[3])))
@@ -8028,6 +8028,139 @@ decode_coding_gap (struct coding_system *coding, ptrdiff_t bytes)
   unbind_to (count, Qnil);
 }
 
+/* Note which markers of the current buffer should stay at the same
+   end of the text between FROM and TO when it is replaced by its
+   conversion: those at FROM that advance at insertion and those at TO
+   that don't, which the replacement would otherwise move to the other
+   end.  Return true if there are any.  */
+
+static bool
+mark_markers_for_adjustment (ptrdiff_t from, ptrdiff_t to)
+{
+  struct itree_node *node;
+  bool need_marker_adjustment = false;
+
+  ITREE_FOREACH (node, BUF_MARKER_TREE (current_buffer), from, to + 1,
+		 ASCENDING)
+    {
+      struct Lisp_Marker *m = XMARKER (node->data);
+      m->need_adjustment
+	= node->begin == (m->insertion_type ? from : to);
+      need_marker_adjustment |= m->need_adjustment;
+    }
+  return need_marker_adjustment;
+}
+
+/* Put back the markers noted by mark_markers_for_adjustment, now that
+   the text at FROM (FROM_BYTE) has been replaced by the text CODING
+   produced.  */
+
+static void
+adjust_markers_after_conversion (struct coding_system *coding,
+				 ptrdiff_t from, ptrdiff_t from_byte)
+{
+  ptrdiff_t to = (NILP (BVAR (current_buffer, enable_multibyte_characters))
+		  ? from + coding->produced : from + coding->produced_char);
+  ptrdiff_t to_byte = from_byte + coding->produced;
+  struct itree_node *node;
+  struct Lisp_Marker **markers;
+  ptrdiff_t nmarkers = 0, i;
+  USE_SAFE_ALLOCA;
+
+  /* The tree can't be changed while we look for the markers, so
+     collect them first.  */
+  SAFE_NALLOCA (markers, 1, itree_size (BUF_MARKER_TREE (current_buffer)));
+  ITREE_FOREACH (node, BUF_MARKER_TREE (current_buffer), from, to + 1,
+		 ASCENDING)
+    {
+      struct Lisp_Marker *m = XMARKER (node->data);
+      if (m->need_adjustment)
+	{
+	  m->need_adjustment = 0;
+	  markers[nmarkers++] = m;
+	}
+    }
+  for (i = 0; i < nmarkers; i++)
+    {
+      struct Lisp_Marker *m = markers[i];
+      if (m->insertion_type)
+	attach_marker (m, m->buffer, from, from_byte);
+      else
+	attach_marker (m, m->buffer, to, to_byte);
+    }
+  SAFE_FREE ();
+}
+
+
+/* Return the number of characters in the source text of CODING if
+   decoding it would just copy its bytes, as for ASCII text or valid
+   UTF-8 that needs no EOL conversion.  Otherwise, return -1.
+
+   The source must be unibyte.  If it is not the last block, an
+   incomplete UTF-8 sequence at its end is moved to
+   CODING->carryover, and CODING->src_bytes reduced to exclude it.  */
+
+static ptrdiff_t
+check_verbatim (struct coding_system *coding)
+{
+  Lisp_Object attrs = CODING_ID_ATTRS (coding->id);
+  Lisp_Object eol_type = CODING_ID_EOL_TYPE (coding->id);
+  ptrdiff_t nchars, tail = 0;
+
+  if (disable_ascii_optimization
+      || coding->src_multibyte
+      || NILP (CODING_ATTR_ASCII_COMPAT (attrs))
+      || ! NILP (CODING_ATTR_POST_READ (attrs))
+      || ! NILP (get_translation_table (attrs, 0, NULL))
+      || ! (inhibit_eol_conversion
+	    || EQ (eol_type, Qunix) || VECTORP (eol_type)))
+    return -1;
+
+  coding->head_ascii = -1;
+  coding->eol_seen = EOL_SEEN_NONE;
+  nchars = check_ascii (coding);
+  if (nchars < coding->src_bytes)
+    {
+      /* There exists a non-ASCII byte.  */
+      if (! (EQ (CODING_ATTR_TYPE (attrs), Qutf_8)
+	     && CODING_UTF_8_BOM (coding) == utf_without_bom))
+	return -1;
+      if (! (coding->mode & CODING_MODE_LAST_BLOCK))
+	{
+	  const unsigned char *end = coding->source + coding->src_bytes;
+	  const unsigned char *p = end - 1;
+	  int len;
+
+	  while (p > coding->source && end - p < 4
+		 && UTF_8_EXTRA_OCTET_P (*p))
+	    p--;
+	  len = (UTF_8_2_OCTET_LEADING_P (*p) ? 2
+		 : UTF_8_3_OCTET_LEADING_P (*p) ? 3
+		 : UTF_8_4_OCTET_LEADING_P (*p) ? 4
+		 : 0);
+	  if (end - p < len)
+	    tail = end - p;
+	}
+      coding->src_bytes -= tail;
+      nchars = check_utf_8 (coding);
+      coding->src_bytes += tail;
+      if (nchars < 0)
+	return -1;
+    }
+
+  if (! inhibit_eol_conversion && VECTORP (eol_type))
+    {
+      if (coding->eol_seen & ~EOL_SEEN_LF)
+	return -1;
+      if (coding->eol_seen == EOL_SEEN_LF)
+	adjust_coding_eol_type (coding, EOL_SEEN_LF);
+    }
+
+  coding->src_bytes -= tail;
+  memcpy (coding->carryover, coding->source + coding->src_bytes, tail);
+  coding->carryover_bytes = tail;
+  return nchars;
+}
 
 /* Decode the text in the range FROM/FROM_BYTE and TO/TO_BYTE in
    SRC_OBJECT into DST_OBJECT by coding context CODING.
@@ -8100,14 +8233,7 @@ decode_coding_object (struct coding_system *coding,
 	move_gap_both (from, from_byte);
       if (EQ (src_object, dst_object))
 	{
-	  struct Lisp_Marker *tail;
-
-	  for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-	    {
-	      tail->need_adjustment
-		= tail->charpos == (tail->insertion_type ? from : to);
-	      need_marker_adjustment |= tail->need_adjustment;
-	    }
+	  need_marker_adjustment = mark_markers_for_adjustment (from, to);
 	  saved_pt = PT, saved_pt_byte = PT_BYTE;
 	  TEMP_SET_PT_BOTH (from, from_byte);
 	  current_buffer->text->inhibit_shrinking = 1;
@@ -8126,6 +8252,51 @@ decode_coding_object (struct coding_system *coding,
     detect_coding (coding);
   attrs = CODING_ID_ATTRS (coding->id);
 
+  /* Text that decodes to itself can be copied to its destination
+     directly, without going through a work buffer.  */
+  if (NILP (src_object)
+      && (BUFFERP (dst_object)
+	  ? ! NILP (BVAR (XBUFFER (dst_object), enable_multibyte_characters))
+	  : EQ (dst_object, Qt) && ! CODING_FOR_UNIBYTE (coding)))
+    {
+      ptrdiff_t nchars = check_verbatim (coding);
+
+      if (nchars >= 0)
+	{
+	  ptrdiff_t nbytes = coding->src_bytes;
+
+	  coding->consumed = bytes;
+	  coding->consumed_char = chars;
+	  coding->produced = nbytes;
+	  coding->produced_char = nchars;
+	  coding->dst_multibyte = true;
+	  record_conversion_result (coding, CODING_RESULT_SUCCESS);
+	  if (BUFFERP (dst_object))
+	    {
+	      struct buffer *old = current_buffer;
+
+	      set_buffer_internal (XBUFFER (dst_object));
+	      if (GPT != PT)
+		move_gap_both (PT, PT_BYTE);
+	      if (GAP_SIZE < nbytes)
+		make_gap (nbytes - GAP_SIZE);
+	      if (MODIFF <= SAVE_MODIFF)
+		record_first_change ();
+	      memcpy (GPT_ADDR, coding->source, nbytes);
+	      coding->dst_object = dst_object;
+	      coding->dst_pos = PT;
+	      coding->dst_pos_byte = PT_BYTE;
+	      insert_from_gap (nchars, nbytes, false);
+	      set_buffer_internal (old);
+	    }
+	  else
+	    coding->dst_object
+	      = make_specified_string ((const char *) coding->source,
+				       nchars, nbytes, true);
+	  return;
+	}
+    }
+
   if (EQ (dst_object, Qt)
       || (! NILP (CODING_ATTR_POST_READ (attrs))
 	  && NILP (dst_object)))
@@ -8216,27 +8387,7 @@ decode_coding_object (struct coding_system *coding,
 			  saved_pt_byte + (coding->produced - bytes));
 
       if (need_marker_adjustment)
-	{
-	  struct Lisp_Marker *tail;
-
-	  for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-	    if (tail->need_adjustment)
-	      {
-		tail->need_adjustment = 0;
-		if (tail->insertion_type)
-		  {
-		    tail->bytepos = from_byte;
-		    tail->charpos = from;
-		  }
-		else
-		  {
-		    tail->bytepos = from_byte + coding->produced;
-		    tail->charpos
-		      = (NILP (BVAR (current_buffer, enable_multibyte_characters))
-			 ? tail->bytepos : from + coding->produced_char);
-		  }
-	      }
-	}
+	adjust_markers_after_conversion (coding, from, from_byte);
     }
 
   Vdeactivate_mark = old_deactivate_mark;
@@ -8271,14 +8422,7 @@ encode_coding_object (struct coding_system *coding,
 
   if (EQ (src_object, dst_object))
     {
-      struct Lisp_Marker *tail;
-
-      for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-	{
-	  tail->need_adjustment
-	    = tail->charpos == (tail->insertion_type ? from : to);
-	  need_marker_adjustment |= tail->need_adjustment;
-	}
+      need_marker_adjustment = mark_markers_for_adjustment (from, to);
     }
 
   if (! NILP (CODING_ATTR_PRE_WRITE (attrs)))
@@ -8419,27 +8563,7 @@ encode_coding_object (struct coding_system *coding,
 			  saved_pt_byte + (coding->produced - bytes));
 
       if (need_marker_adjustment)
-	{
-	  struct Lisp_Marker *tail;
-
-	  for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-	    if (tail->need_adjustment)
-	      {
-		tail->need_adjustment = 0;
-		if (tail->insertion_type)
-		  {
-		    tail->bytepos = from_byte;
-		    tail->charpos = from;
-		  }
-		else
-		  {
-		    tail->bytepos = from_byte + coding->produced;
-		    tail->charpos
-		      = (NILP (BVAR (current_buffer, enable_multibyte_characters))
-			 ? tail->bytepos : from + coding->produced_char);
-		  }
-	      }
-	}
+	adjust_markers_after_conversion (coding, from, from_byte);
     }
 
   if (kill_src_buffer)
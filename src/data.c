@@ -2304,6 +2304,7 @@ bool-vector.  IDX starts at 0.  */)
     {
       CHECK_CHARACTER (idx);
       CHAR_TABLE_SET (array, idxval, newelt);
+      char_table_modiff++;
     }
   else if (RECORDP (array))
     {
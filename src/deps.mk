@@ -38,7 +38,7 @@ atimer.o: atimer.c atimer.h syssignal.h systime.h lisp.h blockinput.h \
  globals.h ../lib/unistd.h msdos.h $(config_h)
 bidi.o: bidi.c buffer.h character.h dispextern.h msdos.h lisp.h \
    globals.h $(config_h)
-buffer.o: buffer.c buffer.h region-cache.h commands.h window.h \
+buffer.o: buffer.c buffer.h region-cache.h line-index.h commands.h window.h \
    $(INTERVALS_H) blockinput.h atimer.h systime.h character.h ../lib/unistd.h \
    indent.h keyboard.h coding.h keymap.h frame.h lisp.h globals.h $(config_h)
 callint.o: callint.c window.h commands.h buffer.h keymap.h globals.h msdos.h \
@@ -86,7 +86,7 @@ dosfns.o: buffer.h termchar.h termhooks.h frame.h blockinput.h window.h \
    msdos.h dosfns.h dispextern.h charset.h coding.h atimer.h systime.h \
    lisp.h $(config_h)
 editfns.o: editfns.c window.h buffer.h systime.h $(INTERVALS_H) character.h \
-   coding.h frame.h blockinput.h atimer.h \
+   coding.h frame.h blockinput.h atimer.h line-index.h \
    ../lib/intprops.h ../lib/strftime.h ../lib/unistd.h \
    lisp.h globals.h $(config_h)
 emacs.o: emacs.c commands.h systty.h syssignal.h blockinput.h process.h \
@@ -128,7 +128,10 @@ indent.o: indent.c frame.h window.h indent.h buffer.h lisp.h $(config_h) \
    keyboard.h systime.h coding.h $(INTERVALS_H) globals.h
 inotify.o: inotify.c lisp.h coding.h process.h keyboard.h frame.h termhooks.h
 insdel.o: insdel.c window.h buffer.h $(INTERVALS_H) blockinput.h character.h \
-   atimer.h systime.h region-cache.h lisp.h globals.h $(config_h)
+   atimer.h systime.h region-cache.h line-index.h lisp.h globals.h $(config_h)
+itree.o: itree.c itree.h lisp.h globals.h $(config_h)
+line-index.o: line-index.c line-index.h buffer.h character.h lisp.h \
+   globals.h $(config_h)
 keyboard.o: keyboard.c termchar.h termhooks.h termopts.h buffer.h character.h \
    commands.h frame.h window.h macros.h disptab.h keyboard.h syssignal.h \
    systime.h syntax.h $(INTERVALS_H) blockinput.h atimer.h composite.h \
@@ -143,7 +146,8 @@ macros.o: macros.c window.h buffer.h commands.h macros.h keyboard.h msdos.h \
 gmalloc.o: gmalloc.c $(config_h)
 ralloc.o: ralloc.c lisp.h $(config_h)
 vm-limit.o: vm-limit.c lisp.h globals.h $(config_h)
-marker.o: marker.c buffer.h character.h lisp.h globals.h $(config_h)
+marker.o: marker.c buffer.h character.h line-index.h lisp.h globals.h \
+   $(config_h)
 minibuf.o: minibuf.c syntax.h frame.h window.h keyboard.h systime.h \
    buffer.h commands.h character.h msdos.h $(INTERVALS_H) keymap.h \
    termhooks.h lisp.h globals.h $(config_h) coding.h
@@ -1847,6 +1847,42 @@ enum face_id
 /* A cache of realized faces.  Each frame has its own cache because
    Emacs allows different frame-local face definitions.  */
 
+/* Maximum number of face specs in a cached face merge, and log2 of
+   the number of merges cached per frame.  */
+
+enum { FACE_MERGE_MAX_SPECS = 4, FACE_MERGE_CACHE_BITS = 8 };
+
+/* A cached result of merging face specs into the attributes of a
+   realized face, as done by face_at_buffer_position.  */
+
+struct face_merge
+{
+  /* The face specs that were merged, in order, into the attributes of
+     the face BASE_FACE_ID, passing ATTR_FILTER to merge_face_ref.
+     BASE_FACE_ID is -1 in unused entries.  */
+  Lisp_Object specs[FACE_MERGE_MAX_SPECS];
+  int nspecs;
+  int base_face_id;
+  enum lface_attribute_index attr_filter;
+
+  /* ID of the realized face for the merged attributes.  */
+  int face_id;
+};
+
+struct face_merge_cache
+{
+  /* Pairs of entries for merges with the same hash code, the more
+     recently used first.  */
+  struct face_merge entries[1 << FACE_MERGE_CACHE_BITS];
+
+  /* The number of changes to Lisp face definitions when the entries
+     were made.  */
+  EMACS_INT generation;
+
+  /* Number of lookups that found a cached merge, and that did not.  */
+  intmax_t hits, misses;
+};
+
 struct face_cache
 {
   /* Hash table of cached realized faces.  */
@@ -1862,6 +1898,9 @@ struct face_cache
   ptrdiff_t size;
   int used;
 
+  /* Results of merging face specs, or NULL if none were cached yet.  */
+  struct face_merge_cache *merge_cache;
+
   /* Flag indicating that attributes of the `menu' face have been
      changed.  */
   bool_bf menu_face_changed_p : 1;
@@ -3344,6 +3383,7 @@ int window_box_left_offset (struct window *, enum glyph_row_area);
 int window_box_right (struct window *, enum glyph_row_area);
 int estimate_mode_line_height (struct frame *, enum face_id);
 int move_it_to (struct it *, ptrdiff_t, int, int, int, int);
+void invalidate_line_layout_caches (void);
 void pixel_to_glyph_coords (struct frame *, int, int, int *, int *,
                             NativeRectangle *, bool);
 void remember_mouse_glyph (struct frame *, int, int, NativeRectangle *);
@@ -3532,6 +3572,7 @@ bool parse_color_spec (const char *,
 
 Lisp_Object tty_color_name (struct frame *, int);
 void clear_face_cache (bool);
+void clear_face_merge_caches (void);
 unsigned long load_color (struct frame *, struct face *, Lisp_Object,
                           enum lface_attribute_index);
 char *choose_face_font (struct frame *, Lisp_Object *, Lisp_Object,
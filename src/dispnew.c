@@ -2335,6 +2335,8 @@ free_window_matrices (struct window *w)
 	  free_glyph_matrix (w->current_matrix);
 	  free_glyph_matrix (w->desired_matrix);
 	  w->current_matrix = w->desired_matrix = NULL;
+	  xfree (w->line_layout_cache);
+	  w->line_layout_cache = NULL;
 	}
 
       /* Next window on same level.  */
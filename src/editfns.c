@@ -51,6 +51,7 @@ along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
 #include "buffer.h"
 #include "window.h"
 #include "blockinput.h"
+#include "line-index.h"
 
 static void update_buffer_properties (ptrdiff_t, ptrdiff_t);
 static Lisp_Object styled_format (ptrdiff_t, Lisp_Object *, bool);
@@ -261,43 +262,19 @@ static ptrdiff_t
 overlays_around (EMACS_INT pos, Lisp_Object *vec, ptrdiff_t len)
 {
   ptrdiff_t idx = 0;
-
-  for (struct Lisp_Overlay *tail = current_buffer->overlays_before;
-       tail; tail = tail->next)
-    {
-      Lisp_Object overlay = make_lisp_ptr (tail, Lisp_Vectorlike);
-      Lisp_Object end = OVERLAY_END (overlay);
-      ptrdiff_t endpos = OVERLAY_POSITION (end);
-      if (endpos < pos)
-	  break;
-      Lisp_Object start = OVERLAY_START (overlay);
-      ptrdiff_t startpos = OVERLAY_POSITION (start);
-      if (startpos <= pos)
-	{
-	  if (idx < len)
-	    vec[idx] = overlay;
-	  /* Keep counting overlays even if we can't return them all.  */
-	  idx++;
-	}
-    }
-
-  for (struct Lisp_Overlay *tail = current_buffer->overlays_after;
-       tail; tail = tail->next)
-    {
-      Lisp_Object overlay = make_lisp_ptr (tail, Lisp_Vectorlike);
-      Lisp_Object start = OVERLAY_START (overlay);
-      ptrdiff_t startpos = OVERLAY_POSITION (start);
-      if (pos < startpos)
-	break;
-      Lisp_Object end = OVERLAY_END (overlay);
-      ptrdiff_t endpos = OVERLAY_POSITION (end);
-      if (pos <= endpos)
-	{
-	  if (idx < len)
-	    vec[idx] = overlay;
-	  idx++;
-	}
-    }
+  struct itree_node *node;
+
+  /* Overlays ending at POS as well as empty ones at POS all
+     intersect [POS - 1, POS + 1).  */
+  ITREE_FOREACH (node, current_buffer->overlays, pos - 1, pos + 1,
+		 ASCENDING)
+    if (node->begin <= pos && pos <= node->end)
+      {
+	if (idx < len)
+	  vec[idx] = node->data;
+	/* Keep counting overlays even if we can't return them all.  */
+	idx++;
+      }
 
   return idx;
 }
@@ -359,11 +336,10 @@ at POSITION.  */)
 	  if (!NILP (tem))
 	    {
 	      /* Check the overlay is indeed active at point.  */
-	      Lisp_Object start = OVERLAY_START (ol), finish = OVERLAY_END (ol);
-	      if ((OVERLAY_POSITION (start) == posn
-		   && XMARKER (start)->insertion_type == 1)
-		  || (OVERLAY_POSITION (finish) == posn
-		      && XMARKER (finish)->insertion_type == 0))
+	      if ((OVERLAY_START (ol) == posn
+		   && OVERLAY_FRONT_ADVANCE_P (ol))
+		  || (OVERLAY_END (ol) == posn
+		      && ! OVERLAY_REAR_ADVANCE_P (ol)))
 		; /* The overlay will not cover a char inserted at point.  */
 	      else
 		{
@@ -778,6 +754,74 @@ This function does not move point.  */)
 			      Qnil, Qt, Qnil);
 }
 
+DEFUN ("line-number-at-pos", Fline_number_at_pos, Sline_number_at_pos, 0, 2, 0,
+       doc: /* Return buffer line number at position POS.
+If POS is nil, use current buffer location.
+
+If ABSOLUTE is nil, the default, counting starts
+at (point-min), so the value refers to the contents of the
+accessible portion of the (potentially narrowed) buffer.  If
+ABSOLUTE is non-nil, ignore any narrowing and return the
+absolute line number.  */)
+  (Lisp_Object pos, Lisp_Object absolute)
+{
+  ptrdiff_t beg = NILP (absolute) ? BEGV : BEG;
+  ptrdiff_t beg_byte = NILP (absolute) ? BEGV_BYTE : BEG_BYTE;
+  ptrdiff_t charpos = (NILP (pos) ? PT
+		       : clip_to_bounds (beg, fix_position (pos),
+					 NILP (absolute) ? ZV : Z));
+
+  /* With `selective-display' t, a carriage return also ends a line,
+     as far as `count-lines' is concerned, but the line index only
+     knows about newlines.  */
+  if (EQ (BVAR (current_buffer, selective_display), Qt))
+    {
+      ptrdiff_t bol = find_newline (charpos, -1, beg, beg_byte, -1,
+				    NULL, NULL, true);
+      return Fadd1 (call2 (Qcount_lines, make_fixnum (beg),
+			   make_fixnum (bol)));
+    }
+
+  return make_fixnum (1 + buffer_newlines_before (current_buffer,
+						  CHAR_TO_BYTE (charpos))
+		      - buffer_newlines_before (current_buffer, beg_byte));
+}
+
+DEFUN ("buffer-line-position", Fbuffer_line_position,
+       Sbuffer_line_position, 1, 2, 0,
+       doc: /* Return the position of the beginning of line number LINE.
+Lines are numbered from 1.  If ABSOLUTE is nil, the default, counting
+starts at (point-min), and the value is nil if the accessible portion
+of the buffer has fewer lines than LINE.  If ABSOLUTE is non-nil,
+ignore any narrowing, and return nil if the buffer has fewer lines
+than LINE.
+
+This is like moving to the beginning of the accessible portion and
+calling `forward-line' with LINE - 1, but much faster when LINE is
+large, because Emacs keeps an index of the lines of the buffer.  */)
+  (Lisp_Object line, Lisp_Object absolute)
+{
+  CHECK_INTEGER (line);
+  if (NILP (Fnatnump (line)) || EQ (line, make_fixnum (0)))
+    args_out_of_range (line, Qnil);
+
+  ptrdiff_t beg = NILP (absolute) ? BEGV : BEG;
+  ptrdiff_t beg_byte = NILP (absolute) ? BEGV_BYTE : BEG_BYTE;
+  if (EQ (line, make_fixnum (1)))
+    return make_fixnum (beg);
+
+  ptrdiff_t charpos, bytepos, newlines;
+  if (!FIXNUMP (line)
+      || INT_ADD_WRAPV (XFIXNUM (line) - 1,
+			buffer_newlines_before (current_buffer, beg_byte),
+			&newlines)
+      || !buffer_newline_position (current_buffer, newlines,
+				   &charpos, &bytepos)
+      || (NILP (absolute) ? ZV : Z) < charpos)
+    return Qnil;
+  return make_fixnum (charpos);
+}
+
 /* Save current buffer state for save-excursion special form.  */
 
 void
@@ -2731,26 +2775,31 @@ save_restriction_restore (Lisp_Object data)
   if (CONSP (data))
     /* A pair of marks bounding a saved restriction.  */
     {
-      struct Lisp_Marker *beg = XMARKER (XCAR (data));
-      struct Lisp_Marker *end = XMARKER (XCDR (data));
-      eassert (buf == end->buffer);
+      Lisp_Object beg = XCAR (data);
+      Lisp_Object end = XCDR (data);
+      eassert (buf == XMARKER (end)->buffer);
 
       if (buf /* Verify marker still points to a buffer.  */
-	  && (beg->charpos != BUF_BEGV (buf) || end->charpos != BUF_ZV (buf)))
+	  && (marker_position (beg) != BUF_BEGV (buf)
+	      || marker_position (end) != BUF_ZV (buf)))
 	/* The restriction has changed from the saved one, so restore
 	   the saved restriction.  */
 	{
 	  ptrdiff_t pt = BUF_PT (buf);
+	  ptrdiff_t begpos = marker_position (beg);
+	  ptrdiff_t endpos = marker_position (end);
+	  ptrdiff_t begbyte = marker_byte_position (beg);
+	  ptrdiff_t endbyte = marker_byte_position (end);
 
-	  SET_BUF_BEGV_BOTH (buf, beg->charpos, beg->bytepos);
-	  SET_BUF_ZV_BOTH (buf, end->charpos, end->bytepos);
+	  SET_BUF_BEGV_BOTH (buf, begpos, begbyte);
+	  SET_BUF_ZV_BOTH (buf, endpos, endbyte);
 
-	  if (pt < beg->charpos || pt > end->charpos)
+	  if (pt < begpos || pt > endpos)
 	    /* The point is outside the new visible range, move it inside. */
 	    SET_BUF_PT_BOTH (buf,
-			     clip_to_bounds (beg->charpos, pt, end->charpos),
-			     clip_to_bounds (beg->bytepos, BUF_PT_BYTE (buf),
-					     end->bytepos));
+			     clip_to_bounds (begpos, pt, endpos),
+			     clip_to_bounds (begbyte, BUF_PT_BYTE (buf),
+					     endbyte));
 
 	  buf->clip_changed = 1; /* Remember that the narrowing changed. */
 	}
@@ -4031,9 +4080,8 @@ Case is ignored if `case-fold-search' is non-nil in the current buffer.  */)
    START2, END2 are the character positions of the second region.
    START2_BYTE, END2_BYTE are the byte positions.
 
-   Traverses the entire marker list of the buffer to do so, adding an
-   appropriate amount to some, subtracting from some, and leaving the
-   rest untouched.  Most of this is copied from adjust_markers in insdel.c.
+   Only the markers between START1 and END2 are visited, in the tree
+   of marker positions.
 
    It's the caller's job to ensure that START1 <= END1 <= START2 <= END2.  */
 
@@ -4043,9 +4091,6 @@ transpose_markers (ptrdiff_t start1, ptrdiff_t end1,
 		   ptrdiff_t start1_byte, ptrdiff_t end1_byte,
 		   ptrdiff_t start2_byte, ptrdiff_t end2_byte)
 {
-  register ptrdiff_t amt1, amt1_byte, amt2, amt2_byte, diff, diff_byte, mpos;
-  register struct Lisp_Marker *marker;
-
   /* Update point as if it were a marker.  */
   if (PT < start1)
     ;
@@ -4060,50 +4105,8 @@ transpose_markers (ptrdiff_t start1, ptrdiff_t end1,
     TEMP_SET_PT_BOTH (PT - (start2 - start1),
 		      PT_BYTE - (start2_byte - start1_byte));
 
-  /* We used to adjust the endpoints here to account for the gap, but that
-     isn't good enough.  Even if we assume the caller has tried to move the
-     gap out of our way, it might still be at start1 exactly, for example;
-     and that places it `inside' the interval, for our purposes.  The amount
-     of adjustment is nontrivial if there's a `denormalized' marker whose
-     position is between GPT and GPT + GAP_SIZE, so it's simpler to leave
-     the dirty work to Fmarker_position, below.  */
-
-  /* The difference between the region's lengths */
-  diff = (end2 - start2) - (end1 - start1);
-  diff_byte = (end2_byte - start2_byte) - (end1_byte - start1_byte);
-
-  /* For shifting each marker in a region by the length of the other
-     region plus the distance between the regions.  */
-  amt1 = (end2 - start2) + (start2 - end1);
-  amt2 = (end1 - start1) + (start2 - end1);
-  amt1_byte = (end2_byte - start2_byte) + (start2_byte - end1_byte);
-  amt2_byte = (end1_byte - start1_byte) + (start2_byte - end1_byte);
-
-  for (marker = BUF_MARKERS (current_buffer); marker; marker = marker->next)
-    {
-      mpos = marker->bytepos;
-      if (mpos >= start1_byte && mpos < end2_byte)
-	{
-	  if (mpos < end1_byte)
-	    mpos += amt1_byte;
-	  else if (mpos < start2_byte)
-	    mpos += diff_byte;
-	  else
-	    mpos -= amt2_byte;
-	  marker->bytepos = mpos;
-	}
-      mpos = marker->charpos;
-      if (mpos >= start1 && mpos < end2)
-	{
-	  if (mpos < end1)
-	    mpos += amt1;
-	  else if (mpos < start2)
-	    mpos += diff;
-	  else
-	    mpos -= amt2;
-	}
-      marker->charpos = mpos;
-    }
+  transpose_overlays_in_tree (BUF_MARKER_TREE (current_buffer),
+			      start1, end1, start2, end2);
 }
 
 DEFUN ("transpose-regions", Ftranspose_regions, Stranspose_regions, 4, 5,
@@ -4401,6 +4404,8 @@ ring.  */)
       update_compositions (end2 - len1, end2, CHECK_BORDER);
     }
 
+  invalidate_line_index_text (current_buffer, start1 - BEG, Z - end2);
+
   /* When doing multiple transpositions, it might be nice
      to optimize this.  Perhaps the markers in any one buffer
      should be organized in some sorted data tree.  */
@@ -4409,7 +4414,7 @@ ring.  */)
       transpose_markers (start1, end1, start2, end2,
 			 start1_byte, start1_byte + len1_byte,
 			 start2_byte, start2_byte + len2_byte);
-      fix_start_end_in_overlays (start1, end2);
+      transpose_overlays (start1, end1, start2, end2);
     }
   else
     {
@@ -4511,6 +4516,8 @@ it to be non-nil.  */);
   /* A special value for Qfield properties.  */
   DEFSYM (Qboundary, "boundary");
 
+  DEFSYM (Qcount_lines, "count-lines");
+
   defsubr (&Sfield_beginning);
   defsubr (&Sfield_end);
   defsubr (&Sfield_string);
@@ -4520,6 +4527,8 @@ it to be non-nil.  */);
 
   defsubr (&Sline_beginning_position);
   defsubr (&Sline_end_position);
+  defsubr (&Sline_number_at_pos);
+  defsubr (&Sbuffer_line_position);
 
   defsubr (&Ssave_excursion);
   defsubr (&Ssave_current_buffer);
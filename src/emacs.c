@@ -687,6 +687,8 @@ dump_error_to_string (int result)
       return "dump file is result of failed dump attempt";
     case PDUMPER_LOAD_VERSION_MISMATCH:
       return "not built for this Emacs executable";
+    case PDUMPER_LOAD_BAD_BASE:
+      return "base dump file missing or changed";
     default:
       return (result <= PDUMPER_LOAD_ERROR
 	      ? "generic error"
@@ -1598,10 +1600,6 @@ Using an Emacs configured with --with-x-toolkit=lucid does not have this problem
     init_xfaces ();
 #endif
 
-#if defined HAVE_JSON && !defined WINDOWSNT
-  init_json ();
-#endif
-
   no_loadup
     = argmatch (argv, argc, "-nl", "--no-loadup", 6, NULL, &skip_args);
 
@@ -1957,10 +1955,7 @@ Using an Emacs configured with --with-x-toolkit=lucid does not have this problem
       syms_of_threads ();
       syms_of_profiler ();
       syms_of_pdumper ();
-
-#ifdef HAVE_JSON
       syms_of_json ();
-#endif
 
       keys_of_casefiddle ();
       keys_of_cmds ();
@@ -54,6 +54,7 @@ along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
 #include "window.h"
 #include "blockinput.h"
 #include "region-cache.h"
+#include "line-index.h"
 #include "frame.h"
 
 #ifdef HAVE_LINUX_FS_H
@@ -3575,7 +3576,6 @@ decide_coding_unwind (Lisp_Object unwind_data)
      So move markers that set-auto-coding might have created to BEG,
      just in case.  */
   adjust_markers_for_delete (BEG, BEG_BYTE, Z, Z_BYTE);
-  adjust_overlays_for_delete (BEG, Z - BEG);
   set_buffer_intervals (current_buffer, NULL);
   TEMP_SET_PT_BOTH (BEG, BEG_BYTE);
 
@@ -4011,8 +4011,7 @@ by calling `format-decode', which see.  */)
 		  bset_read_only (buf, Qnil);
 		  bset_filename (buf, Qnil);
 		  bset_undo_list (buf, Qt);
-		  eassert (buf->overlays_before == NULL);
-		  eassert (buf->overlays_after == NULL);
+		  eassert (! buffer_has_overlays ());
 
 		  set_buffer_internal (buf);
 		  Ferase_buffer ();
@@ -4851,8 +4850,8 @@ by calling `format-decode', which see.  */)
     }
 
   /* We made a lot of deletions and insertions above, so invalidate
-     the newline cache for the entire region of the inserted
-     characters.  */
+     the newline cache and the line index for the entire region of the
+     inserted characters.  */
   if (current_buffer->base_buffer && current_buffer->base_buffer->newline_cache)
     invalidate_region_cache (current_buffer->base_buffer,
                              current_buffer->base_buffer->newline_cache,
@@ -4861,6 +4860,12 @@ by calling `format-decode', which see.  */)
     invalidate_region_cache (current_buffer,
                              current_buffer->newline_cache,
                              PT - BEG, Z - PT - inserted);
+  if (current_buffer->base_buffer && current_buffer->base_buffer->line_index)
+    invalidate_line_index (current_buffer->base_buffer->line_index,
+			   PT - BEG, Z - PT - inserted);
+  else if (current_buffer->line_index)
+    invalidate_line_index (current_buffer->line_index,
+			   PT - BEG, Z - PT - inserted);
 
   if (read_quit)
     quit ();
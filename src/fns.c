@@ -2441,10 +2441,9 @@ internal_equal (Lisp_Object o1, Lisp_Object o2, enum equal_kind equal_kind,
 	  return mpz_cmp (*xbignum_val (o1), *xbignum_val (o2)) == 0;
 	if (OVERLAYP (o1))
 	  {
-	    if (!internal_equal (OVERLAY_START (o1), OVERLAY_START (o2),
-				 equal_kind, depth + 1, ht)
-		|| !internal_equal (OVERLAY_END (o1), OVERLAY_END (o2),
-				    equal_kind, depth + 1, ht))
+	    if (OVERLAY_BUFFER (o1) != OVERLAY_BUFFER (o2)
+		|| OVERLAY_START (o1) != OVERLAY_START (o2)
+		|| OVERLAY_END (o1) != OVERLAY_END (o2))
 	      return false;
 	    o1 = XOVERLAY (o1)->plist;
 	    o2 = XOVERLAY (o2)->plist;
@@ -2455,7 +2454,7 @@ internal_equal (Lisp_Object o1, Lisp_Object o2, enum equal_kind equal_kind,
 	  {
 	    return (XMARKER (o1)->buffer == XMARKER (o2)->buffer
 		    && (XMARKER (o1)->buffer == 0
-			|| XMARKER (o1)->bytepos == XMARKER (o2)->bytepos));
+			|| marker_position (o1) == marker_position (o2)));
 	  }
 	if (BOOL_VECTOR_P (o1))
 	  {
@@ -2519,6 +2518,7 @@ ARRAY is a vector, string, char-table, or bool-vector.  */)
       for (i = 0; i < (1 << CHARTAB_SIZE_BITS_0); i++)
 	set_char_table_contents (array, i, item);
       set_char_table_defalt (array, item);
+      char_table_modiff++;
     }
   else if (STRINGP (array))
     {
@@ -3820,22 +3820,6 @@ CHECK_HASH_TABLE (Lisp_Object x)
   CHECK_TYPE (HASH_TABLE_P (x), Qhash_table_p, x);
 }
 
-static void
-set_hash_next_slot (struct Lisp_Hash_Table *h, ptrdiff_t idx, ptrdiff_t val)
-{
-  gc_aset (h->next, idx, make_fixnum (val));
-}
-static void
-set_hash_hash_slot (struct Lisp_Hash_Table *h, ptrdiff_t idx, Lisp_Object val)
-{
-  gc_aset (h->hash, idx, val);
-}
-static void
-set_hash_index_slot (struct Lisp_Hash_Table *h, ptrdiff_t idx, ptrdiff_t val)
-{
-  gc_aset (h->index, idx, make_fixnum (val));
-}
-
 /* If OBJ is a Lisp hash table, return a pointer to its struct
    Lisp_Hash_Table.  Otherwise, signal an error.  */
 
@@ -3930,22 +3914,170 @@ larger_vector (Lisp_Object vec, ptrdiff_t incr_min, ptrdiff_t nitems_max)
 			 Low-level Functions
  ***********************************************************************/
 
-/* Return the index of the next entry in H following the one at IDX,
-   or -1 if none.  */
+/* Reduce the hash code HASH computed by the hash function of a table
+   to the hash code kept in its buckets.  Adding rather than xoring
+   the high half keeps increasing hash codes, such as the addresses
+   of objects allocated one after the other, in increasing order.  */
+
+static hash_hash_t
+reduce_hash (Lisp_Object hash)
+{
+  EMACS_UINT code = XUFIXNUM (hash);
+  return code + (code >> (EMACS_INT_WIDTH / 2));
+}
+
+/* Return the home bucket in hash table H of the entries whose keys
+   have the reduced hash code HASH, that is, the bucket where looking
+   for them starts.  */
+
+static ptrdiff_t
+hash_table_home (struct Lisp_Hash_Table *h, hash_hash_t hash)
+{
+  /* Multiplying by 2**32 divided by the golden ratio scrambles the
+     hash codes.  */
+  if (h->scramble_hash)
+    hash *= 0x9e3779b9u;
+  return hash % (hash_hash_t) h->index_size;
+}
+
+/* Return how many buckets past its home bucket is the entry in bucket
+   I of hash table H.  */
+
+static ptrdiff_t
+hash_bucket_distance (struct Lisp_Hash_Table *h, ptrdiff_t i)
+{
+  ptrdiff_t distance = i - hash_table_home (h, h->index[i].hash);
+  return distance < 0 ? distance + h->index_size : distance;
+}
+
+/* Return the bucket after bucket I of hash table H.  */
+
+static ptrdiff_t
+hash_next_bucket (struct Lisp_Hash_Table *h, ptrdiff_t i)
+{
+  return i + 1 < h->index_size ? i + 1 : 0;
+}
+
+/* Return a new array of SIZE empty buckets.  */
+
+static struct hash_table_bucket *
+make_hash_index (ptrdiff_t size)
+{
+  struct hash_table_bucket *index = xnmalloc (size, sizeof *index);
+  for (ptrdiff_t i = 0; i < size; i++)
+    index[i].entry = -1;
+  return index;
+}
+
+/* Put the entry of bucket *B in a bucket of hash table H, moving
+   entries closer to their home buckets farther away as needed, and
+   stopping at the first bucket whose entry is negative.  Store the
+   former contents of that bucket in *B.  Return the number of full
+   buckets that this went through.  */
 
 static ptrdiff_t
-HASH_NEXT (struct Lisp_Hash_Table *h, ptrdiff_t idx)
+hash_index_place (struct Lisp_Hash_Table *h, struct hash_table_bucket *b)
 {
-  return XFIXNUM (AREF (h->next, idx));
+  ptrdiff_t i = hash_table_home (h, b->hash);
+  ptrdiff_t probes = 0;
+
+  for (ptrdiff_t distance = 0; 0 <= h->index[i].entry;
+       i = hash_next_bucket (h, i), distance++, probes++)
+    {
+      ptrdiff_t d = hash_bucket_distance (h, i);
+      if (d < distance)
+	{
+	  struct hash_table_bucket displaced = h->index[i];
+	  h->index[i] = *b;
+	  *b = displaced;
+	  distance = d;
+	}
+    }
+
+  struct hash_table_bucket last = h->index[i];
+  h->index[i] = *b;
+  *b = last;
+  return probes;
 }
 
-/* Return the index of the element in hash table H that is the start
-   of the collision list at index IDX, or -1 if the list is empty.  */
+/* Put entry ENTRY, whose key has the reduced hash code HASH, in a
+   bucket of hash table H.  Return the number of full buckets that
+   this went through.  */
 
 static ptrdiff_t
-HASH_INDEX (struct Lisp_Hash_Table *h, ptrdiff_t idx)
+hash_index_insert (struct Lisp_Hash_Table *h, hash_hash_t hash,
+		   ptrdiff_t entry)
 {
-  return XFIXNUM (AREF (h->index, idx));
+  struct hash_table_bucket b = { hash, entry };
+  return hash_index_place (h, &b);
+}
+
+/* The number of full buckets, per doubling of the number of
+   buckets, that an insertion into a hash table whose hash codes are
+   not scrambled may go through.  */
+enum { HASH_MAX_PROBES = 32 };
+
+/* Return true if an insertion into hash table H that went through
+   PROBES full buckets shows that H is crowded, so that its hash codes
+   should be scrambled.  Keys with nearby hash codes can fill long
+   stretches of buckets, which scrambling breaks up.  But when home
+   buckets are random, the longest stretches also grow with the
+   logarithm of the number of buckets: with the largest load, a
+   million entries commonly give stretches of a few hundred buckets.
+   Scrambling would not make those shorter, but it would move the
+   keys of entries added one after the other, whose hash codes are
+   often close together, away from each other.  */
+
+static bool
+hash_index_crowded_p (struct Lisp_Hash_Table *h, ptrdiff_t probes)
+{
+  if (probes <= HASH_MAX_PROBES || h->scramble_hash)
+    return false;
+  int doublings = 0;
+  for (ptrdiff_t n = h->index_size; 1 < n; n >>= 1)
+    doublings++;
+  return HASH_MAX_PROBES * doublings < probes;
+}
+
+/* Scramble the hash codes of hash table H, and move its entries to
+   their new home buckets.  This doesn't allocate memory.  */
+
+static void
+scramble_hash_index (struct Lisp_Hash_Table *h)
+{
+  /* Mark the entries that have yet to move by storing -2 - ENTRY in
+     their buckets.  hash_index_place takes marked buckets for empty
+     ones, and hands back the marked entry it stops at.  */
+  for (ptrdiff_t i = 0; i < h->index_size; i++)
+    if (0 <= h->index[i].entry)
+      h->index[i].entry = -2 - h->index[i].entry;
+
+  h->scramble_hash = true;
+  for (ptrdiff_t i = 0; i < h->index_size; i++)
+    if (h->index[i].entry < -1)
+      {
+	struct hash_table_bucket b = h->index[i];
+	h->index[i].entry = -1;
+	do
+	  {
+	    b.entry = -2 - b.entry;
+	    hash_index_place (h, &b);
+	  }
+	while (b.entry < -1);
+      }
+}
+
+/* Empty bucket I of hash table H, and move the entries after it that
+   are not in their home buckets back by one.  */
+
+static void
+hash_index_remove (struct Lisp_Hash_Table *h, ptrdiff_t i)
+{
+  for (ptrdiff_t j = hash_next_bucket (h, i);
+       0 <= h->index[j].entry && 0 < hash_bucket_distance (h, j);
+       i = j, j = hash_next_bucket (h, j))
+    h->index[i] = h->index[j];
+  h->index[i].entry = -1;
 }
 
 /* Restore a hash table's mutability after the critical section exits.  */
@@ -4056,24 +4188,28 @@ static struct Lisp_Hash_Table *
 allocate_hash_table (void)
 {
   return ALLOCATE_PSEUDOVECTOR (struct Lisp_Hash_Table,
-				index, PVEC_HASH_TABLE);
+				weak, PVEC_HASH_TABLE);
 }
 
-/* An upper bound on the size of a hash table index.  It must fit in
-   ptrdiff_t and be a valid Emacs fixnum.  This is an upper bound on
-   VECTOR_ELTS_MAX (see alloc.c) and gets as close as we can without
-   violating modularity.  */
+/* An upper bound on the number of buckets of a hash table.  It keeps
+   entry numbers within hash_idx_t, and bucket numbers within
+   hash_hash_t and ptrdiff_t.  */
 #define INDEX_SIZE_BOUND \
-  ((ptrdiff_t) min (MOST_POSITIVE_FIXNUM, \
-		    ((min (PTRDIFF_MAX, SIZE_MAX) \
-		      - header_size - GCALIGNMENT) \
-		     / word_size)))
+  ((ptrdiff_t) min (INT32_MAX, min (PTRDIFF_MAX, SIZE_MAX) / 16))
+
+/* The largest ratio of entries to buckets that a hash table may
+   reach, whatever its rehash threshold.  Open addressing needs empty
+   buckets to end its searches.  */
+#define HASH_INDEX_MAX_LOAD 0.75
+
+/* Return the number of buckets that hash table H needs to hold SIZE
+   entries.  There is always at least one more bucket than entries.  */
 
 static ptrdiff_t
-hash_index_size (struct Lisp_Hash_Table *h, ptrdiff_t size)
+hash_index_size_for (struct Lisp_Hash_Table *h, ptrdiff_t size)
 {
-  double threshold = h->rehash_threshold;
-  double index_float = size / threshold;
+  double threshold = min (h->rehash_threshold, HASH_INDEX_MAX_LOAD);
+  double index_float = size / threshold + 1;
   ptrdiff_t index_size = (index_float < INDEX_SIZE_BOUND + 1
 	                  ? next_almost_prime (index_float)
 	                  : INDEX_SIZE_BOUND + 1);
@@ -4135,18 +4271,22 @@ make_hash_table (struct hash_table_test test, EMACS_INT size,
   h->rehash_threshold = rehash_threshold;
   h->rehash_size = rehash_size;
   h->count = 0;
+  h->scramble_hash = false;
+  h->index_size = hash_index_size_for (h, size);
   h->key_and_value = make_vector (2 * size, Qunbound);
-  h->hash = make_nil_vector (size);
-  h->next = make_vector (size, make_fixnum (-1));
-  h->index = make_vector (hash_index_size (h, size), make_fixnum (-1));
+  h->next = NULL;
+  h->index = NULL;
   h->next_weak = NULL;
   h->purecopy = purecopy;
   h->mutable = true;
 
-  /* Set up the free list.  */
+  /* Set up the free list and the buckets.  */
+  h->next = xnmalloc (size, sizeof *h->next);
   for (i = 0; i < size - 1; ++i)
-    set_hash_next_slot (h, i, i + 1);
+    h->next[i] = i + 1;
+  h->next[size - 1] = -1;
   h->next_free = 0;
+  h->index = make_hash_index (h->index_size);
 
   XSET_HASH_TABLE (table, h);
   eassert (HASH_TABLE_P (table));
@@ -4169,11 +4309,17 @@ copy_hash_table (struct Lisp_Hash_Table *h1)
   *h2 = *h1;
   h2->mutable = true;
   h2->key_and_value = Fcopy_sequence (h1->key_and_value);
-  h2->hash = Fcopy_sequence (h1->hash);
-  h2->next = Fcopy_sequence (h1->next);
-  h2->index = Fcopy_sequence (h1->index);
+  h2->next = NULL;
+  h2->index = NULL;
   XSET_HASH_TABLE (table, h2);
 
+  ptrdiff_t size = HASH_TABLE_SIZE (h1);
+  h2->next = xnmalloc (size, sizeof *h2->next);
+  memcpy (h2->next, h1->next, size * sizeof *h2->next);
+  ptrdiff_t index_size = h1->index_size;
+  h2->index = xnmalloc (index_size, sizeof *h2->index);
+  memcpy (h2->index, h1->index, index_size * sizeof *h2->index);
+
   return table;
 }
 
@@ -4205,42 +4351,44 @@ maybe_resize_hash_table (struct Lisp_Hash_Table *h)
       if (new_size <= old_size)
 	new_size = old_size + 1;
 
-      /* Allocate all the new vectors before updating *H, to
-	 avoid problems if memory is exhausted.  larger_vecalloc
-	 finishes computing the size of the replacement vectors.  */
-      Lisp_Object next = larger_vecalloc (h->next, new_size - old_size,
-					  new_size);
-      ptrdiff_t next_size = ASIZE (next);
-      for (ptrdiff_t i = old_size; i < next_size - 1; i++)
-	ASET (next, i, make_fixnum (i + 1));
-      ASET (next, next_size - 1, make_fixnum (-1));
-
-      /* Build the new&larger key_and_value vector, making sure the new
-         fields are initialized to `unbound`.  */
+      /* Allocate the new key_and_value vector before updating *H,
+	 to avoid problems if memory is exhausted, making sure the new
+	 fields are initialized to `unbound`.  larger_vecalloc finishes
+	 computing the new size.  */
+      ptrdiff_t index_size = hash_index_size_for (h, new_size);
       Lisp_Object key_and_value
-	= larger_vecalloc (h->key_and_value, 2 * (next_size - old_size),
-			   2 * next_size);
+	= larger_vecalloc (h->key_and_value, 2 * (new_size - old_size),
+			   2 * new_size);
+      ptrdiff_t next_size = ASIZE (key_and_value) / 2;
+      eassert (next_size == new_size);
       for (ptrdiff_t i = 2 * old_size; i < 2 * next_size; i++)
         ASET (key_and_value, i, Qunbound);
 
-      Lisp_Object hash = larger_vector (h->hash, next_size - old_size,
-					next_size);
-      ptrdiff_t index_size = hash_index_size (h, next_size);
-      h->index = make_vector (index_size, make_fixnum (-1));
+      /* A larger NEXT is harmless, so install it right away.  */
+      h->next = xnrealloc (h->next, next_size, sizeof *h->next);
+      for (ptrdiff_t i = old_size; i < next_size - 1; i++)
+	h->next[i] = i + 1;
+      h->next[next_size - 1] = -1;
+
+      struct hash_table_bucket *old_index = h->index;
+      ptrdiff_t old_index_size = h->index_size;
+      h->index = make_hash_index (index_size);
+      h->index_size = index_size;
+      h->scramble_hash = false;
       h->key_and_value = key_and_value;
-      h->hash = hash;
-      h->next = next;
       h->next_free = old_size;
 
-      /* Rehash.  */
-      for (ptrdiff_t i = 0; i < old_size; i++)
-	if (!NILP (HASH_HASH (h, i)))
+      /* Move the entries to the new buckets.  Their buckets remember
+	 their hash codes, so there is no need to compute them.  */
+      for (ptrdiff_t i = 0; i < old_index_size; i++)
+	if (0 <= old_index[i].entry)
 	  {
-	    EMACS_UINT hash_code = XUFIXNUM (HASH_HASH (h, i));
-	    ptrdiff_t start_of_bucket = hash_code % ASIZE (h->index);
-	    set_hash_next_slot (h, i, HASH_INDEX (h, start_of_bucket));
-	    set_hash_index_slot (h, start_of_bucket, i);
+	    ptrdiff_t probes = hash_index_insert (h, old_index[i].hash,
+						  old_index[i].entry);
+	    if (hash_index_crowded_p (h, probes))
+	      scramble_hash_index (h);
 	  }
+      xfree (old_index);
 
 #ifdef ENABLE_CHECKING
       if (HASH_TABLE_P (Vpurify_flag) && XHASH_TABLE (Vpurify_flag) == h)
@@ -4249,33 +4397,58 @@ maybe_resize_hash_table (struct Lisp_Hash_Table *h)
     }
 }
 
-/* Recompute the hashes (and hence also the "next" pointers).
-   Normally there's never a need to recompute hashes.
-   This is done only on first access to a hash-table loaded from
-   the "pdump", because the objects' addresses may have changed, thus
-   affecting their hashes.  */
+/* Compute the hash codes of the entries of the table HASH, and set
+   up its buckets and its free list.  This is done only for tables
+   loaded from the "pdump", because the objects' addresses may have
+   changed, thus affecting their hashes, and because the pdump doesn't
+   hold the arrays of the table.  The entries in use must be the first
+   HASH->count ones.  */
 void
 hash_table_rehash (Lisp_Object hash)
 {
   struct Lisp_Hash_Table *h = XHASH_TABLE (hash);
-  ptrdiff_t i, count = h->count;
+  ptrdiff_t i, count = h->count, size = HASH_TABLE_SIZE (h);
 
-  /* Recompute the actual hash codes for each entry in the table.
-     Order is still invalid.  */
+  h->index_size = hash_index_size_for (h, size);
+  h->index = make_hash_index (h->index_size);
+  h->scramble_hash = false;
   for (i = 0; i < count; i++)
     {
       Lisp_Object key = HASH_KEY (h, i);
-      Lisp_Object hash_code = h->test.hashfn (key, h);
-      ptrdiff_t start_of_bucket = XUFIXNUM (hash_code) % ASIZE (h->index);
-      set_hash_hash_slot (h, i, hash_code);
-      set_hash_next_slot (h, i, HASH_INDEX (h, start_of_bucket));
-      set_hash_index_slot (h, start_of_bucket, i);
-      eassert (HASH_NEXT (h, i) != i); /* Stop loops.  */
+      hash_hash_t hash_code = reduce_hash (h->test.hashfn (key, h));
+      if (hash_index_crowded_p (h, hash_index_insert (h, hash_code, i)))
+	scramble_hash_index (h);
     }
 
-  ptrdiff_t size = ASIZE (h->next);
-  for (; i + 1 < size; i++)
-    set_hash_next_slot (h, i, i + 1);
+  h->next = xnmalloc (size, sizeof *h->next);
+  for (; i < size; i++)
+    h->next[i] = i + 1 < size ? i + 1 : -1;
+  h->next_free = count < size ? count : -1;
+}
+
+/* Return the bucket of hash table H that refers to the entry matching
+   KEY, whose reduced hash code is HASH, or -1 if there is no such
+   entry.  */
+
+static ptrdiff_t
+hash_lookup_bucket (struct Lisp_Hash_Table *h, Lisp_Object key,
+		    hash_hash_t hash)
+{
+  ptrdiff_t i = hash_table_home (h, hash);
+
+  for (ptrdiff_t distance = 0; ; i = hash_next_bucket (h, i), distance++)
+    {
+      ptrdiff_t entry = h->index[i].entry;
+      if (entry < 0)
+	return -1;
+      if (h->index[i].hash == hash
+	  && (EQ (key, HASH_KEY (h, entry))
+	      || (h->test.cmpfn
+		  && !NILP (h->test.cmpfn (key, HASH_KEY (h, entry), h)))))
+	return i;
+      if (hash_bucket_distance (h, i) < distance)
+	return -1;
+    }
 }
 
 /* Lookup KEY in hash table H.  If HASH is non-null, return in *HASH
@@ -4285,22 +4458,12 @@ hash_table_rehash (Lisp_Object hash)
 ptrdiff_t
 hash_lookup (struct Lisp_Hash_Table *h, Lisp_Object key, Lisp_Object *hash)
 {
-  ptrdiff_t start_of_bucket, i;
-
   Lisp_Object hash_code = h->test.hashfn (key, h);
   if (hash)
     *hash = hash_code;
 
-  start_of_bucket = XUFIXNUM (hash_code) % ASIZE (h->index);
-
-  for (i = HASH_INDEX (h, start_of_bucket); 0 <= i; i = HASH_NEXT (h, i))
-    if (EQ (key, HASH_KEY (h, i))
-	|| (h->test.cmpfn
-	    && EQ (hash_code, HASH_HASH (h, i))
-	    && !NILP (h->test.cmpfn (key, HASH_KEY (h, i), h))))
-      break;
-
-  return i;
+  ptrdiff_t i = hash_lookup_bucket (h, key, reduce_hash (hash_code));
+  return i < 0 ? -1 : h->index[i].entry;
 }
 
 static void
@@ -4319,7 +4482,7 @@ ptrdiff_t
 hash_put (struct Lisp_Hash_Table *h, Lisp_Object key, Lisp_Object value,
 	  Lisp_Object hash)
 {
-  ptrdiff_t start_of_bucket, i;
+  ptrdiff_t i;
 
   /* Increment count after resizing because resizing may fail.  */
   maybe_resize_hash_table (h);
@@ -4327,22 +4490,35 @@ hash_put (struct Lisp_Hash_Table *h, Lisp_Object key, Lisp_Object value,
 
   /* Store key/value in the key_and_value vector.  */
   i = h->next_free;
-  eassert (NILP (HASH_HASH (h, i)));
   eassert (EQ (Qunbound, (HASH_KEY (h, i))));
-  h->next_free = HASH_NEXT (h, i);
+  h->next_free = h->next[i];
   set_hash_key_slot (h, i, key);
   set_hash_value_slot (h, i, value);
 
-  /* Remember its hash code.  */
-  set_hash_hash_slot (h, i, hash);
-
-  /* Add new entry to its collision chain.  */
-  start_of_bucket = XUFIXNUM (hash) % ASIZE (h->index);
-  set_hash_next_slot (h, i, HASH_INDEX (h, start_of_bucket));
-  set_hash_index_slot (h, start_of_bucket, i);
+  /* Give the new entry a bucket, which remembers its hash code.  */
+  if (hash_index_crowded_p (h, hash_index_insert (h, reduce_hash (hash), i)))
+    scramble_hash_index (h);
   return i;
 }
 
+/* Remove the entry of hash table H that bucket BUCKET refers to.  */
+
+static void
+hash_remove_bucket (struct Lisp_Hash_Table *h, ptrdiff_t bucket)
+{
+  ptrdiff_t i = h->index[bucket].entry;
+  hash_index_remove (h, bucket);
+
+  /* Clear slots in key_and_value and add the slots to the free
+     list.  */
+  set_hash_key_slot (h, i, Qunbound);
+  set_hash_value_slot (h, i, Qnil);
+  h->next[i] = h->next_free;
+  h->next_free = i;
+  h->count--;
+  eassert (h->count >= 0);
+}
+
 
 /* Remove the entry matching KEY from hash table H, if there is one.  */
 
@@ -4350,38 +4526,9 @@ void
 hash_remove_from_table (struct Lisp_Hash_Table *h, Lisp_Object key)
 {
   Lisp_Object hash_code = h->test.hashfn (key, h);
-  ptrdiff_t start_of_bucket = XUFIXNUM (hash_code) % ASIZE (h->index);
-  ptrdiff_t prev = -1;
-
-  for (ptrdiff_t i = HASH_INDEX (h, start_of_bucket);
-       0 <= i;
-       i = HASH_NEXT (h, i))
-    {
-      if (EQ (key, HASH_KEY (h, i))
-	  || (h->test.cmpfn
-	      && EQ (hash_code, HASH_HASH (h, i))
-	      && !NILP (h->test.cmpfn (key, HASH_KEY (h, i), h))))
-	{
-	  /* Take entry out of collision chain.  */
-	  if (prev < 0)
-	    set_hash_index_slot (h, start_of_bucket, HASH_NEXT (h, i));
-	  else
-	    set_hash_next_slot (h, prev, HASH_NEXT (h, i));
-
-	  /* Clear slots in key_and_value and add the slots to
-	     the free list.  */
-	  set_hash_key_slot (h, i, Qunbound);
-	  set_hash_value_slot (h, i, Qnil);
-	  set_hash_hash_slot (h, i, Qnil);
-	  set_hash_next_slot (h, i, h->next_free);
-	  h->next_free = i;
-	  h->count--;
-	  eassert (h->count >= 0);
-	  break;
-	}
-
-      prev = i;
-    }
+  ptrdiff_t bucket = hash_lookup_bucket (h, key, reduce_hash (hash_code));
+  if (0 <= bucket)
+    hash_remove_bucket (h, bucket);
 }
 
 
@@ -4393,16 +4540,15 @@ hash_clear (struct Lisp_Hash_Table *h)
   if (h->count > 0)
     {
       ptrdiff_t size = HASH_TABLE_SIZE (h);
-      memclear (xvector_contents (h->hash), size * word_size);
       for (ptrdiff_t i = 0; i < size; i++)
 	{
-	  set_hash_next_slot (h, i, i < size - 1 ? i + 1 : -1);
+	  h->next[i] = i < size - 1 ? i + 1 : -1;
 	  set_hash_key_slot (h, i, Qunbound);
 	  set_hash_value_slot (h, i, Qnil);
 	}
 
-      for (ptrdiff_t i = 0; i < ASIZE (h->index); i++)
-	ASET (h->index, i, make_fixnum (-1));
+      for (ptrdiff_t i = 0; i < h->index_size; i++)
+	h->index[i].entry = -1;
 
       h->next_free = 0;
       h->count = 0;
@@ -4423,89 +4569,72 @@ hash_clear (struct Lisp_Hash_Table *h)
 bool
 sweep_weak_table (struct Lisp_Hash_Table *h, bool remove_entries_p)
 {
-  ptrdiff_t n = gc_asize (h->index);
+  ptrdiff_t n = h->index_size;
   bool marked = false;
 
-  for (ptrdiff_t bucket = 0; bucket < n; ++bucket)
+  for (ptrdiff_t bucket = 0; bucket < n; )
     {
-      /* Follow collision chain, removing entries that don't survive
-         this garbage collection.  */
-      ptrdiff_t prev = -1;
-      ptrdiff_t next;
-      for (ptrdiff_t i = HASH_INDEX (h, bucket); 0 <= i; i = next)
-        {
-	  bool key_known_to_survive_p = survives_gc_p (HASH_KEY (h, i));
-	  bool value_known_to_survive_p = survives_gc_p (HASH_VALUE (h, i));
-	  bool remove_p;
-
-	  if (EQ (h->weak, Qkey))
-	    remove_p = !key_known_to_survive_p;
-	  else if (EQ (h->weak, Qvalue))
-	    remove_p = !value_known_to_survive_p;
-	  else if (EQ (h->weak, Qkey_or_value))
-	    remove_p = !(key_known_to_survive_p || value_known_to_survive_p);
-	  else if (EQ (h->weak, Qkey_and_value))
-	    remove_p = !(key_known_to_survive_p && value_known_to_survive_p);
-	  else
-	    emacs_abort ();
+      ptrdiff_t i = h->index[bucket].entry;
+      if (i < 0)
+	{
+	  bucket++;
+	  continue;
+	}
 
-	  next = HASH_NEXT (h, i);
+      bool key_known_to_survive_p = survives_gc_p (HASH_KEY (h, i));
+      bool value_known_to_survive_p = survives_gc_p (HASH_VALUE (h, i));
+      bool remove_p;
+
+      if (EQ (h->weak, Qkey))
+	remove_p = !key_known_to_survive_p;
+      else if (EQ (h->weak, Qvalue))
+	remove_p = !value_known_to_survive_p;
+      else if (EQ (h->weak, Qkey_or_value))
+	remove_p = !(key_known_to_survive_p || value_known_to_survive_p);
+      else if (EQ (h->weak, Qkey_and_value))
+	remove_p = !(key_known_to_survive_p && value_known_to_survive_p);
+      else
+	emacs_abort ();
 
-	  if (remove_entries_p)
+      if (remove_entries_p)
+	{
+	  eassert (!remove_p
+		   == (key_known_to_survive_p && value_known_to_survive_p));
+	  if (remove_p)
 	    {
-              eassert (!remove_p
-                       == (key_known_to_survive_p && value_known_to_survive_p));
-	      if (remove_p)
-		{
-		  /* Take out of collision chain.  */
-		  if (prev < 0)
-		    set_hash_index_slot (h, bucket, next);
-		  else
-		    set_hash_next_slot (h, prev, next);
-
-		  /* Add to free list.  */
-		  set_hash_next_slot (h, i, h->next_free);
-		  h->next_free = i;
-
-		  /* Clear key, value, and hash.  */
-		  set_hash_key_slot (h, i, Qunbound);
-		  set_hash_value_slot (h, i, Qnil);
-                  if (!NILP (h->hash))
-                    set_hash_hash_slot (h, i, Qnil);
-
-                  eassert (h->count != 0);
-                  h->count--;
-                }
-	      else
-		{
-		  prev = i;
-		}
+	      /* Removing the entry moves the entries of the following
+		 buckets back, so look at this bucket again.  An entry
+		 that wraps around from the first buckets was already
+		 kept, and is kept again.  */
+	      hash_remove_bucket (h, bucket);
+	      continue;
 	    }
-	  else
+	}
+      else
+	{
+	  if (!remove_p)
 	    {
-	      if (!remove_p)
+	      /* Make sure key and value survive.  */
+	      if (!key_known_to_survive_p)
 		{
-		  /* Make sure key and value survive.  */
-		  if (!key_known_to_survive_p)
-		    {
-		      mark_object (HASH_KEY (h, i));
-                      marked = true;
-		    }
-
-		  if (!value_known_to_survive_p)
-		    {
-		      mark_object (HASH_VALUE (h, i));
-                      marked = true;
-		    }
+		  mark_object (HASH_KEY (h, i));
+		  marked = true;
+		}
+
+	      if (!value_known_to_survive_p)
+		{
+		  mark_object (HASH_VALUE (h, i));
+		  marked = true;
 		}
 	    }
 	}
+      bucket++;
     }
 
   return marked;
 }
 
-
+
 /***********************************************************************
 			Hash Code Computation
  ***********************************************************************/
@@ -4519,24 +4648,56 @@ sweep_weak_table (struct Lisp_Hash_Table *h, bool remove_entries_p)
 
 #define SXHASH_MAX_LEN   7
 
+/* An odd multiplier whose bits look random, taken from the golden
+   ratio, for mixing words into hash codes.  */
+
+static EMACS_UINT const hash_string_multiplier
+  = (EMACS_INT_WIDTH <= 32
+     ? 0x9e3779b9u
+     : (EMACS_UINT) 0x9e3779b97f4a7c15u);
+
+/* Return HASH with the word C mixed in.  */
+
+static EMACS_UINT
+hash_string_mix (EMACS_UINT hash, EMACS_UINT c)
+{
+  hash = (hash << 5) | (hash >> (EMACS_INT_WIDTH - 5));
+  return (hash ^ c) * hash_string_multiplier;
+}
+
 /* Return a hash for string PTR which has length LEN.  The hash value
-   can be any EMACS_UINT value.  */
+   can be any EMACS_UINT value.
+
+   The string is read a word at a time rather than a byte at a time,
+   and each word is mixed in with a multiplication; the last step
+   spreads the bits of the words that the multiplications moved to
+   the top of the hash back to its bottom.  */
 
 EMACS_UINT
 hash_string (char const *ptr, ptrdiff_t len)
 {
   char const *p = ptr;
   char const *end = p + len;
-  unsigned char c;
-  EMACS_UINT hash = 0;
+  EMACS_UINT hash = len;
+
+  while (end - p >= (ptrdiff_t) sizeof (EMACS_UINT))
+    {
+      EMACS_UINT c;
+      memcpy (&c, p, sizeof c);
+      hash = hash_string_mix (hash, c);
+      p += sizeof c;
+    }
 
-  while (p != end)
+  if (p != end)
     {
-      c = *p++;
-      hash = sxhash_combine (hash, c);
+      EMACS_UINT c = 0;
+      memcpy (&c, p, end - p);
+      hash = hash_string_mix (hash, c);
     }
 
-  return hash;
+  hash ^= hash >> (EMACS_INT_WIDTH / 2);
+  hash *= hash_string_multiplier;
+  return hash ^ (hash >> (EMACS_INT_WIDTH / 2));
 }
 
 /* Return a hash for string PTR which has length LEN.  The hash
@@ -4686,18 +4847,18 @@ sxhash_obj (Lisp_Object obj, int depth)
 	  return sxhash_bignum (obj);
 	else if (pvec_type == PVEC_MARKER)
 	  {
-	    ptrdiff_t bytepos
-	      = XMARKER (obj)->buffer ? XMARKER (obj)->bytepos : 0;
+	    ptrdiff_t charpos
+	      = XMARKER (obj)->buffer ? marker_position (obj) : 0;
 	    EMACS_UINT hash
-	      = sxhash_combine ((intptr_t) XMARKER (obj)->buffer, bytepos);
+	      = sxhash_combine ((intptr_t) XMARKER (obj)->buffer, charpos);
 	    return SXHASH_REDUCE (hash);
 	  }
 	else if (pvec_type == PVEC_BOOL_VECTOR)
 	  return sxhash_bool_vector (obj);
 	else if (pvec_type == PVEC_OVERLAY)
 	  {
-	    EMACS_UINT hash = sxhash_obj (OVERLAY_START (obj), depth);
-	    hash = sxhash_combine (hash, sxhash_obj (OVERLAY_END (obj), depth));
+	    EMACS_UINT hash = OVERLAY_START (obj);
+	    hash = sxhash_combine (hash, OVERLAY_END (obj));
 	    hash = sxhash_combine (hash, sxhash_obj (XOVERLAY (obj)->plist, depth));
 	    return SXHASH_REDUCE (hash);
 	  }
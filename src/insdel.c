@@ -29,6 +29,7 @@ along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
 #include "buffer.h"
 #include "window.h"
 #include "region-cache.h"
+#include "line-index.h"
 #include "pdumper.h"
 
 static void insert_from_string_1 (Lisp_Object, ptrdiff_t, ptrdiff_t, ptrdiff_t,
@@ -66,13 +67,15 @@ check_markers (void)
 
   for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
     {
+      Lisp_Object marker = make_lisp_ptr (tail, Lisp_Vectorlike);
       if (tail->buffer->text != current_buffer->text)
 	emacs_abort ();
-      if (tail->charpos > Z)
+      if (marker_position (marker) > Z)
 	emacs_abort ();
-      if (tail->bytepos > Z_BYTE)
+      if (marker_byte_position (marker) > Z_BYTE)
 	emacs_abort ();
-      if (multibyte && ! CHAR_HEAD_P (FETCH_BYTE (tail->bytepos)))
+      if (multibyte
+	  && ! CHAR_HEAD_P (FETCH_BYTE (marker_byte_position (marker))))
 	emacs_abort ();
     }
 }
@@ -227,8 +230,8 @@ adjust_suspend_auto_hscroll (ptrdiff_t from, ptrdiff_t to)
 
       if (BUFFERP (w->contents)
 	  && XBUFFER (w->contents) == current_buffer
-	  && XMARKER (w->old_pointm)->charpos >= from
-	  && XMARKER (w->old_pointm)->charpos <= to)
+	  && marker_position (w->old_pointm) >= from
+	  && marker_position (w->old_pointm) <= to)
 	w->suspend_auto_hscroll = 0;
     }
 }
@@ -245,35 +248,20 @@ void
 adjust_markers_for_delete (ptrdiff_t from, ptrdiff_t from_byte,
 			   ptrdiff_t to, ptrdiff_t to_byte)
 {
-  struct Lisp_Marker *m;
-  ptrdiff_t charpos;
-
   adjust_suspend_auto_hscroll (from, to);
-  for (m = BUF_MARKERS (current_buffer); m; m = m->next)
-    {
-      charpos = m->charpos;
-      eassert (charpos <= Z);
+  invalidate_line_index_text (current_buffer, from - BEG, Z - to);
 
-      /* If the marker is after the deletion,
-	 relocate by number of chars / bytes deleted.  */
-      if (charpos > to)
-	{
-	  m->charpos -= to - from;
-	  m->bytepos -= to_byte - from_byte;
-	}
-      /* Here's the case where a marker is inside text being deleted.  */
-      else if (charpos > from)
-	{
-	  m->charpos = from;
-	  m->bytepos = from_byte;
-	}
-    }
+  /* Markers after the deletion move back by the number of chars
+     deleted, and markers inside it move to FROM.  */
+  itree_delete_gap (BUF_MARKER_TREE (current_buffer), from, to - from);
+
+  adjust_overlays_for_delete (from, to - from);
 }
 
 
 /* Adjust markers for an insertion that stretches from FROM / FROM_BYTE
    to TO / TO_BYTE.  We have to relocate the charpos of every marker
-   that points after the insertion (but not their bytepos).
+   that points after the insertion.
 
    When a marker points at the insertion point,
    we advance it if either its insertion-type is t
@@ -283,42 +271,39 @@ static void
 adjust_markers_for_insert (ptrdiff_t from, ptrdiff_t from_byte,
 			   ptrdiff_t to, ptrdiff_t to_byte, bool before_markers)
 {
-  struct Lisp_Marker *m;
-  bool adjusted = 0;
-  ptrdiff_t nchars = to - from;
-  ptrdiff_t nbytes = to_byte - from_byte;
+  struct itree_tree *tree = BUF_MARKER_TREE (current_buffer);
 
   adjust_suspend_auto_hscroll (from, to);
-  for (m = BUF_MARKERS (current_buffer); m; m = m->next)
-    {
-      eassert (m->bytepos >= m->charpos
-	       && m->bytepos - m->charpos <= Z_BYTE - Z);
+  invalidate_line_index_text (current_buffer, from - BEG, Z - to);
 
-      if (m->bytepos == from_byte)
-	{
-	  if (m->insertion_type || before_markers)
-	    {
-	      m->bytepos = to_byte;
-	      m->charpos = to;
-	      if (m->insertion_type)
-		adjusted = 1;
-	    }
-	}
-      else if (m->bytepos > from_byte)
-	{
-	  m->bytepos += nbytes;
-	  m->charpos += nchars;
-	}
-    }
-
-  /* Adjusting only markers whose insertion-type is t may result in
-     - disordered start and end in overlays, and
-     - disordered overlays in the slot `overlays_before' of current_buffer.  */
-  if (adjusted)
+  /* The tree advances the empty nodes at FROM according to their
+     insertion types, which are not kept up to date in the nodes
+     themselves, since markers change them directly.  */
+  if (!before_markers)
     {
-      fix_start_end_in_overlays (from, to);
-      fix_overlays_before (current_buffer, from, to);
+      struct itree_node *node;
+      ITREE_FOREACH (node, tree, from, from + 1, ASCENDING)
+	if (node->begin == from)
+	  node->front_advance = node->rear_advance
+	    = XMARKER (node->data)->insertion_type;
     }
+  itree_insert_gap (tree, from, to - from, before_markers);
+
+  adjust_overlays_for_insert (from, to - from, before_markers);
+}
+
+/* Advance the markers and overlay boundaries left at FROM by an
+   insertion of the text from FROM to TO, as if the text had been
+   inserted before markers.  This is for callers that insert text by
+   decoding it into the buffer.  */
+
+void
+advance_markers_over_insertion (ptrdiff_t from, ptrdiff_t to)
+{
+  itree_delete_gap (BUF_MARKER_TREE (current_buffer), from, to - from);
+  itree_insert_gap (BUF_MARKER_TREE (current_buffer), from, to - from, true);
+  adjust_overlays_for_delete (from, to - from);
+  adjust_overlays_for_insert (from, to - from, true);
 }
 
 /* Adjust point for an insertion of NBYTES bytes, which are NCHARS characters.
@@ -349,96 +334,39 @@ adjust_markers_for_replace (ptrdiff_t from, ptrdiff_t from_byte,
 			    ptrdiff_t old_chars, ptrdiff_t old_bytes,
 			    ptrdiff_t new_chars, ptrdiff_t new_bytes)
 {
-  register struct Lisp_Marker *m;
-  ptrdiff_t prev_to_byte = from_byte + old_bytes;
-  ptrdiff_t diff_chars = new_chars - old_chars;
-  ptrdiff_t diff_bytes = new_bytes - old_bytes;
+  struct itree_tree *tree = BUF_MARKER_TREE (current_buffer);
 
   adjust_suspend_auto_hscroll (from, from + old_chars);
-  for (m = BUF_MARKERS (current_buffer); m; m = m->next)
-    {
-      if (m->bytepos >= prev_to_byte)
-	{
-	  m->charpos += diff_chars;
-	  m->bytepos += diff_bytes;
-	}
-      else if (m->bytepos > from_byte)
-	{
-	  m->charpos = from;
-	  m->bytepos = from_byte;
-	}
-    }
+  invalidate_line_index_text (current_buffer, from - BEG,
+			      Z - (from + new_chars));
 
-  check_markers ();
-}
+  /* Markers at or after the end of the old text move by the
+     difference in length, and markers inside it move to FROM.  */
+  itree_insert_gap (tree, from + old_chars, new_chars, true);
+  itree_delete_gap (tree, from, old_chars);
 
-/* Starting at POS (BYTEPOS), find the byte position corresponding to
-   ENDPOS, which could be either before or after POS.  */
-static ptrdiff_t
-count_bytes (ptrdiff_t pos, ptrdiff_t bytepos, ptrdiff_t endpos)
-{
-  eassert (BEG_BYTE <= bytepos && bytepos <= Z_BYTE
-	   && BEG <= endpos && endpos <= Z);
-
-  if (pos <= endpos)
-    for ( ; pos < endpos; pos++)
-      bytepos += next_char_len (bytepos);
-  else
-    for ( ; pos > endpos; pos--)
-      bytepos -= prev_char_len (bytepos);
+  adjust_overlays_for_insert (from + old_chars, new_chars, true);
+  adjust_overlays_for_delete (from, old_chars);
 
-  return bytepos;
+  check_markers ();
 }
 
-/* Adjust byte positions of markers when their character positions
-   didn't change.  This is used in several places that replace text,
-   but keep the character positions of the markers unchanged -- the
-   byte positions could still change due to different numbers of bytes
-   in the new text.
+/* Take note that the byte positions of the text between FROM
+   (FROM_BYTE) and TO (TO_BYTE) changed, while its character positions
+   did not.  This is used in several places that replace text, but
+   keep the character positions of the markers unchanged -- the byte
+   positions could still change due to different numbers of bytes in
+   the new text.  Markers record only their character positions, so
+   only the caches of byte positions need to be told.
 
-   FROM (FROM_BYTE) and TO (TO_BYTE) specify the region of text where
-   changes have been done.  TO_Z, if non-zero, means all the markers
-   whose positions are after TO should also be adjusted.  */
+   TO_Z, if non-zero, means the byte positions after TO changed as
+   well.  */
 void
 adjust_markers_bytepos (ptrdiff_t from, ptrdiff_t from_byte,
 			ptrdiff_t to, ptrdiff_t to_byte, int to_z)
 {
-  register struct Lisp_Marker *m;
-  ptrdiff_t beg = from, begbyte = from_byte;
-
   adjust_suspend_auto_hscroll (from, to);
-
-  if (Z == Z_BYTE || (!to_z && to == to_byte))
-    {
-      /* Make sure each affected marker's bytepos is equal to
-	 its charpos.  */
-      for (m = BUF_MARKERS (current_buffer); m; m = m->next)
-	{
-	  if (m->bytepos > from_byte
-	      && (to_z || m->bytepos <= to_byte))
-	    m->bytepos = m->charpos;
-	}
-    }
-  else
-    {
-      for (m = BUF_MARKERS (current_buffer); m; m = m->next)
-	{
-	  /* Recompute each affected marker's bytepos.  */
-	  if (m->bytepos > from_byte
-	      && (to_z || m->bytepos <= to_byte))
-	    {
-	      if (m->charpos < beg
-		  && beg - m->charpos > m->charpos - from)
-		{
-		  beg = from;
-		  begbyte = from_byte;
-		}
-	      m->bytepos = count_bytes (beg, begbyte, m->charpos);
-	      beg = m->charpos;
-	      begbyte = m->bytepos;
-	    }
-	}
-    }
+  invalidate_line_index_text (current_buffer, from - BEG, to_z ? 0 : Z - to);
 
   /* Make sure cached charpos/bytepos is invalid.  */
   clear_charpos_cache (current_buffer);
@@ -929,7 +857,6 @@ insert_1_both (const char *string,
   if (Z - GPT < END_UNCHANGED)
     END_UNCHANGED = Z - GPT;
 
-  adjust_overlays_for_insert (PT, nchars);
   adjust_markers_for_insert (PT, PT_BYTE,
 			     PT + nchars, PT_BYTE + nbytes,
 			     before_markers);
@@ -1055,7 +982,6 @@ insert_from_string_1 (Lisp_Object string, ptrdiff_t pos, ptrdiff_t pos_byte,
   if (Z - GPT < END_UNCHANGED)
     END_UNCHANGED = Z - GPT;
 
-  adjust_overlays_for_insert (PT, nchars);
   adjust_markers_for_insert (PT, PT_BYTE, PT + nchars,
 			     PT_BYTE + outgoing_nbytes,
 			     before_markers);
@@ -1126,7 +1052,6 @@ insert_from_gap (ptrdiff_t nchars, ptrdiff_t nbytes, bool text_at_gap_tail)
 
   insert_from_gap_1 (nchars, nbytes, text_at_gap_tail);
 
-  adjust_overlays_for_insert (ins_charpos, nchars);
   adjust_markers_for_insert (ins_charpos, ins_bytepos,
 			     ins_charpos + nchars, ins_bytepos + nbytes, 0);
 
@@ -1268,7 +1193,6 @@ insert_from_buffer_1 (struct buffer *buf,
   if (Z - GPT < END_UNCHANGED)
     END_UNCHANGED = Z - GPT;
 
-  adjust_overlays_for_insert (PT, nchars);
   adjust_markers_for_insert (PT, PT_BYTE, PT + nchars,
 			     PT_BYTE + outgoing_nbytes,
 			     0);
@@ -1333,11 +1257,6 @@ adjust_after_replace (ptrdiff_t from, ptrdiff_t from_byte,
     record_delete (from, prev_text, false);
   record_insert (from, len);
 
-  if (len > nchars_del)
-    adjust_overlays_for_insert (from, len - nchars_del);
-  else if (len < nchars_del)
-    adjust_overlays_for_delete (from, nchars_del - len);
-
   offset_intervals (current_buffer, from, len - nchars_del);
 
   if (from < PT)
@@ -1521,11 +1440,6 @@ replace_range (ptrdiff_t from, ptrdiff_t to, Lisp_Object new,
 			      from_byte + outgoing_insbytes, 1);
     }
 
-  /* Adjust the overlay center as needed.  This must be done after
-     adjusting the markers that bound the overlays.  */
-  adjust_overlays_for_delete (from, nchars_del);
-  adjust_overlays_for_insert (from, inschars);
-
   offset_intervals (current_buffer, from, inschars - nchars_del);
 
   /* Get the intervals for the part of the string we are inserting--
@@ -1652,14 +1566,6 @@ replace_range_2 (ptrdiff_t from, ptrdiff_t from_byte,
 	}
     }
 
-  /* Adjust the overlay center as needed.  This must be done after
-     adjusting the markers that bound the overlays.  */
-  if (nchars_del != inschars)
-    {
-      adjust_overlays_for_insert (from, inschars);
-      adjust_overlays_for_delete (from + inschars, nchars_del);
-    }
-
   offset_intervals (current_buffer, from, inschars - nchars_del);
 
   /* Relocate point as if it were a marker.  */
@@ -1862,10 +1768,6 @@ del_range_2 (ptrdiff_t from, ptrdiff_t from_byte,
 
   offset_intervals (current_buffer, from, - nchars_del);
 
-  /* Adjust the overlay center as needed.  This must be done after
-     adjusting the markers that bound the overlays.  */
-  adjust_overlays_for_delete (from, nchars_del);
-
   GAP_SIZE += nbytes_del;
   ZV_BYTE -= nbytes_del;
   Z_BYTE -= nbytes_del;
@@ -2070,6 +1972,12 @@ invalidate_buffer_caches (struct buffer *buf, ptrdiff_t start, ptrdiff_t end)
     invalidate_region_cache (buf,
                              buf->width_run_cache,
                              start - BUF_BEG (buf), BUF_Z (buf) - end);
+  if (buf->line_index)
+    invalidate_line_index (buf->line_index,
+			   start - BUF_BEG (buf), BUF_Z (buf) - end);
+  /* Anything but an insertion at the end changes the existing text.  */
+  if (start < BUF_Z (buf))
+    BUF_INNER_MODIFF (buf) = BUF_MODIFF (buf) + 1;
 }
 
 /* These macros work with an argument named `preserve_ptr'
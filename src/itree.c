@@ -0,0 +1,1066 @@
+/* This file implements an efficient interval data-structure.
+
+Copyright (C) 2017-2020 Free Software Foundation, Inc.
+
+This file is part of GNU Emacs.
+
+GNU Emacs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+GNU Emacs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include "itree.h"
+
+/*
+   Intervals of the form [BEGIN, END), are stored as nodes inside a RB
+   tree, ordered by BEGIN.  The core operation of this tree (besides
+   insert, remove, etc.) is finding all intervals intersecting with
+   some given interval.  In order to perform this operation
+   efficiently, every node stores a third value called LIMIT.  (See
+   https://en.wikipedia.org/wiki/Interval_tree#Augmented_tree and the
+   book "Introduction to Algorithms" (Cormen et al.).)
+
+   ==== Finding intervals ====
+
+   If we search for all intervals intersecting with (X, Y], we look at
+   some node and test whether
+
+   NODE.BEGIN > Y
+
+   Due to the invariant of the search tree, we know, that we may
+   safely prune NODE's right subtree if this test succeeds, since all
+   intervals begin strictly after Y.
+
+   But we can not make such an assumptions about the left tree, since
+   all we know is that the intervals in this subtree must start before
+   or at NODE.BEGIN.  So we can't tell, whether they end before X or
+   not.  To solve this problem we add another attribute to each node,
+   called LIMIT.
+
+   The LIMIT of a node is the largest END value occurring in the nodes
+   subtree (including the node itself).  Thus, we may look at the left
+   child of some NODE and test whether
+
+   NODE.left.LIMIT < X
+
+   and this tells us, if all intervals in the left subtree of NODE end
+   before X and if they can therefore be pruned.
+
+   ==== Adjusting intervals ====
+
+   Since this data-structure will be used for overlays in an Emacs
+   buffer, a second core operation is the ability to insert and delete
+   gaps in the tree.  This models the insertion and deletion of text
+   in a buffer and the effects it may have on the positions of
+   overlays.
+
+   Consider this: Something gets inserted at position P into a buffer
+   and assume that all overlays occur strictly after P.  Ordinarily,
+   we would have to iterate all overlays and increment their BEGIN and
+   END values accordingly (the insertion of text pushes them back).
+   In order to avoid this, we introduce yet another node attribute
+   called OFFSET.
+
+   The OFFSET of some subtree, represented by its root, is the amount
+   of shift that needs to be applied to its BEGIN, END and LIMIT
+   values, in order to get to the actual buffer positions.  Coming
+   back to the example, all we would need to do in this case, is to
+   increment the OFFSET of the tree's root, without any traversal of
+   the tree itself.
+
+   As a consequence, the real values of BEGIN, END and LIMIT of a node
+   are not known, until all OFFSETs of the node's parents are
+   accumulated and applied.  This is done lazily, whenever a node is
+   traversed, see itree_inherit_offset.  Each tree also maintains an
+   OTICK which is incremented whenever some OFFSET is changed, and
+   nodes remember the OTICK at which they were last made clean, so
+   that a node whose positions are already known costs nothing to
+   query again.  */
+
+static bool
+null_safe_is_red (struct itree_node *node)
+{
+  return node != NULL && node->red;
+}
+
+static bool
+null_safe_is_black (struct itree_node *node)
+{
+  return node == NULL || !node->red; /* NULL nodes are black */
+}
+
+/* Return the LIMIT NODE should have, given the LIMITs of its
+   children.  */
+
+static ptrdiff_t
+itree_newlimit (struct itree_node *node)
+{
+  eassert (node != NULL);
+  return max (node->end,
+	      max (node->left == NULL
+		   ? PTRDIFF_MIN
+		   : node->left->limit + node->left->offset,
+		   node->right == NULL
+		   ? PTRDIFF_MIN
+		   : node->right->limit + node->right->offset));
+}
+
+/* Update NODE's limit attribute according to its children.  */
+
+static void
+itree_update_limit (struct itree_node *node)
+{
+  if (node == NULL)
+    return;
+
+  node->limit = itree_newlimit (node);
+}
+
+/* Update NODE's LIMIT and those of its ancestors, as long as they
+   change.  */
+
+static void
+itree_propagate_limit (struct itree_node *node)
+{
+  while (node != NULL)
+    {
+      ptrdiff_t newlimit = itree_newlimit (node);
+      if (newlimit == node->limit)
+	break;
+      node->limit = newlimit;
+      node = node->parent;
+    }
+}
+
+/* Apply NODE's offset to its begin, end and limit values and pass it
+   on to its children.  If NODE's parent is clean, NODE becomes clean
+   as well.  */
+
+static void
+itree_inherit_offset (uintmax_t otick, struct itree_node *node)
+{
+  eassert (node->parent == NULL || node->parent->otick >= node->otick);
+  if (node->otick == otick)
+    {
+      eassert (node->offset == 0);
+      return;
+    }
+
+  /* Offsets can be inherited from dirty nodes (with out of date
+     otick) during removal, since we do not travel down from the root
+     in that case.  In this case rotations are performed on
+     potentially "dirty" nodes, where we only need to make sure the
+     *local* offsets are zero.  */
+
+  if (node->offset)
+    {
+      node->begin += node->offset;
+      node->end += node->offset;
+      node->limit += node->offset;
+      if (node->left != NULL)
+	node->left->offset += node->offset;
+      if (node->right != NULL)
+	node->right->offset += node->offset;
+      node->offset = 0;
+    }
+  /* The node is clean when its parent is clean.  */
+  if (node->parent == NULL || node->parent->otick == otick)
+    node->otick = otick;
+}
+
+/* Make sure NODE's BEGIN, END and LIMIT are up to date, by
+   inheriting the offsets of all of its ancestors.  Return NODE.  */
+
+static struct itree_node *
+itree_validate (struct itree_tree *tree, struct itree_node *node)
+{
+  if (node == NULL || tree->otick == node->otick)
+    return node;
+  if (node != tree->root)
+    itree_validate (tree, node->parent);
+
+  itree_inherit_offset (tree->otick, node);
+  return node;
+}
+
+/* Initialize an allocated node.  */
+
+void
+itree_node_init (struct itree_node *node,
+		 bool front_advance, bool rear_advance,
+		 Lisp_Object data)
+{
+  node->parent = NULL;
+  node->left = NULL;
+  node->right = NULL;
+  node->begin = -1;
+  node->end = -1;
+  node->limit = 0;
+  node->offset = 0;
+  node->otick = 0;
+  node->red = false;
+  node->front_advance = front_advance;
+  node->rear_advance = rear_advance;
+  node->data = data;
+}
+
+/* Return NODE's begin value, computing it if necessary.  */
+
+ptrdiff_t
+itree_node_begin (struct itree_tree *tree,
+		  struct itree_node *node)
+{
+  itree_validate (tree, node);
+  return node->begin;
+}
+
+/* Return NODE's end value, computing it if necessary.  */
+
+ptrdiff_t
+itree_node_end (struct itree_tree *tree,
+		struct itree_node *node)
+{
+  itree_validate (tree, node);
+  return node->end;
+}
+
+/* Allocate an itree_tree.  Free with itree_destroy.  */
+
+struct itree_tree *
+itree_create (void)
+{
+  struct itree_tree *tree = xmalloc (sizeof *tree);
+  tree->root = NULL;
+  tree->otick = 1;
+  tree->size = 0;
+  return tree;
+}
+
+/* Free the memory allocated for TREE, which must be empty.  */
+
+void
+itree_destroy (struct itree_tree *tree)
+{
+  eassert (tree->root == NULL);
+  xfree (tree);
+}
+
+/* Return the number of nodes in TREE.  */
+
+intmax_t
+itree_size (struct itree_tree *tree)
+{
+  return tree->size;
+}
+
+/* Remove all nodes from TREE, leaving every node detached.  */
+
+void
+itree_clear (struct itree_tree *tree)
+{
+  struct itree_node *node = tree->root;
+
+  /* Walk down to a leaf, cut it off its parent and continue with the
+     parent, until nothing is left.  This visits every node a bounded
+     number of times without needing any auxiliary storage.  */
+  while (node != NULL)
+    {
+      if (node->left != NULL)
+	node = node->left;
+      else if (node->right != NULL)
+	node = node->right;
+      else
+	{
+	  struct itree_node *parent = node->parent;
+	  if (parent != NULL)
+	    {
+	      if (parent->left == node)
+		parent->left = NULL;
+	      else
+		parent->right = NULL;
+	    }
+	  node->parent = NULL;
+	  node->red = false;
+	  node = parent;
+	}
+    }
+
+  tree->root = NULL;
+  tree->otick = 1;
+  tree->size = 0;
+}
+
+/* Perform the familiar left-rotation on node NODE.  */
+
+static void
+itree_rotate_left (struct itree_tree *tree, struct itree_node *node)
+{
+  eassert (node->right != NULL);
+
+  struct itree_node *right = node->right;
+
+  itree_inherit_offset (tree->otick, node);
+  itree_inherit_offset (tree->otick, right);
+
+  /* Turn right's left subtree into node's right subtree.  */
+  node->right = right->left;
+  if (right->left != NULL)
+    right->left->parent = node;
+
+  /* right's parent was node's parent.  */
+  right->parent = node->parent;
+
+  /* Get the parent to point to right instead of node.  */
+  if (node != tree->root)
+    {
+      if (node == node->parent->left)
+	node->parent->left = right;
+      else
+	node->parent->right = right;
+    }
+  else
+    tree->root = right;
+
+  /* Put node on right's left.  */
+  right->left = node;
+  node->parent = right;
+
+  /* Order matters here.  */
+  itree_update_limit (node);
+  itree_update_limit (right);
+}
+
+/* Perform the familiar right-rotation on node NODE.  */
+
+static void
+itree_rotate_right (struct itree_tree *tree, struct itree_node *node)
+{
+  eassert (tree && node && node->left != NULL);
+
+  struct itree_node *left = node->left;
+
+  itree_inherit_offset (tree->otick, node);
+  itree_inherit_offset (tree->otick, left);
+
+  node->left = left->right;
+  if (left->right != NULL)
+    left->right->parent = node;
+
+  left->parent = node->parent;
+  if (node != tree->root)
+    {
+      if (node == node->parent->right)
+	node->parent->right = left;
+      else
+	node->parent->left = left;
+    }
+  else
+    tree->root = left;
+
+  left->right = node;
+  node->parent = left;
+
+  itree_update_limit (node);
+  itree_update_limit (left);
+}
+
+/* Repair the tree after an insertion.
+   The new NODE was added as red, so we may have 2 reds in a row.
+   Rebalance the parents as needed to re-establish the RB invariants.  */
+
+static void
+itree_insert_fix (struct itree_tree *tree, struct itree_node *node)
+{
+  eassert (tree->root->red == false);
+
+  while (null_safe_is_red (node->parent))
+    {
+      /* NODE is red and its parent is red.  This is a violation of
+	 red-black tree property #3.  */
+      eassert (node->red);
+
+      if (node->parent == node->parent->parent->left)
+	{
+	  /* We're on the left side of our grandparent, and OTHER is
+	     our "uncle".  */
+	  struct itree_node *uncle = node->parent->parent->right;
+
+	  if (null_safe_is_red (uncle)) /* case 1.a */
+	    {
+	      /* Uncle and parent are red but should be black because
+		 NODE is red.  Change the colors accordingly and
+		 proceed with the grandparent.  */
+	      node->parent->red = false;
+	      uncle->red = false;
+	      node->parent->parent->red = true;
+	      node = node->parent->parent;
+	    }
+	  else
+	    {
+	      /* Parent and uncle have different colors; parent is
+		 red, uncle is black.  */
+	      if (node == node->parent->right) /* case 2.a */
+		{
+		  node = node->parent;
+		  itree_rotate_left (tree, node);
+		}
+	      /* case 3.a */
+	      node->parent->red = false;
+	      node->parent->parent->red = true;
+	      itree_rotate_right (tree, node->parent->parent);
+	    }
+	}
+      else
+	{
+	  /* This is the symmetrical case of above.  */
+	  struct itree_node *uncle = node->parent->parent->left;
+
+	  if (null_safe_is_red (uncle)) /* case 1.b */
+	    {
+	      node->parent->red = false;
+	      uncle->red = false;
+	      node->parent->parent->red = true;
+	      node = node->parent->parent;
+	    }
+	  else
+	    {
+	      if (node == node->parent->left) /* case 2.b */
+		{
+		  node = node->parent;
+		  itree_rotate_right (tree, node);
+		}
+	      /* case 3.b */
+	      node->parent->red = false;
+	      node->parent->parent->red = true;
+	      itree_rotate_left (tree, node->parent->parent);
+	    }
+	}
+    }
+
+  /* The root may have been changed to red due to the algorithm.
+     Set it to black so that property #5 is satisfied.  */
+  tree->root->red = false;
+  eassert (null_safe_is_black (tree->root));
+}
+
+/* Insert NODE into TREE.  NODE's BEGIN and END must already be set,
+   and NODE must be clean with respect to TREE.  */
+
+static void
+itree_insert_node (struct itree_tree *tree, struct itree_node *node)
+{
+  eassert (node && node->begin <= node->end);
+  eassert (node->left == NULL && node->right == NULL
+	   && node->parent == NULL);
+  eassert (node->otick == tree->otick);
+
+  struct itree_node *parent = NULL;
+  struct itree_node *child = tree->root;
+  uintmax_t otick = tree->otick;
+
+  /* Find the insertion point, accumulate node's offset and update
+     ancestors limit values.  */
+  while (child != NULL)
+    {
+      itree_inherit_offset (otick, child);
+      parent = child;
+      eassert (child->offset == 0);
+      child->limit = max (child->limit, node->end);
+      /* This suggests that nodes in the right subtree are strictly
+	 greater.  But this is not true due to later rotations.  */
+      child = node->begin <= child->begin ? child->left : child->right;
+    }
+
+  /* Insert the node.  */
+  if (parent == NULL)
+    tree->root = node;
+  else if (node->begin <= parent->begin)
+    parent->left = node;
+  else
+    parent->right = node;
+
+  /* Init the node.  */
+  node->parent = parent;
+  node->left = NULL;
+  node->right = NULL;
+  node->offset = 0;
+  node->limit = node->end;
+  eassert (node->parent == NULL || node->parent->otick >= node->otick);
+
+  /* Fix/update the tree.  */
+  ++tree->size;
+  if (node == tree->root)
+    node->red = false;
+  else
+    {
+      node->red = true;
+      itree_insert_fix (tree, node);
+    }
+}
+
+/* Insert NODE into TREE, covering the interval [BEGIN, END).  */
+
+void
+itree_insert (struct itree_tree *tree, struct itree_node *node,
+	      ptrdiff_t begin, ptrdiff_t end)
+{
+  node->begin = begin;
+  node->end = end;
+  node->otick = tree->otick;
+  itree_insert_node (tree, node);
+}
+
+/* Safely modify a node's interval.  */
+
+void
+itree_node_set_region (struct itree_tree *tree,
+		       struct itree_node *node,
+		       ptrdiff_t begin, ptrdiff_t end)
+{
+  itree_validate (tree, node);
+  if (begin != node->begin)
+    {
+      itree_remove (tree, node);
+      node->begin = min (begin, PTRDIFF_MAX - 1);
+      node->end = max (node->begin, end);
+      itree_insert_node (tree, node);
+    }
+  else if (end != node->end)
+    {
+      node->end = max (node->begin, end);
+      itree_propagate_limit (node);
+    }
+}
+
+/* Return the node with the smallest BEGIN in the subtree rooted at
+   NODE, inheriting offsets on the way down.  */
+
+static struct itree_node *
+itree_subtree_min (uintmax_t otick, struct itree_node *node)
+{
+  if (node == NULL)
+    return node;
+  while ((itree_inherit_offset (otick, node),
+	  node->left != NULL))
+    node = node->left;
+  return node;
+}
+
+/* Repair the tree after a deletion.
+   The black-depth of NODE is one less than that of its sibling,
+   so re-balance the parents to re-establish the RB invariants.  */
+
+static void
+itree_remove_fix (struct itree_tree *tree,
+		  struct itree_node *node,
+		  struct itree_node *parent)
+{
+  if (parent == NULL)
+    eassert (node == tree->root);
+  else
+    eassert (node == NULL || node->parent == parent);
+
+  while (parent != NULL && null_safe_is_black (node))
+    {
+      eassert (node == parent->left || node == parent->right);
+
+      if (node == parent->left)
+	{
+	  struct itree_node *other = parent->right;
+
+	  if (null_safe_is_red (other)) /* case 1.a */
+	    {
+	      other->red = false;
+	      parent->red = true;
+	      itree_rotate_left (tree, parent);
+	      other = parent->right;
+	    }
+	  eassume (other != NULL);
+
+	  if (null_safe_is_black (other->left) /* 2.a */
+	      && null_safe_is_black (other->right))
+	    {
+	      other->red = true;
+	      node = parent;
+	      eassert (node != NULL);
+	      parent = node->parent;
+	    }
+	  else
+	    {
+	      if (null_safe_is_black (other->right)) /* 3.a */
+		{
+		  other->left->red = false;
+		  other->red = true;
+		  itree_rotate_right (tree, other);
+		  other = parent->right;
+		}
+	      other->red = parent->red; /* 4.a */
+	      parent->red = false;
+	      other->right->red = false;
+	      itree_rotate_left (tree, parent);
+	      node = tree->root;
+	      parent = NULL;
+	    }
+	}
+      else
+	{
+	  struct itree_node *other = parent->left;
+
+	  if (null_safe_is_red (other)) /* 1.b */
+	    {
+	      other->red = false;
+	      parent->red = true;
+	      itree_rotate_right (tree, parent);
+	      other = parent->left;
+	    }
+	  eassume (other != NULL);
+
+	  if (null_safe_is_black (other->right) /* 2.b */
+	      && null_safe_is_black (other->left))
+	    {
+	      other->red = true;
+	      node = parent;
+	      eassert (node != NULL);
+	      parent = node->parent;
+	    }
+	  else
+	    {
+	      if (null_safe_is_black (other->left)) /* 3.b */
+		{
+		  other->right->red = false;
+		  other->red = true;
+		  itree_rotate_left (tree, other);
+		  other = parent->left;
+		}
+
+	      other->red = parent->red; /* 4.b */
+	      parent->red = false;
+	      other->left->red = false;
+	      itree_rotate_right (tree, parent);
+	      node = tree->root;
+	      parent = NULL;
+	    }
+	}
+    }
+
+  if (node != NULL)
+    node->red = false;
+}
+
+/* Link node SOURCE in DEST's place.
+   It's the caller's responsibility to refresh the `limit`s
+   of DEST->parents afterwards.  */
+
+static void
+itree_replace_child (struct itree_tree *tree,
+		     struct itree_node *source,
+		     struct itree_node *dest)
+{
+  eassert (tree && dest != NULL);
+  eassert (source == NULL
+	   || dest->parent == NULL
+	   || dest->parent->offset == 0);
+
+  if (dest->parent == NULL)
+    tree->root = source;
+  else if (dest == dest->parent->left)
+    dest->parent->left = source;
+  else
+    dest->parent->right = source;
+
+  if (source != NULL)
+    source->parent = dest->parent;
+}
+
+/* Replace DEST with SOURCE as a tree node.
+   Similar to itree_replace_child, but also transfers DEST's children
+   to SOURCE.  */
+
+static void
+itree_transplant (struct itree_tree *tree,
+		  struct itree_node *source,
+		  struct itree_node *dest)
+{
+  itree_replace_child (tree, source, dest);
+  source->left = dest->left;
+  if (source->left != NULL)
+    source->left->parent = source;
+  source->right = dest->right;
+  if (source->right != NULL)
+    source->right->parent = source;
+  source->red = dest->red;
+}
+
+/* Remove NODE from TREE and return it.  NODE must exist in TREE.  */
+
+struct itree_node *
+itree_remove (struct itree_tree *tree, struct itree_node *node)
+{
+  /* Make NODE and all of its ancestors clean, so that every node we
+     relink below has no pending offset.  */
+  itree_validate (tree, node);
+
+  /* Find `splice`, the leaf node to splice out of the tree.  When
+     `node` has at most one child this is `node` itself.  Otherwise,
+     it is the in order successor of `node`.  */
+  struct itree_node *splice
+    = (node->left == NULL || node->right == NULL)
+	? node
+	: itree_subtree_min (tree->otick, node->right);
+
+  /* Find `subtree`, the only child of `splice` (may be NULL).  Note:
+     `subtree` will not be modified other than changing its parent to
+     `splice`.  */
+  eassert (splice->left == NULL || splice->right == NULL);
+  struct itree_node *subtree
+    = splice->left != NULL ? splice->left : splice->right;
+
+  /* Save a pointer to the parent of where `subtree` will eventually
+     be in `subtree_parent`.  */
+  struct itree_node *subtree_parent
+    = splice->parent != node ? splice->parent : splice;
+
+  /* If `splice` is black removing it may violate Red-Black
+     invariants, so note this for later.  */
+  bool removed_black = !splice->red;
+
+  /* Replace `splice` with `subtree` under subtree's parent.  */
+  itree_replace_child (tree, subtree, splice);
+
+  /* Replace `node` with `splice` in the tree and propagate limit
+     upwards, if necessary.  Note: Limit propagation can stabilize at
+     any point, so we must call from bottom to top for every node that
+     has a new child.  */
+  if (splice != node)
+    {
+      itree_transplant (tree, splice, node);
+      itree_propagate_limit (subtree_parent);
+      if (splice != subtree_parent)
+	itree_update_limit (splice);
+    }
+  itree_propagate_limit (splice->parent);
+
+  --tree->size;
+
+  /* Fix any black height violation caused by removing a black node.  */
+  if (removed_black)
+    itree_remove_fix (tree, subtree, subtree_parent);
+
+  eassert ((tree->size == 0) == (tree->root == NULL));
+
+  /* Clear fields related to the tree for sanity while debugging.  */
+  node->red = false;
+  node->right = node->left = node->parent = NULL;
+  node->limit = 0;
+
+  /* Must be clean (all offsets applied).  Also, some callers rely on
+     node's otick being the tree's otick.  */
+  eassert (node->otick == tree->otick);
+  eassert (node->offset == 0);
+
+  return node;
+}
+
+
+/* +=======================================================================+
+ * | Insert/Delete Gaps
+ * +=======================================================================+ */
+
+/* Shift the positions of the nodes in the subtree rooted at NODE for
+   an insertion of LENGTH characters at POS.  Subtrees lying entirely
+   after POS are shifted lazily through their OFFSET, so only the
+   nodes along the search path and those overlapping POS are actually
+   visited.  */
+
+static void
+itree_insert_gap_1 (struct itree_tree *tree, struct itree_node *node,
+		    ptrdiff_t pos, ptrdiff_t length, bool before_markers)
+{
+  itree_inherit_offset (tree->otick, node);
+  if (pos > node->limit)
+    return;
+  if (node->right != NULL)
+    {
+      if (node->begin > pos)
+	{
+	  /* All nodes in this subtree are shifted by length.  */
+	  node->right->offset += length;
+	  ++tree->otick;
+	}
+      else
+	itree_insert_gap_1 (tree, node->right, pos, length, before_markers);
+    }
+  if (node->left != NULL)
+    itree_insert_gap_1 (tree, node->left, pos, length, before_markers);
+
+  if (before_markers
+      ? node->begin >= pos
+      : node->begin > pos) /* node->begin == pos => front-advance */
+    node->begin += length;
+  if (node->end > pos
+      || (node->end == pos && (before_markers || node->rear_advance)))
+    node->end += length;
+  itree_update_limit (node);
+}
+
+/* Insert a gap at POS of length LENGTH expanding all intervals
+   intersecting it, while respecting their rear_advance and
+   front_advance setting.
+
+   If BEFORE_MARKERS is non-zero, all overlays beginning/ending at POS
+   are treated as if their front_advance/rear_advance was true.  */
+
+void
+itree_insert_gap (struct itree_tree *tree,
+		  ptrdiff_t pos, ptrdiff_t length, bool before_markers)
+{
+  if (!tree || length <= 0 || tree->root == NULL)
+    return;
+
+  /* Nodes with front_advance starting at pos may mess up the tree
+     order, so we need to remove them first.  This doesn't apply for
+     `before_markers` since in that case, all positions move
+     identically regardless of `front_advance` or `rear_advance`.  */
+  struct itree_node **saved = NULL;
+  ptrdiff_t nsaved = 0, saved_size = 0;
+  if (!before_markers)
+    {
+      struct itree_node *node;
+      ITREE_FOREACH (node, tree, pos, pos + 1, ASCENDING)
+	{
+	  if (node->begin == pos && node->front_advance
+	      /* If we have front_advance and !rear_advance and the
+		 overlay is empty, make sure we don't move begin past end
+		 by pretending it's !front_advance.  */
+	      && (node->begin != node->end || node->rear_advance))
+	    {
+	      if (nsaved == saved_size)
+		saved = xpalloc (saved, &saved_size, 1, -1, sizeof *saved);
+	      saved[nsaved++] = node;
+	    }
+	}
+    }
+  for (ptrdiff_t i = 0; i < nsaved; i++)
+    itree_remove (tree, saved[i]);
+
+  if (tree->root != NULL)
+    itree_insert_gap_1 (tree, tree->root, pos, length, before_markers);
+
+  /* Reinsert nodes starting at POS having front-advance.  */
+  for (ptrdiff_t i = nsaved - 1; i >= 0; i--)
+    {
+      struct itree_node *node = saved[i];
+      eassert (node->begin == pos);
+      eassert (node->end > pos || node->rear_advance);
+      node->begin += length;
+      node->end += length;
+      node->otick = tree->otick;
+      itree_insert_node (tree, node);
+    }
+
+  xfree (saved);
+}
+
+/* Shift the positions of the nodes in the subtree rooted at NODE for
+   a deletion of LENGTH characters at POS.  */
+
+static void
+itree_delete_gap_1 (struct itree_tree *tree, struct itree_node *node,
+		    ptrdiff_t pos, ptrdiff_t length)
+{
+  itree_inherit_offset (tree->otick, node);
+  if (pos > node->limit)
+    return;
+  if (node->right != NULL)
+    {
+      if (node->begin > pos + length)
+	{
+	  /* Shift right subtree to the left.  */
+	  node->right->offset -= length;
+	  ++tree->otick;
+	}
+      else
+	itree_delete_gap_1 (tree, node->right, pos, length);
+    }
+  if (node->left != NULL)
+    itree_delete_gap_1 (tree, node->left, pos, length);
+
+  if (pos < node->begin)
+    node->begin = max (pos, node->begin - length);
+  if (node->end > pos)
+    node->end = max (pos, node->end - length);
+  itree_update_limit (node);
+}
+
+/* Delete a gap at POS of length LENGTH, contracting all intervals
+   intersecting it.  */
+
+void
+itree_delete_gap (struct itree_tree *tree,
+		  ptrdiff_t pos, ptrdiff_t length)
+{
+  if (!tree || length <= 0 || tree->root == NULL)
+    return;
+
+  itree_delete_gap_1 (tree, tree->root, pos, length);
+}
+
+
+/* +=======================================================================+
+ * | Iterator
+ * +=======================================================================+ */
+
+/* Return true, if NODE's interval intersects with [BEGIN, END).
+   Note: We always include empty nodes at BEGIN (and not at END),
+   but if BEGIN==END, then we don't include non-empty nodes starting
+   at BEGIN or ending at END.  This matches the behavior of the old
+   overlays code.  */
+
+static inline bool
+itree_node_intersects (const struct itree_node *node,
+		       ptrdiff_t begin, ptrdiff_t end)
+{
+  return (begin < node->end && node->begin < end)
+    || (node->begin == node->end && begin == node->begin);
+}
+
+/* Return true if the subtree rooted at NODE, whose offset must have
+   been inherited already, may contain nodes ending at or after
+   ITER's BEGIN.  */
+
+static inline bool
+itree_iter_subtree_relevant (struct itree_iterator *iter,
+			     struct itree_node *node)
+{
+  itree_inherit_offset (iter->otick, node);
+  return node->limit >= iter->begin;
+}
+
+/* Return the node following NODE in ITER's traversal order, skipping
+   subtrees that can't contain nodes intersecting ITER's bounds.  The
+   returned node itself may not intersect them.  */
+
+static struct itree_node *
+itree_iter_next_in_subtree (struct itree_node *node,
+			    struct itree_iterator *iter)
+{
+  struct itree_node *next;
+  switch (iter->order)
+    {
+    case ITREE_ASCENDING:
+      next = node->right;
+      if (next != NULL && itree_iter_subtree_relevant (iter, next))
+	{
+	  node = next;
+	  while ((next = node->left) != NULL
+		 && itree_iter_subtree_relevant (iter, next))
+	    node = next;
+	}
+      else
+	{
+	  while ((next = node->parent) != NULL && next->right == node)
+	    node = next;
+	  if (next == NULL)
+	    return NULL;	/* No more nodes to visit.  */
+	  node = next;
+	}
+      if (node->begin > iter->end)
+	return NULL;		/* No more nodes within begin..end.  */
+      return node;
+
+    case ITREE_DESCENDING:
+      next = node->left;
+      if (next != NULL && itree_iter_subtree_relevant (iter, next))
+	{
+	  node = next;
+	  while (node->begin <= iter->end
+		 && (next = node->right) != NULL
+		 && itree_iter_subtree_relevant (iter, next))
+	    node = next;
+	}
+      else
+	{
+	  while ((next = node->parent) != NULL && next->left == node)
+	    node = next;
+	  if (next == NULL)
+	    return NULL;	/* No more nodes to visit.  */
+	  node = next;
+	}
+      return node;
+
+    default:
+      emacs_abort ();
+    }
+}
+
+/* Return the first node of TREE in ITER's traversal order.  */
+
+static struct itree_node *
+itree_iterator_first_node (struct itree_tree *tree,
+			   struct itree_iterator *iter)
+{
+  struct itree_node *node = tree->root;
+  if (node == NULL || !itree_iter_subtree_relevant (iter, node))
+    return NULL;
+
+  struct itree_node dummy;
+  dummy.parent = NULL;
+  dummy.left = NULL;
+  dummy.right = NULL;
+  switch (iter->order)
+    {
+    case ITREE_ASCENDING:
+      dummy.right = node;
+      return itree_iter_next_in_subtree (&dummy, iter);
+
+    case ITREE_DESCENDING:
+      dummy.left = node;
+      return itree_iter_next_in_subtree (&dummy, iter);
+
+    default:
+      emacs_abort ();
+    }
+}
+
+/* Start an iterator enumerating all intervals of TREE intersecting
+   [BEGIN, END) in the given ORDER, using the storage ITER.  Return
+   ITER, or NULL if TREE is NULL.  */
+
+struct itree_iterator *
+itree_iterator_start (struct itree_iterator *iter,
+		      struct itree_tree *tree,
+		      ptrdiff_t begin, ptrdiff_t end, enum itree_order order)
+{
+  if (tree == NULL)
+    return NULL;
+  iter->begin = begin;
+  iter->end = end;
+  iter->otick = tree->otick;
+  iter->order = order;
+  iter->node = itree_iterator_first_node (tree, iter);
+  return iter;
+}
+
+/* Return the next node of the iterator in the order given when it was
+   started; or NULL if there are no more nodes.  */
+
+struct itree_node *
+itree_iterator_next (struct itree_iterator *iter)
+{
+  struct itree_node *node = iter->node;
+  while (node != NULL
+	 && !itree_node_intersects (node, iter->begin, iter->end))
+    node = itree_iter_next_in_subtree (node, iter);
+  iter->node = node ? itree_iter_next_in_subtree (node, iter) : NULL;
+  return node;
+}
@@ -0,0 +1,180 @@
+/* This file implements an efficient interval data-structure.
+
+Copyright (C) 2017-2020 Free Software Foundation, Inc.
+
+This file is part of GNU Emacs.
+
+GNU Emacs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+GNU Emacs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef ITREE_H
+#define ITREE_H
+#include <config.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "lisp.h"
+
+/* The tree and node structs are mainly here, so they can be
+   allocated.
+
+   NOTE: The only time where it is safe to modify node.begin and
+   node.end directly, is while the node is not part of any tree.
+
+   NOTE: It is safe to read node.begin and node.end directly, if the
+   node came from an iterator, because it validates the nodes it
+   returns as a side-effect.  See ITREE_FOREACH.  */
+
+struct itree_node
+{
+  /* The normal parent, left and right links found in binary trees.
+     See also `red`, below, which completes the Red-Black tree
+     representation.  */
+  struct itree_node *parent;
+  struct itree_node *left;
+  struct itree_node *right;
+
+  /* The following five fields comprise the interval abstraction.
+
+     BEGIN is node's inclusive start position.
+     END is node's exclusive end position.
+
+     LIMIT is the largest END position occurring in this node's
+     subtree (including this node).  It is used to prune searches.
+
+     OFFSET is the amount by which BEGIN, END and LIMIT of this node
+     and all of its descendants still have to be shifted.  Insertions
+     and deletions of text shift whole subtrees at once this way,
+     which keeps the cost of an edit logarithmic in the number of
+     nodes.  OFFSET is pushed down to the children whenever a node is
+     traversed; see itree_inherit_offset.
+
+     OTICK determines whether BEGIN, END, LIMIT and OFFSET are
+     considered dirty.  A node is clean when its OTICK is equal to the
+     OTICK of its tree (see struct itree_tree).  Otherwise, it is
+     dirty.
+
+     In a clean node, BEGIN, END and LIMIT are correct buffer
+     positions, and OFFSET is zero.  In a dirty node, the node's
+     OTICK won't equal its tree's OTICK, and its OFFSET may be
+     non-zero.  At all times the descendants of a dirty node are also
+     dirty.  */
+  ptrdiff_t begin;
+  ptrdiff_t end;
+  ptrdiff_t limit;
+  ptrdiff_t offset;
+  uintmax_t otick;
+
+  /* The overlay this node belongs to.  */
+  Lisp_Object data;
+
+  bool_bf red : 1;
+  bool_bf rear_advance : 1;	/* Same as for marker and overlays.  */
+  bool_bf front_advance : 1;	/* Same as for marker and overlays.  */
+};
+
+struct itree_tree
+{
+  struct itree_node *root;
+  uintmax_t otick;		/* Offset tick, compared with node's otick.  */
+  intmax_t size;		/* Number of nodes in the tree.  */
+};
+
+enum itree_order
+  {
+    ITREE_ASCENDING,
+    ITREE_DESCENDING,
+  };
+
+void itree_node_init (struct itree_node *, bool, bool, Lisp_Object);
+ptrdiff_t itree_node_begin (struct itree_tree *, struct itree_node *);
+ptrdiff_t itree_node_end (struct itree_tree *, struct itree_node *);
+void itree_node_set_region (struct itree_tree *, struct itree_node *,
+			    ptrdiff_t, ptrdiff_t);
+struct itree_tree *itree_create (void);
+void itree_destroy (struct itree_tree *);
+intmax_t itree_size (struct itree_tree *);
+void itree_clear (struct itree_tree *);
+void itree_insert (struct itree_tree *, struct itree_node *,
+		   ptrdiff_t, ptrdiff_t);
+struct itree_node *itree_remove (struct itree_tree *,
+				 struct itree_node *);
+void itree_insert_gap (struct itree_tree *, ptrdiff_t, ptrdiff_t, bool);
+void itree_delete_gap (struct itree_tree *, ptrdiff_t, ptrdiff_t);
+
+/* An iterator over the nodes of a tree that intersect a given
+   interval.  Iterators live on the C stack, so any number of them may
+   be active at the same time, but the tree must not be modified while
+   one of its iterators is in use.  */
+
+struct itree_iterator
+{
+  struct itree_node *node;
+  ptrdiff_t begin;
+  ptrdiff_t end;
+  uintmax_t otick;
+  enum itree_order order;
+};
+
+struct itree_iterator *itree_iterator_start (struct itree_iterator *,
+					     struct itree_tree *,
+					     ptrdiff_t, ptrdiff_t,
+					     enum itree_order);
+struct itree_node *itree_iterator_next (struct itree_iterator *);
+
+/* Narrow the search space of iterator ITER to the interval
+   [BEGIN, END).  The new bounds must be included in the current
+   ones, because nodes outside of them may already have been
+   skipped.  */
+
+INLINE void
+itree_iterator_narrow (struct itree_iterator *iter,
+		       ptrdiff_t begin, ptrdiff_t end)
+{
+  eassert (begin >= iter->begin && end <= iter->end);
+  iter->begin = begin;
+  iter->end = end;
+}
+
+/* Iterate over the intervals between BEG and END in the tree T.
+   N will hold successive nodes.  ORDER can be either `ASCENDING`
+   or `DESCENDING`.
+   It should be used as:
+
+      ITREE_FOREACH (n, t, beg, end, order)
+        {
+          .. do the thing with n ..
+        }
+
+   BEWARE:
+   - The tree T may be NULL, in which case the body is never run.
+   - The tree T must not be modified in any way during the iteration:
+     the body must not insert, remove or move nodes of T, nor change
+     the text of the buffer T belongs to.  If that is needed, collect
+     the nodes first and modify the tree afterwards.
+   - If you need to exit the loop early, you can use `break`;
+     unlike iterators which own global state, nothing needs to be
+     cleaned up.
+   - The nodes returned have up-to-date BEGIN and END fields.  */
+
+#define ITREE_FOREACH(n, t, beg, end, order)				\
+  for (struct itree_iterator itree_local_iter_,				\
+	 *itree_iter_							\
+	   = itree_iterator_start (&itree_local_iter_, t, beg, end,	\
+				   ITREE_##order);			\
+       itree_iter_ && ((n) = itree_iterator_next (itree_iter_)) != NULL; )
+
+#define ITREE_FOREACH_NARROW(beg, end)				\
+  itree_iterator_narrow (itree_iter_, beg, end)
+
+#endif
@@ -19,204 +19,162 @@ along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
 
 #include <config.h>
 
-#include <errno.h>
+#include <math.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include <jansson.h>
+#include <flexmember.h>
+#include <ftoastr.h>
 
 #include "lisp.h"
 #include "buffer.h"
+#include "character.h"
 #include "coding.h"
 
-#define JSON_HAS_ERROR_CODE (JANSSON_VERSION_HEX >= 0x020B00)
-
-#ifdef WINDOWSNT
-# include <windows.h>
-# include "w32common.h"
-# include "w32.h"
-
-DEF_DLL_FN (void, json_set_alloc_funcs,
-	    (json_malloc_t malloc_fn, json_free_t free_fn));
-DEF_DLL_FN (void, json_delete, (json_t *json));
-DEF_DLL_FN (json_t *, json_array, (void));
-DEF_DLL_FN (int, json_array_append_new, (json_t *array, json_t *value));
-DEF_DLL_FN (size_t, json_array_size, (const json_t *array));
-DEF_DLL_FN (json_t *, json_object, (void));
-DEF_DLL_FN (int, json_object_set_new,
-	    (json_t *object, const char *key, json_t *value));
-DEF_DLL_FN (json_t *, json_null, (void));
-DEF_DLL_FN (json_t *, json_true, (void));
-DEF_DLL_FN (json_t *, json_false, (void));
-DEF_DLL_FN (json_t *, json_integer, (json_int_t value));
-DEF_DLL_FN (json_t *, json_real, (double value));
-DEF_DLL_FN (json_t *, json_stringn, (const char *value, size_t len));
-DEF_DLL_FN (char *, json_dumps, (const json_t *json, size_t flags));
-DEF_DLL_FN (int, json_dump_callback,
-	    (const json_t *json, json_dump_callback_t callback, void *data,
-	     size_t flags));
-DEF_DLL_FN (json_int_t, json_integer_value, (const json_t *integer));
-DEF_DLL_FN (double, json_real_value, (const json_t *real));
-DEF_DLL_FN (const char *, json_string_value, (const json_t *string));
-DEF_DLL_FN (size_t, json_string_length, (const json_t *string));
-DEF_DLL_FN (json_t *, json_array_get, (const json_t *array, size_t index));
-DEF_DLL_FN (json_t *, json_object_get, (const json_t *object, const char *key));
-DEF_DLL_FN (size_t, json_object_size, (const json_t *object));
-DEF_DLL_FN (const char *, json_object_iter_key, (void *iter));
-DEF_DLL_FN (void *, json_object_iter, (json_t *object));
-DEF_DLL_FN (json_t *, json_object_iter_value, (void *iter));
-DEF_DLL_FN (void *, json_object_key_to_iter, (const char *key));
-DEF_DLL_FN (void *, json_object_iter_next, (json_t *object, void *iter));
-DEF_DLL_FN (json_t *, json_loads,
-	    (const char *input, size_t flags, json_error_t *error));
-DEF_DLL_FN (json_t *, json_load_callback,
-	    (json_load_callback_t callback, void *data, size_t flags,
-	     json_error_t *error));
-
-/* This is called by json_decref, which is an inline function.  */
-void json_delete(json_t *json)
-{
-  fn_json_delete (json);
-}
-
-static bool json_initialized;
+/* Both the parser and the serializer work directly on the UTF-8
+   bytes of strings and buffer text: the parser makes Lisp objects as
+   it reads the JSON text, and the serializer writes the JSON text of
+   Lisp objects into a single growing buffer.  Neither makes any
+   intermediate tree of JSON values.  */
 
-static bool
-init_json_functions (void)
-{
-  HMODULE library = w32_delayed_load (Qjson);
+enum json_object_type {
+  json_object_hashtable,
+  json_object_alist,
+  json_object_plist
+};
 
-  if (!library)
-    return false;
+enum json_array_type {
+  json_array_array,
+  json_array_list
+};
 
-  LOAD_DLL_FN (library, json_set_alloc_funcs);
-  LOAD_DLL_FN (library, json_delete);
-  LOAD_DLL_FN (library, json_array);
-  LOAD_DLL_FN (library, json_array_append_new);
-  LOAD_DLL_FN (library, json_array_size);
-  LOAD_DLL_FN (library, json_object);
-  LOAD_DLL_FN (library, json_object_set_new);
-  LOAD_DLL_FN (library, json_null);
-  LOAD_DLL_FN (library, json_true);
-  LOAD_DLL_FN (library, json_false);
-  LOAD_DLL_FN (library, json_integer);
-  LOAD_DLL_FN (library, json_real);
-  LOAD_DLL_FN (library, json_stringn);
-  LOAD_DLL_FN (library, json_dumps);
-  LOAD_DLL_FN (library, json_dump_callback);
-  LOAD_DLL_FN (library, json_integer_value);
-  LOAD_DLL_FN (library, json_real_value);
-  LOAD_DLL_FN (library, json_string_value);
-  LOAD_DLL_FN (library, json_string_length);
-  LOAD_DLL_FN (library, json_array_get);
-  LOAD_DLL_FN (library, json_object_get);
-  LOAD_DLL_FN (library, json_object_size);
-  LOAD_DLL_FN (library, json_object_iter_key);
-  LOAD_DLL_FN (library, json_object_iter);
-  LOAD_DLL_FN (library, json_object_iter_value);
-  LOAD_DLL_FN (library, json_object_key_to_iter);
-  LOAD_DLL_FN (library, json_object_iter_next);
-  LOAD_DLL_FN (library, json_loads);
-  LOAD_DLL_FN (library, json_load_callback);
-
-  init_json ();
+struct json_configuration {
+  enum json_object_type object_type;
+  enum json_array_type array_type;
+  Lisp_Object null_object;
+  Lisp_Object false_object;
+};
 
-  return true;
-}
 
-#define json_set_alloc_funcs fn_json_set_alloc_funcs
-#define json_array fn_json_array
-#define json_array_append_new fn_json_array_append_new
-#define json_array_size fn_json_array_size
-#define json_object fn_json_object
-#define json_object_set_new fn_json_object_set_new
-#define json_null fn_json_null
-#define json_true fn_json_true
-#define json_false fn_json_false
-#define json_integer fn_json_integer
-#define json_real fn_json_real
-#define json_stringn fn_json_stringn
-#define json_dumps fn_json_dumps
-#define json_dump_callback fn_json_dump_callback
-#define json_integer_value fn_json_integer_value
-#define json_real_value fn_json_real_value
-#define json_string_value fn_json_string_value
-#define json_string_length fn_json_string_length
-#define json_array_get fn_json_array_get
-#define json_object_get fn_json_object_get
-#define json_object_size fn_json_object_size
-#define json_object_iter_key fn_json_object_iter_key
-#define json_object_iter fn_json_object_iter
-#define json_object_iter_value fn_json_object_iter_value
-#define json_object_key_to_iter fn_json_object_key_to_iter
-#define json_object_iter_next fn_json_object_iter_next
-#define json_loads fn_json_loads
-#define json_load_callback fn_json_load_callback
-
-#endif	/* WINDOWSNT */
-
-/* We install a custom allocator so that we can avoid objects larger
-   than PTRDIFF_MAX.  Such objects wouldn't play well with the rest of
-   Emacs's codebase, which generally uses ptrdiff_t for sizes and
-   indices.  The other functions in this file also generally assume
-   that size_t values never exceed PTRDIFF_MAX.
-
-   In addition, we need to use a custom allocator because on
-   MS-Windows we replace malloc/free with our own functions, see
-   w32heap.c, so we must force the library to use our allocator, or
-   else we won't be able to free storage allocated by the library.  */
-
-static void *
-json_malloc (size_t size)
-{
-  if (size > PTRDIFF_MAX)
-    {
-      errno = ENOMEM;
-      return NULL;
-    }
-  return malloc (size);
-}
+/* Scanning text a word at a time.  Like count_newlines_word in
+   search.c, these functions look at eight bytes at once, and examine
+   single bytes only near the ones they are looking for.  */
 
-static void
-json_free (void *ptr)
+static uint_fast64_t const json_ones = 0x0101010101010101;
+static uint_fast64_t const json_highs = 0x8080808080808080;
+
+/* Return nonzero if a byte of the word W is less than N, which must
+   be at most 0x80, or has its top bit set.  */
+
+static uint_fast64_t
+json_word_has_less (uint_fast64_t w, int n)
 {
-  free (ptr);
+  return ((w - n * json_ones) | w) & json_highs;
 }
 
-void
-init_json (void)
+/* Return nonzero if a byte of the word W is C.  */
+
+static uint_fast64_t
+json_word_has_byte (uint_fast64_t w, int c)
 {
-  json_set_alloc_funcs (json_malloc, json_free);
+  uint_fast64_t x = w ^ (c * json_ones);
+  return (x - json_ones) & ~x & json_highs;
 }
 
-#if !JSON_HAS_ERROR_CODE
-
-/* Return whether STRING starts with PREFIX.  */
+/* Return whether the byte C can appear as is in a JSON string, and
+   stands for itself there: it is ASCII, but neither a control
+   character nor a quotation mark nor a backslash.  */
 
 static bool
-json_has_prefix (const char *string, const char *prefix)
+json_plain_byte_p (int c)
 {
-  return strncmp (string, prefix, strlen (prefix)) == 0;
+  return 0x20 <= c && c < 0x80 && c != '"' && c != '\\';
 }
 
-/* Return whether STRING ends with SUFFIX.  */
+/* Return the first byte from P to END that is not plain in the sense
+   of json_plain_byte_p, or END if there is none.  */
 
-static bool
-json_has_suffix (const char *string, const char *suffix)
+static unsigned char const *
+json_skip_plain_bytes (unsigned char const *p, unsigned char const *end)
+{
+  for (; 8 <= end - p; p += 8)
+    {
+      uint64_t w;
+      memcpy (&w, p, 8);
+      if (json_word_has_less (w, 0x20)
+	  | json_word_has_byte (w, '"') | json_word_has_byte (w, '\\'))
+	break;
+    }
+  while (p < end && json_plain_byte_p (*p))
+    p++;
+  return p;
+}
+
+/* Return the first quotation mark or backslash from P to END, or END
+   if there is none.  */
+
+static unsigned char const *
+json_skip_to_quote (unsigned char const *p, unsigned char const *end)
 {
-  size_t string_len = strlen (string);
-  size_t suffix_len = strlen (suffix);
-  return string_len >= suffix_len
-    && memcmp (string + string_len - suffix_len, suffix, suffix_len) == 0;
+  for (; 8 <= end - p; p += 8)
+    {
+      uint64_t w;
+      memcpy (&w, p, 8);
+      if (json_word_has_byte (w, '"') | json_word_has_byte (w, '\\'))
+	break;
+    }
+  while (p < end && *p != '"' && *p != '\\')
+    p++;
+  return p;
 }
 
-#endif
+/* Return the length of the UTF-8 sequence of a Unicode scalar value
+   that starts at P, which is before END and not ASCII; return 0 if
+   the bytes from P to END do not start with such a sequence.  This
+   rejects overlong sequences, surrogates, and code points beyond
+   U+10FFFF, so it also rejects the raw bytes and the characters
+   beyond Unicode of multibyte text.  */
+
+static int
+json_utf8_length (unsigned char const *p, unsigned char const *end)
+{
+  int c = p[0];
+  ptrdiff_t left = end - p;
+  int len, lo = 0x80, hi = 0xBF;
+  if (c < 0xC2)
+    return 0;
+  else if (c < 0xE0)
+    len = 2;
+  else if (c < 0xF0)
+    {
+      len = 3;
+      if (c == 0xE0)
+	lo = 0xA0;
+      else if (c == 0xED)
+	hi = 0x9F;
+    }
+  else if (c < 0xF5)
+    {
+      len = 4;
+      if (c == 0xF0)
+	lo = 0x90;
+      else if (c == 0xF4)
+	hi = 0x8F;
+    }
+  else
+    return 0;
+
+  if (left < len || p[1] < lo || hi < p[1])
+    return 0;
+  for (int i = 2; i < len; i++)
+    if ((p[i] & 0xC0) != 0x80)
+      return 0;
+  return len;
+}
 
-/* Note that all callers of make_string_from_utf8 and build_string_from_utf8
-   below either pass only value UTF-8 strings or use the functionf for
-   formatting error messages; in the latter case correctness isn't
-   critical.  */
 
 /* Return a unibyte string containing the sequence of UTF-8 encoding
    units of the UTF-8 representation of STRING.  If STRING does not
@@ -226,56 +184,22 @@ json_has_suffix (const char *string, const char *suffix)
 static Lisp_Object
 json_encode (Lisp_Object string)
 {
-  /* FIXME: Raise an error if STRING is not a scalar value
-     sequence.  */
   return encode_string_utf_8 (string, Qnil, false, Qt, Qt);
 }
 
-static AVOID
-json_out_of_memory (void)
-{
-  xsignal0 (Qjson_out_of_memory);
-}
-
-/* Signal a Lisp error corresponding to the JSON ERROR.  */
-
-static AVOID
-json_parse_error (const json_error_t *error)
-{
-  Lisp_Object symbol;
-#if JSON_HAS_ERROR_CODE
-  switch (json_error_code (error))
-    {
-    case json_error_premature_end_of_input:
-      symbol = Qjson_end_of_file;
-      break;
-    case json_error_end_of_input_expected:
-      symbol = Qjson_trailing_content;
-      break;
-    default:
-      symbol = Qjson_parse_error;
-      break;
-    }
-#else
-  if (json_has_suffix (error->text, "expected near end of file"))
-    symbol = Qjson_end_of_file;
-  else if (json_has_prefix (error->text, "end of file expected"))
-    symbol = Qjson_trailing_content;
-  else
-    symbol = Qjson_parse_error;
-#endif
-  xsignal (symbol,
-           list5 (build_string_from_utf8 (error->text),
-                  build_string_from_utf8 (error->source),
-		  INT_TO_INTEGER (error->line),
-                  INT_TO_INTEGER (error->column),
-		  INT_TO_INTEGER (error->position)));
-}
+/* Return whether STRING is multibyte and has raw bytes, which stand
+   for bytes of its UTF-8 text rather than for characters.  */
 
-static void
-json_release_object (void *object)
+static bool
+json_string_has_raw_bytes (Lisp_Object string)
 {
-  json_decref (object);
+  if (!STRING_MULTIBYTE (string))
+    return false;
+  unsigned char const *p = SDATA (string), *end = p + SBYTES (string);
+  for (; p < end; p++)
+    if (*p == 0xC0 || *p == 0xC1)
+      return true;
+  return false;
 }
 
 /* Signal an error if OBJECT is not a string, or if OBJECT contains
@@ -289,224 +213,417 @@ check_string_without_embedded_nulls (Lisp_Object object)
               Qstring_without_embedded_nulls_p, object);
 }
 
-/* Signal an error of type `json-out-of-memory' if OBJECT is
-   NULL.  */
 
-static json_t *
-json_check (json_t *object)
+/* Sets of symbols, to find duplicate keys in objects.  A set is a
+   hash table of 2**BITS entries, Qunbound where unused; the sets of
+   objects that contain other objects are chained by UP, so that all
+   of them can be freed after a nonlocal exit.  */
+
+struct symset_tbl
+{
+  struct symset_tbl *up;
+  int bits;
+  ptrdiff_t count;
+  Lisp_Object entries[FLEXIBLE_ARRAY_MEMBER];
+};
+
+/* Return a new empty set of 2**BITS entries, chained to UP.  */
+
+static struct symset_tbl *
+symset_push (struct symset_tbl *up, int bits)
 {
-  if (object == NULL)
-    json_out_of_memory ();
-  return object;
+  if (PTRDIFF_WIDTH - 8 < bits)
+    memory_full (SIZE_MAX);
+  ptrdiff_t size = (ptrdiff_t) 1 << bits;
+  struct symset_tbl *t
+    = xmalloc (FLEXSIZEOF (struct symset_tbl, entries,
+			   size * sizeof t->entries[0]));
+  t->up = up;
+  t->bits = bits;
+  t->count = 0;
+  for (ptrdiff_t i = 0; i < size; i++)
+    t->entries[i] = Qunbound;
+  return t;
 }
 
-/* If STRING is not a valid UTF-8 string, signal an error of type
-   `wrong-type-argument'.  STRING must be a unibyte string.  */
+/* Free the set T, and return the one it is chained to.  */
 
-static void
-json_check_utf8 (Lisp_Object string)
+static struct symset_tbl *
+symset_pop (struct symset_tbl *t)
 {
-  CHECK_TYPE (utf8_string_p (string), Qutf_8_string_p, string);
+  struct symset_tbl *up = t->up;
+  xfree (t);
+  return up;
 }
 
-enum json_object_type {
-  json_object_hashtable,
-  json_object_alist,
-  json_object_plist
-};
+/* Return the entry of a set of 2**BITS entries where SYM belongs.  */
 
-enum json_array_type {
-  json_array_array,
-  json_array_list
-};
+static ptrdiff_t
+symset_home (Lisp_Object sym, int bits)
+{
+  return ((uint64_t) XHASH (sym) * 0x9e3779b97f4a7c15u) >> (64 - bits);
+}
 
-struct json_configuration {
-  enum json_object_type object_type;
-  enum json_array_type array_type;
-  Lisp_Object null_object;
-  Lisp_Object false_object;
+/* Add SYM to the set *PT, growing it if need be.  Return false if
+   SYM was in the set already.  */
+
+static bool
+symset_add (struct symset_tbl **pt, Lisp_Object sym)
+{
+  struct symset_tbl *t = *pt;
+  ptrdiff_t mask = ((ptrdiff_t) 1 << t->bits) - 1;
+  ptrdiff_t i = symset_home (sym, t->bits);
+  for (; !EQ (t->entries[i], Qunbound); i = (i + 1) & mask)
+    if (EQ (t->entries[i], sym))
+      return false;
+  t->entries[i] = sym;
+
+  if (mask < 2 * ++t->count)
+    {
+      struct symset_tbl *n = symset_push (t->up, t->bits + 1);
+      ptrdiff_t nmask = ((ptrdiff_t) 1 << n->bits) - 1;
+      for (ptrdiff_t j = 0; j <= mask; j++)
+	if (!EQ (t->entries[j], Qunbound))
+	  {
+	    ptrdiff_t k = symset_home (t->entries[j], n->bits);
+	    while (!EQ (n->entries[k], Qunbound))
+	      k = (k + 1) & nmask;
+	    n->entries[k] = t->entries[j];
+	  }
+      n->count = t->count;
+      xfree (t);
+      *pt = n;
+    }
+  return true;
+}
+
+
+/* Serialization.  */
+
+struct json_out
+{
+  /* The JSON text written so far, SIZE bytes in a buffer of CAPACITY
+     bytes.  */
+  char *buf;
+  ptrdiff_t size;
+  ptrdiff_t capacity;
+
+  /* The number of bytes of the text minus its number of
+     characters.  */
+  ptrdiff_t chars_delta;
+
+  /* The keys written so far in the alists and plists being
+     written.  */
+  struct symset_tbl *symsets;
+
+  struct json_configuration conf;
 };
 
-static json_t *lisp_to_json (Lisp_Object, struct json_configuration *conf);
+static void json_out_value (struct json_out *, Lisp_Object);
 
-/* Convert a Lisp object to a toplevel JSON object (array or object).  */
+/* Free what JO allocated.  */
 
-static json_t *
-lisp_to_json_toplevel_1 (Lisp_Object lisp,
-                         struct json_configuration *conf)
+static void
+json_out_done (void *jo_ptr)
 {
-  json_t *json;
-  ptrdiff_t count;
+  struct json_out *jo = jo_ptr;
+  xfree (jo->buf);
+  while (jo->symsets)
+    jo->symsets = symset_pop (jo->symsets);
+}
+
+/* Make room in JO for N more bytes.  */
+
+static void
+json_out_grow (struct json_out *jo, ptrdiff_t n)
+{
+  if (jo->capacity - jo->size < n)
+    jo->buf = xpalloc (jo->buf, &jo->capacity,
+		       n - (jo->capacity - jo->size), -1, 1);
+}
+
+static void
+json_out_bytes (struct json_out *jo, void const *bytes, ptrdiff_t n)
+{
+  json_out_grow (jo, n);
+  memcpy (jo->buf + jo->size, bytes, n);
+  jo->size += n;
+}
+
+static void
+json_out_byte (struct json_out *jo, int c)
+{
+  json_out_grow (jo, 1);
+  jo->buf[jo->size++] = c;
+}
+
+static void
+json_out_str (struct json_out *jo, char const *str)
+{
+  json_out_bytes (jo, str, strlen (str));
+}
+
+/* Enter a vector, hash table, alist or plist, which may be too deep
+   or even cyclic.  */
 
-  if (VECTORP (lisp))
+static void
+json_out_nest (void)
+{
+  if (++lisp_eval_depth > max_lisp_eval_depth)
+    xsignal0 (Qjson_object_too_deep);
+}
+
+static void
+json_out_unnest (void)
+{
+  --lisp_eval_depth;
+}
+
+/* Write the N bytes at P, escaping what JSON strings require.  Return
+   false if P has raw bytes, which is possible only if MULTIBYTE.
+   Signal an error naming STRING if P is not valid UTF-8.  */
+
+static bool
+json_out_utf8 (struct json_out *jo, unsigned char const *p, ptrdiff_t n,
+	       bool multibyte, Lisp_Object string)
+{
+  unsigned char const *end = p + n;
+  while (p < end)
     {
-      ptrdiff_t size = ASIZE (lisp);
-      json = json_check (json_array ());
-      count = SPECPDL_INDEX ();
-      record_unwind_protect_ptr (json_release_object, json);
-      for (ptrdiff_t i = 0; i < size; ++i)
-        {
-          int status
-            = json_array_append_new (json, lisp_to_json (AREF (lisp, i),
-                                                         conf));
-          if (status == -1)
-            json_out_of_memory ();
-        }
-      eassert (json_array_size (json) == size);
+      unsigned char const *q = json_skip_plain_bytes (p, end);
+      json_out_bytes (jo, p, q - p);
+      if (q == end)
+	break;
+      int c = *q;
+      if (c < 0x80)
+	{
+	  static char const escapes[] = "\"\"\\\\\bb\ff\nn\rr\tt";
+	  char const *e = c ? memchr (escapes, c, sizeof escapes - 1) : NULL;
+	  if (e)
+	    {
+	      char esc[2] = { '\\', e[1] };
+	      json_out_bytes (jo, esc, 2);
+	    }
+	  else
+	    {
+	      char esc[sizeof "\\u001F"];
+	      json_out_bytes (jo, esc, sprintf (esc, "\\u%04X", (unsigned) c));
+	    }
+	  p = q + 1;
+	}
+      else
+	{
+	  int len = json_utf8_length (q, end);
+	  if (len == 0)
+	    {
+	      if (multibyte && (c == 0xC0 || c == 0xC1))
+		return false;
+	      wrong_type_argument (Qutf_8_string_p, string);
+	    }
+	  json_out_bytes (jo, q, len);
+	  jo->chars_delta += len - 1;
+	  p = q + len;
+	}
     }
-  else if (HASH_TABLE_P (lisp))
+  return true;
+}
+
+/* Write STRING, minus its first SKIP bytes, as a JSON string.  */
+
+static void
+json_out_string (struct json_out *jo, Lisp_Object string, ptrdiff_t skip)
+{
+  ptrdiff_t size = jo->size, chars_delta = jo->chars_delta;
+  json_out_byte (jo, '"');
+  if (!json_out_utf8 (jo, SDATA (string) + skip, SBYTES (string) - skip,
+		      STRING_MULTIBYTE (string), string))
     {
-      struct Lisp_Hash_Table *h = XHASH_TABLE (lisp);
-      json = json_check (json_object ());
-      count = SPECPDL_INDEX ();
-      record_unwind_protect_ptr (json_release_object, json);
-      for (ptrdiff_t i = 0; i < HASH_TABLE_SIZE (h); ++i)
-        {
-          Lisp_Object key = HASH_KEY (h, i);
-          if (!EQ (key, Qunbound))
-            {
-              CHECK_STRING (key);
-              Lisp_Object ekey = json_encode (key);
-              /* We can't specify the length, so the string must be
-		 null-terminated.  */
-              check_string_without_embedded_nulls (ekey);
-              const char *key_str = SSDATA (ekey);
-              /* Reject duplicate keys.  These are possible if the hash
-		 table test is not `equal'.  */
-              if (json_object_get (json, key_str) != NULL)
-                wrong_type_argument (Qjson_value_p, lisp);
-              int status
-                = json_object_set_new (json, key_str,
-                                       lisp_to_json (HASH_VALUE (h, i), conf));
-              if (status == -1)
-                {
-                  /* A failure can be caused either by an invalid key or
-                   by low memory.  */
-                  json_check_utf8 (ekey);
-                  json_out_of_memory ();
-                }
-            }
-        }
+      /* Start over with the bytes that the raw bytes stand for.  */
+      jo->size = size + 1;
+      jo->chars_delta = chars_delta;
+      Lisp_Object encoded = json_encode (string);
+      json_out_utf8 (jo, SDATA (encoded) + skip, SBYTES (encoded) - skip,
+		     false, string);
     }
-  else if (NILP (lisp))
-    return json_check (json_object ());
-  else if (CONSP (lisp))
+  json_out_byte (jo, '"');
+}
+
+static void
+json_out_integer (struct json_out *jo, Lisp_Object obj)
+{
+  if (FIXNUMP (obj))
     {
-      Lisp_Object tail = lisp;
-      json = json_check (json_object ());
-      count = SPECPDL_INDEX ();
-      record_unwind_protect_ptr (json_release_object, json);
-      bool is_plist = !CONSP (XCAR (tail));
-      FOR_EACH_TAIL (tail)
-        {
-          const char *key_str;
-          Lisp_Object value;
-          Lisp_Object key_symbol;
-          if (is_plist)
-            {
-              key_symbol = XCAR (tail);
-              tail = XCDR (tail);
-              CHECK_CONS (tail);
-              value = XCAR (tail);
-            }
-          else
-            {
-              Lisp_Object pair = XCAR (tail);
-              CHECK_CONS (pair);
-              key_symbol = XCAR (pair);
-              value = XCDR (pair);
-            }
-          CHECK_SYMBOL (key_symbol);
-          Lisp_Object key = SYMBOL_NAME (key_symbol);
-          /* We can't specify the length, so the string must be
-             null-terminated.  */
-          check_string_without_embedded_nulls (key);
-          key_str = SSDATA (key);
-          /* In plists, ensure leading ":" in keys is stripped.  It
-             will be reconstructed later in `json_to_lisp'.*/
-          if (is_plist && ':' == key_str[0] && key_str[1])
-            {
-              key_str = &key_str[1];
-            }
-          /* Only add element if key is not already present.  */
-          if (json_object_get (json, key_str) == NULL)
-            {
-              int status
-                = json_object_set_new (json, key_str, lisp_to_json (value,
-                                                                    conf));
-              if (status == -1)
-                json_out_of_memory ();
-            }
-        }
-      CHECK_LIST_END (tail, lisp);
+      char buf[INT_BUFSIZE_BOUND (EMACS_INT)];
+      json_out_bytes (jo, buf, sprintf (buf, "%"pI"d", XFIXNUM (obj)));
     }
   else
-    wrong_type_argument (Qjson_value_p, lisp);
-
-  clear_unwind_protect (count);
-  unbind_to (count, Qnil);
-  return json;
+    {
+      Lisp_Object digits = bignum_to_string (obj, 10);
+      json_out_bytes (jo, SDATA (digits), SBYTES (digits));
+    }
 }
 
-/* Convert LISP to a toplevel JSON object (array or object).  Signal
-   an error of type `wrong-type-argument' if LISP is not a vector,
-   hashtable, alist, or plist.  */
-
-static json_t *
-lisp_to_json_toplevel (Lisp_Object lisp, struct json_configuration *conf)
+static void
+json_out_float (struct json_out *jo, Lisp_Object obj)
 {
-  if (++lisp_eval_depth > max_lisp_eval_depth)
-    xsignal0 (Qjson_object_too_deep);
-  json_t *json = lisp_to_json_toplevel_1 (lisp, conf);
-  --lisp_eval_depth;
-  return json;
+  double x = XFLOAT_DATA (obj);
+  if (!isfinite (x))
+    wrong_type_argument (Qjson_value_p, obj);
+  /* Write the fewest digits that read back as X, with a fraction or
+     an exponent so that they read back as a float.  */
+  char buf[FLOAT_TO_STRING_BUFSIZE];
+  int len = dtoastr (buf, sizeof buf - 2, 0, 0, x);
+  if (!strpbrk (buf, ".e"))
+    {
+      strcpy (buf + len, ".0");
+      len += 2;
+    }
+  json_out_bytes (jo, buf, len);
 }
 
-/* Convert LISP to any JSON object.  Signal an error of type
-   `wrong-type-argument' if the type of LISP can't be converted to a
-   JSON object.  */
+static void
+json_out_array (struct json_out *jo, Lisp_Object obj)
+{
+  json_out_nest ();
+  json_out_byte (jo, '[');
+  for (ptrdiff_t i = 0; i < ASIZE (obj); i++)
+    {
+      if (i > 0)
+	json_out_byte (jo, ',');
+      json_out_value (jo, AREF (obj, i));
+    }
+  json_out_byte (jo, ']');
+  json_out_unnest ();
+}
 
-static json_t *
-lisp_to_json (Lisp_Object lisp, struct json_configuration *conf)
+static void
+json_out_object_hash (struct json_out *jo, Lisp_Object obj)
 {
-  if (EQ (lisp, conf->null_object))
-    return json_check (json_null ());
-  else if (EQ (lisp, conf->false_object))
-    return json_check (json_false ());
-  else if (EQ (lisp, Qt))
-    return json_check (json_true ());
-  else if (INTEGERP (lisp))
+  json_out_nest ();
+  struct Lisp_Hash_Table *h = XHASH_TABLE (obj);
+  /* Keys of other tables than `equal' ones can have the same
+     text.  */
+  Lisp_Object seen = (EQ (h->test.name, Qequal) ? Qnil
+		      : CALLN (Fmake_hash_table, QCtest, Qequal));
+  bool first = true;
+  json_out_byte (jo, '{');
+  for (ptrdiff_t i = 0; i < HASH_TABLE_SIZE (h); i++)
     {
-      intmax_t low = TYPE_MINIMUM (json_int_t);
-      intmax_t high = TYPE_MAXIMUM (json_int_t);
-      intmax_t value = check_integer_range (lisp, low, high);
-      return json_check (json_integer (value));
+      Lisp_Object key = HASH_KEY (h, i);
+      if (EQ (key, Qunbound))
+	continue;
+      check_string_without_embedded_nulls (key);
+      if (!NILP (seen))
+	{
+	  if (!NILP (Fgethash (key, seen, Qnil)))
+	    wrong_type_argument (Qjson_value_p, obj);
+	  Fputhash (key, Qt, seen);
+	}
+      if (!first)
+	json_out_byte (jo, ',');
+      first = false;
+      json_out_string (jo, key, 0);
+      json_out_byte (jo, ':');
+      json_out_value (jo, HASH_VALUE (h, i));
     }
-  else if (FLOATP (lisp))
-    return json_check (json_real (XFLOAT_DATA (lisp)));
-  else if (STRINGP (lisp))
+  json_out_byte (jo, '}');
+  json_out_unnest ();
+}
+
+static void
+json_out_object_cons (struct json_out *jo, Lisp_Object obj)
+{
+  json_out_nest ();
+  jo->symsets = symset_push (jo->symsets, 3);
+  bool is_plist = !CONSP (XCAR (obj));
+  bool first = true;
+  json_out_byte (jo, '{');
+  Lisp_Object tail = obj;
+  FOR_EACH_TAIL (tail)
     {
-      Lisp_Object encoded = json_encode (lisp);
-      json_t *json = json_stringn (SSDATA (encoded), SBYTES (encoded));
-      if (json == NULL)
-        {
-          /* A failure can be caused either by an invalid string or by
-             low memory.  */
-          json_check_utf8 (encoded);
-          json_out_of_memory ();
-        }
-      return json;
+      Lisp_Object key, value;
+      if (is_plist)
+	{
+	  key = XCAR (tail);
+	  tail = XCDR (tail);
+	  CHECK_CONS (tail);
+	  value = XCAR (tail);
+	}
+      else
+	{
+	  Lisp_Object pair = XCAR (tail);
+	  CHECK_CONS (pair);
+	  key = XCAR (pair);
+	  value = XCDR (pair);
+	}
+      CHECK_SYMBOL (key);
+      Lisp_Object name = SYMBOL_NAME (key);
+      check_string_without_embedded_nulls (name);
+      /* Only the first member with a given key counts.  */
+      if (symset_add (&jo->symsets, key))
+	{
+	  if (!first)
+	    json_out_byte (jo, ',');
+	  first = false;
+	  /* Strip the colon of plist keys, which `json-parse-string'
+	     puts back.  */
+	  json_out_string (jo, name,
+			   is_plist && SREF (name, 0) == ':' && SBYTES (name) > 1);
+	  json_out_byte (jo, ':');
+	  json_out_value (jo, value);
+	}
     }
+  CHECK_LIST_END (tail, obj);
+  json_out_byte (jo, '}');
+  jo->symsets = symset_pop (jo->symsets);
+  json_out_unnest ();
+}
+
+/* Write OBJ, which must be a vector, hash table, alist, or plist.  */
 
-  /* LISP now must be a vector, hashtable, alist, or plist.  */
-  return lisp_to_json_toplevel (lisp, conf);
+static void
+json_out_toplevel (struct json_out *jo, Lisp_Object obj)
+{
+  if (VECTORP (obj))
+    json_out_array (jo, obj);
+  else if (HASH_TABLE_P (obj))
+    json_out_object_hash (jo, obj);
+  else if (NILP (obj))
+    json_out_str (jo, "{}");
+  else if (CONSP (obj))
+    json_out_object_cons (jo, obj);
+  else
+    wrong_type_argument (Qjson_value_p, obj);
+}
+
+static void
+json_out_value (struct json_out *jo, Lisp_Object obj)
+{
+  if (EQ (obj, jo->conf.null_object))
+    json_out_str (jo, "null");
+  else if (EQ (obj, jo->conf.false_object))
+    json_out_str (jo, "false");
+  else if (EQ (obj, Qt))
+    json_out_str (jo, "true");
+  else if (INTEGERP (obj))
+    json_out_integer (jo, obj);
+  else if (FLOATP (obj))
+    json_out_float (jo, obj);
+  else if (STRINGP (obj))
+    json_out_string (jo, obj, 0);
+  else
+    json_out_toplevel (jo, obj);
 }
 
+/* Parse the keyword arguments ARGS into CONF.  If STATE, also accept
+   `:state', and store its value in *STATE.  */
+
 static void
 json_parse_args (ptrdiff_t nargs,
                  Lisp_Object *args,
                  struct json_configuration *conf,
-                 bool parse_object_types)
+                 bool parse_object_types,
+                 Lisp_Object *state)
 {
   if ((nargs % 2) != 0)
     wrong_type_argument (Qplistp, Flist (nargs, args));
@@ -540,6 +657,15 @@ json_parse_args (ptrdiff_t nargs,
       conf->null_object = value;
     else if (EQ (key, QCfalse_object))
       conf->false_object = value;
+    else if (state && EQ (key, QCstate))
+      *state = value;
+    else if (state)
+      wrong_choice (list5 (QCobject_type,
+                           QCarray_type,
+                           QCnull_object,
+                           QCfalse_object,
+                           QCstate),
+                    value);
     else if (parse_object_types)
       wrong_choice (list4 (QCobject_type,
                            QCarray_type,
@@ -553,6 +679,24 @@ json_parse_args (ptrdiff_t nargs,
   }
 }
 
+/* Write the JSON text of OBJECT into JO, which is new, configured by
+   the keyword arguments ARGS.  Free JO's storage when the current
+   binding depth drops back.  */
+
+static void
+json_serialize (struct json_out *jo, Lisp_Object object,
+		ptrdiff_t nargs, Lisp_Object *args)
+{
+  jo->buf = NULL;
+  jo->size = jo->capacity = jo->chars_delta = 0;
+  jo->symsets = NULL;
+  jo->conf = (struct json_configuration)
+    {json_object_hashtable, json_array_array, QCnull, QCfalse};
+  record_unwind_protect_ptr (json_out_done, jo);
+  json_parse_args (nargs, args, &jo->conf, false, NULL);
+  json_out_toplevel (jo, object);
+}
+
 DEFUN ("json-serialize", Fjson_serialize, Sjson_serialize, 1, MANY,
        NULL,
        doc: /* Return the JSON representation of OBJECT as a string.
@@ -583,349 +727,775 @@ usage: (json-serialize OBJECT &rest ARGS)  */)
      (ptrdiff_t nargs, Lisp_Object *args)
 {
   ptrdiff_t count = SPECPDL_INDEX ();
+  struct json_out jo;
+  json_serialize (&jo, args[0], nargs - 1, args + 1);
+  return unbind_to (count, make_specified_string (jo.buf,
+						  jo.size - jo.chars_delta,
+						  jo.size, true));
+}
 
-#ifdef WINDOWSNT
-  if (!json_initialized)
-    {
-      Lisp_Object status;
-      json_initialized = init_json_functions ();
-      status = json_initialized ? Qt : Qnil;
-      Vlibrary_cache = Fcons (Fcons (Qjson, status), Vlibrary_cache);
-    }
-  if (!json_initialized)
-    {
-      message1 ("jansson library not found");
-      return Qnil;
-    }
-#endif
+DEFUN ("json-insert", Fjson_insert, Sjson_insert, 1, MANY,
+       NULL,
+       doc: /* Insert the JSON representation of OBJECT before point.
+This is the same as (insert (json-serialize OBJECT)), but potentially
+faster.  See the function `json-serialize' for allowed values of
+OBJECT.
+usage: (json-insert OBJECT &rest ARGS)  */)
+     (ptrdiff_t nargs, Lisp_Object *args)
+{
+  ptrdiff_t count = SPECPDL_INDEX ();
+  struct json_out jo;
+  json_serialize (&jo, args[0], nargs - 1, args + 1);
 
-  struct json_configuration conf =
-    {json_object_hashtable, json_array_array, QCnull, QCfalse};
-  json_parse_args (nargs - 1, args + 1, &conf, false);
+  prepare_to_modify_buffer (PT, PT, NULL);
+  move_gap_both (PT, PT_BYTE);
+  if (GAP_SIZE < jo.size)
+    make_gap (jo.size - GAP_SIZE);
+  memcpy (GPT_ADDR, jo.buf, jo.size);
+
+  /* The JSON text is valid UTF-8, which is how multibyte buffers
+     represent it too; unibyte buffers get its bytes.  */
+  ptrdiff_t inserted_bytes = jo.size;
+  ptrdiff_t inserted
+    = (NILP (BVAR (current_buffer, enable_multibyte_characters))
+       ? jo.size : jo.size - jo.chars_delta);
+  unbind_to (count, Qnil);
 
-  json_t *json = lisp_to_json_toplevel (args[0], &conf);
-  record_unwind_protect_ptr (json_release_object, json);
+  insert_from_gap_1 (inserted, inserted_bytes, false);
+  invalidate_buffer_caches (current_buffer, PT, PT + inserted);
+  adjust_after_insert (PT, PT_BYTE, PT + inserted, PT_BYTE + inserted_bytes,
+		       inserted);
 
-  /* If desired, we might want to add the following flags:
-     JSON_DECODE_ANY, JSON_ALLOW_NUL.  */
-  char *string = json_dumps (json, JSON_COMPACT);
-  if (string == NULL)
-    json_out_of_memory ();
-  record_unwind_protect_ptr (json_free, string);
+  /* Call after-change hooks.  */
+  signal_after_change (PT, 0, inserted);
+  if (inserted > 0)
+    {
+      update_compositions (PT, PT, CHECK_BORDER);
+      /* Move point to after the inserted text.  */
+      SET_PT_BOTH (PT + inserted, PT_BYTE + inserted_bytes);
+    }
 
-  return unbind_to (count, build_string_from_utf8 (string));
+  return Qnil;
 }
 
-struct json_buffer_and_size
+
+/* Parsing.  */
+
+struct json_parser
 {
-  const char *buffer;
-  ptrdiff_t size;
-  /* This tracks how many bytes were inserted by the callback since
-     json_dump_callback was called.  */
-  ptrdiff_t inserted_bytes;
+  /* The input is the bytes of up to two segments, since the gap can
+     split the text of a buffer; the second segment is empty if
+     there is just one.  */
+  unsigned char const *segment_begin[2], *segment_end[2];
+
+  /* The current segment, the next byte to read in it, and its end.  */
+  int segment;
+  unsigned char const *input_current, *input_end;
+
+  /* What the input is, for error messages.  */
+  char const *source;
+
+  struct json_configuration conf;
+
+  /* The bytes of the string being parsed, when they can't be used
+     where they are in the input.  */
+  unsigned char *byte_workspace;
+  ptrdiff_t byte_workspace_size, byte_workspace_current;
+
+  /* A vector used as a stack of the elements and members of the
+     arrays and objects being parsed.  */
+  Lisp_Object object_workspace;
+  ptrdiff_t object_workspace_current;
+
+  /* The keys of the object being parsed, to find duplicates.  */
+  struct symset_tbl *symsets;
+
+  unsigned short quit_count;
 };
 
-static Lisp_Object
-json_insert (void *data)
+static Lisp_Object json_parse_value (struct json_parser *, int);
+
+/* Make P parse the N1 bytes at INPUT1 followed by the N2 bytes at
+   INPUT2.  */
+
+static void
+json_parser_init (struct json_parser *p, struct json_configuration conf,
+		  char const *source,
+		  unsigned char const *input1, ptrdiff_t n1,
+		  unsigned char const *input2, ptrdiff_t n2)
+{
+  p->segment_begin[0] = input1;
+  p->segment_end[0] = input1 + n1;
+  p->segment_begin[1] = input2;
+  p->segment_end[1] = input2 + n2;
+  p->segment = 0;
+  p->input_current = input1;
+  p->input_end = input1 + n1;
+  p->source = source;
+  p->conf = conf;
+  p->byte_workspace = NULL;
+  p->byte_workspace_size = p->byte_workspace_current = 0;
+  p->object_workspace = make_nil_vector (64);
+  p->object_workspace_current = 0;
+  p->symsets = NULL;
+  p->quit_count = 0;
+}
+
+/* Free what P allocated.  */
+
+static void
+json_parser_done (void *parser)
 {
-  struct json_buffer_and_size *buffer_and_size = data;
-  ptrdiff_t len = buffer_and_size->size;
-  ptrdiff_t inserted_bytes = buffer_and_size->inserted_bytes;
-  ptrdiff_t gap_size = GAP_SIZE - inserted_bytes;
+  struct json_parser *p = parser;
+  xfree (p->byte_workspace);
+  while (p->symsets)
+    p->symsets = symset_pop (p->symsets);
+}
 
-  /* Enlarge the gap if necessary.  */
-  if (gap_size < len)
-    make_gap (len - gap_size);
+/* Return the number of bytes P has read.  */
 
-  /* Copy this chunk of data into the gap.  */
-  memcpy ((char *) BEG_ADDR + PT_BYTE - BEG_BYTE + inserted_bytes,
-	  buffer_and_size->buffer, len);
-  buffer_and_size->inserted_bytes += len;
-  return Qnil;
+static ptrdiff_t
+json_input_position (struct json_parser *p)
+{
+  ptrdiff_t pos = p->input_current - p->segment_begin[p->segment];
+  if (p->segment == 1)
+    pos += p->segment_end[0] - p->segment_begin[0];
+  return pos;
 }
 
-static Lisp_Object
-json_handle_nonlocal_exit (enum nonlocal_exit type, Lisp_Object data)
+/* Signal ERROR with MESSAGE at the current position of P.  */
+
+static AVOID
+json_signal_error (struct json_parser *p, Lisp_Object error,
+		   char const *message)
 {
-  switch (type)
+  /* Count the lines before the position, and the characters after
+     the last newline.  */
+  EMACS_INT line = 1, column = 0;
+  for (int s = 0; s <= p->segment; s++)
     {
-    case NONLOCAL_EXIT_SIGNAL:
-      return data;
-    case NONLOCAL_EXIT_THROW:
-      return Fcons (Qno_catch, data);
-    default:
-      eassume (false);
+      unsigned char const *q = p->segment_begin[s];
+      unsigned char const *end
+	= s == p->segment ? p->input_current : p->segment_end[s];
+      for (; q < end; q++)
+	if (*q == '\n')
+	  line++, column = 0;
+	else
+	  column += (*q & 0xC0) != 0x80;
     }
+  xsignal (error, list5 (build_string (message), build_string (p->source),
+			 make_int (line), make_int (column),
+			 make_int (json_input_position (p))));
 }
 
-struct json_insert_data
+/* Move P on to the second segment of its input; return false if
+   there is none.  */
+
+static bool
+json_input_switch (struct json_parser *p)
 {
-  /* This tracks how many bytes were inserted by the callback since
-     json_dump_callback was called.  */
-  ptrdiff_t inserted_bytes;
-  /* nil if json_insert succeeded, otherwise the symbol
-     Qcatch_all_memory_full or a cons (ERROR-SYMBOL . ERROR-DATA).  */
-  Lisp_Object error;
-};
+  if (p->segment == 1 || p->segment_begin[1] == p->segment_end[1])
+    return false;
+  p->segment = 1;
+  p->input_current = p->segment_begin[1];
+  p->input_end = p->segment_end[1];
+  return true;
+}
 
-/* Callback for json_dump_callback that inserts a JSON representation
-   as a unibyte string into the gap.  DATA must point to a structure
-   of type json_insert_data.  This function may not exit nonlocally.
-   It catches all nonlocal exits and stores them in data->error for
-   reraising.  */
+/* Read a byte, or return -1 at the end of the input.  */
 
 static int
-json_insert_callback (const char *buffer, size_t size, void *data)
+json_input_get_if_possible (struct json_parser *p)
 {
-  struct json_insert_data *d = data;
-  struct json_buffer_and_size buffer_and_size
-    = {.buffer = buffer, .size = size, .inserted_bytes = d->inserted_bytes};
-  d->error = internal_catch_all (json_insert, &buffer_and_size,
-                                 json_handle_nonlocal_exit);
-  d->inserted_bytes = buffer_and_size.inserted_bytes;
-  return NILP (d->error) ? 0 : -1;
+  if (p->input_current == p->input_end && !json_input_switch (p))
+    return -1;
+  return *p->input_current++;
 }
 
-DEFUN ("json-insert", Fjson_insert, Sjson_insert, 1, MANY,
-       NULL,
-       doc: /* Insert the JSON representation of OBJECT before point.
-This is the same as (insert (json-serialize OBJECT)), but potentially
-faster.  See the function `json-serialize' for allowed values of
-OBJECT.
-usage: (json-insert OBJECT &rest ARGS)  */)
-     (ptrdiff_t nargs, Lisp_Object *args)
+static int
+json_input_get (struct json_parser *p)
 {
-  ptrdiff_t count = SPECPDL_INDEX ();
+  int c = json_input_get_if_possible (p);
+  if (c < 0)
+    json_signal_error (p, Qjson_end_of_file, "unexpected end of input");
+  return c;
+}
+
+/* Unread the byte that was just read.  */
+
+static void
+json_input_unget (struct json_parser *p)
+{
+  p->input_current--;
+}
 
-#ifdef WINDOWSNT
-  if (!json_initialized)
+/* Skip whitespace, and return the byte after it, or -1 at the end of
+   the input.  */
+
+static int
+json_skip_whitespace_if_possible (struct json_parser *p)
+{
+  for (;;)
     {
-      Lisp_Object status;
-      json_initialized = init_json_functions ();
-      status = json_initialized ? Qt : Qnil;
-      Vlibrary_cache = Fcons (Fcons (Qjson, status), Vlibrary_cache);
+      int c = json_input_get_if_possible (p);
+      if (! (c == ' ' || c == '\t' || c == '\n' || c == '\r'))
+	return c;
     }
-  if (!json_initialized)
+}
+
+static int
+json_skip_whitespace (struct json_parser *p)
+{
+  int c = json_skip_whitespace_if_possible (p);
+  if (c < 0)
+    json_signal_error (p, Qjson_end_of_file, "unexpected end of input");
+  return c;
+}
+
+/* Make room for N more bytes in the byte workspace of P.  */
+
+static void
+json_byte_workspace_grow (struct json_parser *p, ptrdiff_t n)
+{
+  ptrdiff_t room = p->byte_workspace_size - p->byte_workspace_current;
+  if (room < n)
+    p->byte_workspace = xpalloc (p->byte_workspace, &p->byte_workspace_size,
+				 n - room, -1, 1);
+}
+
+static void
+json_byte_workspace_put (struct json_parser *p, void const *bytes,
+			 ptrdiff_t n)
+{
+  json_byte_workspace_grow (p, n);
+  memcpy (p->byte_workspace + p->byte_workspace_current, bytes, n);
+  p->byte_workspace_current += n;
+}
+
+static void
+json_byte_workspace_put_byte (struct json_parser *p, int c)
+{
+  unsigned char b = c;
+  json_byte_workspace_put (p, &b, 1);
+}
+
+/* Push OBJ on the object workspace of P.  */
+
+static void
+json_object_workspace_push (struct json_parser *p, Lisp_Object obj)
+{
+  ptrdiff_t size = ASIZE (p->object_workspace);
+  if (p->object_workspace_current == size)
+    p->object_workspace = larger_vector (p->object_workspace, 1, -1);
+  ASET (p->object_workspace, p->object_workspace_current++, obj);
+  rarely_quit (++p->quit_count);
+}
+
+/* Enter an array or object; they can be too deeply nested.  */
+
+static void
+json_parse_nest (void)
+{
+  if (++lisp_eval_depth > max_lisp_eval_depth)
+    xsignal0 (Qjson_object_too_deep);
+}
+
+static void
+json_parse_unnest (void)
+{
+  --lisp_eval_depth;
+}
+
+static int
+json_parse_hex4 (struct json_parser *p)
+{
+  int u = 0;
+  for (int i = 0; i < 4; i++)
     {
-      message1 ("jansson library not found");
-      return Qnil;
+      int c = json_input_get (p);
+      int d = ('0' <= c && c <= '9' ? c - '0'
+	       : 'a' <= (c | 0x20) && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10
+	       : -1);
+      if (d < 0)
+	json_signal_error (p, Qjson_parse_error, "invalid \\u escape");
+      u = (u << 4) | d;
     }
-#endif
-
-  struct json_configuration conf =
-    {json_object_hashtable, json_array_array, QCnull, QCfalse};
-  json_parse_args (nargs - 1, args + 1, &conf, false);
+  return u;
+}
 
-  json_t *json = lisp_to_json (args[0], &conf);
-  record_unwind_protect_ptr (json_release_object, json);
+/* Parse an escape sequence of a string, whose backslash has been
+   read, and put the UTF-8 bytes of its character in the byte
+   workspace.  Return the number of those bytes minus one.  */
 
-  prepare_to_modify_buffer (PT, PT, NULL);
-  move_gap_both (PT, PT_BYTE);
-  struct json_insert_data data;
-  data.inserted_bytes = 0;
-  /* If desired, we might want to add the following flags:
-     JSON_DECODE_ANY, JSON_ALLOW_NUL.  */
-  int status
-    /* Could have used json_dumpb, but that became available only in
-       Jansson 2.10, whereas we want to support 2.7 and upward.  */
-    = json_dump_callback (json, json_insert_callback, &data, JSON_COMPACT);
-  if (status == -1)
+static int
+json_parse_escape (struct json_parser *p)
+{
+  int c = json_input_get (p);
+  switch (c)
     {
-      if (CONSP (data.error))
-        xsignal (XCAR (data.error), XCDR (data.error));
-      else
-        json_out_of_memory ();
+    case '"': case '\\': case '/': break;
+    case 'b': c = '\b'; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'u':
+      c = json_parse_hex4 (p);
+      if (0xD800 <= c && c < 0xDC00)
+	{
+	  /* A surrogate pair.  */
+	  if (json_input_get (p) != '\\' || json_input_get (p) != 'u')
+	    json_signal_error (p, Qjson_parse_error, "invalid \\u escape");
+	  int lo = json_parse_hex4 (p);
+	  if (! (0xDC00 <= lo && lo < 0xE000))
+	    json_signal_error (p, Qjson_parse_error, "invalid \\u escape");
+	  c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+	}
+      else if (0xDC00 <= c && c < 0xE000)
+	json_signal_error (p, Qjson_parse_error, "invalid \\u escape");
+      else if (c == 0)
+	json_signal_error (p, Qjson_parse_error, "\\u0000 is not allowed");
+      break;
+    default:
+      json_signal_error (p, Qjson_parse_error, "invalid escape");
     }
+  unsigned char str[MAX_MULTIBYTE_LENGTH];
+  int len = CHAR_STRING (c, str);
+  json_byte_workspace_put (p, str, len);
+  return len - 1;
+}
 
-  ptrdiff_t inserted = 0;
-  ptrdiff_t inserted_bytes = data.inserted_bytes;
-  if (inserted_bytes > 0)
+/* Parse a string, whose opening quotation mark has been read.  Return
+   its UTF-8 bytes, which are either in the input or in the byte
+   workspace, and store their number in *NBYTES and the number of
+   characters they make in *NCHARS.  */
+
+static unsigned char const *
+json_parse_string_bytes (struct json_parser *p,
+			 ptrdiff_t *nbytes, ptrdiff_t *nchars)
+{
+  /* The bytes from RUN on have not been copied into the workspace;
+     COPIED says whether the string is there instead of in the
+     input.  */
+  unsigned char const *run = p->input_current;
+  bool copied = false;
+  ptrdiff_t delta = 0;
+  p->byte_workspace_current = 0;
+
+  for (;;)
     {
-      /* If required, decode the stuff we've read into the gap.  */
-      struct coding_system coding;
-      /* JSON strings are UTF-8 encoded strings.  If for some reason
-	 the text returned by the Jansson library includes invalid
-	 byte sequences, they will be represented by raw bytes in the
-	 buffer text.  */
-      setup_coding_system (Qutf_8_unix, &coding);
-      coding.dst_multibyte =
-	!NILP (BVAR (current_buffer, enable_multibyte_characters));
-      if (CODING_MAY_REQUIRE_DECODING (&coding))
+      unsigned char const *q
+	= json_skip_plain_bytes (p->input_current, p->input_end);
+      p->input_current = q;
+      if (q == p->input_end)
+	{
+	  /* The string goes on after the gap, if anywhere.  */
+	  json_byte_workspace_put (p, run, q - run);
+	  copied = true;
+	  if (!json_input_switch (p))
+	    json_signal_error (p, Qjson_end_of_file,
+			       "unexpected end of input");
+	  run = p->input_current;
+	  continue;
+	}
+
+      int c = *q;
+      if (c == '"')
 	{
-          /* Now we have all the new bytes at the beginning of the gap,
-             but `decode_coding_gap` needs them at the end of the gap, so
-             we need to move them.  */
-          memmove (GAP_END_ADDR - inserted_bytes, GPT_ADDR, inserted_bytes);
-	  decode_coding_gap (&coding, inserted_bytes);
-	  inserted = coding.produced_char;
+	  p->input_current = q + 1;
+	  if (copied)
+	    {
+	      json_byte_workspace_put (p, run, q - run);
+	      run = p->byte_workspace;
+	      *nbytes = p->byte_workspace_current;
+	    }
+	  else
+	    *nbytes = q - run;
+	  *nchars = *nbytes - delta;
+	  return run;
 	}
+      else if (c == '\\')
+	{
+	  json_byte_workspace_put (p, run, q - run);
+	  copied = true;
+	  p->input_current = q + 1;
+	  delta += json_parse_escape (p);
+	  run = p->input_current;
+	}
+      else if (c < 0x20)
+	json_signal_error (p, Qjson_parse_error,
+			   "control character in string");
       else
 	{
-          /* Make the inserted text part of the buffer, as unibyte text.  */
-          eassert (NILP (BVAR (current_buffer, enable_multibyte_characters)));
-          insert_from_gap_1 (inserted_bytes, inserted_bytes, false);
-
-	  /* The target buffer is unibyte, so we don't need to decode.  */
-	  invalidate_buffer_caches (current_buffer,
-				    PT, PT + inserted_bytes);
-	  adjust_after_insert (PT, PT_BYTE,
-			       PT + inserted_bytes,
-			       PT_BYTE + inserted_bytes,
-			       inserted_bytes);
-	  inserted = inserted_bytes;
+	  int len = json_utf8_length (q, p->input_end);
+	  if (0 < len)
+	    p->input_current = q + len;
+	  else if (p->input_end - q < 4 && p->segment == 0
+		   && p->segment_begin[1] < p->segment_end[1]
+		   && 0xC2 <= c && c < 0xF5)
+	    {
+	      /* A unibyte buffer can have the gap in the middle of a
+		 sequence.  */
+	      unsigned char seq[4];
+	      len = c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+	      json_byte_workspace_put (p, run, q - run);
+	      copied = true;
+	      for (int i = 0; i < len; i++)
+		seq[i] = json_input_get (p);
+	      if (json_utf8_length (seq, seq + len) != len)
+		json_signal_error (p, Qjson_parse_error, "invalid UTF-8");
+	      json_byte_workspace_put (p, seq, len);
+	      run = p->input_current;
+	    }
+	  else
+	    json_signal_error (p, Qjson_parse_error, "invalid UTF-8");
+	  delta += len - 1;
 	}
     }
+}
 
-  /* Call after-change hooks.  */
-  signal_after_change (PT, 0, inserted);
-  if (inserted > 0)
+static Lisp_Object
+json_parse_string (struct json_parser *p)
+{
+  ptrdiff_t nbytes, nchars;
+  unsigned char const *bytes = json_parse_string_bytes (p, &nbytes, &nchars);
+  return make_specified_string ((char const *) bytes, nchars, nbytes, true);
+}
+
+/* Parse an object key, whose opening quotation mark has been read,
+   and return what represents it in the Lisp object.  */
+
+static Lisp_Object
+json_parse_key (struct json_parser *p)
+{
+  ptrdiff_t nbytes, nchars;
+  unsigned char const *bytes = json_parse_string_bytes (p, &nbytes, &nchars);
+  switch (p->conf.object_type)
     {
-      update_compositions (PT, PT, CHECK_BORDER);
-      /* Move point to after the inserted text.  */
-      SET_PT_BOTH (PT + inserted, PT_BYTE + inserted_bytes);
+    case json_object_hashtable:
+      return make_specified_string ((char const *) bytes, nchars, nbytes,
+				    true);
+    case json_object_alist:
+      break;
+    case json_object_plist:
+      {
+	/* Prepend a colon.  */
+	bool in_workspace = bytes == p->byte_workspace;
+	p->byte_workspace_current = nbytes;
+	json_byte_workspace_grow (p, 1);
+	memmove (p->byte_workspace + 1,
+		 in_workspace ? p->byte_workspace : bytes, nbytes);
+	p->byte_workspace[0] = ':';
+	bytes = p->byte_workspace;
+	nbytes++;
+	nchars++;
+	break;
+      }
+    default:
+      emacs_abort ();
     }
 
-  return unbind_to (count, Qnil);
+  /* Intern the key without making a string unless it is new.  */
+  Lisp_Object obarray = check_obarray (Vobarray);
+  Lisp_Object found = oblookup (obarray, (char const *) bytes, nchars, nbytes);
+  if (SYMBOLP (found))
+    return found;
+  return intern_driver (make_specified_string ((char const *) bytes,
+					       nchars, nbytes, true),
+			obarray, found);
 }
 
-/* Convert a JSON object to a Lisp object.  */
+/* Parse the rest of a number, whose first byte C has been read.  */
 
-static Lisp_Object ARG_NONNULL ((1))
-json_to_lisp (json_t *json, struct json_configuration *conf)
+static Lisp_Object
+json_parse_number (struct json_parser *p, int c)
 {
-  switch (json_typeof (json))
+  /* Copy the number into the byte workspace, checking its syntax on
+     the way.  */
+  p->byte_workspace_current = 0;
+  bool negative = c == '-', is_float = false;
+  if (negative)
     {
-    case JSON_NULL:
-      return conf->null_object;
-    case JSON_FALSE:
-      return conf->false_object;
-    case JSON_TRUE:
-      return Qt;
-    case JSON_INTEGER:
+      json_byte_workspace_put_byte (p, c);
+      c = json_input_get (p);
+    }
+  if (! ('0' <= c && c <= '9'))
+    json_signal_error (p, Qjson_parse_error, "invalid number");
+  ptrdiff_t ndigits = 0;
+  do
+    {
+      json_byte_workspace_put_byte (p, c);
+      ndigits++;
+      c = json_input_get_if_possible (p);
+    }
+  while ('0' <= c && c <= '9' && p->byte_workspace[negative] != '0');
+  if (c == '.')
+    {
+      is_float = true;
+      json_byte_workspace_put_byte (p, c);
+      c = json_input_get (p);
+      if (! ('0' <= c && c <= '9'))
+	json_signal_error (p, Qjson_parse_error, "invalid number");
+      do
+	{
+	  json_byte_workspace_put_byte (p, c);
+	  c = json_input_get_if_possible (p);
+	}
+      while ('0' <= c && c <= '9');
+    }
+  if (c == 'e' || c == 'E')
+    {
+      is_float = true;
+      json_byte_workspace_put_byte (p, c);
+      c = json_input_get (p);
+      if (c == '+' || c == '-')
+	{
+	  json_byte_workspace_put_byte (p, c);
+	  c = json_input_get (p);
+	}
+      if (! ('0' <= c && c <= '9'))
+	json_signal_error (p, Qjson_parse_error, "invalid number");
+      do
+	{
+	  json_byte_workspace_put_byte (p, c);
+	  c = json_input_get_if_possible (p);
+	}
+      while ('0' <= c && c <= '9');
+    }
+  if (0 <= c)
+    json_input_unget (p);
+  json_byte_workspace_put_byte (p, '\0');
+
+  char const *number = (char const *) p->byte_workspace;
+  if (is_float)
+    return make_float (strtod (number, NULL));
+  if (ndigits < 19)
+    {
+      intmax_t n = 0;
+      for (char const *d = number + negative; *d; d++)
+	n = 10 * n + (*d - '0');
+      return make_int (negative ? -n : n);
+    }
+  return string_to_number (number, 10, NULL);
+}
+
+/* Parse the rest of the literal that starts with C, which has been
+   read, and is the first letter of WORD.  */
+
+static void
+json_parse_literal (struct json_parser *p, char const *word)
+{
+  for (word++; *word; word++)
+    if (json_input_get (p) != *word)
+      json_signal_error (p, Qjson_parse_error, "invalid token");
+}
+
+static Lisp_Object
+json_parse_array (struct json_parser *p)
+{
+  json_parse_nest ();
+  ptrdiff_t first = p->object_workspace_current;
+  int c = json_skip_whitespace (p);
+  if (c != ']')
+    for (;;)
       {
-	json_int_t i = json_integer_value (json);
-	return INT_TO_INTEGER (i);
+	json_object_workspace_push (p, json_parse_value (p, c));
+	c = json_skip_whitespace (p);
+	if (c == ']')
+	  break;
+	if (c != ',')
+	  json_signal_error (p, Qjson_parse_error, "',' or ']' expected");
+	c = json_skip_whitespace (p);
       }
-    case JSON_REAL:
-      return make_float (json_real_value (json));
-    case JSON_STRING:
-      return make_string_from_utf8 (json_string_value (json),
-				    json_string_length (json));
-    case JSON_ARRAY:
+
+  ptrdiff_t n = p->object_workspace_current - first;
+  Lisp_Object *elts = XVECTOR (p->object_workspace)->contents + first;
+  Lisp_Object result;
+  switch (p->conf.array_type)
+    {
+    case json_array_array:
+      result = make_uninit_vector (n);
+      memcpy (XVECTOR (result)->contents, elts, n * word_size);
+      break;
+    case json_array_list:
+      result = Qnil;
+      for (ptrdiff_t i = n - 1; i >= 0; i--)
+	result = Fcons (elts[i], result);
+      break;
+    default:
+      emacs_abort ();
+    }
+  p->object_workspace_current = first;
+  json_parse_unnest ();
+  return result;
+}
+
+/* The N members of an object are the key-value pairs at MEMBERS.
+   Give the value of each member whose key is also that of an earlier
+   member to that earlier member, and drop it by making its key
+   Qunbound: the last value counts, at the place of the first.  */
+
+static void
+json_merge_duplicate_keys (struct json_parser *p, Lisp_Object *members,
+			   ptrdiff_t n)
+{
+  /* Compare the keys of small objects with each other; use a set of
+     keys to see whether large objects have any duplicates.  */
+  struct symset_tbl *set = NULL;
+  if (n > 8)
+    {
+      int bits = 4;
+      while (((ptrdiff_t) 1 << bits) < 2 * n)
+	bits++;
+      set = p->symsets = symset_push (p->symsets, bits);
+    }
+
+  for (ptrdiff_t i = 0; i < n; i++)
+    {
+      Lisp_Object key = members[2 * i];
+      if (set ? symset_add (&p->symsets, key) : i == 0)
+	continue;
+      for (ptrdiff_t j = 0; j < i; j++)
+	if (EQ (members[2 * j], key))
+	  {
+	    members[2 * j + 1] = members[2 * i + 1];
+	    members[2 * i] = Qunbound;
+	    break;
+	  }
+    }
+
+  if (set)
+    p->symsets = symset_pop (p->symsets);
+}
+
+static Lisp_Object
+json_parse_object (struct json_parser *p)
+{
+  json_parse_nest ();
+  ptrdiff_t first = p->object_workspace_current;
+  int c = json_skip_whitespace (p);
+  if (c != '}')
+    for (;;)
       {
-        if (++lisp_eval_depth > max_lisp_eval_depth)
-          xsignal0 (Qjson_object_too_deep);
-        size_t size = json_array_size (json);
-        if (PTRDIFF_MAX < size)
-          overflow_error ();
-        Lisp_Object result;
-        switch (conf->array_type)
-          {
-          case json_array_array:
-            {
-              result = make_vector (size, Qunbound);
-              for (ptrdiff_t i = 0; i < size; ++i)
-                {
-                  rarely_quit (i);
-                  ASET (result, i,
-                        json_to_lisp (json_array_get (json, i), conf));
-                }
-              break;
-            }
-          case json_array_list:
-            {
-              result = Qnil;
-              for (ptrdiff_t i = size - 1; i >= 0; --i)
-                {
-                  rarely_quit (i);
-                  result = Fcons (json_to_lisp (json_array_get (json, i), conf),
-                                  result);
-                }
-              break;
-            }
-          default:
-            /* Can't get here.  */
-            emacs_abort ();
-          }
-        --lisp_eval_depth;
-        return result;
+	if (c != '"')
+	  json_signal_error (p, Qjson_parse_error, "string expected");
+	json_object_workspace_push (p, json_parse_key (p));
+	if (json_skip_whitespace (p) != ':')
+	  json_signal_error (p, Qjson_parse_error, "':' expected");
+	c = json_skip_whitespace (p);
+	json_object_workspace_push (p, json_parse_value (p, c));
+	c = json_skip_whitespace (p);
+	if (c == '}')
+	  break;
+	if (c != ',')
+	  json_signal_error (p, Qjson_parse_error, "',' or '}' expected");
+	c = json_skip_whitespace (p);
       }
-    case JSON_OBJECT:
+
+  ptrdiff_t n = (p->object_workspace_current - first) / 2;
+  Lisp_Object *members = XVECTOR (p->object_workspace)->contents + first;
+  Lisp_Object result;
+  switch (p->conf.object_type)
+    {
+    case json_object_hashtable:
       {
-        if (++lisp_eval_depth > max_lisp_eval_depth)
-          xsignal0 (Qjson_object_too_deep);
-        Lisp_Object result;
-        switch (conf->object_type)
-          {
-          case json_object_hashtable:
-            {
-              size_t size = json_object_size (json);
-              if (FIXNUM_OVERFLOW_P (size))
-                overflow_error ();
-              result = CALLN (Fmake_hash_table, QCtest, Qequal, QCsize,
-                              make_fixed_natnum (size));
-              struct Lisp_Hash_Table *h = XHASH_TABLE (result);
-              const char *key_str;
-              json_t *value;
-              json_object_foreach (json, key_str, value)
-                {
-		  Lisp_Object key = build_string_from_utf8 (key_str), hash;
-                  ptrdiff_t i = hash_lookup (h, key, &hash);
-                  /* Keys in JSON objects are unique, so the key can't
-                     be present yet.  */
-                  eassert (i < 0);
-                  hash_put (h, key, json_to_lisp (value, conf), hash);
-                }
-              break;
-            }
-          case json_object_alist:
-            {
-              result = Qnil;
-              const char *key_str;
-              json_t *value;
-              json_object_foreach (json, key_str, value)
-                {
-                  Lisp_Object key
-		    = Fintern (build_string_from_utf8 (key_str), Qnil);
-                  result
-                    = Fcons (Fcons (key, json_to_lisp (value, conf)),
-                             result);
-                }
-              result = Fnreverse (result);
-              break;
-            }
-          case json_object_plist:
-            {
-              result = Qnil;
-              const char *key_str;
-              json_t *value;
-              json_object_foreach (json, key_str, value)
-                {
-                  USE_SAFE_ALLOCA;
-                  ptrdiff_t key_str_len = strlen (key_str);
-                  char *keyword_key_str = SAFE_ALLOCA (1 + key_str_len + 1);
-                  keyword_key_str[0] = ':';
-                  strcpy (&keyword_key_str[1], key_str);
-                  Lisp_Object key = intern_1 (keyword_key_str, key_str_len + 1);
-                  /* Build the plist as value-key since we're going to
-                     reverse it in the end.*/
-                  result = Fcons (key, result);
-                  result = Fcons (json_to_lisp (value, conf), result);
-                  SAFE_FREE ();
-                }
-              result = Fnreverse (result);
-              break;
-            }
-          default:
-            /* Can't get here.  */
-            emacs_abort ();
-          }
-        --lisp_eval_depth;
-        return result;
+	result = CALLN (Fmake_hash_table, QCtest, Qequal, QCsize,
+			make_fixed_natnum (n));
+	struct Lisp_Hash_Table *h = XHASH_TABLE (result);
+	for (ptrdiff_t i = 0; i < n; i++)
+	  {
+	    Lisp_Object key = members[2 * i], value = members[2 * i + 1];
+	    Lisp_Object hash;
+	    ptrdiff_t j = hash_lookup (h, key, &hash);
+	    if (j < 0)
+	      hash_put (h, key, value, hash);
+	    else
+	      set_hash_value_slot (h, j, value);
+	  }
+	break;
       }
+    case json_object_alist:
+      json_merge_duplicate_keys (p, members, n);
+      result = Qnil;
+      for (ptrdiff_t i = n - 1; i >= 0; i--)
+	if (!EQ (members[2 * i], Qunbound))
+	  result = Fcons (Fcons (members[2 * i], members[2 * i + 1]), result);
+      break;
+    case json_object_plist:
+      json_merge_duplicate_keys (p, members, n);
+      result = Qnil;
+      for (ptrdiff_t i = n - 1; i >= 0; i--)
+	if (!EQ (members[2 * i], Qunbound))
+	  result = Fcons (members[2 * i], Fcons (members[2 * i + 1], result));
+      break;
+    default:
+      emacs_abort ();
     }
-  /* Can't get here.  */
-  emacs_abort ();
+  p->object_workspace_current = first;
+  json_parse_unnest ();
+  return result;
+}
+
+/* Parse the rest of the value whose first byte C has been read.  */
+
+static Lisp_Object
+json_parse_value (struct json_parser *p, int c)
+{
+  switch (c)
+    {
+    case '{':
+      return json_parse_object (p);
+    case '[':
+      return json_parse_array (p);
+    case '"':
+      return json_parse_string (p);
+    case 't':
+      json_parse_literal (p, "true");
+      return Qt;
+    case 'f':
+      json_parse_literal (p, "false");
+      return p->conf.false_object;
+    case 'n':
+      json_parse_literal (p, "null");
+      return p->conf.null_object;
+    case '-': case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      return json_parse_number (p, c);
+    default:
+      json_signal_error (p, Qjson_parse_error, "invalid token");
+    }
+}
+
+/* Parse an array or object, and leave P just after it.  */
+
+static Lisp_Object
+json_parse_toplevel (struct json_parser *p)
+{
+  int c = json_skip_whitespace (p);
+  if (c != '[' && c != '{')
+    json_signal_error (p, Qjson_parse_error, "'[' or '{' expected");
+  return json_parse_value (p, c);
+}
+
+/* Return the JSON value in the NBYTES bytes of text at DATA,
+   configured by CONF.  Signal an error if there is anything else.  */
+
+static Lisp_Object
+json_parse_text (struct json_configuration conf,
+		 unsigned char const *data, ptrdiff_t nbytes)
+{
+  ptrdiff_t count = SPECPDL_INDEX ();
+  struct json_parser p;
+  json_parser_init (&p, conf, "<string>", data, nbytes, NULL, 0);
+  record_unwind_protect_ptr (json_parser_done, &p);
+  Lisp_Object result = json_parse_toplevel (&p);
+  if (0 <= json_skip_whitespace_if_possible (&p))
+    {
+      json_input_unget (&p);
+      json_signal_error (&p, Qjson_trailing_content,
+			 "end of input expected");
+    }
+  return unbind_to (count, result);
 }
 
 DEFUN ("json-parse-string", Fjson_parse_string, Sjson_parse_string, 1, MANY,
@@ -956,70 +1526,234 @@ represent a JSON false value.  It defaults to `:false'.
 usage: (json-parse-string STRING &rest ARGS) */)
   (ptrdiff_t nargs, Lisp_Object *args)
 {
-  ptrdiff_t count = SPECPDL_INDEX ();
-
-#ifdef WINDOWSNT
-  if (!json_initialized)
-    {
-      Lisp_Object status;
-      json_initialized = init_json_functions ();
-      status = json_initialized ? Qt : Qnil;
-      Vlibrary_cache = Fcons (Fcons (Qjson, status), Vlibrary_cache);
-    }
-  if (!json_initialized)
-    {
-      message1 ("jansson library not found");
-      return Qnil;
-    }
-#endif
-
   Lisp_Object string = args[0];
   CHECK_STRING (string);
-  Lisp_Object encoded = json_encode (string);
-  check_string_without_embedded_nulls (encoded);
+  if (json_string_has_raw_bytes (string))
+    string = json_encode (string);
+  check_string_without_embedded_nulls (string);
   struct json_configuration conf =
     {json_object_hashtable, json_array_array, QCnull, QCfalse};
-  json_parse_args (nargs - 1, args + 1, &conf, true);
+  json_parse_args (nargs - 1, args + 1, &conf, true, NULL);
+  return json_parse_text (conf, SDATA (string), SBYTES (string));
+}
+
+/* Store in CONF the configuration given by ARGS, a list of
+   keyword/argument pairs as accepted by `json-parse-string'.  */
 
-  json_error_t error;
-  json_t *object = json_loads (SSDATA (encoded), 0, &error);
-  if (object == NULL)
-    json_parse_error (&error);
+static void
+json_parse_arg_list (Lisp_Object args, struct json_configuration *conf)
+{
+  Lisp_Object *vec;
+  USE_SAFE_ALLOCA;
+  ptrdiff_t nargs = list_length (args);
+  SAFE_ALLOCA_LISP (vec, nargs);
+  for (ptrdiff_t i = 0; i < nargs; i++, args = XCDR (args))
+    vec[i] = XCAR (args);
+  json_parse_args (nargs, vec, conf, true, NULL);
+  SAFE_FREE ();
+}
 
-  /* Avoid leaking the object in case of further errors.  */
-  if (object != NULL)
-    record_unwind_protect_ptr (json_release_object, object);
+/* Signal an error unless ARGS is a list of keyword/argument pairs
+   that `json-parse-string' accepts.  */
 
-  return unbind_to (count, json_to_lisp (object, &conf));
+void
+json_check_parse_args (Lisp_Object args)
+{
+  struct json_configuration conf =
+    {json_object_hashtable, json_array_array, QCnull, QCfalse};
+  json_parse_arg_list (args, &conf);
 }
 
-struct json_read_buffer_data
+/* Return the JSON value in the NBYTES bytes of UTF-8 text at DATA,
+   configured by ARGS as in `json-parse-string'.  Signal an error if
+   the text is not exactly one JSON value.  This is for callers that
+   have the text in a C buffer, such as the message framing of process
+   output, and it doesn't allocate a Lisp string for the text.  */
+
+Lisp_Object
+json_parse_bytes (unsigned char const *data, ptrdiff_t nbytes,
+		  Lisp_Object args)
 {
-  /* Byte position of position to read the next chunk from.  */
-  ptrdiff_t point;
+  struct json_configuration conf =
+    {json_object_hashtable, json_array_array, QCnull, QCfalse};
+  json_parse_arg_list (args, &conf);
+  return json_parse_text (conf, data, nbytes);
+}
+
+/* Make P parse the accessible text of the current buffer from the
+   byte position BEG on.  */
+
+static void
+json_parser_init_buffer (struct json_parser *p,
+			 struct json_configuration conf, ptrdiff_t beg)
+{
+  ptrdiff_t end = ZV_BYTE;
+  if (beg < GPT_BYTE && GPT_BYTE < end)
+    json_parser_init (p, conf, "<buffer>",
+		      BYTE_POS_ADDR (beg), GPT_BYTE - beg,
+		      GAP_END_ADDR, end - GPT_BYTE);
+  else
+    json_parser_init (p, conf, "<buffer>",
+		      BYTE_POS_ADDR (beg), end - beg, NULL, 0);
+}
+
+
+/* Resuming the parse of incomplete buffer text.
+
+   A parse state lets `json-parse-buffer' tell whether the text after
+   point holds a whole JSON value by looking only at the text added
+   since the previous call: it records how far it scanned, and the
+   nesting depth of arrays and objects there.  The parser proper runs
+   only once the closing bracket of the value is in the buffer.
+
+   The state can be resumed only if no text changed since then, except
+   by insertion at the end of the buffer.  It records the character
+   modification count and the size of the buffer for that purpose.  */
+
+enum json_scan_slot
+  {
+    JSON_SCAN_BUFFER = 1,	/* The buffer.  */
+    JSON_SCAN_BEG,		/* The byte position of the value.  */
+    JSON_SCAN_POS,		/* The byte position scanned up to.  */
+    JSON_SCAN_DEPTH,		/* The nesting depth there.  */
+    JSON_SCAN_STRING,		/* Whether that is in a string,
+				   1 if so, 2 if after a backslash.  */
+    JSON_SCAN_LINE,		/* The number of newlines from BEG.  */
+    JSON_SCAN_BOL,		/* The byte position after the last.  */
+    JSON_SCAN_MODIFF,		/* The value of CHARS_MODIFF.  */
+    JSON_SCAN_Z,		/* The value of Z_BYTE.  */
+    JSON_SCAN_SLOTS
+  };
+
+/* The part of a parse state that changes while scanning.  */
+
+struct json_scan
+{
+  ptrdiff_t pos, depth, line, bol;
+  int string;
 };
 
-/* Callback for json_load_callback that reads from the current buffer.
-   DATA must point to a structure of type json_read_buffer_data.
-   data->point must point to the byte position to read from; after
-   reading, data->point is advanced accordingly.  The buffer point
-   itself is ignored.  This function may not exit nonlocally.  */
+/* Scan the buffer text from S->pos to the byte position END.  Return
+   true if that completes the JSON value, or shows that it can't be
+   one; return false if the value needs more text.  */
 
-static size_t
-json_read_buffer_callback (void *buffer, size_t buflen, void *data)
+static bool
+json_scan_buffer (struct json_scan *s, ptrdiff_t end)
 {
-  struct json_read_buffer_data *d = data;
+  while (s->pos < end)
+    {
+      ptrdiff_t limit = min (end, BUFFER_CEILING_OF (s->pos) + 1);
+      unsigned char const *beg = BYTE_POS_ADDR (s->pos);
+      unsigned char const *q = beg, *qend = beg + (limit - s->pos);
+      while (q < qend)
+	{
+	  if (s->string == 2)
+	    {
+	      s->string = 1;
+	      q++;
+	    }
+	  else if (s->string)
+	    {
+	      q = json_skip_to_quote (q, qend);
+	      if (q < qend)
+		s->string = *q++ == '\\' ? 2 : 0;
+	    }
+	  else
+	    {
+	      int c = *q++;
+	      /* A value must be an array or an object, so a string
+		 outside of them ends the scan like any other token.  */
+	      if (c == '"' && s->depth > 0)
+		s->string = 1;
+	      else if (c == '[' || c == '{')
+		s->depth++;
+	      else if (c == ']' || c == '}')
+		{
+		  if (--s->depth <= 0)
+		    return true;
+		}
+	      else if (c == '\n')
+		{
+		  s->line++;
+		  s->bol = s->pos + (q - beg);
+		}
+	      else if (s->depth == 0 && c != ' ' && c != '\t' && c != '\r')
+		return true;
+	    }
+	}
+      s->pos = limit;
+    }
+  return false;
+}
+
+DEFUN ("json-make-parse-state", Fjson_make_parse_state,
+       Sjson_make_parse_state, 0, 0, 0,
+       doc: /* Return a new state for parsing JSON text incrementally.
+Pass it to `json-parse-buffer' as the value of the keyword argument
+`:state', to avoid scanning the text of an incomplete JSON value
+anew each time more of it arrives.  */)
+  (void)
+{
+  return Fmake_record (Qjson_parse_state,
+		       make_fixnum (JSON_SCAN_SLOTS - 1), Qnil);
+}
+
+/* Scan the buffer text after point with the parse state STATE, and
+   signal `json-end-of-file' if it is not a whole JSON value yet.  */
+
+static void
+json_check_complete (Lisp_Object state)
+{
+  CHECK_TYPE (RECORDP (state) && EQ (AREF (state, 0), Qjson_parse_state),
+	      Qjson_parse_state_p, state);
+
+  /* Start over unless the state is about the same value, and the text
+     was only added to at the end of the buffer since.  */
+  Lisp_Object buffer;
+  XSETBUFFER (buffer, current_buffer);
+  struct json_scan s;
+  intmax_t modiff;
+  if (EQ (AREF (state, JSON_SCAN_BUFFER), buffer)
+      && EQ (AREF (state, JSON_SCAN_BEG), make_fixnum (PT_BYTE))
+      && integer_to_intmax (AREF (state, JSON_SCAN_MODIFF), &modiff)
+      && BUF_INNER_MODIFF (current_buffer) <= modiff
+      && XFIXNUM (AREF (state, JSON_SCAN_Z)) <= Z_BYTE
+      && XFIXNUM (AREF (state, JSON_SCAN_POS)) <= ZV_BYTE)
+    {
+      s.pos = XFIXNUM (AREF (state, JSON_SCAN_POS));
+      s.depth = XFIXNUM (AREF (state, JSON_SCAN_DEPTH));
+      s.string = XFIXNUM (AREF (state, JSON_SCAN_STRING));
+      s.line = XFIXNUM (AREF (state, JSON_SCAN_LINE));
+      s.bol = XFIXNUM (AREF (state, JSON_SCAN_BOL));
+    }
+  else
+    {
+      s.pos = s.bol = PT_BYTE;
+      s.depth = s.line = s.string = 0;
+    }
 
-  /* First, parse from point to the gap or the end of the accessible
-     portion, whatever is closer.  */
-  ptrdiff_t point = d->point;
-  ptrdiff_t end = BUFFER_CEILING_OF (point) + 1;
-  ptrdiff_t count = end - point;
-  if (buflen < count)
-    count = buflen;
-  memcpy (buffer, BYTE_POS_ADDR (point), count);
-  d->point += count;
-  return count;
+  bool complete = json_scan_buffer (&s, ZV_BYTE);
+  if (complete)
+    /* The next value will start elsewhere.  */
+    ASET (state, JSON_SCAN_BUFFER, Qnil);
+  else
+    {
+      ASET (state, JSON_SCAN_BUFFER, buffer);
+      ASET (state, JSON_SCAN_BEG, make_fixnum (PT_BYTE));
+      ASET (state, JSON_SCAN_POS, make_fixnum (s.pos));
+      ASET (state, JSON_SCAN_DEPTH, make_fixnum (s.depth));
+      ASET (state, JSON_SCAN_STRING, make_fixnum (s.string));
+      ASET (state, JSON_SCAN_LINE, make_fixnum (s.line));
+      ASET (state, JSON_SCAN_BOL, make_fixnum (s.bol));
+      ASET (state, JSON_SCAN_MODIFF, modiff_to_integer (CHARS_MODIFF));
+      ASET (state, JSON_SCAN_Z, make_fixnum (Z_BYTE));
+      xsignal (Qjson_end_of_file,
+	       list5 (build_string ("unexpected end of input"),
+		      build_string ("<buffer>"),
+		      make_int (s.line + 1),
+		      make_int (BYTE_TO_CHAR (s.pos) - BYTE_TO_CHAR (s.bol)),
+		      make_int (s.pos - PT_BYTE)));
+    }
 }
 
 DEFUN ("json-parse-buffer", Fjson_parse_buffer, Sjson_parse_buffer,
@@ -1051,50 +1785,38 @@ to represent a JSON null value.  It defaults to `:null'.
 
 The keyword argument `:false-object' specifies which object to use to
 represent a JSON false value.  It defaults to `:false'.
+
+The keyword argument `:state', if non-nil, is a state made by
+`json-make-parse-state'.  If the object after point is incomplete,
+the error `json-end-of-file' that says so leaves in the state how far
+the text was scanned, and another call with the same state and point
+resumes there if text was only inserted at the end of the buffer in
+between; after any other change, it scans the text anew.  This lets a process filter parse its output as it arrives,
+without scanning the beginning of a large object over and over.
 usage: (json-parse-buffer &rest args) */)
      (ptrdiff_t nargs, Lisp_Object *args)
 {
   ptrdiff_t count = SPECPDL_INDEX ();
 
-#ifdef WINDOWSNT
-  if (!json_initialized)
-    {
-      Lisp_Object status;
-      json_initialized = init_json_functions ();
-      status = json_initialized ? Qt : Qnil;
-      Vlibrary_cache = Fcons (Fcons (Qjson, status), Vlibrary_cache);
-    }
-  if (!json_initialized)
-    {
-      message1 ("jansson library not found");
-      return Qnil;
-    }
-#endif
-
+  Lisp_Object state = Qnil;
   struct json_configuration conf =
     {json_object_hashtable, json_array_array, QCnull, QCfalse};
-  json_parse_args (nargs, args, &conf, true);
+  json_parse_args (nargs, args, &conf, true, &state);
 
-  ptrdiff_t point = PT_BYTE;
-  struct json_read_buffer_data data = {.point = point};
-  json_error_t error;
-  json_t *object = json_load_callback (json_read_buffer_callback, &data,
-                                       JSON_DISABLE_EOF_CHECK, &error);
+  if (!NILP (state))
+    json_check_complete (state);
 
-  if (object == NULL)
-    json_parse_error (&error);
-
-  /* Avoid leaking the object in case of further errors.  */
-  record_unwind_protect_ptr (json_release_object, object);
-
-  /* Convert and then move point only if everything succeeded.  */
-  Lisp_Object lisp = json_to_lisp (object, &conf);
+  struct json_parser p;
+  ptrdiff_t point = PT_BYTE;
+  json_parser_init_buffer (&p, conf, point);
+  record_unwind_protect_ptr (json_parser_done, &p);
+  Lisp_Object result = json_parse_toplevel (&p);
 
-  /* Adjust point by how much we just read.  */
-  point += error.position;
+  /* Move point after what we read.  */
+  point += json_input_position (&p);
   SET_PT_BOTH (BYTE_TO_CHAR (point), point);
 
-  return unbind_to (count, lisp);
+  return unbind_to (count, result);
 }
 
 /* Simplified version of 'define-error' that works with pure
@@ -1153,12 +1875,16 @@ syms_of_json (void)
   DEFSYM (QCarray_type, ":array-type");
   DEFSYM (QCnull_object, ":null-object");
   DEFSYM (QCfalse_object, ":false-object");
+  DEFSYM (QCstate, ":state");
   DEFSYM (Qalist, "alist");
   DEFSYM (Qplist, "plist");
   DEFSYM (Qarray, "array");
+  DEFSYM (Qjson_parse_state, "json-parse-state");
+  DEFSYM (Qjson_parse_state_p, "json-parse-state-p");
 
   defsubr (&Sjson_serialize);
   defsubr (&Sjson_insert);
   defsubr (&Sjson_parse_string);
+  defsubr (&Sjson_make_parse_state);
   defsubr (&Sjson_parse_buffer);
 }
@@ -1651,8 +1651,8 @@ adjust_point_for_property (ptrdiff_t last_pt, bool modified)
 	  && display_prop_intangible_p (val, overlay, PT, PT_BYTE)
 	  && (!OVERLAYP (overlay)
 	      ? get_property_and_range (PT, Qdisplay, &val, &beg, &end, Qnil)
-	      : (beg = OVERLAY_POSITION (OVERLAY_START (overlay)),
-		 end = OVERLAY_POSITION (OVERLAY_END (overlay))))
+	      : (beg = OVERLAY_START (overlay),
+		 end = OVERLAY_END (overlay)))
 	  && (beg < PT /* && end > PT   <- It's always the case.  */
 	      || (beg <= PT && STRINGP (val) && SCHARS (val) == 0)))
 	{
@@ -2755,6 +2755,11 @@ read_char (int commandflag, Lisp_Object map,
 	maybe_gc ();
     }
 
+  /* Finish the sweep of the last garbage collection while idle.  */
+  if (NILP (c))
+    while (!detect_input_pending () && lazy_sweep_some_blocks ())
+      continue;
+
   /* Notify the caller if an autosave hook, or a timer, sentinel or
      filter in the sit_for calls above have changed the current
      kboard.  This could happen if they use the minibuffer or start a
@@ -0,0 +1,495 @@
+/* An index of the lines of a buffer.
+
+Copyright (C) 2020 Free Software Foundation, Inc.
+
+This file is part of GNU Emacs.
+
+GNU Emacs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+GNU Emacs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include "lisp.h"
+#include "character.h"
+#include "buffer.h"
+#include "line-index.h"
+
+/* The index divides the text into chunks of between CHUNK_SIZE and
+   twice as many bytes, except when there is less text than that, and
+   records where each chunk starts.  A binary search finds the chunk
+   holding a position or a newline, and only that chunk has to be
+   scanned to answer a question.  When the text changes, only the
+   chunks holding changed text are counted anew, but the starts of all
+   the chunks after them must be shifted; as there are few chunks
+   even in huge buffers, that is cheap.
+
+   Within each chunk, the index also records how many characters
+   precede every BLOCK_SIZE'th byte, so that converting between
+   character and byte positions never scans more than BLOCK_SIZE
+   bytes.  These counts are relative to the start of their chunk, and
+   so remain valid when the chunk moves.  */
+
+enum { CHUNK_SIZE = 64 * 1024, BLOCK_SIZE = 4 * 1024 };
+
+/* A chunk is shorter than twice CHUNK_SIZE, plus the tail of a
+   character.  */
+
+enum { BLOCKS_PER_CHUNK = 2 * CHUNK_SIZE / BLOCK_SIZE + 1 };
+
+/* A position in the text, as offsets from the beginning of the
+   buffer.  */
+
+struct line_index_pos
+{
+  ptrdiff_t bytes, chars, newlines;
+};
+
+/* A record of the text that changed since part of an index was last
+   brought up to date.  If CHANGED, the text changed except for its
+   first BEG_UNCHANGED and last END_UNCHANGED characters.  */
+
+struct line_index_change
+{
+  bool changed;
+  ptrdiff_t beg_unchanged, end_unchanged;
+};
+
+struct line_index
+{
+  /* The number of chunks, and the number of elements allocated for
+     START.  */
+  ptrdiff_t nchunks, size;
+
+  /* START[I] is where chunk I begins.  START[NCHUNKS] is the end of
+     the text, as it was when the index was last brought up to
+     date.  */
+  struct line_index_pos *start;
+
+  /* BLOCKS[I][M - 1] is the number of characters of chunk I that
+     start before its byte offset M * BLOCK_SIZE.  */
+  int (*blocks)[BLOCKS_PER_CHUNK];
+
+  /* The text that changed since the lines were last counted, and the
+     subset of it whose characters were inserted, deleted or replaced
+     by characters of different lengths since the index was last used
+     to convert positions.  The latter can be brought up to date on
+     its own, even in the middle of a change to the buffer, as the
+     former still covers the lines that may be miscounted.  */
+  struct line_index_change lines, text;
+};
+
+static struct line_index *
+new_line_index (void)
+{
+  struct line_index *idx = xmalloc (sizeof *idx);
+  idx->nchunks = 0;
+  idx->size = 1;
+  idx->start = xzalloc (sizeof *idx->start);
+  idx->blocks = xmalloc (sizeof *idx->blocks);
+  idx->lines.changed = idx->text.changed = true;
+  idx->lines.beg_unchanged = idx->lines.end_unchanged = 0;
+  idx->text.beg_unchanged = idx->text.end_unchanged = 0;
+  return idx;
+}
+
+void
+free_line_index (struct line_index *idx)
+{
+  xfree (idx->start);
+  xfree (idx->blocks);
+  xfree (idx);
+}
+
+static void
+note_change (struct line_index_change *change,
+	     ptrdiff_t beg_unchanged, ptrdiff_t end_unchanged)
+{
+  if (change->changed)
+    {
+      change->beg_unchanged = min (change->beg_unchanged, beg_unchanged);
+      change->end_unchanged = min (change->end_unchanged, end_unchanged);
+    }
+  else
+    {
+      change->changed = true;
+      change->beg_unchanged = beg_unchanged;
+      change->end_unchanged = end_unchanged;
+    }
+}
+
+void
+invalidate_line_index (struct line_index *idx,
+		       ptrdiff_t beg_unchanged, ptrdiff_t end_unchanged)
+{
+  note_change (&idx->lines, beg_unchanged, end_unchanged);
+}
+
+void
+invalidate_line_index_text (struct buffer *b,
+			    ptrdiff_t beg_unchanged, ptrdiff_t end_unchanged)
+{
+  if (b->base_buffer)
+    b = b->base_buffer;
+  if (b->line_index)
+    {
+      note_change (&b->line_index->lines, beg_unchanged, end_unchanged);
+      note_change (&b->line_index->text, beg_unchanged, end_unchanged);
+    }
+}
+
+
+/* Counting text.  */
+
+/* Return the number of characters in the N bytes of multibyte text
+   at P.  */
+
+static ptrdiff_t
+count_chars (unsigned char const *p, ptrdiff_t n)
+{
+  ptrdiff_t tails = 0;
+  for (ptrdiff_t i = 0; i < n; i++)
+    tails += !CHAR_HEAD_P (p[i]);
+  return n - tails;
+}
+
+/* Add to *POS the bytes, characters and newlines of the text of
+   buffer B between the byte offsets FROM and TO.  If CHARS is false,
+   count only bytes and newlines.  */
+
+static void
+count_text (struct buffer *b, ptrdiff_t from, ptrdiff_t to,
+	    struct line_index_pos *pos, bool chars)
+{
+  bool multibyte = !NILP (BVAR (b, enable_multibyte_characters));
+  ptrdiff_t gpt = BUF_GPT_BYTE (b) - BUF_BEG_BYTE (b);
+
+  while (from < to)
+    {
+      ptrdiff_t stop = from < gpt ? min (to, gpt) : to;
+      unsigned char *p = BUF_BYTE_ADDRESS (b, BUF_BEG_BYTE (b) + from);
+      ptrdiff_t n = stop - from;
+      pos->bytes += n;
+      if (chars)
+	pos->chars += multibyte ? count_chars (p, n) : n;
+      pos->newlines += count_newlines (p, n);
+      from = stop;
+    }
+}
+
+/* Return the number of characters of buffer B that start between the
+   byte offsets FROM and TO.  */
+
+static ptrdiff_t
+count_heads (struct buffer *b, ptrdiff_t from, ptrdiff_t to)
+{
+  if (NILP (BVAR (b, enable_multibyte_characters)))
+    return to - from;
+
+  ptrdiff_t gpt = BUF_GPT_BYTE (b) - BUF_BEG_BYTE (b), chars = 0;
+  while (from < to)
+    {
+      ptrdiff_t stop = from < gpt ? min (to, gpt) : to;
+      chars += count_chars (BUF_BYTE_ADDRESS (b, BUF_BEG_BYTE (b) + from),
+			    stop - from);
+      from = stop;
+    }
+  return chars;
+}
+
+/* Count the text of chunk K of the index IDX of buffer B, which
+   starts at *POS and ends at the byte offset TO, adding it to *POS
+   and recording the characters before each of its blocks.  */
+
+static void
+count_chunk (struct buffer *b, struct line_index *idx, ptrdiff_t k,
+	     struct line_index_pos *pos, ptrdiff_t to)
+{
+  ptrdiff_t from = pos->bytes, chars = pos->chars;
+  for (int m = 1; from + m * BLOCK_SIZE < to; m++)
+    {
+      count_text (b, pos->bytes, from + m * BLOCK_SIZE, pos, true);
+      idx->blocks[k][m - 1] = pos->chars - chars;
+    }
+  count_text (b, pos->bytes, to, pos, true);
+}
+
+/* Return the byte offset of the first character of buffer B that
+   starts at or after the byte offset BYTES.  */
+
+static ptrdiff_t
+char_head (struct buffer *b, ptrdiff_t bytes)
+{
+  if (!NILP (BVAR (b, enable_multibyte_characters)))
+    while (bytes < BUF_Z_BYTE (b) - BUF_BEG_BYTE (b)
+	   && !CHAR_HEAD_P (BUF_FETCH_BYTE (b, BUF_BEG_BYTE (b) + bytes)))
+      bytes++;
+  return bytes;
+}
+
+
+/* Bringing the index up to date.  */
+
+/* Return the index of the last chunk of IDX that starts at or before
+   VALUE, as measured by the member of struct line_index_pos at offset
+   MEMBER.  Return -1 if there is no such chunk.  */
+
+static ptrdiff_t
+find_chunk (struct line_index *idx, size_t member, ptrdiff_t value)
+{
+  ptrdiff_t lo = 0, hi = idx->nchunks;
+
+  /* The chunk is in [LO - 1, HI - 1].  */
+  while (lo < hi)
+    {
+      ptrdiff_t mid = lo + (hi - lo) / 2;
+      ptrdiff_t v = *(ptrdiff_t *) ((char *) &idx->start[mid] + member);
+      if (v <= value)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo - 1;
+}
+
+/* Count anew the text of buffer B that changed since the line index
+   IDX was last brought up to date, as recorded in CHANGE, which is
+   either of the records of IDX.  */
+
+static void
+revalidate_line_index (struct buffer *b, struct line_index *idx,
+		       struct line_index_change *change)
+{
+  struct line_index_pos *start = idx->start;
+  struct line_index_pos old_end = start[idx->nchunks];
+  ptrdiff_t new_chars = BUF_Z (b) - BUF_BEG (b);
+  ptrdiff_t new_bytes = BUF_Z_BYTE (b) - BUF_BEG_BYTE (b);
+
+  /* The changed text is between the unchanged BEG characters at the
+     beginning and the unchanged END characters at the end.  If the
+     text changed without telling us, count it all again.  */
+  ptrdiff_t beg = 0, end = 0;
+  if (change->changed)
+    {
+      beg = min (change->beg_unchanged, min (old_end.chars, new_chars));
+      end = min (change->end_unchanged,
+		 min (old_end.chars, new_chars) - beg);
+    }
+
+  /* The chunks from I to J - 1 hold changed text.  Extend them to a
+     neighboring chunk when the change is at a chunk boundary, so that
+     inserted text joins an existing chunk.  */
+  ptrdiff_t i = max (0, find_chunk (idx, offsetof (struct line_index_pos,
+						  chars), beg));
+  if (0 < i && start[i].chars == beg)
+    i--;
+  ptrdiff_t j = find_chunk (idx, offsetof (struct line_index_pos, chars),
+			    old_end.chars - end - 1) + 1;
+  j = max (j, min (i + 1, idx->nchunks));
+
+  /* Divide the text that replaces those chunks into new chunks.  */
+  ptrdiff_t from = start[i].bytes;
+  ptrdiff_t to = new_bytes - (old_end.bytes - start[j].bytes);
+  ptrdiff_t n = (to - from) / CHUNK_SIZE;
+  if (n == 0 && from < to)
+    n = 1;
+  ptrdiff_t nchunks = idx->nchunks - (j - i) + n;
+  if (idx->size <= nchunks)
+    {
+      idx->start = xpalloc (idx->start, &idx->size,
+			    nchunks + 1 - idx->size, -1,
+			    sizeof *idx->start);
+      idx->blocks = xnrealloc (idx->blocks, idx->size,
+			       sizeof *idx->blocks);
+      start = idx->start;
+    }
+  struct line_index_pos pos = start[i], old_j = start[j];
+  memmove (&start[i + n], &start[j],
+	   (idx->nchunks - j + 1) * sizeof *start);
+  memmove (&idx->blocks[i + n], &idx->blocks[j],
+	   (idx->nchunks - j) * sizeof *idx->blocks);
+  for (ptrdiff_t k = 1; k <= n; k++)
+    {
+      ptrdiff_t next = (k == n ? to
+			: char_head (b, from + (to - from) / n * k));
+      count_chunk (b, idx, i + k - 1, &pos, next);
+      if (k < n)
+	start[i + k] = pos;
+    }
+
+  /* Shift the chunks after the changed text.  */
+  for (ptrdiff_t k = i + n; k <= nchunks; k++)
+    {
+      start[k].bytes += pos.bytes - old_j.bytes;
+      start[k].chars += pos.chars - old_j.chars;
+      start[k].newlines += pos.newlines - old_j.newlines;
+    }
+
+  idx->nchunks = nchunks;
+  change->changed = false;
+  if (change == &idx->lines)
+    idx->text.changed = false;
+  eassert (start[nchunks].bytes == new_bytes
+	   && start[nchunks].chars == new_chars);
+}
+
+/* Return the line index of buffer B, making one if needed.  Bring
+   its line counts up to date if LINES, and otherwise only its
+   character counts.  */
+
+static struct line_index *
+buffer_line_index (struct buffer *b, bool lines)
+{
+  if (b->base_buffer)
+    b = b->base_buffer;
+  if (!b->line_index)
+    b->line_index = new_line_index ();
+
+  struct line_index *idx = b->line_index;
+  struct line_index_pos *end = &idx->start[idx->nchunks];
+  if (end->bytes != BUF_Z_BYTE (b) - BUF_BEG_BYTE (b)
+      || end->chars != BUF_Z (b) - BUF_BEG (b))
+    {
+      /* The text changed without telling us.  */
+      idx->lines.changed = true;
+      idx->lines.beg_unchanged = idx->lines.end_unchanged = 0;
+      revalidate_line_index (b, idx, &idx->lines);
+    }
+  else if (lines ? idx->lines.changed : idx->text.changed)
+    revalidate_line_index (b, idx, lines ? &idx->lines : &idx->text);
+  return idx;
+}
+
+
+/* Using the index.  */
+
+ptrdiff_t
+buffer_newlines_before (struct buffer *b, ptrdiff_t bytepos)
+{
+  struct line_index *idx = buffer_line_index (b, true);
+  ptrdiff_t bytes = bytepos - BUF_BEG_BYTE (b);
+  ptrdiff_t k = find_chunk (idx, offsetof (struct line_index_pos, bytes),
+			    bytes);
+  if (k < 0)
+    return 0;
+
+  /* Count from whichever end of the chunk is nearer.  */
+  struct line_index_pos pos = idx->start[k];
+  if (bytes - pos.bytes <= idx->start[k + 1].bytes - bytes)
+    {
+      count_text (b, pos.bytes, bytes, &pos, false);
+      return pos.newlines;
+    }
+  else
+    {
+      pos.newlines = 0;
+      count_text (b, bytes, idx->start[k + 1].bytes, &pos, false);
+      return idx->start[k + 1].newlines - pos.newlines;
+    }
+}
+
+bool
+buffer_newline_position (struct buffer *b, ptrdiff_t newlines,
+			 ptrdiff_t *charpos, ptrdiff_t *bytepos)
+{
+  struct line_index *idx = buffer_line_index (b, true);
+  if (newlines <= 0)
+    {
+      *charpos = BUF_BEG (b);
+      *bytepos = BUF_BEG_BYTE (b);
+      return true;
+    }
+  if (idx->start[idx->nchunks].newlines < newlines)
+    return false;
+
+  /* Find the chunk that holds the newline, and look for it there.  */
+  ptrdiff_t k = find_chunk (idx, offsetof (struct line_index_pos, newlines),
+			    newlines - 1);
+  struct line_index_pos pos = idx->start[k];
+  ptrdiff_t gpt = BUF_GPT_BYTE (b) - BUF_BEG_BYTE (b);
+  ptrdiff_t bytes = pos.bytes, count = newlines - pos.newlines;
+
+  while (true)
+    {
+      ptrdiff_t stop = bytes < gpt ? gpt : idx->start[idx->nchunks].bytes;
+      unsigned char *p = BUF_BYTE_ADDRESS (b, BUF_BEG_BYTE (b) + bytes);
+      unsigned char *lim = p + (stop - bytes);
+      for (; (p = memchr (p, '\n', lim - p)); p++)
+	if (--count == 0)
+	  {
+	    bytes = stop - (lim - p) + 1;
+	    count_text (b, pos.bytes, bytes, &pos, true);
+	    *charpos = BUF_BEG (b) + pos.chars;
+	    *bytepos = BUF_BEG_BYTE (b) + pos.bytes;
+	    return true;
+	  }
+      bytes = stop;
+    }
+}
+
+ptrdiff_t
+line_index_bytepos_to_charpos (struct buffer *b, ptrdiff_t bytepos)
+{
+  struct line_index *idx = buffer_line_index (b, false);
+  ptrdiff_t bytes = bytepos - BUF_BEG_BYTE (b);
+  if (idx->start[idx->nchunks].bytes <= bytes)
+    return BUF_Z (b);
+  ptrdiff_t k = find_chunk (idx, offsetof (struct line_index_pos, bytes),
+			    bytes);
+
+  /* Count from the start of the block that holds BYTEPOS.  */
+  ptrdiff_t m = (bytes - idx->start[k].bytes) / BLOCK_SIZE;
+  ptrdiff_t from = idx->start[k].bytes + m * BLOCK_SIZE;
+  ptrdiff_t chars = idx->start[k].chars + (m ? idx->blocks[k][m - 1] : 0);
+  return BUF_BEG (b) + chars + count_heads (b, from, bytes);
+}
+
+ptrdiff_t
+line_index_charpos_to_bytepos (struct buffer *b, ptrdiff_t charpos)
+{
+  if (NILP (BVAR (b, enable_multibyte_characters)))
+    return charpos;
+  struct line_index *idx = buffer_line_index (b, false);
+  ptrdiff_t chars = charpos - BUF_BEG (b);
+  if (idx->start[idx->nchunks].chars <= chars)
+    return BUF_Z_BYTE (b);
+  ptrdiff_t k = find_chunk (idx, offsetof (struct line_index_pos, chars),
+			    chars);
+
+  /* Find the last block of the chunk that starts at or before the
+     character.  */
+  struct line_index_pos *pos = &idx->start[k];
+  int *blocks = idx->blocks[k];
+  ptrdiff_t lo = 0;
+  ptrdiff_t hi = (pos[1].bytes - pos->bytes - 1) / BLOCK_SIZE;
+  while (lo < hi)
+    {
+      ptrdiff_t mid = hi - (hi - lo) / 2;
+      if (blocks[mid - 1] <= chars - pos->chars)
+	lo = mid;
+      else
+	hi = mid - 1;
+    }
+
+  /* Look for the character's first byte there.  */
+  ptrdiff_t bytes = pos->bytes + lo * BLOCK_SIZE;
+  ptrdiff_t count = chars - pos->chars - (lo ? blocks[lo - 1] : 0);
+  ptrdiff_t gpt = BUF_GPT_BYTE (b) - BUF_BEG_BYTE (b);
+  while (true)
+    {
+      ptrdiff_t stop = bytes < gpt ? gpt : pos[1].bytes;
+      unsigned char *p = BUF_BYTE_ADDRESS (b, BUF_BEG_BYTE (b) + bytes);
+      for (; bytes < stop; bytes++, p++)
+	if (CHAR_HEAD_P (*p) && count-- == 0)
+	  return BUF_BEG_BYTE (b) + bytes;
+    }
+}
@@ -0,0 +1,82 @@
+/* Header file: An index of the lines of a buffer.
+
+Copyright (C) 2020 Free Software Foundation, Inc.
+
+This file is part of GNU Emacs.
+
+GNU Emacs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+GNU Emacs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef EMACS_LINE_INDEX_H
+#define EMACS_LINE_INDEX_H
+
+#include "lisp.h"
+
+/* The line index of a buffer lets Emacs find the line number of a
+   position, or the position of a line number, without counting the
+   newlines from the beginning of the buffer every time.  A buffer
+   gets an index the first time it is asked such a question, and the
+   index covers the whole text, regardless of any narrowing.
+
+   Like the region caches, the index is not updated when the text
+   changes: invalidate_line_index only records which part of the
+   text changed, and the index counts the lines of that part anew
+   the next time it is consulted.
+
+   The index also counts the characters of the text, and so serves to
+   convert between character and byte positions in time that does
+   not depend on the size of the buffer or its number of markers.  */
+
+struct buffer;
+struct line_index;
+
+/* Free the line index IDX.  */
+extern void free_line_index (struct line_index *idx);
+
+/* Tell the line index IDX that the text changed, except for the
+   first BEG_UNCHANGED and the last END_UNCHANGED characters of the
+   buffer.  */
+extern void invalidate_line_index (struct line_index *idx,
+				   ptrdiff_t beg_unchanged,
+				   ptrdiff_t end_unchanged);
+
+/* Tell the line index of buffer B, if any, that characters were
+   inserted, deleted, or replaced by characters of other lengths,
+   except for the first BEG_UNCHANGED and the last END_UNCHANGED
+   characters of the buffer.  Unless the change alters the size of
+   the text, this must be called after the change, not before.  */
+extern void invalidate_line_index_text (struct buffer *b,
+					ptrdiff_t beg_unchanged,
+					ptrdiff_t end_unchanged);
+
+/* Return the number of newlines in the text of buffer B before the
+   byte position BYTEPOS.  */
+extern ptrdiff_t buffer_newlines_before (struct buffer *b, ptrdiff_t bytepos);
+
+/* Find the position just after the NEWLINES'th newline of buffer B,
+   and store it in *CHARPOS and *BYTEPOS.  Return false if B has fewer
+   newlines than that.  */
+extern bool buffer_newline_position (struct buffer *b, ptrdiff_t newlines,
+				     ptrdiff_t *charpos, ptrdiff_t *bytepos);
+
+/* Return the character position of the byte position BYTEPOS of
+   buffer B, which must be at a character boundary.  */
+extern ptrdiff_t line_index_bytepos_to_charpos (struct buffer *b,
+						ptrdiff_t bytepos);
+
+/* Return the byte position of the character position CHARPOS of
+   buffer B.  */
+extern ptrdiff_t line_index_charpos_to_bytepos (struct buffer *b,
+						ptrdiff_t charpos);
+
+#endif /* EMACS_LINE_INDEX_H */
@@ -1423,6 +1423,22 @@ INLINE Lisp_Object
   return lisp_h_XCDR (c);
 }
 
+/* True if minor garbage collections need to know about stores into
+   old cons cells; see remember_cons_store in alloc.c.  */
+extern bool gc_write_barrier;
+extern void remember_cons_store (struct Lisp_Cons *);
+
+/* The write barrier used by minor garbage collections.  Call this
+   after storing N into a field of the cons C.  Only conses and floats
+   are allocated young, so storing any other object needs no
+   bookkeeping.  */
+INLINE void
+cons_write_barrier (Lisp_Object c, Lisp_Object n)
+{
+  if (gc_write_barrier && (CONSP (n) || TAGGEDP (n, Lisp_Float)))
+    remember_cons_store (XCONS (c));
+}
+
 /* Use these to set the fields of a cons cell.
 
    Note that both arguments may refer to the same object, so 'n'
@@ -1431,11 +1447,13 @@ INLINE void
 XSETCAR (Lisp_Object c, Lisp_Object n)
 {
   *xcar_addr (c) = n;
+  cons_write_barrier (c, n);
 }
 INLINE void
 XSETCDR (Lisp_Object c, Lisp_Object n)
 {
   *xcdr_addr (c) = n;
+  cons_write_barrier (c, n);
 }
 
 /* Take the car or cdr of something whose type is not known.  */
@@ -2263,6 +2281,22 @@ struct hash_table_test
   Lisp_Object (*hashfn) (Lisp_Object, struct Lisp_Hash_Table *);
 };
 
+/* The type of the number of an entry of a hash table.  */
+typedef int32_t hash_idx_t;
+
+/* The type of the hash codes kept in the buckets of a hash table.  */
+typedef uint32_t hash_hash_t;
+
+/* A bucket of the index of a hash table.  */
+struct hash_table_bucket
+{
+  /* The hash code of the key of the entry, reduced to hash_hash_t.  */
+  hash_hash_t hash;
+
+  /* The number of the entry, or -1 if the bucket is empty.  */
+  hash_idx_t entry;
+};
+
 struct Lisp_Hash_Table
 {
   /* Change pdumper.c if you change the fields here.  */
@@ -2274,24 +2308,8 @@ struct Lisp_Hash_Table
      weakness of the table.  */
   Lisp_Object weak;
 
-  /* Vector of hash codes, or nil if the table needs rehashing.
-     If the I-th entry is unused, then hash[I] should be nil.  */
-  Lisp_Object hash;
-
-  /* Vector used to chain entries.  If entry I is free, next[I] is the
-     entry number of the next free item.  If entry I is non-free,
-     next[I] is the index of the next entry in the collision chain,
-     or -1 if there is such entry.  */
-  Lisp_Object next;
-
-  /* Bucket vector.  An entry of -1 indicates no item is present,
-     and a nonnegative entry is the index of the first item in
-     a collision chain.  This vector's size can be larger than the
-     hash table size to reduce collisions.  */
-  Lisp_Object index;
-
-  /* Only the fields above are traced normally by the GC.  The ones after
-     'index' are special and are either ignored by the GC or traced in
+  /* Only the field above is traced normally by the GC.  The ones after
+     'weak' are special and are either ignored by the GC or traced in
      a special way (e.g. because of weakness).  */
 
   /* Number of key/value entries in the table.  */
@@ -2309,6 +2327,16 @@ struct Lisp_Hash_Table
      immutable for recursive attempts to mutate it.  */
   bool mutable;
 
+  /* True if the home buckets of the entries depend on their scrambled
+     hash codes.  This is false at first, so that keys with nearby hash
+     codes, like consecutive integers, get nearby buckets, which helps
+     caches when they are looked up in order.  It becomes true once
+     such keys crowd the buckets, until the table grows.  */
+  bool scramble_hash;
+
+  /* The number of buckets in INDEX.  */
+  ptrdiff_t index_size;
+
   /* Resize hash table when number of entries / table size is >= this
      ratio.  */
   float rehash_threshold;
@@ -2329,6 +2357,23 @@ struct Lisp_Hash_Table
   /* The comparison and hash functions.  */
   struct hash_table_test test;
 
+  /* Array used to chain free entries.  If entry I is free, next[I] is
+     the entry number of the next free entry, or -1 if there is none.
+     The elements for entries in use are meaningless.  */
+  hash_idx_t *next;
+
+  /* Open-addressed array of INDEX_SIZE buckets, which refer to the
+     entries in use.  The entry whose key has the reduced hash code H
+     is looked for from its home bucket, H (or H scrambled, if
+     SCRAMBLE_HASH) modulo INDEX_SIZE, on, wrapping around at the
+     end.  The buckets are kept in "Robin Hood" order: an entry is
+     never farther from its home bucket than the entries it comes
+     after are from theirs, so a lookup can stop at the first bucket
+     that is closer to its home than the key would be.  This array
+     has more buckets than the table has entries, so some are always
+     empty.  */
+  struct hash_table_bucket *index;
+
   /* Next weak hash table if this is a weak hash table.  The head of
      the list is in weak_hash_tables.  Used only during garbage
      collection --- at other times, it is NULL.  */
@@ -2368,18 +2413,11 @@ HASH_VALUE (const struct Lisp_Hash_Table *h, ptrdiff_t idx)
   return AREF (h->key_and_value, 2 * idx + 1);
 }
 
-/* Value is the hash code computed for entry IDX in hash table H.  */
-INLINE Lisp_Object
-HASH_HASH (const struct Lisp_Hash_Table *h, ptrdiff_t idx)
-{
-  return AREF (h->hash, idx);
-}
-
 /* Value is the size of hash table H.  */
 INLINE ptrdiff_t
 HASH_TABLE_SIZE (const struct Lisp_Hash_Table *h)
 {
-  ptrdiff_t size = ASIZE (h->next);
+  ptrdiff_t size = ASIZE (h->key_and_value) >> 1;
   eassume (0 < size);
   return size;
 }
@@ -2441,45 +2479,38 @@ struct Lisp_Marker
      leaves the marker after the inserted text.  */
   bool_bf insertion_type : 1;
 
+  /* The node of the marker in the tree of marker positions of its
+     buffer (see itree.h), which begins and ends at the char position
+     where the marker points.  The tree adjusts the positions of the
+     markers after an insertion or deletion without visiting each of
+     them, and the byte position of a marker is computed from its char
+     position when needed.  The node belongs to the marker for all its
+     life, whether or not it points anywhere.  */
+  struct itree_node *interval;
+
   /* The remaining fields are meaningless in a marker that
      does not point anywhere.  */
 
   /* For markers that point somewhere,
-     this is used to chain of all the markers in a given buffer.
+     this is used to chain all the markers in a given buffer, in both
+     directions, so that a marker can be removed from the chain without
+     looking for it.
      The chain does not preserve markers from garbage collection;
      instead, markers are removed from the chain when freed by GC.  */
-  /* We could remove it and use an array in buffer_text instead.
-     That would also allow us to preserve it ordered.  */
-  struct Lisp_Marker *next;
-  /* This is the char position where the marker points.  */
-  ptrdiff_t charpos;
-  /* This is the byte position.
-     It's mostly used as a charpos<->bytepos cache (i.e. it's not directly
-     used to implement the functionality of markers, but rather to (ab)use
-     markers as a cache for char<->byte mappings).  */
-  ptrdiff_t bytepos;
+  struct Lisp_Marker *next, *prev;
 } GCALIGNED_STRUCT;
 
-/* START and END are markers in the overlay's buffer, and
-   PLIST is the overlay's property list.  */
+/* The data content of an overlay is its property list PLIST, the
+   BUFFER it belongs to (NULL if the overlay has been deleted), and the
+   node INTERVAL of that buffer's overlay tree, which holds the
+   overlay's start and end positions and its insertion types.  See
+   itree.h.  */
 struct Lisp_Overlay
-/* An overlay's real data content is:
-   - plist
-   - buffer (really there are two buffer pointers, one per marker,
-     and both points to the same buffer)
-   - insertion type of both ends (per-marker fields)
-   - start & start byte (of start marker)
-   - end & end byte (of end marker)
-   - next (singly linked list of overlays)
-   - next fields of start and end markers (singly linked list of markers).
-   I.e. 9words plus 2 bits, 3words of which are for external linked lists.
-*/
   {
     union vectorlike_header header;
-    Lisp_Object start;
-    Lisp_Object end;
     Lisp_Object plist;
-    struct Lisp_Overlay *next;
+    struct buffer *buffer;        /* eassert (live buffer || NULL). */
+    struct itree_node *interval;
   } GCALIGNED_STRUCT;
 
 struct Lisp_Misc_Ptr
@@ -3643,11 +3674,11 @@ extern void init_fringe_once (void);
 extern int x_bitmap_mask (struct frame *, ptrdiff_t);
 extern void syms_of_image (void);
 
-#ifdef HAVE_JSON
 /* Defined in json.c.  */
-extern void init_json (void);
+extern void json_check_parse_args (Lisp_Object);
+extern Lisp_Object json_parse_bytes (unsigned char const *, ptrdiff_t,
+				     Lisp_Object);
 extern void syms_of_json (void);
-#endif
 
 /* Defined in insdel.c.  */
 extern void move_gap_both (ptrdiff_t, ptrdiff_t);
@@ -3689,6 +3720,7 @@ extern void invalidate_buffer_caches (struct buffer *, ptrdiff_t, ptrdiff_t);
 extern void signal_after_change (ptrdiff_t, ptrdiff_t, ptrdiff_t);
 extern void adjust_after_insert (ptrdiff_t, ptrdiff_t, ptrdiff_t,
 				 ptrdiff_t, ptrdiff_t);
+extern void advance_markers_over_insertion (ptrdiff_t, ptrdiff_t);
 extern void adjust_markers_for_delete (ptrdiff_t, ptrdiff_t,
 				       ptrdiff_t, ptrdiff_t);
 extern void adjust_markers_bytepos (ptrdiff_t, ptrdiff_t,
@@ -3793,6 +3825,7 @@ flush_stack_call_func (void (*func) (void *arg), void *arg)
 
 extern void garbage_collect (void);
 extern void maybe_garbage_collect (void);
+extern bool lazy_sweep_some_blocks (void);
 extern const char *pending_malloc_warning;
 extern Lisp_Object zero_vector;
 extern EMACS_INT consing_until_gc;
@@ -3977,7 +4010,7 @@ extern bool gc_in_progress;
 extern Lisp_Object make_float (double);
 extern void display_malloc_warning (void);
 extern ptrdiff_t inhibit_garbage_collection (void);
-extern Lisp_Object build_overlay (Lisp_Object, Lisp_Object, Lisp_Object);
+extern Lisp_Object build_overlay (bool, bool, Lisp_Object);
 extern void free_cons (struct Lisp_Cons *);
 extern void init_alloc_once (void);
 extern void init_alloc (void);
@@ -4004,6 +4037,7 @@ extern void r_alloc_inhibit_buffer_relocation (int);
 #endif
 
 /* Defined in chartab.c.  */
+extern EMACS_INT char_table_modiff;
 extern Lisp_Object copy_char_table (Lisp_Object);
 extern Lisp_Object char_table_ref_and_range (Lisp_Object, int,
                                              int *, int *);
@@ -4241,9 +4275,9 @@ extern void syms_of_editfns (void);
 extern bool mouse_face_overlay_overlaps (Lisp_Object);
 extern Lisp_Object disable_line_numbers_overlay_at_eob (void);
 extern AVOID nsberror (Lisp_Object);
-extern void adjust_overlays_for_insert (ptrdiff_t, ptrdiff_t);
+extern void adjust_overlays_for_insert (ptrdiff_t, ptrdiff_t, bool);
 extern void adjust_overlays_for_delete (ptrdiff_t, ptrdiff_t);
-extern void fix_start_end_in_overlays (ptrdiff_t, ptrdiff_t);
+extern void transpose_overlays (ptrdiff_t, ptrdiff_t, ptrdiff_t, ptrdiff_t);
 extern void report_overlay_modification (Lisp_Object, Lisp_Object, bool,
                                          Lisp_Object, Lisp_Object, Lisp_Object);
 extern bool overlay_touches_p (ptrdiff_t);
@@ -4263,6 +4297,8 @@ extern ptrdiff_t buf_charpos_to_bytepos (struct buffer *, ptrdiff_t);
 extern ptrdiff_t buf_bytepos_to_charpos (struct buffer *, ptrdiff_t);
 extern void detach_marker (Lisp_Object);
 extern void unchain_marker (struct Lisp_Marker *);
+extern void attach_marker (struct Lisp_Marker *, struct buffer *,
+                           ptrdiff_t, ptrdiff_t);
 extern Lisp_Object set_marker_restricted (Lisp_Object, Lisp_Object, Lisp_Object);
 extern Lisp_Object set_marker_both (Lisp_Object, Lisp_Object, ptrdiff_t, ptrdiff_t);
 extern Lisp_Object set_marker_restricted_both (Lisp_Object, Lisp_Object,
@@ -4297,6 +4333,7 @@ extern void syms_of_fileio (void);
 
 /* Defined in search.c.  */
 extern void shrink_regexp_cache (void);
+extern void mark_regexp_cache (void);
 extern void restore_search_regs (void);
 extern void update_search_regs (ptrdiff_t oldstart,
                                 ptrdiff_t oldend, ptrdiff_t newend);
@@ -4320,6 +4357,10 @@ extern ptrdiff_t fast_c_string_match_ignore_case (Lisp_Object, const char *,
 						  ptrdiff_t);
 extern ptrdiff_t fast_looking_at (Lisp_Object, ptrdiff_t, ptrdiff_t,
                                   ptrdiff_t, ptrdiff_t, Lisp_Object);
+/* The number of bytes the newline scanners count at a time when they
+   are looking for many newlines.  */
+enum { NEWLINE_BLOCK_SIZE = 4096 };
+extern ptrdiff_t count_newlines (unsigned char const *, ptrdiff_t);
 extern ptrdiff_t find_newline (ptrdiff_t, ptrdiff_t, ptrdiff_t, ptrdiff_t,
 			       ptrdiff_t, ptrdiff_t *, ptrdiff_t *, bool);
 extern void scan_newline (ptrdiff_t, ptrdiff_t, ptrdiff_t, ptrdiff_t,
@@ -4926,7 +4967,8 @@ enum
 /* Declare NAME as an auto Lisp cons or short list if possible, a
    GC-based one otherwise.  This is in the sense of the C keyword
    'auto'; i.e., the object has the lifetime of the containing block.
-   The resulting object should not be made visible to user Lisp code.  */
+   The resulting object should not be made visible to user Lisp code,
+   and should not be modified with XSETCAR or XSETCDR.  */
 
 #define AUTO_CONS(name, a, b) Lisp_Object name = AUTO_CONS_EXPR (a, b)
 #define AUTO_LIST1(name, a)						\
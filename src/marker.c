@@ -23,6 +23,7 @@ along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
 #include "lisp.h"
 #include "character.h"
 #include "buffer.h"
+#include "line-index.h"
 
 /* Record one cached position found recently by
    buf_charpos_to_bytepos or buf_bytepos_to_charpos.  */
@@ -80,8 +81,13 @@ clear_charpos_cache (struct buffer *b)
 
 /* There are several places in the buffer where we know
    the correspondence: BEG, BEGV, PT, GPT, ZV and Z,
-   and everywhere there is a marker.  So we find the one of these places
-   that is closest to the specified position, and scan from there.  */
+   and the position converted last.  So we find the one of these places
+   that is closest to the specified position, and scan from there.
+   If none of them is close, we ask the line index of the buffer,
+   which finds a nearby place in logarithmic time.
+
+   Markers also know the correspondence, but there can be so many of
+   them that looking through them takes longer than scanning.  */
 
 /* This macro is a subroutine of buf_charpos_to_bytepos.
    Note that it is desirable that BYTEPOS is not evaluated
@@ -133,37 +139,17 @@ CHECK_MARKER (Lisp_Object x)
   CHECK_TYPE (MARKERP (x), Qmarkerp, x);
 }
 
-/* When converting bytes from/to chars, we look through the list of
-   markers to try and find a good starting point (since markers keep
-   track of both bytepos and charpos at the same time).
-   But if there are many markers, it can take too much time to find a "good"
-   marker from which to start.  Worse yet: if it takes a long time and we end
-   up finding a nearby markers, we won't add a new marker to cache this
-   result, so next time around we'll have to go through this same long list
-   to (re)find this best marker.  So the further down the list of
-   markers we go, the less demanding we are w.r.t what is a good marker.
-
-   The previous code used INITIAL=50 and INCREMENT=0 and this lead to
-   really poor performance when there are many markers.
-   I haven't tried to tweak INITIAL, but experiments on my trusty Thinkpad
-   T61 using various artificial test cases seem to suggest that INCREMENT=50
-   might be "the best compromise": it significantly improved the
-   worst case and it was rarely slower and never by much.
-
-   The asymptotic behavior is still poor, tho, so in largish buffers with many
-   overlays (e.g. 300KB and 30K overlays), it can still be a bottleneck.  */
-#define BYTECHAR_DISTANCE_INITIAL 50
-#define BYTECHAR_DISTANCE_INCREMENT 50
+/* If the nearest known place is further than this from the position
+   to convert, use the line index instead of scanning.  */
+#define BYTECHAR_DISTANCE 2000
 
 /* Return the byte position corresponding to CHARPOS in B.  */
 
 ptrdiff_t
 buf_charpos_to_bytepos (struct buffer *b, ptrdiff_t charpos)
 {
-  struct Lisp_Marker *tail;
   ptrdiff_t best_above, best_above_byte;
   ptrdiff_t best_below, best_below_byte;
-  ptrdiff_t distance = BYTECHAR_DISTANCE_INITIAL;
 
   eassert (BUF_BEG (b) <= charpos && charpos <= BUF_Z (b));
 
@@ -188,48 +174,48 @@ buf_charpos_to_bytepos (struct buffer *b, ptrdiff_t charpos)
      two best approximations is all single-byte,
      we interpolate the result immediately.  */
 
-  CONSIDER (BUF_PT (b), BUF_PT_BYTE (b));
   CONSIDER (BUF_GPT (b), BUF_GPT_BYTE (b));
-  CONSIDER (BUF_BEGV (b), BUF_BEGV_BYTE (b));
-  CONSIDER (BUF_ZV (b), BUF_ZV_BYTE (b));
 
-  if (b == cached_buffer && BUF_MODIFF (b) == cached_modiff)
-    CONSIDER (cached_charpos, cached_bytepos);
-
-  for (tail = BUF_MARKERS (b); tail; tail = tail->next)
+  /* A buffer other than the current one that has indirect buffers
+     keeps point and the bounds of its accessible portion in markers,
+     whose byte positions are computed by this very function.  */
+  if (b == current_buffer || NILP (BVAR (b, pt_marker)))
     {
-      CONSIDER (tail->charpos, tail->bytepos);
-
-      /* If we are down to a range of 50 chars,
-	 don't bother checking any other markers;
-	 scan the intervening chars directly now.  */
-      if (best_above - charpos < distance
-          || charpos - best_below < distance)
-	break;
-      else
-        distance += BYTECHAR_DISTANCE_INCREMENT;
+      CONSIDER (BUF_PT (b), BUF_PT_BYTE (b));
+      CONSIDER (BUF_BEGV (b), BUF_BEGV_BYTE (b));
+      CONSIDER (BUF_ZV (b), BUF_ZV_BYTE (b));
     }
 
+  if (b == cached_buffer && BUF_MODIFF (b) == cached_modiff)
+    CONSIDER (cached_charpos, cached_bytepos);
+
   /* We get here if we did not exactly hit one of the known places.
      We have one known above and one known below.
-     Scan, counting characters, from whichever one is closer.  */
+     Scan, counting characters, from whichever one is closer,
+     unless both are far.  */
 
-  if (charpos - best_below < best_above - charpos)
+  if (BYTECHAR_DISTANCE < charpos - best_below
+      && BYTECHAR_DISTANCE < best_above - charpos)
     {
-      bool record = charpos - best_below > 5000;
+      ptrdiff_t value = line_index_charpos_to_bytepos (b, charpos);
 
+      byte_char_debug_check (b, charpos, value);
+
+      cached_buffer = b;
+      cached_modiff = BUF_MODIFF (b);
+      cached_charpos = charpos;
+      cached_bytepos = value;
+
+      return value;
+    }
+  else if (charpos - best_below < best_above - charpos)
+    {
       while (best_below != charpos)
 	{
 	  best_below++;
 	  best_below_byte += buf_next_char_len (b, best_below_byte);
 	}
 
-      /* If this position is quite far from the nearest known position,
-	 cache the correspondence by creating a marker here.
-	 It will last until the next GC.  */
-      if (record)
-	build_marker (b, best_below, best_below_byte);
-
       byte_char_debug_check (b, best_below, best_below_byte);
 
       cached_buffer = b;
@@ -241,20 +227,12 @@ buf_charpos_to_bytepos (struct buffer *b, ptrdiff_t charpos)
     }
   else
     {
-      bool record = best_above - charpos > 5000;
-
       while (best_above != charpos)
 	{
 	  best_above--;
 	  best_above_byte -= buf_prev_char_len (b, best_above_byte);
 	}
 
-      /* If this position is quite far from the nearest known position,
-	 cache the correspondence by creating a marker here.
-	 It will last until the next GC.  */
-      if (record)
-	build_marker (b, best_above, best_above_byte);
-
       byte_char_debug_check (b, best_above, best_above_byte);
 
       cached_buffer = b;
@@ -316,10 +294,8 @@ buf_charpos_to_bytepos (struct buffer *b, ptrdiff_t charpos)
 ptrdiff_t
 buf_bytepos_to_charpos (struct buffer *b, ptrdiff_t bytepos)
 {
-  struct Lisp_Marker *tail;
   ptrdiff_t best_above, best_above_byte;
   ptrdiff_t best_below, best_below_byte;
-  ptrdiff_t distance = BYTECHAR_DISTANCE_INITIAL;
 
   eassert (BUF_BEG_BYTE (b) <= bytepos && bytepos <= BUF_Z_BYTE (b));
 
@@ -339,50 +315,46 @@ buf_bytepos_to_charpos (struct buffer *b, ptrdiff_t bytepos)
   best_below = BEG;
   best_below_byte = BEG_BYTE;
 
-  CONSIDER (BUF_PT_BYTE (b), BUF_PT (b));
   CONSIDER (BUF_GPT_BYTE (b), BUF_GPT (b));
-  CONSIDER (BUF_BEGV_BYTE (b), BUF_BEGV (b));
-  CONSIDER (BUF_ZV_BYTE (b), BUF_ZV (b));
 
-  if (b == cached_buffer && BUF_MODIFF (b) == cached_modiff)
-    CONSIDER (cached_bytepos, cached_charpos);
-
-  for (tail = BUF_MARKERS (b); tail; tail = tail->next)
+  /* See buf_charpos_to_bytepos.  */
+  if (b == current_buffer || NILP (BVAR (b, pt_marker)))
     {
-      CONSIDER (tail->bytepos, tail->charpos);
-
-      /* If we are down to a range of 50 chars,
-	 don't bother checking any other markers;
-	 scan the intervening chars directly now.  */
-      if (best_above - bytepos < distance
-          || bytepos - best_below < distance)
-	break;
-      else
-        distance += BYTECHAR_DISTANCE_INCREMENT;
+      CONSIDER (BUF_PT_BYTE (b), BUF_PT (b));
+      CONSIDER (BUF_BEGV_BYTE (b), BUF_BEGV (b));
+      CONSIDER (BUF_ZV_BYTE (b), BUF_ZV (b));
     }
 
+  if (b == cached_buffer && BUF_MODIFF (b) == cached_modiff)
+    CONSIDER (cached_bytepos, cached_charpos);
+
   /* We get here if we did not exactly hit one of the known places.
      We have one known above and one known below.
-     Scan, counting characters, from whichever one is closer.  */
+     Scan, counting characters, from whichever one is closer,
+     unless both are far.  */
 
-  if (bytepos - best_below_byte < best_above_byte - bytepos)
+  if (BYTECHAR_DISTANCE < bytepos - best_below_byte
+      && BYTECHAR_DISTANCE < best_above_byte - bytepos)
     {
-      bool record = bytepos - best_below_byte > 5000;
+      ptrdiff_t value = line_index_bytepos_to_charpos (b, bytepos);
+
+      byte_char_debug_check (b, value, bytepos);
 
+      cached_buffer = b;
+      cached_modiff = BUF_MODIFF (b);
+      cached_charpos = value;
+      cached_bytepos = bytepos;
+
+      return value;
+    }
+  else if (bytepos - best_below_byte < best_above_byte - bytepos)
+    {
       while (best_below_byte < bytepos)
 	{
 	  best_below++;
 	  best_below_byte += buf_next_char_len (b, best_below_byte);
 	}
 
-      /* If this position is quite far from the nearest known position,
-	 cache the correspondence by creating a marker here.
-	 It will last until the next GC.
-	 But don't do it if BUF_MARKERS is nil;
-	 that is a signal from Fset_buffer_multibyte.  */
-      if (record && BUF_MARKERS (b))
-	build_marker (b, best_below, best_below_byte);
-
       byte_char_debug_check (b, best_below, best_below_byte);
 
       cached_buffer = b;
@@ -394,22 +366,12 @@ buf_bytepos_to_charpos (struct buffer *b, ptrdiff_t bytepos)
     }
   else
     {
-      bool record = best_above_byte - bytepos > 5000;
-
       while (best_above_byte > bytepos)
 	{
 	  best_above--;
 	  best_above_byte -= buf_prev_char_len (b, best_above_byte);
 	}
 
-      /* If this position is quite far from the nearest known position,
-	 cache the correspondence by creating a marker here.
-	 It will last until the next GC.
-	 But don't do it if BUF_MARKERS is nil;
-	 that is a signal from Fset_buffer_multibyte.  */
-      if (record && BUF_MARKERS (b))
-	build_marker (b, best_above, best_above_byte);
-
       byte_char_debug_check (b, best_above, best_above_byte);
 
       cached_buffer = b;
@@ -451,14 +413,16 @@ DEFUN ("marker-position", Fmarker_position, Smarker_position, 1, 1, 0,
 {
   CHECK_MARKER (marker);
   if (XMARKER (marker)->buffer)
-    return make_fixnum (XMARKER (marker)->charpos);
+    return make_fixnum (marker_position (marker));
 
   return Qnil;
 }
 
-/* Change M so it points to B at CHARPOS and BYTEPOS.  */
+/* Change M so it points to B at CHARPOS and BYTEPOS.  BYTEPOS is
+   only used for checking, as a marker records only its char
+   position.  */
 
-static void
+void
 attach_marker (struct Lisp_Marker *m, struct buffer *b,
 	       ptrdiff_t charpos, ptrdiff_t bytepos)
 {
@@ -469,16 +433,22 @@ attach_marker (struct Lisp_Marker *m, struct buffer *b,
   else
     eassert (charpos <= bytepos);
 
-  m->charpos = charpos;
-  m->bytepos = bytepos;
-
   if (m->buffer != b)
     {
       unchain_marker (m);
       m->buffer = b;
+      m->prev = NULL;
       m->next = BUF_MARKERS (b);
+      if (m->next)
+	m->next->prev = m;
       BUF_MARKERS (b) = m;
+      if (!BUF_MARKER_TREE (b))
+	BUF_MARKER_TREE (b) = itree_create ();
+      itree_insert (BUF_MARKER_TREE (b), m->interval, charpos, charpos);
     }
+  else
+    itree_node_set_region (BUF_MARKER_TREE (b), m->interval,
+			   charpos, charpos);
 }
 
 /* If BUFFER is nil, return current buffer pointer.  Next, check
@@ -517,17 +487,15 @@ set_marker_internal (Lisp_Object marker, Lisp_Object position,
   else if (MARKERP (position) && b == XMARKER (position)->buffer
 	   && b == m->buffer)
     {
-      m->bytepos = XMARKER (position)->bytepos;
-      m->charpos = XMARKER (position)->charpos;
+      ptrdiff_t charpos = marker_position (position);
+      itree_node_set_region (BUF_MARKER_TREE (b), m->interval,
+			     charpos, charpos);
     }
 
   else
     {
-      register ptrdiff_t charpos, bytepos;
+      register ptrdiff_t charpos;
 
-      /* Do not use CHECK_FIXNUM_COERCE_MARKER because we
-	 don't want to call buf_charpos_to_bytepos if POSITION
-	 is a marker and so we know the bytepos already.  */
       if (FIXNUMP (position))
 	{
 #if EMACS_INT_MAX > PTRDIFF_MAX
@@ -536,34 +504,20 @@ set_marker_internal (Lisp_Object marker, Lisp_Object position,
 	  if (cpos > PTRDIFF_MAX)
 	    cpos = PTRDIFF_MAX;
 	  charpos = cpos;
-	  bytepos = -1;
 #else
-	  charpos = XFIXNUM (position), bytepos = -1;
+	  charpos = XFIXNUM (position);
 #endif
 	}
       else if (MARKERP (position))
-	{
-	  charpos = XMARKER (position)->charpos;
-	  bytepos = XMARKER (position)->bytepos;
-	}
+	charpos = marker_position (position);
       else
 	wrong_type_argument (Qinteger_or_marker_p, position);
 
       charpos = clip_to_bounds
 	(restricted ? BUF_BEGV (b) : BUF_BEG (b), charpos,
 	 restricted ? BUF_ZV (b) : BUF_Z (b));
-      /* Don't believe BYTEPOS if it comes from a different buffer,
-	 since that buffer might have a very different correspondence
-	 between character and byte positions.  */
-      if (bytepos == -1
-	  || !(MARKERP (position) && XMARKER (position)->buffer == b))
-	bytepos = buf_charpos_to_bytepos (b, charpos);
-      else
-	bytepos = clip_to_bounds
-	  (restricted ? BUF_BEGV_BYTE (b) : BUF_BEG_BYTE (b),
-	   bytepos, restricted ? BUF_ZV_BYTE (b) : BUF_Z_BYTE (b));
 
-      attach_marker (m, b, charpos, bytepos);
+      attach_marker (m, b, charpos, buf_charpos_to_bytepos (b, charpos));
     }
   return marker;
 }
@@ -652,34 +606,27 @@ unchain_marker (register struct Lisp_Marker *marker)
 
   if (b)
     {
-      register struct Lisp_Marker *tail, **prev;
-
       /* No dead buffers here.  */
       eassert (BUFFER_LIVE_P (b));
 
       marker->buffer = NULL;
-      prev = &BUF_MARKERS (b);
-
-      for (tail = BUF_MARKERS (b); tail; prev = &tail->next, tail = *prev)
-	if (marker == tail)
-	  {
-	    if (*prev == BUF_MARKERS (b))
-	      {
-		/* Deleting first marker from the buffer's chain.  Crash
-		   if new first marker in chain does not say it belongs
-		   to the same buffer, or at least that they have the same
-		   base buffer.  */
-		if (tail->next && b->text != tail->next->buffer->text)
-		  emacs_abort ();
-	      }
-	    *prev = tail->next;
-	    /* We have removed the marker from the chain;
-	       no need to scan the rest of the chain.  */
-	    break;
-	  }
-
-      /* Error if marker was not in it's chain.  */
-      eassert (tail != NULL);
+      if (marker->prev)
+	marker->prev->next = marker->next;
+      else
+	{
+	  /* Deleting first marker from the buffer's chain.  Crash
+	     if new first marker in chain does not say it belongs
+	     to the same buffer, or at least that they have the same
+	     base buffer.  */
+	  eassert (BUF_MARKERS (b) == marker);
+	  if (marker->next && b->text != marker->next->buffer->text)
+	    emacs_abort ();
+	  BUF_MARKERS (b) = marker->next;
+	}
+      if (marker->next)
+	marker->next->prev = marker->prev;
+      marker->next = marker->prev = NULL;
+      itree_remove (BUF_MARKER_TREE (b), marker->interval);
     }
 }
 
@@ -694,9 +641,10 @@ marker_position (Lisp_Object marker)
   if (!buf)
     error ("Marker does not point anywhere");
 
-  eassert (BUF_BEG (buf) <= m->charpos && m->charpos <= BUF_Z (buf));
+  ptrdiff_t charpos = itree_node_begin (BUF_MARKER_TREE (buf), m->interval);
+  eassert (BUF_BEG (buf) <= charpos && charpos <= BUF_Z (buf));
 
-  return m->charpos;
+  return charpos;
 }
 
 /* Return the byte position of marker MARKER, as a C integer.  */
@@ -704,15 +652,8 @@ marker_position (Lisp_Object marker)
 ptrdiff_t
 marker_byte_position (Lisp_Object marker)
 {
-  register struct Lisp_Marker *m = XMARKER (marker);
-  register struct buffer *buf = m->buffer;
-
-  if (!buf)
-    error ("Marker does not point anywhere");
-
-  eassert (BUF_BEG_BYTE (buf) <= m->bytepos && m->bytepos <= BUF_Z_BYTE (buf));
-
-  return m->bytepos;
+  ptrdiff_t charpos = marker_position (marker);
+  return buf_charpos_to_bytepos (XMARKER (marker)->buffer, charpos);
 }
 
 DEFUN ("copy-marker", Fcopy_marker, Scopy_marker, 0, 2, 0,
@@ -764,13 +705,12 @@ DEFUN ("buffer-has-markers-at", Fbuffer_has_markers_at, Sbuffer_has_markers_at,
        doc: /* Return t if there are markers pointing at POSITION in the current buffer.  */)
   (Lisp_Object position)
 {
-  register struct Lisp_Marker *tail;
-  register ptrdiff_t charpos;
-
-  charpos = clip_to_bounds (BEG, XFIXNUM (position), Z);
+  struct itree_node *node;
+  ptrdiff_t charpos = clip_to_bounds (BEG, XFIXNUM (position), Z);
 
-  for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-    if (tail->charpos == charpos)
+  ITREE_FOREACH (node, BUF_MARKER_TREE (current_buffer),
+		 charpos, charpos + 1, ASCENDING)
+    if (node->begin == charpos)
       return Qt;
 
   return Qnil;
@@ -817,9 +817,9 @@ get_minibuffer (EMACS_INT depth)
   else
     {
       ptrdiff_t count = SPECPDL_INDEX ();
-      /* We have to empty both overlay lists.  Otherwise we end
-	 up with overlays that think they belong to this buffer
-	 while the buffer doesn't know about them any more.  */
+      /* We have to empty the overlay tree.  Otherwise we end up
+	 with overlays that think they belong to this buffer while
+	 the buffer doesn't know about them any more.  */
       delete_all_overlays (XBUFFER (buf));
       reset_buffer (XBUFFER (buf));
       record_unwind_current_buffer ();
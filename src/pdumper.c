@@ -337,7 +337,13 @@ dump_fingerprint (char const *label,
    actually loaded.
 
    Dump files can contain pointers to other objects in the dump file
-   or to parts of the Emacs binary.  */
+   or to parts of the Emacs binary.
+
+   An overlay dump holds only the objects that an Emacs started from
+   another dump file, its base dump, created or changed since.  It is
+   loaded right after its base dump, as if the two were one file, and
+   it can point to the objects of the base dump; the objects of the
+   base dump that changed are copied over the originals at load.  */
 struct dump_header
 {
   /* File type magic.  */
@@ -384,6 +390,33 @@ struct dump_header
 
   /* Offset of a vector of the dumped hash tables.  */
   dump_off hash_list;
+
+  /* For an overlay dump, the size of the base dump, which is where
+     the overlay dump starts; zero in other dumps.  All offsets in an
+     overlay dump, including those in this header, count from the
+     start of the base dump.  */
+  dump_off overlay_start;
+
+  /* For an overlay dump, the hash of the header of the base dump.  */
+  EMACS_UINT base_header_hash;
+
+  /* For an overlay dump, the absolute file name of the base dump, as
+     an array of bytes.  */
+  struct dump_table_locator base_file_name;
+
+  /* For an overlay dump, the objects of the base dump it changes;
+     each entry is a struct dump_patch.  */
+  struct dump_table_locator patches;
+};
+
+/* An object of the base dump that an overlay dump changes: loading
+   the overlay dump copies SIZE bytes at OFFSET over the object at
+   BASE_OFFSET.  */
+struct dump_patch
+{
+  dump_off offset;
+  dump_off base_offset;
+  dump_off size;
 };
 
 /* Double-ended singly linked list.  */
@@ -544,6 +577,19 @@ struct dump_context
   /* List of hash tables that have been dumped.  */
   Lisp_Object hash_tables;
 
+  /* When making an overlay dump, the size of its base dump, and a
+     copy of the base dump as it was just after loading.  */
+  dump_off overlay_start;
+  char *base_image;
+  const char *base_filename;
+
+  /* Patches of the base dump, as (OFFSET BASE-OFFSET SIZE) lists.  */
+  Lisp_Object patches;
+  dump_off patched_bytes;
+  /* Hash mapping the objects of the base dump that the overlay dump
+     changes to the offsets of their new contents.  */
+  Lisp_Object patched_objects;
+
   dump_off number_hot_relocations;
   dump_off number_discardable_relocations;
 };
@@ -582,6 +628,7 @@ static struct link_weight const
 /* Dump file creation */
 
 static dump_off dump_object (struct dump_context *ctx, Lisp_Object object);
+static void dump_read_base_image (struct dump_context *ctx);
 static dump_off dump_object_for_offset (struct dump_context *ctx,
 					Lisp_Object object);
 
@@ -829,7 +876,8 @@ static void
 dump_seek (struct dump_context *ctx, dump_off offset)
 {
   eassert (ctx->obj_offset == 0);
-  if (lseek (ctx->fd, offset, SEEK_SET) < 0)
+  eassert (ctx->overlay_start <= offset);
+  if (lseek (ctx->fd, offset - ctx->overlay_start, SEEK_SET) < 0)
     report_file_error ("Setting file position",
                        ctx->dump_filename);
   ctx->offset = offset;
@@ -906,6 +954,17 @@ dump_remember_object (struct dump_context *ctx,
             ctx->objects_dumped);
 }
 
+/* Return the offset at which the contents of OBJECT were written.
+   This is the offset of OBJECT itself, except for the objects of the
+   base dump that an overlay dump changes.  */
+static dump_off
+dump_recall_object_contents (struct dump_context *ctx, Lisp_Object object)
+{
+  Lisp_Object offset = Fgethash (object, ctx->patched_objects, Qnil);
+  return NILP (offset) ? dump_recall_object (ctx, object)
+    : dump_off_from_lisp (offset);
+}
+
 static void
 dump_note_reachable (struct dump_context *ctx, Lisp_Object object)
 {
@@ -934,6 +993,23 @@ dump_object_emacs_ptr (Lisp_Object lv)
   return NULL;
 }
 
+/* If CTX is making an overlay dump and OBJECT belongs to its base
+   dump, return the offset of OBJECT in the base dump; otherwise,
+   return 0.  */
+static dump_off
+dump_base_offset (struct dump_context *ctx, Lisp_Object object)
+{
+  if (ctx->overlay_start == 0)
+    return 0;
+  void *ptr = (SYMBOLP (object)
+	       ? (void *) XSYMBOL (object)
+	       : XUNTAG (object, XTYPE (object), void));
+  if (!pdumper_object_p (ptr))
+    return 0;
+  dump_off offset = (uintptr_t) ptr - dump_public.start;
+  return offset < ctx->overlay_start ? offset : 0;
+}
+
 static void
 dump_queue_init (struct dump_queue *dump_queue)
 {
@@ -2101,10 +2177,34 @@ dump_string (struct dump_context *ctx, const struct Lisp_String *string)
   return offset;
 }
 
+/* Dump the interval tree node NODE of an overlay that doesn't belong
+   to any buffer, or of a marker, which isn't linked to other nodes.  */
+
+static dump_off
+dump_itree_node (struct dump_context *ctx, const struct itree_node *node)
+{
+#if CHECK_STRUCTS && !defined (HASH_itree_node_5B50FA95EE)
+# error "itree_node changed. See CHECK_STRUCTS comment in config.h."
+#endif
+  struct itree_node out;
+  eassert (!node->parent && !node->left && !node->right);
+  dump_object_start (ctx, &out, sizeof (out));
+  DUMP_FIELD_COPY (&out, node, begin);
+  DUMP_FIELD_COPY (&out, node, end);
+  DUMP_FIELD_COPY (&out, node, limit);
+  DUMP_FIELD_COPY (&out, node, offset);
+  DUMP_FIELD_COPY (&out, node, otick);
+  dump_field_lv (ctx, &out, node, &node->data, WEIGHT_STRONG);
+  DUMP_FIELD_COPY (&out, node, red);
+  DUMP_FIELD_COPY (&out, node, rear_advance);
+  DUMP_FIELD_COPY (&out, node, front_advance);
+  return dump_object_finish (ctx, &out, sizeof (out));
+}
+
 static dump_off
 dump_marker (struct dump_context *ctx, const struct Lisp_Marker *marker)
 {
-#if CHECK_STRUCTS && !defined (HASH_Lisp_Marker_642DBAF866)
+#if CHECK_STRUCTS && !defined (HASH_Lisp_Marker_2FB17F014C)
 # error "Lisp_Marker changed. See CHECK_STRUCTS comment in config.h."
 #endif
 
@@ -2118,23 +2218,49 @@ dump_marker (struct dump_context *ctx, const struct Lisp_Marker *marker)
 			    Lisp_Vectorlike, WEIGHT_NORMAL);
       dump_field_lv_rawptr (ctx, out, marker, &marker->next,
 			    Lisp_Vectorlike, WEIGHT_STRONG);
-      DUMP_FIELD_COPY (out, marker, charpos);
-      DUMP_FIELD_COPY (out, marker, bytepos);
+      dump_field_lv_rawptr (ctx, out, marker, &marker->prev,
+			    Lisp_Vectorlike, WEIGHT_STRONG);
     }
-  return finish_dump_pvec (ctx, &out->header);
+  dump_field_fixup_later (ctx, out, marker, &marker->interval);
+  dump_off offset = finish_dump_pvec (ctx, &out->header);
+
+  /* The trees of marker positions aren't dumped, see dump_buffer, so
+     dump the node of the marker on its own, with its position.  The
+     tree is rebuilt from the chain of markers when the dump is
+     loaded.  */
+  struct itree_node node;
+  itree_node_init (&node, false, false, make_lisp_ptr ((void *) marker,
+						       Lisp_Vectorlike));
+  if (marker->buffer)
+    node.begin = node.end = node.limit
+      = itree_node_begin (BUF_MARKER_TREE (marker->buffer),
+			  marker->interval);
+  dump_remember_fixup_ptr_raw
+    (ctx,
+     offset + dump_offsetof (struct Lisp_Marker, interval),
+     dump_itree_node (ctx, &node));
+  return offset;
 }
 
 static dump_off
 dump_overlay (struct dump_context *ctx, const struct Lisp_Overlay *overlay)
 {
-#if CHECK_STRUCTS && !defined (HASH_Lisp_Overlay_72EADA9882)
+#if CHECK_STRUCTS && !defined (HASH_Lisp_Overlay_013E84F6A4)
 # error "Lisp_Overlay changed. See CHECK_STRUCTS comment in config.h."
 #endif
+  /* Overlays living in a buffer are never dumped, see dump_buffer.  */
+  if (overlay->buffer)
+    error ("cannot dump an overlay that belongs to a buffer");
   START_DUMP_PVEC (ctx, &overlay->header, struct Lisp_Overlay, out);
   dump_pseudovector_lisp_fields (ctx, &out->header, &overlay->header);
-  dump_field_lv_rawptr (ctx, out, overlay, &overlay->next,
-                        Lisp_Vectorlike, WEIGHT_STRONG);
-  return finish_dump_pvec (ctx, &out->header);
+  out->buffer = NULL;
+  dump_field_fixup_later (ctx, out, overlay, &overlay->interval);
+  dump_off offset = finish_dump_pvec (ctx, &out->header);
+  dump_remember_fixup_ptr_raw
+    (ctx,
+     offset + dump_offsetof (struct Lisp_Overlay, interval),
+     dump_itree_node (ctx, overlay->interval));
+  return offset;
 }
 
 static void
@@ -2225,13 +2351,48 @@ dump_float (struct dump_context *ctx, const struct Lisp_Float *lfloat)
   return dump_object_finish (ctx, &out, sizeof (out));
 }
 
+/* Emit the Emacs relocations that restore the C variable to which
+   FWD forwards.  Buffer and kboard variables live in their buffers
+   and kboards, so they need nothing here.  */
+static void
+dump_fwd_value (struct dump_context *ctx, lispfwd fwd)
+{
+  switch (XFWDTYPE (fwd))
+    {
+    case Lisp_Fwd_Int:
+      {
+	const struct Lisp_Intfwd *intfwd = fwd.fwdptr;
+	dump_emacs_reloc_immediate_intmax_t (ctx, intfwd->intvar,
+					     *intfwd->intvar);
+      }
+      break;
+    case Lisp_Fwd_Bool:
+      {
+	const struct Lisp_Boolfwd *boolfwd = fwd.fwdptr;
+	dump_emacs_reloc_immediate_bool (ctx, boolfwd->boolvar,
+					 *boolfwd->boolvar);
+      }
+      break;
+    case Lisp_Fwd_Obj:
+      {
+	const struct Lisp_Objfwd *objfwd = fwd.fwdptr;
+	if (NILP (Fgethash (dump_off_to_lisp (emacs_offset (objfwd->objvar)),
+			    ctx->staticpro_table,
+			    Qnil)))
+	  dump_emacs_reloc_to_lv (ctx, objfwd->objvar, *objfwd->objvar);
+      }
+      break;
+    default:
+      break;
+    }
+}
+
 static dump_off
 dump_fwd_int (struct dump_context *ctx, const struct Lisp_Intfwd *intfwd)
 {
 #if CHECK_STRUCTS && !defined HASH_Lisp_Intfwd_4D887A7387
 # error "Lisp_Intfwd changed. See CHECK_STRUCTS comment in config.h."
 #endif
-  dump_emacs_reloc_immediate_intmax_t (ctx, intfwd->intvar, *intfwd->intvar);
   struct Lisp_Intfwd out;
   dump_object_start (ctx, &out, sizeof (out));
   DUMP_FIELD_COPY (&out, intfwd, type);
@@ -2245,7 +2406,6 @@ dump_fwd_bool (struct dump_context *ctx, const struct Lisp_Boolfwd *boolfwd)
 #if CHECK_STRUCTS && !defined (HASH_Lisp_Boolfwd_0EA1C7ADCC)
 # error "Lisp_Boolfwd changed. See CHECK_STRUCTS comment in config.h."
 #endif
-  dump_emacs_reloc_immediate_bool (ctx, boolfwd->boolvar, *boolfwd->boolvar);
   struct Lisp_Boolfwd out;
   dump_object_start (ctx, &out, sizeof (out));
   DUMP_FIELD_COPY (&out, boolfwd, type);
@@ -2259,10 +2419,6 @@ dump_fwd_obj (struct dump_context *ctx, const struct Lisp_Objfwd *objfwd)
 #if CHECK_STRUCTS && !defined (HASH_Lisp_Objfwd_45D3E513DC)
 # error "Lisp_Objfwd changed. See CHECK_STRUCTS comment in config.h."
 #endif
-  if (NILP (Fgethash (dump_off_to_lisp (emacs_offset (objfwd->objvar)),
-                      ctx->staticpro_table,
-                      Qnil)))
-    dump_emacs_reloc_to_lv (ctx, objfwd->objvar, *objfwd->objvar);
   struct Lisp_Objfwd out;
   dump_object_start (ctx, &out, sizeof (out));
   DUMP_FIELD_COPY (&out, objfwd, type);
@@ -2309,6 +2465,7 @@ dump_fwd (struct dump_context *ctx, lispfwd fwd)
   void const *p = fwd.fwdptr;
   dump_off offset;
 
+  dump_fwd_value (ctx, fwd);
   switch (XFWDTYPE (fwd))
     {
     case Lisp_Fwd_Int:
@@ -2607,7 +2764,7 @@ hash_table_contents (struct Lisp_Hash_Table *h)
      relies on it by expecting hash table indices to stay constant
      across the dump.  */
   for (ptrdiff_t i = 0; i < size; i++)
-    if (!NILP (HASH_HASH (h, i)))
+    if (!EQ (HASH_KEY (h, i), Qunbound))
       {
 	ASET (key_and_value, n++, HASH_KEY (h, i));
 	ASET (key_and_value, n++, HASH_VALUE (h, i));
@@ -2636,19 +2793,14 @@ hash_table_freeze (struct Lisp_Hash_Table *h)
 {
   ptrdiff_t npairs = ASIZE (h->key_and_value) / 2;
   h->key_and_value = hash_table_contents (h);
-  h->next = h->hash = make_fixnum (npairs);
-  h->index = make_fixnum (ASIZE (h->index));
+  h->next = NULL;
+  h->index = NULL;
   h->next_free = (npairs == h->count ? -1 : h->count);
 }
 
 static void
 hash_table_thaw (Lisp_Object hash)
 {
-  struct Lisp_Hash_Table *h = XHASH_TABLE (hash);
-  h->hash = make_nil_vector (XFIXNUM (h->hash));
-  h->next = Fmake_vector (h->next, make_fixnum (-1));
-  h->index = Fmake_vector (h->index, make_fixnum (-1));
-
   hash_table_rehash (hash);
 }
 
@@ -2657,7 +2809,7 @@ dump_hash_table (struct dump_context *ctx,
                  Lisp_Object object,
                  dump_off offset)
 {
-#if CHECK_STRUCTS && !defined HASH_Lisp_Hash_Table_6D63EDB618
+#if CHECK_STRUCTS && !defined HASH_Lisp_Hash_Table_B87A662C92
 # error "Lisp_Hash_Table changed. See CHECK_STRUCTS comment in config.h."
 #endif
   const struct Lisp_Hash_Table *hash_in = XHASH_TABLE (object);
@@ -2669,8 +2821,8 @@ dump_hash_table (struct dump_context *ctx,
 
   START_DUMP_PVEC (ctx, &hash->header, struct Lisp_Hash_Table, out);
   dump_pseudovector_lisp_fields (ctx, &out->header, &hash->header);
-  /* TODO: dump the hash bucket vectors synchronously here to keep
-     them as close to the hash table as possible.  */
+  /* The free list and the buckets are not dumped; hash_table_thaw
+     makes them anew.  */
   DUMP_FIELD_COPY (out, hash, count);
   DUMP_FIELD_COPY (out, hash, next_free);
   DUMP_FIELD_COPY (out, hash, purecopy);
@@ -2692,7 +2844,7 @@ dump_hash_table (struct dump_context *ctx,
 static dump_off
 dump_buffer (struct dump_context *ctx, const struct buffer *in_buffer)
 {
-#if CHECK_STRUCTS && !defined HASH_buffer_5DC36DBD42
+#if CHECK_STRUCTS && !defined HASH_buffer_BF894162BD
 # error "buffer changed. See CHECK_STRUCTS comment in config.h."
 #endif
   struct buffer munged_buffer = *in_buffer;
@@ -2724,11 +2876,17 @@ dump_buffer (struct dump_context *ctx, const struct buffer *in_buffer)
   START_DUMP_PVEC (ctx, &buffer->header, struct buffer, out);
   dump_pseudovector_lisp_fields (ctx, &out->header, &buffer->header);
   if (base_offset == 0)
-    base_offset = ctx->obj_offset;
+    {
+      /* A buffer of the base of an overlay dump stays where it is,
+	 and gets these contents copied over it.  */
+      base_offset = dump_base_offset (ctx, make_lisp_ptr ((void *) in_buffer,
+							  Lisp_Vectorlike));
+      if (base_offset == 0)
+	base_offset = ctx->obj_offset;
+    }
   eassert (base_offset > 0);
   if (buffer->base_buffer == NULL)
     {
-      eassert (base_offset == ctx->obj_offset);
 
       if (BUFFER_LIVE_P (buffer))
         {
@@ -2747,6 +2905,7 @@ dump_buffer (struct dump_context *ctx, const struct buffer *in_buffer)
       DUMP_FIELD_COPY (out, buffer, own_text.gap_size);
       DUMP_FIELD_COPY (out, buffer, own_text.modiff);
       DUMP_FIELD_COPY (out, buffer, own_text.chars_modiff);
+      DUMP_FIELD_COPY (out, buffer, own_text.inner_modiff);
       DUMP_FIELD_COPY (out, buffer, own_text.save_modiff);
       DUMP_FIELD_COPY (out, buffer, own_text.overlay_modiff);
       DUMP_FIELD_COPY (out, buffer, own_text.compact);
@@ -2799,18 +2958,18 @@ dump_buffer (struct dump_context *ctx, const struct buffer *in_buffer)
   out->newline_cache = NULL;
   out->width_run_cache = NULL;
   out->bidi_paragraph_cache = NULL;
+  out->line_index = NULL;
 
   DUMP_FIELD_COPY (out, buffer, prevent_redisplay_optimizations_p);
   DUMP_FIELD_COPY (out, buffer, clip_changed);
   DUMP_FIELD_COPY (out, buffer, inhibit_buffer_hooks);
 
-  dump_field_lv_rawptr (ctx, out, buffer, &buffer->overlays_before,
-                        Lisp_Vectorlike, WEIGHT_NORMAL);
+  /* Overlay trees hold manually managed memory, so we don't dump
+     them; the buffers existing at dump time have no overlays.  */
+  if (buffer->overlays && buffer->overlays->root != NULL)
+    error ("dumping overlays is not supported");
+  out->overlays = NULL;
 
-  dump_field_lv_rawptr (ctx, out, buffer, &buffer->overlays_after,
-                        Lisp_Vectorlike, WEIGHT_NORMAL);
-
-  DUMP_FIELD_COPY (out, buffer, overlay_center);
   dump_field_lv (ctx, out, buffer, &buffer->undo_list_,
                  WEIGHT_STRONG);
   dump_off offset = finish_dump_pvec (ctx, &out->header);
@@ -2966,6 +3125,135 @@ dump_vectorlike (struct dump_context *ctx,
   return offset;
 }
 
+/* Return the number of bytes the dump takes for OBJECT itself.  */
+static dump_off
+dump_object_size (Lisp_Object object)
+{
+  switch (XTYPE (object))
+    {
+    case Lisp_String:
+      return sizeof (struct Lisp_String);
+    case Lisp_Symbol:
+      return sizeof (struct Lisp_Symbol);
+    case Lisp_Cons:
+      return sizeof (struct Lisp_Cons);
+    case Lisp_Float:
+      return sizeof (struct Lisp_Float);
+    case Lisp_Vectorlike:
+      return vectorlike_nbytes (&XVECTOR (object)->header);
+    default:
+      emacs_abort ();
+    }
+}
+
+/* Return whether OBJECT, at BASE_OFFSET in the base of the overlay
+   dump that CTX is making, changed since the base dump was loaded.  */
+static bool
+dump_base_object_changed_p (struct dump_context *ctx,
+			    Lisp_Object object,
+			    dump_off base_offset)
+{
+  const char *loaded = ctx->base_image + base_offset;
+  switch (XTYPE (object))
+    {
+    case Lisp_String:
+      {
+	struct Lisp_String *string = XSTRING (object);
+	if (string->u.s.intervals
+	    || memcmp (string, loaded, sizeof *string) != 0)
+	  return true;
+	if (string->u.s.size_byte == -2)
+	  return false;
+	/* The data is where it was loaded, as the pointer is.  */
+	dump_off data_offset
+	  = (uintptr_t) string->u.s.data - dump_public.start;
+	eassert (0 < data_offset && data_offset < ctx->overlay_start);
+	return memcmp (string->u.s.data, ctx->base_image + data_offset,
+		       STRING_BYTES (string) + 1) != 0;
+      }
+    case Lisp_Symbol:
+      /* The buffer-local values are outside the symbol.  */
+      if (XSYMBOL (object)->u.s.redirect == SYMBOL_LOCALIZED)
+	return true;
+      return memcmp (XSYMBOL (object), loaded,
+		     sizeof (struct Lisp_Symbol)) != 0;
+    case Lisp_Vectorlike:
+      switch (PSEUDOVECTOR_TYPE (XVECTOR (object)))
+	{
+	case PVEC_HASH_TABLE:
+	case PVEC_BUFFER:
+	case PVEC_MARKER:
+	case PVEC_OVERLAY:
+	case PVEC_FINALIZER:
+	  /* Loading the dump already changed these.  */
+	  return true;
+	default:
+	  break;
+	}
+      break;
+    default:
+      break;
+    }
+  return memcmp (XUNTAG (object, XTYPE (object), void), loaded,
+		 dump_object_size (object)) != 0;
+}
+
+/* Enqueue the objects to which OBJECT refers, OBJECT being an object
+   of the base of the overlay dump that CTX is making that didn't
+   change: those objects may have changed all the same.  */
+static void
+dump_enqueue_base_object_referents (struct dump_context *ctx,
+				    Lisp_Object object)
+{
+  if (dump_set_referrer (ctx))
+    ctx->current_referrer = object;
+  switch (XTYPE (object))
+    {
+    case Lisp_Cons:
+      dump_enqueue_object (ctx, XCAR (object), WEIGHT_NORMAL);
+      dump_enqueue_object (ctx, XCDR (object), WEIGHT_NORMAL);
+      break;
+    case Lisp_Symbol:
+      {
+	struct Lisp_Symbol *symbol = XSYMBOL (object);
+	dump_enqueue_object (ctx, symbol->u.s.name, WEIGHT_NORMAL);
+	if (symbol->u.s.redirect == SYMBOL_PLAINVAL)
+	  dump_enqueue_object (ctx, symbol->u.s.val.value, WEIGHT_NORMAL);
+	else if (symbol->u.s.redirect == SYMBOL_VARALIAS)
+	  dump_enqueue_object (ctx, make_lisp_symbol (symbol->u.s.val.alias),
+			       WEIGHT_NORMAL);
+	else if (symbol->u.s.redirect == SYMBOL_FORWARDED)
+	  /* The base dump has the forwarding structure, but the
+	     variable's value is this session's.  */
+	  dump_fwd_value (ctx, symbol->u.s.val.fwd);
+	dump_enqueue_object (ctx, symbol->u.s.function, WEIGHT_NORMAL);
+	dump_enqueue_object (ctx, symbol->u.s.plist, WEIGHT_NORMAL);
+	if (symbol->u.s.next)
+	  dump_enqueue_object (ctx, make_lisp_symbol (symbol->u.s.next),
+			       WEIGHT_NORMAL);
+      }
+      break;
+    case Lisp_Vectorlike:
+      {
+	const struct Lisp_Vector *v = XVECTOR (object);
+	ptrdiff_t size = v->header.size;
+	ptrdiff_t start = 0;
+	if (size & PSEUDOVECTOR_FLAG)
+	  {
+	    size &= PSEUDOVECTOR_SIZE_MASK;
+	    if (PSEUDOVECTOR_TYPEP (&v->header, PVEC_SUB_CHAR_TABLE))
+	      start = SUB_CHAR_TABLE_OFFSET;
+	  }
+	for (ptrdiff_t i = start; i < size; i++)
+	  dump_enqueue_object (ctx, v->contents[i], WEIGHT_NORMAL);
+      }
+      break;
+    default:
+      break;
+    }
+  dump_clear_referrer (ctx);
+}
+
 /* Add an object to the dump.
 
    CTX is the dump context; OBJECT is the object to add.  Normally,
@@ -2999,6 +3287,17 @@ dump_object (struct dump_context *ctx, Lisp_Object object)
   if (offset > 0)
     return offset;  /* Object already dumped.  */
 
+  /* An overlay dump takes the objects of its base dump as they are,
+     unless they changed.  */
+  dump_off base_offset = dump_base_offset (ctx, object);
+  if (base_offset > 0
+      && !dump_base_object_changed_p (ctx, object, base_offset))
+    {
+      dump_remember_object (ctx, object, base_offset);
+      dump_enqueue_base_object_referents (ctx, object);
+      return base_offset;
+    }
+
   bool cold = BOOL_VECTOR_P (object) || FLOATP (object);
   if (cold && ctx->flags.defer_cold_objects)
     {
@@ -3068,6 +3367,20 @@ dump_object (struct dump_context *ctx, Lisp_Object object)
   if (ctx->flags.dump_object_contents && offset > DUMP_OBJECT_NOT_SEEN)
     {
       eassert (offset % DUMP_ALIGNMENT == 0);
+      if (base_offset > 0)
+	{
+	  /* Loading the overlay dump copies the new contents over the
+	     object, which keeps its place in the base dump.  */
+	  dump_off size = dump_object_size (object);
+	  dump_push (&ctx->patches,
+		     list3 (dump_off_to_lisp (offset),
+			    dump_off_to_lisp (base_offset),
+			    dump_off_to_lisp (size)));
+	  ctx->patched_bytes += size;
+	  Fputhash (object, dump_off_to_lisp (offset), ctx->patched_objects);
+	  dump_remember_object (ctx, object, base_offset);
+	  return base_offset;
+	}
       dump_remember_object (ctx, object, offset);
       if (ctx->flags.record_object_starts)
         {
@@ -3260,7 +3573,7 @@ static void
 dump_cold_string (struct dump_context *ctx, Lisp_Object string)
 {
   /* Dump string contents.  */
-  dump_off string_offset = dump_recall_object (ctx, string);
+  dump_off string_offset = dump_recall_object_contents (ctx, string);
   eassert (string_offset > 0);
   if (SBYTES (string) > DUMP_OFF_MAX - 1)
     error ("string too large");
@@ -3291,7 +3604,7 @@ static void
 dump_cold_buffer (struct dump_context *ctx, Lisp_Object data)
 {
   /* Dump buffer text.  */
-  dump_off buffer_offset = dump_recall_object (ctx, data);
+  dump_off buffer_offset = dump_recall_object_contents (ctx, data);
   eassert (buffer_offset > 0);
   struct buffer *b = XBUFFER (data);
   eassert (b->text == &b->own_text);
@@ -3521,6 +3834,7 @@ dump_unwind_cleanup (void *data)
   Vpurify_flag = ctx->old_purify_flag;
   Vpost_gc_hook = ctx->old_post_gc_hook;
   Vprocess_environment = ctx->old_process_environment;
+  xfree (ctx->base_image);
 }
 
 /* Check that DUMP_OFFSET is within the heap.  */
@@ -3564,6 +3878,18 @@ dump_emit_dump_reloc (struct dump_context *ctx, Lisp_Object lreloc)
     ctx->number_discardable_relocations += 1;
 }
 
+static void
+dump_emit_patch (struct dump_context *ctx, Lisp_Object lpatch)
+{
+  eassert (ctx->flags.pack_objects);
+  struct dump_patch patch;
+  dump_object_start (ctx, &patch, sizeof (patch));
+  patch.offset = dump_off_from_lisp (dump_pop (&lpatch));
+  patch.base_offset = dump_off_from_lisp (dump_pop (&lpatch));
+  patch.size = dump_off_from_lisp (dump_pop (&lpatch));
+  dump_object_finish (ctx, &patch, sizeof (patch));
+}
+
 #ifdef ENABLE_CHECKING
 static Lisp_Object
 dump_check_overlap_dump_reloc (Lisp_Object lreloc_a,
@@ -3903,12 +4229,17 @@ dump_drain_deferred_symbols (struct dump_context *ctx)
 
 DEFUN ("dump-emacs-portable",
        Fdump_emacs_portable, Sdump_emacs_portable,
-       1, 2, 0,
+       1, 3, 0,
        doc: /* Dump current state of Emacs into dump file FILENAME.
 If TRACK-REFERRERS is non-nil, keep additional debugging information
 that can help track down the provenance of unsupported object
-types.  */)
-     (Lisp_Object filename, Lisp_Object track_referrers)
+types.
+If OVERLAY is non-nil, make an overlay dump: one that holds only what
+was created or changed since Emacs loaded the dump file it started
+from, and that needs that file, the base dump, to be loaded.  Starting
+Emacs with an overlay dump as its dump file loads the base dump along
+with it.  The base dump must not change afterwards.  */)
+     (Lisp_Object filename, Lisp_Object track_referrers, Lisp_Object overlay)
 {
   eassert (initialized);
 
@@ -3929,6 +4260,9 @@ types.  */)
   if (!NILP (XCDR (Fall_threads ())))
     error ("No other Lisp threads can be running when this function is called");
 
+  if (!NILP (overlay) && !dumped_with_pdumper_p ())
+    error ("Overlay dumps need Emacs to have started from a dump file");
+
   /* Clear out any detritus in memory.  */
   do
     {
@@ -3967,6 +4301,8 @@ types.  */)
   ctx->object_starts = Qnil;
   ctx->emacs_relocs = Qnil;
   ctx->bignum_data = make_eq_hash_table ();
+  ctx->patches = Qnil;
+  ctx->patched_objects = make_eq_hash_table ();
 
   /* Ordinarily, dump_object should remember where it saw objects and
      actually write the object contents to the dump file.  In special
@@ -3991,6 +4327,8 @@ types.  */)
   ctx->dump_filename = filename;
 
   record_unwind_protect_ptr (dump_unwind_cleanup, ctx);
+  if (!NILP (overlay))
+    dump_read_base_image (ctx);
   block_input ();
 
 #ifdef REL_ALLOC
@@ -4023,6 +4361,8 @@ types.  */)
   for (int i = 0; i < sizeof fingerprint; i++)
     ctx->header.fingerprint[i] = fingerprint[i];
 
+  /* An overlay dump goes after its base dump.  */
+  ctx->offset = ctx->overlay_start;
   const dump_off header_start = ctx->offset;
   dump_fingerprint ("Dumping fingerprint", ctx->header.fingerprint);
   dump_write (ctx, &ctx->header, sizeof (ctx->header));
@@ -4141,9 +4481,22 @@ types.  */)
 		    &ctx->object_starts, &ctx->header.object_starts);
   drain_reloc_list (ctx, dump_emit_emacs_reloc, dump_merge_emacs_relocs,
 		    &ctx->emacs_relocs, &ctx->header.emacs_relocs);
+  if (ctx->overlay_start)
+    {
+      drain_reloc_list (ctx, dump_emit_patch, NULL,
+			&ctx->patches, &ctx->header.patches);
+      dump_off length = strlen (ctx->base_filename);
+      ctx->header.base_file_name.offset = ctx->offset;
+      ctx->header.base_file_name.nr_entries = length;
+      dump_write (ctx, ctx->base_filename, length);
+    }
 
   const dump_off cold_end = ctx->offset;
 
+  /* End on a page boundary, so that an overlay dump can be mapped
+     right after this one.  */
+  dump_align_output (ctx, dump_get_page_size ());
+
   eassert (dump_queue_empty_p (&ctx->dump_queue));
   eassert (NILP (ctx->copied_queue));
   eassert (NILP (ctx->cold_queue));
@@ -4152,11 +4505,12 @@ types.  */)
   eassert (NILP (ctx->fixups));
   eassert (NILP (ctx->dump_relocs));
   eassert (NILP (ctx->emacs_relocs));
+  eassert (NILP (ctx->patches));
 
   /* Dump is complete.  Go back to the header and write the magic
      indicating that the dump is complete and can be loaded.  */
   ctx->header.magic[0] = dump_magic[0];
-  dump_seek (ctx, 0);
+  dump_seek (ctx, header_start);
   dump_write (ctx, &ctx->header, sizeof (ctx->header));
 
   dump_off
@@ -4172,6 +4526,11 @@ types.  */)
 	   header_bytes, hot_bytes, discardable_bytes, cold_bytes,
            number_hot_relocations,
            number_discardable_relocations);
+  if (ctx->overlay_start)
+    fprintf (stderr,
+	     "Patched objects of the base dump: %"PRIdDUMP_OFF
+	     " (%"PRIdDUMP_OFF" bytes)\n",
+	     ctx->header.patches.nr_entries, ctx->patched_bytes);
 
   unblock_input ();
   return unbind_to (count, Qnil);
@@ -4440,7 +4799,7 @@ dump_map_file_w32 (void *base, int fd, off_t offset, size_t size,
 #if VM_SUPPORTED == VM_POSIX
 static void *
 dump_map_file_posix (void *base, int fd, off_t offset, size_t size,
-		     enum dump_memory_protection protection)
+		     enum dump_memory_protection protection, bool populate)
 {
   void *ret;
   int mem_prot;
@@ -4466,21 +4825,29 @@ dump_map_file_posix (void *base, int fd, off_t offset, size_t size,
 
   if (base)
     mem_flags |= MAP_FIXED;
+  if (populate)
+    mem_flags |= MAP_POPULATE;
 
   ret = mmap (base, size, mem_prot, mem_flags, fd, offset);
+  if (ret == MAP_FAILED && errno == EINVAL && populate)
+    /* This system didn't understand MAP_POPULATE, so try again
+       without it.  */
+    ret = mmap (base, size, mem_prot, mem_flags & ~MAP_POPULATE, fd, offset);
   if (ret == MAP_FAILED)
     ret = NULL;
   return ret;
 }
 #endif
 
-/* Map a file into memory.  */
+/* Map a file into memory.  If POPULATE, read in all of it right away,
+   as it is all about to be written; this is cheaper than faulting in
+   each page when it is first written.  */
 static void *
 dump_map_file (void *base, int fd, off_t offset, size_t size,
-	       enum dump_memory_protection protection)
+	       enum dump_memory_protection protection, bool populate)
 {
 #if VM_SUPPORTED == VM_POSIX
-  return dump_map_file_posix (base, fd, offset, size, protection);
+  return dump_map_file_posix (base, fd, offset, size, protection, populate);
 #elif VM_SUPPORTED == VM_MS_WINDOWS
   return dump_map_file_w32 (base, fd, offset, size, protection);
 #else
@@ -4517,6 +4884,7 @@ struct dump_memory_map_spec
   size_t size;  /* Number of bytes to map.  */
   off_t offset;  /* Offset within fd.  */
   enum dump_memory_protection protection;
+  bool populate;  /* Whether all of it is about to be written.  */
 };
 
 struct dump_memory_map
@@ -4721,7 +5089,8 @@ dump_mmap_contiguous_vm (struct dump_memory_map *maps, int nr_maps,
 						    spec.protection);
           else
 	    map->mapping = dump_map_file (mem, spec.fd, spec.offset,
-					  spec.size, spec.protection);
+					  spec.size, spec.protection,
+					  spec.populate);
           mem += spec.size;
 	  if (need_retry && map->mapping == NULL
 	      && (errno == EBUSY
@@ -4874,12 +5243,23 @@ struct pdumper_loaded_dump_private
 {
   /* Copy of the header we read from the dump.  */
   struct dump_header header;
+  /* Copy of the header of the base dump, if the dump is an overlay
+     dump, or of the header of the dump itself otherwise.  */
+  struct dump_header base_header;
+  /* Where the overlay dump starts, or zero.  */
+  dump_off overlay_start;
   /* Mark bits for objects in the dump; used during GC.  */
   struct dump_bitset mark_bits, last_mark_bits;
   /* Time taken to load the dump.  */
   double load_time;
+  /* Time taken by each phase of loading the dump.  */
+  double map_time, dump_relocation_time, emacs_relocation_time, hook_time;
+  /* Number of threads that did the dump relocations.  */
+  int relocation_threads;
   /* Dump file name.  */
   char *dump_filename;
+  /* File name of the base dump, or NULL.  */
+  char *base_filename;
 };
 
 struct pdumper_loaded_dump dump_public;
@@ -4901,40 +5281,40 @@ dump_ptr (uintptr_t dump_base, dump_off offset)
   return (char *)dump_base + offset;
 }
 
-/* Read a pointer-sized word of memory at OFFSET within the dump,
-   which begins at DUMP_BASE. DUMP_BASE must be equal to the current
-   dump load location; it's passed as a parameter for efficiency.  */
+/* Read a pointer-sized word of memory at OFFSET within IMAGE, which
+   is the dump as loaded or a copy of it.  */
 static uintptr_t
-dump_read_word_from_dump (uintptr_t dump_base, dump_off offset)
+dump_read_word_from_dump (char *image, dump_off offset)
 {
+  eassert (0 <= offset);
   uintptr_t value;
   /* The compiler optimizes this memcpy into a read.  */
-  memcpy (&value, dump_ptr (dump_base, offset), sizeof (value));
+  memcpy (&value, image + offset, sizeof (value));
   return value;
 }
 
-/* Write a word to the dump. DUMP_BASE and OFFSET are as for
+/* Write a word to the dump. IMAGE and OFFSET are as for
    dump_read_word_from_dump; VALUE is the word to write at the given
    offset.  */
 static void
-dump_write_word_to_dump (uintptr_t dump_base,
+dump_write_word_to_dump (char *image,
                          dump_off offset,
                          uintptr_t value)
 {
   /* The compiler optimizes this memcpy into a write.  */
-  memcpy (dump_ptr (dump_base, offset), &value, sizeof (value));
+  memcpy (image + offset, &value, sizeof (value));
 }
 
-/* Write a Lisp_Object to the dump. DUMP_BASE and OFFSET are as for
+/* Write a Lisp_Object to the dump. IMAGE and OFFSET are as for
    dump_read_word_from_dump; VALUE is the Lisp_Object to write at the
    given offset.  */
 static void
-dump_write_lv_to_dump (uintptr_t dump_base,
+dump_write_lv_to_dump (char *image,
                        dump_off offset,
                        Lisp_Object value)
 {
   /* The compiler optimizes this memcpy into a write.  */
-  memcpy (dump_ptr (dump_base, offset), &value, sizeof (value));
+  memcpy (image + offset, &value, sizeof (value));
 }
 
 /* Search for a relocation given a relocation target.
@@ -4982,13 +5362,23 @@ dump_loaded_p (void)
   return dump_public.start != 0;
 }
 
+/* Return the header of the dump that holds OFFSET: the header of the
+   base dump if OFFSET is in the base of an overlay dump.  */
+static const struct dump_header *
+dump_header_at (dump_off offset)
+{
+  return (offset < dump_private.overlay_start
+	  ? &dump_private.base_header
+	  : &dump_private.header);
+}
+
 bool
 pdumper_cold_object_p_impl (const void *obj)
 {
   eassert (pdumper_object_p (obj));
   eassert (pdumper_object_p_precise (obj));
   dump_off offset = ptrdiff_t_to_dump_off ((uintptr_t) obj - dump_public.start);
-  return offset >= dump_private.header.cold_start;
+  return offset >= dump_header_at (offset)->cold_start;
 }
 
 int
@@ -4998,12 +5388,13 @@ pdumper_find_object_type_impl (const void *obj)
   dump_off offset = ptrdiff_t_to_dump_off ((uintptr_t) obj - dump_public.start);
   if (offset % DUMP_ALIGNMENT != 0)
     return PDUMPER_NO_OBJECT;
+  const struct dump_header *header = dump_header_at (offset);
   ptrdiff_t bitno = offset / DUMP_ALIGNMENT;
-  if (offset < dump_private.header.discardable_start
+  if (offset < header->discardable_start
       && !dump_bitset_bit_set_p (&dump_private.last_mark_bits, bitno))
     return PDUMPER_NO_OBJECT;
   const struct dump_reloc *reloc =
-    dump_find_relocation (&dump_private.header.object_starts, offset);
+    dump_find_relocation (&header->object_starts, offset);
   return (reloc != NULL && dump_reloc_get_offset (*reloc) == offset)
     ? reloc->type
     : PDUMPER_NO_OBJECT;
@@ -5015,8 +5406,8 @@ pdumper_marked_p_impl (const void *obj)
   eassert (pdumper_object_p (obj));
   ptrdiff_t offset = (uintptr_t) obj - dump_public.start;
   eassert (offset % DUMP_ALIGNMENT == 0);
-  eassert (offset < dump_private.header.cold_start);
-  eassert (offset < dump_private.header.discardable_start);
+  eassert (offset < dump_header_at (offset)->cold_start);
+  eassert (offset < dump_header_at (offset)->discardable_start);
   ptrdiff_t bitno = offset / DUMP_ALIGNMENT;
   return dump_bitset_bit_set_p (&dump_private.mark_bits, bitno);
 }
@@ -5027,8 +5418,8 @@ pdumper_set_marked_impl (const void *obj)
   eassert (pdumper_object_p (obj));
   ptrdiff_t offset = (uintptr_t) obj - dump_public.start;
   eassert (offset % DUMP_ALIGNMENT == 0);
-  eassert (offset < dump_private.header.cold_start);
-  eassert (offset < dump_private.header.discardable_start);
+  eassert (offset < dump_header_at (offset)->cold_start);
+  eassert (offset < dump_header_at (offset)->discardable_start);
   ptrdiff_t bitno = offset / DUMP_ALIGNMENT;
   eassert (dump_bitset_bit_set_p (&dump_private.last_mark_bits, bitno));
   dump_bitset_set_bit (&dump_private.mark_bits, bitno);
@@ -5043,6 +5434,43 @@ pdumper_clear_marks_impl (void)
   dump_bitset_clear (&dump_private.mark_bits);
 }
 
+/* Call VISIT on the objects that the dump with header HEADER starts,
+   and that were marked by the last garbage collection.  */
+static void
+dump_visit_live_objects (const struct dump_header *header,
+			 void (*visit) (Lisp_Object))
+{
+  const struct dump_table_locator *table = &header->object_starts;
+  const struct dump_reloc *relocs = dump_ptr (dump_public.start,
+					      table->offset);
+  for (dump_off i = 0; i < table->nr_entries; i++)
+    {
+      dump_off offset = dump_reloc_get_offset (relocs[i]);
+      /* Objects past the hot section have no mark bits; they contain
+	 no references that matter to the garbage collector.  */
+      if (offset >= header->discardable_start)
+	continue;
+      if (!dump_bitset_bit_set_p (&dump_private.last_mark_bits,
+				  offset / DUMP_ALIGNMENT))
+	continue;
+      void *obj = dump_ptr (dump_public.start, offset);
+      enum Lisp_Type type = (enum Lisp_Type) relocs[i].type;
+      visit (type == Lisp_Symbol
+	     ? make_lisp_symbol (obj)
+	     : make_lisp_ptr (obj, type));
+    }
+}
+
+void
+pdumper_visit_live_objects_impl (void (*visit) (Lisp_Object))
+{
+  if (!dump_loaded_p ())
+    return;
+  if (dump_private.overlay_start)
+    dump_visit_live_objects (&dump_private.base_header, visit);
+  dump_visit_live_objects (&dump_private.header, visit);
+}
+
 static ssize_t
 dump_read_all (int fd, void *buf, size_t bytes_to_read)
 {
@@ -5080,11 +5508,11 @@ dump_reloc_size (const struct dump_reloc reloc)
 }
 
 static Lisp_Object
-dump_make_lv_from_reloc (const uintptr_t dump_base,
+dump_make_lv_from_reloc (const uintptr_t dump_base, char *const image,
 			 const struct dump_reloc reloc)
 {
   const dump_off reloc_offset = dump_reloc_get_offset (reloc);
-  uintptr_t value = dump_read_word_from_dump (dump_base, reloc_offset);
+  uintptr_t value = dump_read_word_from_dump (image, reloc_offset);
   enum Lisp_Type lisp_type;
 
   if (RELOC_DUMP_TO_DUMP_LV <= reloc.type
@@ -5113,9 +5541,10 @@ dump_make_lv_from_reloc (const uintptr_t dump_base,
   return lv;
 }
 
-/* Actually apply a dump relocation.  */
+/* Actually apply a dump relocation, to IMAGE, which is the dump
+   loaded at DUMP_BASE or a copy of it.  */
 static inline void
-dump_do_dump_relocation (const uintptr_t dump_base,
+dump_do_dump_relocation (const uintptr_t dump_base, char *const image,
 			 const struct dump_reloc reloc)
 {
   const dump_off reloc_offset = dump_reloc_get_offset (reloc);
@@ -5127,23 +5556,24 @@ dump_do_dump_relocation (const uintptr_t dump_base,
     {
     case RELOC_DUMP_TO_EMACS_PTR_RAW:
       {
-        uintptr_t value = dump_read_word_from_dump (dump_base, reloc_offset);
+        uintptr_t value = dump_read_word_from_dump (image, reloc_offset);
         eassert (dump_reloc_size (reloc) == sizeof (value));
         value += emacs_basis ();
-        dump_write_word_to_dump (dump_base, reloc_offset, value);
+        dump_write_word_to_dump (image, reloc_offset, value);
         break;
       }
     case RELOC_DUMP_TO_DUMP_PTR_RAW:
       {
-        uintptr_t value = dump_read_word_from_dump (dump_base, reloc_offset);
+        uintptr_t value = dump_read_word_from_dump (image, reloc_offset);
         eassert (dump_reloc_size (reloc) == sizeof (value));
         value += dump_base;
-        dump_write_word_to_dump (dump_base, reloc_offset, value);
+        dump_write_word_to_dump (image, reloc_offset, value);
         break;
       }
     case RELOC_BIGNUM:
       {
-        struct Lisp_Bignum *bignum = dump_ptr (dump_base, reloc_offset);
+        struct Lisp_Bignum *bignum
+	  = (struct Lisp_Bignum *) (image + reloc_offset);
         struct bignum_reload_info reload_info;
         verify (sizeof (reload_info) <= sizeof (*bignum_val (bignum)));
         memcpy (&reload_info, bignum_val (bignum), sizeof (reload_info));
@@ -5154,22 +5584,179 @@ dump_do_dump_relocation (const uintptr_t dump_base,
       }
     default: /* Lisp_Object in the dump; precise type in reloc.type */
       {
-        Lisp_Object lv = dump_make_lv_from_reloc (dump_base, reloc);
+        Lisp_Object lv = dump_make_lv_from_reloc (dump_base, image, reloc);
         eassert (dump_reloc_size (reloc) == sizeof (lv));
-        dump_write_lv_to_dump (dump_base, reloc_offset, lv);
+        dump_write_lv_to_dump (image, reloc_offset, lv);
         break;
       }
     }
 }
 
-static void
+/* Relocations can be done by several threads, as each one reads and
+   writes only the object at its own offset.  A thread is worth
+   starting for every DUMP_RELOCATIONS_PER_THREAD relocations, up to
+   DUMP_RELOCATION_THREADS_MAX threads in all.  */
+enum { DUMP_RELOCATIONS_PER_THREAD = 64 * 1024 };
+enum { DUMP_RELOCATION_THREADS_MAX = 8 };
+
+/* The dump relocations shared out among threads.  */
+struct dump_relocation_work
+{
+  uintptr_t dump_base;
+  const struct dump_reloc *relocs;
+  dump_off nr_relocs;
+  /* The relocations are done in NR_PIECES pieces of about the same
+     size, and NEXT_PIECE is the first piece that no thread has taken
+     yet.  */
+  int nr_pieces, next_piece;
+#ifdef THREADS_ENABLED
+  /* The number of threads other than the main thread still running,
+     signaled by DONE when it drops to zero.  */
+  int threads_running;
+  sys_mutex_t mutex;
+  sys_cond_t done;
+#endif
+};
+
+/* Static, as the threads can still use it briefly after the main
+   thread is done waiting for them.  */
+static struct dump_relocation_work dump_relocation_work;
+
+/* Do pieces of the dump relocations until none is left.  */
+static void *
+dump_do_dump_relocation_pieces (void *arg)
+{
+  struct dump_relocation_work *w = &dump_relocation_work;
+  bool main_thread = arg == NULL;
+
+  while (true)
+    {
+#ifdef THREADS_ENABLED
+      if (w->nr_pieces > 1)
+	sys_mutex_lock (&w->mutex);
+#endif
+      int piece = w->next_piece < w->nr_pieces ? w->next_piece++ : -1;
+#ifdef THREADS_ENABLED
+      if (piece < 0 && !main_thread && --w->threads_running == 0)
+	sys_cond_signal (&w->done);
+      if (w->nr_pieces > 1)
+	sys_mutex_unlock (&w->mutex);
+#endif
+      if (piece < 0)
+	return NULL;
+
+      dump_off start = (intmax_t) w->nr_relocs * piece / w->nr_pieces;
+      dump_off end = (intmax_t) w->nr_relocs * (piece + 1) / w->nr_pieces;
+      for (dump_off i = start; i < end; ++i)
+	dump_do_dump_relocation (w->dump_base, (char *) w->dump_base,
+				 w->relocs[i]);
+    }
+}
+
+/* Do the dump relocations, and return the number of threads that did
+   them.  */
+static int
 dump_do_all_dump_relocations (const struct dump_header *const header,
 			      const uintptr_t dump_base)
 {
-  struct dump_reloc *r = dump_ptr (dump_base, header->dump_relocs.offset);
-  dump_off nr_entries = header->dump_relocs.nr_entries;
-  for (dump_off i = 0; i < nr_entries; ++i)
-    dump_do_dump_relocation (dump_base, r[i]);
+  struct dump_relocation_work *w = &dump_relocation_work;
+  int nr_threads = 1;
+
+  w->dump_base = dump_base;
+  w->relocs = dump_ptr (dump_base, header->dump_relocs.offset);
+  w->nr_relocs = header->dump_relocs.nr_entries;
+  w->nr_pieces = 1;
+  w->next_piece = 0;
+
+#if defined THREADS_ENABLED && defined _SC_NPROCESSORS_ONLN
+  long nr_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  nr_threads = min (w->nr_relocs / DUMP_RELOCATIONS_PER_THREAD,
+		    min (nr_cpus, DUMP_RELOCATION_THREADS_MAX));
+  nr_threads = max (nr_threads, 1);
+#endif
+
+#ifdef THREADS_ENABLED
+  if (nr_threads > 1)
+    {
+      /* Cut the work into more pieces than threads, so that a thread
+	 that gets slowed down doesn't hold up the others.  */
+      w->nr_pieces = 4 * nr_threads;
+      w->threads_running = 0;
+      sys_mutex_init (&w->mutex);
+      sys_cond_init (&w->done);
+      sys_mutex_lock (&w->mutex);
+      for (int i = 1; i < nr_threads; i++)
+	{
+	  sys_thread_t thread;
+	  if (!sys_thread_create (&thread, dump_do_dump_relocation_pieces,
+				  w))
+	    break;
+	  w->threads_running++;
+	}
+      nr_threads = w->threads_running + 1;
+      sys_mutex_unlock (&w->mutex);
+    }
+#endif
+
+  dump_do_dump_relocation_pieces (NULL);
+
+#ifdef THREADS_ENABLED
+  if (w->nr_pieces > 1)
+    {
+      sys_mutex_lock (&w->mutex);
+      while (w->threads_running > 0)
+	sys_cond_wait (&w->done, &w->mutex);
+      sys_mutex_unlock (&w->mutex);
+    }
+#endif
+
+  return nr_threads;
+}
+
+/* Prepare CTX for making an overlay dump on top of the dump file
+   Emacs started from, or on top of the base of that dump file if it
+   is itself an overlay dump: read the base dump into CTX->base_image
+   and relocate it, to have it as it was just after loading.  */
+static void
+dump_read_base_image (struct dump_context *ctx)
+{
+  const char *filename = (dump_private.base_filename
+			  ? dump_private.base_filename
+			  : dump_private.dump_filename);
+  const struct dump_header *header = &dump_private.base_header;
+  dump_off size = (dump_private.overlay_start
+		   ? dump_private.overlay_start
+		   : dump_public.end - dump_public.start);
+  Lisp_Object lfilename = build_unibyte_string (filename);
+
+  if (size % dump_get_page_size () != 0)
+    error ("Dump file %s cannot be the base of an overlay dump", filename);
+
+  ptrdiff_t count = SPECPDL_INDEX ();
+  int fd = emacs_open (filename, O_RDONLY, 0);
+  if (fd < 0)
+    report_file_error ("Opening base dump", lfilename);
+  record_unwind_protect_int (close_file_unwind, fd);
+
+  ctx->base_image = xmalloc (size);
+  struct stat st;
+  if (fstat (fd, &st) < 0
+      || st.st_size != size
+      || dump_read_all (fd, ctx->base_image, size) < size
+      || memcmp (ctx->base_image, header, sizeof *header) != 0)
+    error ("Dump file %s changed since Emacs loaded it", filename);
+  unbind_to (count, Qnil);
+
+  const struct dump_reloc *relocs
+    = (struct dump_reloc *) (ctx->base_image + header->dump_relocs.offset);
+  for (dump_off i = 0; i < header->dump_relocs.nr_entries; i++)
+    dump_do_dump_relocation (dump_public.start, ctx->base_image, relocs[i]);
+
+  ctx->overlay_start = size;
+  ctx->base_filename = filename;
+  ctx->header.overlay_start = size;
+  ctx->header.base_header_hash
+    = hash_string ((char *) header, sizeof *header);
 }
 
 static void
@@ -5243,78 +5830,42 @@ enum dump_section
 /* Pointer to a stack variable to avoid having to staticpro it.  */
 static Lisp_Object *pdumper_hashes = &zero_vector;
 
-/* Load a dump from DUMP_FILENAME.  Return an error code.
+/* Return the number of seconds since *START, and set *START to now.  */
+static double
+dump_phase_time (struct timespec *start)
+{
+  struct timespec now = current_timespec ();
+  double elapsed = timespectod (timespec_sub (now, *start));
+  *start = now;
+  return elapsed;
+}
 
-   N.B. We run very early in initialization, so we can't use lisp,
-   unwinding, xmalloc, and so on.  */
-int
-pdumper_load (const char *dump_filename)
+/* Read the header of the dump file open on FD into HEADER, and set
+   *SIZE to the size of the file.  Return an error code.  */
+static int
+dump_read_header (int fd, struct dump_header *header, intptr_t *size)
 {
-  intptr_t dump_size;
   struct stat stat;
-  uintptr_t dump_base;
-  int dump_page_size;
-  dump_off adj_discardable_start;
-
-  struct dump_bitset mark_bits[2];
-  size_t mark_bits_needed;
-
-  struct dump_header header_buf = { 0 };
-  struct dump_header *header = &header_buf;
-  struct dump_memory_map sections[NUMBER_DUMP_SECTIONS] = { 0 };
-
-  const struct timespec start_time = current_timespec ();
-  char *dump_filename_copy;
-
-  /* Overwriting an initialized Lisp universe will not go well.  */
-  eassert (!initialized);
-
-  /* We can load only one dump.  */
-  eassert (!dump_loaded_p ());
-
-  int err;
-  int dump_fd = emacs_open (dump_filename, O_RDONLY, 0);
-  if (dump_fd < 0)
-    {
-      err = (errno == ENOENT || errno == ENOTDIR
-	     ? PDUMPER_LOAD_FILE_NOT_FOUND
-	     : PDUMPER_LOAD_ERROR + errno);
-      goto out;
-    }
-
-  err = PDUMPER_LOAD_FILE_NOT_FOUND;
-  if (fstat (dump_fd, &stat) < 0)
-    goto out;
+  if (fstat (fd, &stat) < 0)
+    return PDUMPER_LOAD_FILE_NOT_FOUND;
 
-  err = PDUMPER_LOAD_BAD_FILE_TYPE;
   if (stat.st_size > INTPTR_MAX)
-    goto out;
-  dump_size = (intptr_t) stat.st_size;
-
-  err = PDUMPER_LOAD_BAD_FILE_TYPE;
-  if (dump_size < sizeof (*header))
-    goto out;
+    return PDUMPER_LOAD_BAD_FILE_TYPE;
+  *size = (intptr_t) stat.st_size;
 
-  err = PDUMPER_LOAD_BAD_FILE_TYPE;
-  if (dump_read_all (dump_fd,
-                     header,
-                     sizeof (*header)) < sizeof (*header))
-    goto out;
+  if (*size < sizeof (*header)
+      || dump_read_all (fd, header, sizeof (*header)) < sizeof (*header))
+    return PDUMPER_LOAD_BAD_FILE_TYPE;
 
   if (memcmp (header->magic, dump_magic, sizeof (dump_magic)) != 0)
     {
       if (header->magic[0] == '!'
 	  && (header->magic[0] = dump_magic[0],
 	      memcmp (header->magic, dump_magic, sizeof (dump_magic)) == 0))
-        {
-          err = PDUMPER_LOAD_FAILED_DUMP;
-          goto out;
-        }
-      err = PDUMPER_LOAD_BAD_FILE_TYPE;
-      goto out;
+	return PDUMPER_LOAD_FAILED_DUMP;
+      return PDUMPER_LOAD_BAD_FILE_TYPE;
     }
 
-  err = PDUMPER_LOAD_VERSION_MISMATCH;
   verify (sizeof (header->fingerprint) == sizeof (fingerprint));
   unsigned char desired[sizeof fingerprint];
   for (int i = 0; i < sizeof fingerprint; i++)
@@ -5323,18 +5874,22 @@ pdumper_load (const char *dump_filename)
     {
       dump_fingerprint ("desired fingerprint", desired);
       dump_fingerprint ("found fingerprint", header->fingerprint);
-      goto out;
+      return PDUMPER_LOAD_VERSION_MISMATCH;
     }
 
-  /* FIXME: The comment at the start of this function says it should
-     not use xmalloc, but xstrdup calls xmalloc.  Either fix the
-     comment or fix the following code.  */
-  dump_filename_copy = xstrdup (dump_filename);
-
-  err = PDUMPER_LOAD_OOM;
+  return PDUMPER_LOAD_SUCCESS;
+}
 
-  adj_discardable_start = header->discardable_start;
-  dump_page_size = dump_get_page_size ();
+/* Describe in SECTIONS, an array of NUMBER_DUMP_SECTIONS maps, how to
+   map the dump file of SIZE bytes with header HEADER open on FD.  */
+static void
+dump_describe_sections (struct dump_memory_map *sections,
+			const struct dump_header *header,
+			int fd, intptr_t size)
+{
+  dump_off start = header->overlay_start;
+  dump_off adj_discardable_start = header->discardable_start;
+  int dump_page_size = dump_get_page_size ();
   /* Snap to next page boundary.  */
   adj_discardable_start = ROUNDUP (adj_discardable_start, dump_page_size);
   eassert (adj_discardable_start % dump_page_size == 0);
@@ -5342,29 +5897,136 @@ pdumper_load (const char *dump_filename)
 
   sections[DS_HOT].spec = (struct dump_memory_map_spec)
     {
-     .fd = dump_fd,
-     .size = adj_discardable_start,
+     .fd = fd,
+     .size = adj_discardable_start - start,
      .offset = 0,
      .protection = DUMP_MEMORY_ACCESS_READWRITE,
+     /* Nearly every page of it holds pointers to relocate.  */
+     .populate = true,
     };
 
   sections[DS_DISCARDABLE].spec = (struct dump_memory_map_spec)
     {
-     .fd = dump_fd,
+     .fd = fd,
      .size = header->cold_start - adj_discardable_start,
-     .offset = adj_discardable_start,
+     .offset = adj_discardable_start - start,
      .protection = DUMP_MEMORY_ACCESS_READWRITE,
     };
 
   sections[DS_COLD].spec = (struct dump_memory_map_spec)
     {
-     .fd = dump_fd,
-     .size = dump_size - header->cold_start,
-     .offset = header->cold_start,
+     .fd = fd,
+     .size = size - (header->cold_start - start),
+     .offset = header->cold_start - start,
      .protection = DUMP_MEMORY_ACCESS_READWRITE,
     };
+}
+
+/* Copy the changed objects of the base dump that the overlay dump
+   with header HEADER holds over the originals.  */
+static void
+dump_do_all_patches (const struct dump_header *const header,
+		     const uintptr_t dump_base)
+{
+  const dump_off nr_entries = header->patches.nr_entries;
+  const struct dump_patch *p = dump_ptr (dump_base, header->patches.offset);
+  for (dump_off i = 0; i < nr_entries; ++i)
+    memcpy (dump_ptr (dump_base, p[i].base_offset),
+	    dump_ptr (dump_base, p[i].offset),
+	    p[i].size);
+}
+
+/* Load a dump from DUMP_FILENAME, and from its base dump if it is an
+   overlay dump.  Return an error code.
+
+   N.B. We run very early in initialization, so we can't use lisp,
+   unwinding, xmalloc, and so on.  */
+int
+pdumper_load (const char *dump_filename)
+{
+  intptr_t dump_size, base_size = 0;
+  uintptr_t dump_base;
+
+  struct dump_bitset mark_bits[2];
+  size_t mark_bits_needed;
+
+  struct dump_header header_buf = { 0 }, base_header_buf = { 0 };
+  struct dump_header *header = &header_buf;
+  struct dump_header *base_header = &base_header_buf;
+  /* The sections of the base dump, if any, then those of DUMP_FILENAME.  */
+  struct dump_memory_map sections[2 * NUMBER_DUMP_SECTIONS] = { 0 };
+  struct dump_memory_map *dump_sections = sections;
+  int nr_sections = NUMBER_DUMP_SECTIONS;
+
+  const struct timespec start_time = current_timespec ();
+  char *dump_filename_copy;
+  char *base_filename = NULL;
 
-  if (!dump_mmap_contiguous (sections, ARRAYELTS (sections)))
+  /* Overwriting an initialized Lisp universe will not go well.  */
+  eassert (!initialized);
+
+  /* We can load only one dump.  */
+  eassert (!dump_loaded_p ());
+
+  int err;
+  int base_fd = -1;
+  int dump_fd = emacs_open (dump_filename, O_RDONLY, 0);
+  if (dump_fd < 0)
+    {
+      err = (errno == ENOENT || errno == ENOTDIR
+	     ? PDUMPER_LOAD_FILE_NOT_FOUND
+	     : PDUMPER_LOAD_ERROR + errno);
+      goto out;
+    }
+
+  err = dump_read_header (dump_fd, header, &dump_size);
+  if (err != PDUMPER_LOAD_SUCCESS)
+    goto out;
+
+  if (header->overlay_start)
+    {
+      /* Find the base dump, and check that it is the one the overlay
+	 dump was made on top of.  */
+      err = PDUMPER_LOAD_BAD_FILE_TYPE;
+      dump_off name_length = header->base_file_name.nr_entries;
+      if (header->overlay_start % dump_get_page_size () != 0
+	  || name_length <= 0
+	  || lseek (dump_fd,
+		    header->base_file_name.offset - header->overlay_start,
+		    SEEK_SET) < 0)
+	goto out;
+      base_filename = xmalloc (name_length + 1);
+      if (dump_read_all (dump_fd, base_filename, name_length) < name_length)
+	goto out;
+      base_filename[name_length] = '\0';
+
+      err = PDUMPER_LOAD_BAD_BASE;
+      base_fd = emacs_open (base_filename, O_RDONLY, 0);
+      if (base_fd < 0
+	  || dump_read_header (base_fd, base_header, &base_size)
+	     != PDUMPER_LOAD_SUCCESS
+	  || base_header->overlay_start != 0
+	  || base_size != header->overlay_start
+	  || (hash_string ((char *) base_header, sizeof *base_header)
+	      != header->base_header_hash))
+	goto out;
+
+      dump_describe_sections (sections, base_header, base_fd, base_size);
+      dump_sections = &sections[NUMBER_DUMP_SECTIONS];
+      nr_sections += NUMBER_DUMP_SECTIONS;
+    }
+  else
+    *base_header = *header;
+
+  /* FIXME: The comment at the start of this function says it should
+     not use xmalloc, but xstrdup calls xmalloc.  Either fix the
+     comment or fix the following code.  */
+  dump_filename_copy = xstrdup (dump_filename);
+
+  err = PDUMPER_LOAD_OOM;
+
+  dump_describe_sections (dump_sections, header, dump_fd, dump_size);
+  if (!dump_mmap_contiguous (sections, nr_sections))
     goto out;
 
   err = PDUMPER_LOAD_ERROR;
@@ -5378,16 +6040,29 @@ pdumper_load (const char *dump_filename)
   dump_base = (uintptr_t) sections[DS_HOT].mapping;
   gflags.dumped_with_pdumper_ = true;
   dump_private.header = *header;
+  dump_private.base_header = *base_header;
+  dump_private.overlay_start = header->overlay_start;
   dump_private.mark_bits = mark_bits[0];
   dump_private.last_mark_bits = mark_bits[1];
   dump_public.start = dump_base;
-  dump_public.end = dump_public.start + dump_size;
-
-  dump_do_all_dump_relocations (header, dump_base);
+  dump_public.end = dump_public.start + header->overlay_start + dump_size;
+
+  struct timespec phase_time = current_timespec ();
+  dump_private.map_time
+    = timespectod (timespec_sub (phase_time, start_time));
+  if (header->overlay_start)
+    dump_do_all_dump_relocations (base_header, dump_base);
+  dump_private.relocation_threads
+    = dump_do_all_dump_relocations (header, dump_base);
+  if (header->overlay_start)
+    dump_do_all_patches (header, dump_base);
+  dump_private.dump_relocation_time = dump_phase_time (&phase_time);
   dump_do_all_emacs_relocations (header, dump_base);
+  dump_private.emacs_relocation_time = dump_phase_time (&phase_time);
 
-  dump_mmap_discard_contents (&sections[DS_DISCARDABLE]);
-  for (int i = 0; i < ARRAYELTS (sections); ++i)
+  for (int i = DS_DISCARDABLE; i < nr_sections; i += NUMBER_DUMP_SECTIONS)
+    dump_mmap_discard_contents (&sections[i]);
+  for (int i = 0; i < nr_sections; ++i)
     dump_mmap_reset (&sections[i]);
 
   Lisp_Object hashes = zero_vector;
@@ -5404,17 +6079,23 @@ pdumper_load (const char *dump_filename)
   for (int i = 0; i < nr_dump_hooks; ++i)
     dump_hooks[i] ();
   initialized = true;
+  dump_private.hook_time = dump_phase_time (&phase_time);
 
   struct timespec load_timespec =
     timespec_sub (current_timespec (), start_time);
   dump_private.load_time = timespectod (load_timespec);
   dump_private.dump_filename = dump_filename_copy;
+  dump_private.base_filename = base_filename;
+  base_filename = NULL;
 
  out:
-  for (int i = 0; i < ARRAYELTS (sections); ++i)
+  for (int i = 0; i < nr_sections; ++i)
     dump_mmap_release (&sections[i]);
   if (dump_fd >= 0)
     emacs_close (dump_fd);
+  if (base_fd >= 0)
+    emacs_close (base_fd);
+  xfree (base_filename);
   return err;
 }
 
@@ -5438,10 +6119,20 @@ DEFUN ("pdumper-stats", Fpdumper_stats, Spdumper_stats, 0, 0, 0,
 If this Emacs session was started from a dump file,
 the return value is an alist of the form:
 
-  ((dumped-with-pdumper . t) (load-time . TIME) (dump-file-name . FILE))
+  ((dumped-with-pdumper . t) (load-time . TIME) (dump-file-name . FILE)
+   (load-phases . PHASES) (relocation-threads . THREADS))
 
 where TIME is the time in seconds it took to restore Emacs state
 from the dump file, and FILE is the name of the dump file.
+If that is an overlay dump, the alist also has an element
+\(base-dump-file-name . BASE), where BASE is the name of the
+dump file loaded along with it.
+PHASES is an alist that breaks TIME down into the seconds spent
+mapping the dump file (`map'), relocating pointers in the dump
+\(`dump-relocations'), relocating pointers from Emacs into the dump
+\(`emacs-relocations'), and running the code that completes loading
+\(`hooks').  THREADS is the number of threads that relocated the
+pointers in the dump.
 Value is nil if this session was not started using a dump file.*/)
      (void)
 {
@@ -5461,9 +6152,27 @@ Value is nil if this session was not started using a dump file.*/)
 
   dump_fn = Fexpand_file_name (dump_fn, Qnil);
 
-  return list3 (Fcons (Qdumped_with_pdumper, Qt),
-		Fcons (Qload_time, make_float (dump_private.load_time)),
-		Fcons (Qdump_file_name, dump_fn));
+  Lisp_Object base = Qnil;
+  if (dump_private.base_filename)
+    base = list1 (Fcons (Qbase_dump_file_name,
+			 DECODE_FILE (build_unibyte_string
+				      (dump_private.base_filename))));
+
+  Lisp_Object phases
+    = list4 (Fcons (Qmap, make_float (dump_private.map_time)),
+	     Fcons (Qdump_relocations,
+		    make_float (dump_private.dump_relocation_time)),
+	     Fcons (Qemacs_relocations,
+		    make_float (dump_private.emacs_relocation_time)),
+	     Fcons (Qhooks, make_float (dump_private.hook_time)));
+
+  return nconc2 (list5 (Fcons (Qdumped_with_pdumper, Qt),
+		       Fcons (Qload_time, make_float (dump_private.load_time)),
+		       Fcons (Qdump_file_name, dump_fn),
+		       Fcons (Qload_phases, phases),
+		       Fcons (Qrelocation_threads,
+			      make_fixnum (dump_private.relocation_threads))),
+		 base);
 }
 
 #endif /* HAVE_PDUMPER */
@@ -5497,6 +6206,13 @@ syms_of_pdumper (void)
   DEFSYM (Qdumped_with_pdumper, "dumped-with-pdumper");
   DEFSYM (Qload_time, "load-time");
   DEFSYM (Qdump_file_name, "dump-file-name");
+  DEFSYM (Qbase_dump_file_name, "base-dump-file-name");
+  DEFSYM (Qload_phases, "load-phases");
+  DEFSYM (Qmap, "map");
+  DEFSYM (Qdump_relocations, "dump-relocations");
+  DEFSYM (Qemacs_relocations, "emacs-relocations");
+  DEFSYM (Qhooks, "hooks");
+  DEFSYM (Qrelocation_threads, "relocation-threads");
   defsubr (&Spdumper_stats);
 #endif /* HAVE_PDUMPER */
 }
@@ -124,6 +124,7 @@ enum pdumper_load_result
     PDUMPER_LOAD_FAILED_DUMP,
     PDUMPER_LOAD_OOM,
     PDUMPER_LOAD_VERSION_MISMATCH,
+    PDUMPER_LOAD_BAD_BASE,
     PDUMPER_LOAD_ERROR /* Must be last, as errno may be added.  */
   };
 
@@ -252,6 +253,20 @@ pdumper_clear_marks (void)
 #endif
 }
 
+extern void pdumper_visit_live_objects_impl (void (*) (Lisp_Object));
+
+/* Call VISIT on every object of the loaded dump that survived the
+   last garbage collection and might refer to other objects.  */
+INLINE void
+pdumper_visit_live_objects (void (*visit) (Lisp_Object))
+{
+#ifdef HAVE_PDUMPER
+  pdumper_visit_live_objects_impl (visit);
+#else
+  (void) visit;
+#endif
+}
+
 /* Record the Emacs startup directory, relative to which the pdump
    file was loaded.  */
 extern void pdumper_record_wd (const char *);
@@ -97,6 +97,24 @@ static struct rlimit nofile_limit;
 #include <pty.h>
 #endif
 
+/* Builds that wait with glib or NS have their own loops.  */
+#if (defined HAVE_EPOLL_CREATE1 && defined HAVE_EPOLL_PWAIT \
+     && !defined HAVE_GLIB && !defined HAVE_NS && !defined HAVE_PGTK)
+#include <sys/epoll.h>
+#define USE_EPOLL
+#endif
+
+#ifdef HAVE_WRITEV
+#include <sys/uio.h>
+#else
+/* A piece of text for send_process to write.  */
+struct iovec
+{
+  void *iov_base;
+  size_t iov_len;
+};
+#endif
+
 #include <c-ctype.h>
 #include <flexmember.h>
 #include <sig2str.h>
@@ -256,6 +274,9 @@ static EMACS_INT update_tick;
 #define READ_OUTPUT_DELAY_MAX       (READ_OUTPUT_DELAY_INCREMENT * 5)
 #define READ_OUTPUT_DELAY_MAX_MAX   (READ_OUTPUT_DELAY_INCREMENT * 7)
 
+/* Number of bytes to read at first from a process.  */
+#define READ_OUTPUT_SIZE_MIN 4096
+
 /* Number of processes which have a non-zero read_output_delay,
    and therefore might be delayed for adaptive read buffering.  */
 
@@ -275,6 +296,8 @@ static int status_notify (struct Lisp_Process *, struct Lisp_Process *);
 static int read_process_output (Lisp_Object, int);
 static void create_pty (Lisp_Object);
 static void exec_sentinel (Lisp_Object, Lisp_Object);
+static void write_queue_watch (struct Lisp_Process *, bool);
+static void send_process_writable (int, void *);
 
 static Lisp_Object
 network_lookup_address_info_1 (Lisp_Object host, const char *service,
@@ -379,6 +402,16 @@ pset_mark (struct Lisp_Process *p, Lisp_Object val)
   p->mark = val;
 }
 static void
+pset_message_buf (struct Lisp_Process *p, Lisp_Object val)
+{
+  p->message_buf = val;
+}
+static void
+pset_message_framing (struct Lisp_Process *p, Lisp_Object val)
+{
+  p->message_framing = val;
+}
+static void
 pset_thread (struct Lisp_Process *p, Lisp_Object val)
 {
   p->thread = val;
@@ -456,6 +489,361 @@ static struct fd_callback_data
   struct thread_state *waiting_thread;
 } fd_callback_info[FD_SETSIZE];
 
+/* The maximum number of ready descriptors to handle after one wait.  */
+enum { MAX_READY_FDS = 64 };
+
+/* The descriptors in fd_callback_info that are waited for, by kind:
+   those with FOR_READ, those with FOR_READ but not KEYBOARD_FD, those
+   with FOR_READ but not PROCESS_FD, and those with FOR_WRITE.  They
+   are kept up to date as descriptors are added and deleted, so that
+   when it is the only thread, the main thread can wait without
+   looking at every descriptor.  */
+static fd_set input_wait_set;
+static fd_set non_keyboard_wait_set;
+static fd_set non_process_wait_set;
+static fd_set write_wait_set;
+
+/* The number of descriptors whose waiting_thread is not null.  */
+static int num_waiting_fds;
+
+#ifdef USE_EPOLL
+
+/* When it is the only thread, the main thread waits for input with
+   epoll rather than pselect.  A descriptor is registered with the
+   epoll instance for as long as fd_callback_info says to wait for it,
+   so that a wait makes system calls only for the descriptors that
+   are ready, and the kernel looks only at those.  */
+
+/* The epoll instance, or -1 if there is none.  */
+static int epoll_fd = -1;
+
+/* The events each descriptor is registered for with epoll_fd, or 0
+   if it is not registered.  */
+static uint32_t epoll_events[FD_SETSIZE];
+
+/* The descriptors whose registration the current wait changed, and
+   that are to be registered again as fd_callback_info says once it
+   is over, their number, and whether each descriptor is among them.
+   Only the main thread changes these, never a signal handler.  */
+static int epoll_dirty[FD_SETSIZE];
+static int epoll_ndirty;
+static bool epoll_dirty_p[FD_SETSIZE];
+
+/* Whether each descriptor is waited for but could not be registered,
+   as with regular files, and the number of such descriptors.  While
+   there are any, waits use pselect.  */
+static bool epoll_unpollable[FD_SETSIZE];
+static int epoll_num_unpollable;
+
+/* The descriptors found ready by the last call to epoll_select, in
+   increasing order, and their number.  */
+static int epoll_ready[MAX_READY_FDS];
+static int epoll_nready;
+
+/* Register descriptor FD for EVENTS with epoll_fd, or unregister it
+   if EVENTS is 0.  Return false if FD cannot be polled.  */
+
+static bool
+epoll_update (int fd, uint32_t events)
+{
+  struct epoll_event ev = { .events = events, .data.fd = fd };
+  int op = (!epoll_events[fd] ? EPOLL_CTL_ADD
+	    : events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL);
+
+  if (events == epoll_events[fd])
+    return true;
+  if (epoll_ctl (epoll_fd, op, fd, &ev) != 0)
+    {
+      /* Our idea of what is registered can be stale, because closing
+	 a descriptor unregisters it.  */
+      if (op == EPOLL_CTL_MOD && errno == ENOENT)
+	op = EPOLL_CTL_ADD;
+      else if (op == EPOLL_CTL_ADD && errno == EEXIST)
+	op = EPOLL_CTL_MOD;
+      else if (op != EPOLL_CTL_DEL)
+	return false;
+      if (op != EPOLL_CTL_DEL && epoll_ctl (epoll_fd, op, fd, &ev) != 0)
+	return false;
+    }
+  epoll_events[fd] = events;
+  return true;
+}
+
+/* Like epoll_update, but keep track of the descriptors that cannot
+   be polled.  */
+
+static void
+epoll_set (int fd, uint32_t events)
+{
+  bool ok = epoll_update (fd, events);
+
+  if (ok == epoll_unpollable[fd])
+    {
+      epoll_unpollable[fd] = !ok;
+      epoll_num_unpollable += ok ? -1 : 1;
+    }
+}
+
+/* Return the events that fd_callback_info says to wait for on FD.  */
+
+static uint32_t
+epoll_wanted (int fd)
+{
+  int flags = fd_callback_info[fd].flags;
+  return ((flags & FOR_READ ? EPOLLIN : 0)
+	  | (flags & FOR_WRITE ? EPOLLOUT : 0));
+}
+
+/* Register FD as fd_callback_info says, now that this has changed.
+   This is done at once rather than at the next wait, so that FD is
+   no longer registered by the time it is closed: after that, the
+   registration could not be removed, and would stay in effect for as
+   long as the file is open elsewhere.  This can be called from a
+   signal handler.  */
+
+static void
+epoll_changed (int fd)
+{
+  if (0 <= epoll_fd)
+    epoll_set (fd, epoll_wanted (fd));
+}
+
+/* Forget the registration of FD, which is being added to the
+   descriptors to wait for, in case it now refers to a different
+   file.  */
+
+static void
+epoll_forget (int fd)
+{
+  if (epoll_events[fd])
+    epoll_update (fd, 0);
+}
+
+/* Register FD for EVENTS until the end of the current wait.  */
+
+static void
+epoll_set_temporarily (int fd, uint32_t events)
+{
+  if (events != epoll_events[fd])
+    {
+      epoll_set (fd, events);
+      if (!epoll_dirty_p[fd])
+	{
+	  epoll_dirty_p[fd] = true;
+	  epoll_dirty[epoll_ndirty++] = fd;
+	}
+    }
+}
+
+/* Make the next wait notice input on FD, which the caller waits for
+   although fd_callback_info does not say to.  */
+
+static void
+epoll_include (int fd)
+{
+  if (0 <= epoll_fd && !(epoll_events[fd] & EPOLLIN))
+    epoll_set_temporarily (fd, epoll_events[fd] | EPOLLIN);
+}
+
+/* Register again as fd_callback_info says the descriptors whose
+   registration the current wait changed.  */
+
+static void
+epoll_restore (void)
+{
+  while (0 < epoll_ndirty)
+    {
+      int fd = epoll_dirty[--epoll_ndirty];
+      epoll_dirty_p[fd] = false;
+      epoll_set (fd, epoll_wanted (fd));
+    }
+}
+
+/* Replace epoll_fd with a new epoll instance, and register with it
+   the descriptors that fd_callback_info says to wait for, and those
+   in RFDS and WFDS, whose bit count is NFDS.  This gets rid of
+   registrations that can no longer be removed, because their
+   descriptor was closed first.  Return false if this fails.  */
+
+static bool
+epoll_reset (int nfds, fd_set *rfds, fd_set *wfds)
+{
+  int fd;
+
+  emacs_close (epoll_fd);
+  epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  memset (epoll_events, 0, sizeof epoll_events);
+  memset (epoll_dirty_p, 0, sizeof epoll_dirty_p);
+  epoll_ndirty = 0;
+  memset (epoll_unpollable, 0, sizeof epoll_unpollable);
+  epoll_num_unpollable = 0;
+  if (epoll_fd < 0)
+    return false;
+
+  for (fd = 0; fd <= max (max_desc, nfds - 1); fd++)
+    {
+      uint32_t want = epoll_wanted (fd);
+      uint32_t also = ((fd < nfds && rfds && FD_ISSET (fd, rfds)
+			? EPOLLIN : 0)
+		       | (fd < nfds && wfds && FD_ISSET (fd, wfds)
+			  ? EPOLLOUT : 0));
+      epoll_set (fd, want);
+      if (also & ~want)
+	epoll_set_temporarily (fd, want | also);
+    }
+  return !epoll_num_unpollable;
+}
+
+/* Like pselect, but using epoll_fd.  EFDS must be null.  The
+   descriptors in RFDS and WFDS must be registered already, as they
+   are when RFDS and WFDS come from compute_input_wait_mask and the
+   like, or by epoll_include.  */
+
+static int
+epoll_select (int nfds, fd_set *rfds, fd_set *wfds, fd_set *efds,
+	      struct timespec const *timeout, sigset_t const *sigmask)
+{
+  struct epoll_event events[MAX_READY_FDS];
+  struct timespec deadline UNINIT;
+  fd_set rready, wready;
+  int fd, n, i, ready;
+
+  eassert (!efds);
+
+  if (epoll_num_unpollable)
+    {
+      epoll_restore ();
+      return pselect (nfds, rfds, wfds, efds, timeout, sigmask);
+    }
+
+  if (timeout)
+    deadline = timespec_add (current_timespec (), *timeout);
+
+  do
+    {
+      int msecs = -1;
+      bool stale = false;
+
+      if (timeout)
+	{
+	  struct timespec left
+	    = timespec_sub (deadline, current_timespec ());
+	  msecs = (timespec_sign (left) <= 0 ? 0
+		   : left.tv_sec < INT_MAX / 1000 - 1
+		   ? (left.tv_sec * 1000
+		      + (left.tv_nsec + 999999) / 1000000)
+		   : INT_MAX);
+	}
+      n = epoll_pwait (epoll_fd, events, ARRAYELTS (events), msecs,
+		       sigmask);
+      if (n < 0)
+	break;
+
+      FD_ZERO (&rready);
+      FD_ZERO (&wready);
+      ready = 0;
+      epoll_nready = 0;
+      for (i = 0; i < n; i++)
+	{
+	  uint32_t ev = events[i].events, want = 0;
+	  int nready = ready;
+
+	  fd = events[i].data.fd;
+	  if (fd < nfds && rfds && FD_ISSET (fd, rfds))
+	    {
+	      want |= EPOLLIN;
+	      if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		FD_SET (fd, &rready), ready++;
+	    }
+	  if (fd < nfds && wfds && FD_ISSET (fd, wfds))
+	    {
+	      want |= EPOLLOUT;
+	      if (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+		FD_SET (fd, &wready), ready++;
+	    }
+	  if (nready < ready)
+	    {
+	      /* Keep the ready descriptors sorted.  */
+	      int j = epoll_nready++;
+	      for (; 0 < j && fd < epoll_ready[j - 1]; j--)
+		epoll_ready[j] = epoll_ready[j - 1];
+	      epoll_ready[j] = fd;
+	    }
+	  /* An event for a descriptor that is not registered comes
+	     either from handle_child_signal unregistering it during
+	     the wait, or from a registration left behind when it was
+	     closed, in which case FD may now be another file.  Either
+	     way, leave FD alone.  */
+	  if (!epoll_events[fd])
+	    stale |= !want;
+	  /* Stop events that are not waited for from waking us up
+	     again before the wait is over.  */
+	  else if (!want || ev & (EPOLLIN | EPOLLOUT) & ~want)
+	    epoll_set_temporarily (fd, epoll_events[fd] & want);
+	}
+
+      /* The events of a stale registration would keep waking us up,
+	 so start over with a new epoll instance.  */
+      if (stale && !epoll_reset (nfds, rfds, wfds))
+	{
+	  if (ready)
+	    break;
+	  epoll_restore ();
+	  return pselect (nfds, rfds, wfds, efds, timeout, sigmask);
+	}
+    }
+  while (n > 0 && ready == 0);
+
+  epoll_restore ();
+  if (n < 0)
+    return n;
+  if (rfds)
+    *rfds = rready;
+  if (wfds)
+    *wfds = wready;
+  return ready;
+}
+
+#else  /* !USE_EPOLL */
+
+static void
+epoll_changed (int fd)
+{
+}
+
+static void
+epoll_forget (int fd)
+{
+}
+
+#endif	/* !USE_EPOLL */
+
+/* Bring the wait sets, and the epoll registration, of descriptor FD
+   in line with fd_callback_info, now that this has changed.  */
+
+static void
+update_wait_sets (int fd)
+{
+  int flags = fd_callback_info[fd].flags;
+
+  if (flags & FOR_READ)
+    FD_SET (fd, &input_wait_set);
+  else
+    FD_CLR (fd, &input_wait_set);
+  if ((flags & (FOR_READ | KEYBOARD_FD)) == FOR_READ)
+    FD_SET (fd, &non_keyboard_wait_set);
+  else
+    FD_CLR (fd, &non_keyboard_wait_set);
+  if ((flags & (FOR_READ | PROCESS_FD)) == FOR_READ)
+    FD_SET (fd, &non_process_wait_set);
+  else
+    FD_CLR (fd, &non_process_wait_set);
+  if (flags & FOR_WRITE)
+    FD_SET (fd, &write_wait_set);
+  else
+    FD_CLR (fd, &write_wait_set);
+  epoll_changed (fd);
+}
 
 /* Add a file descriptor FD to be monitored for when read is possible.
    When read is possible, call FUNC with argument DATA.  */
@@ -475,8 +863,11 @@ add_non_keyboard_read_fd (int fd)
   eassert (fd >= 0 && fd < FD_SETSIZE);
   eassert (fd_callback_info[fd].func == NULL);
 
+  epoll_forget (fd);
+
   fd_callback_info[fd].flags &= ~KEYBOARD_FD;
   fd_callback_info[fd].flags |= FOR_READ;
+  update_wait_sets (fd);
   if (fd > max_desc)
     max_desc = fd;
 }
@@ -486,6 +877,7 @@ add_process_read_fd (int fd)
 {
   add_non_keyboard_read_fd (fd);
   fd_callback_info[fd].flags |= PROCESS_FD;
+  update_wait_sets (fd);
 }
 
 /* Stop monitoring file descriptor FD for when read is possible.  */
@@ -510,9 +902,12 @@ add_write_fd (int fd, fd_callback func, void *data)
 {
   eassert (fd >= 0 && fd < FD_SETSIZE);
 
+  epoll_forget (fd);
+
   fd_callback_info[fd].func = func;
   fd_callback_info[fd].data = data;
   fd_callback_info[fd].flags |= FOR_WRITE;
+  update_wait_sets (fd);
   if (fd > max_desc)
     max_desc = fd;
 }
@@ -523,7 +918,10 @@ add_non_blocking_write_fd (int fd)
   eassert (fd >= 0 && fd < FD_SETSIZE);
   eassert (fd_callback_info[fd].func == NULL);
 
+  epoll_forget (fd);
+
   fd_callback_info[fd].flags |= FOR_WRITE | NON_BLOCKING_CONNECT_FD;
+  update_wait_sets (fd);
   if (fd > max_desc)
     max_desc = fd;
   ++num_pending_connects;
@@ -555,6 +953,7 @@ delete_write_fd (int fd)
 	emacs_abort ();
     }
   fd_callback_info[fd].flags &= ~(FOR_WRITE | NON_BLOCKING_CONNECT_FD);
+  update_wait_sets (fd);
   if (fd_callback_info[fd].flags == 0)
     {
       fd_callback_info[fd].func = 0;
@@ -565,11 +964,27 @@ delete_write_fd (int fd)
     }
 }
 
+/* Say that the current thread waits for descriptor FD.  */
+
+static void
+set_waiting_thread (int fd)
+{
+  if (!fd_callback_info[fd].waiting_thread)
+    num_waiting_fds++;
+  fd_callback_info[fd].waiting_thread = current_thread;
+}
+
 static void
 compute_input_wait_mask (fd_set *mask)
 {
   int fd;
 
+  if (only_main_thread_p ())
+    {
+      *mask = input_wait_set;
+      return;
+    }
+
   FD_ZERO (mask);
   for (fd = 0; fd <= max_desc; ++fd)
     {
@@ -582,7 +997,7 @@ compute_input_wait_mask (fd_set *mask)
       if ((fd_callback_info[fd].flags & FOR_READ) != 0)
 	{
 	  FD_SET (fd, mask);
-	  fd_callback_info[fd].waiting_thread = current_thread;
+	  set_waiting_thread (fd);
 	}
     }
 }
@@ -592,6 +1007,12 @@ compute_non_process_wait_mask (fd_set *mask)
 {
   int fd;
 
+  if (only_main_thread_p ())
+    {
+      *mask = non_process_wait_set;
+      return;
+    }
+
   FD_ZERO (mask);
   for (fd = 0; fd <= max_desc; ++fd)
     {
@@ -605,7 +1026,7 @@ compute_non_process_wait_mask (fd_set *mask)
 	  && (fd_callback_info[fd].flags & PROCESS_FD) == 0)
 	{
 	  FD_SET (fd, mask);
-	  fd_callback_info[fd].waiting_thread = current_thread;
+	  set_waiting_thread (fd);
 	}
     }
 }
@@ -615,6 +1036,12 @@ compute_non_keyboard_wait_mask (fd_set *mask)
 {
   int fd;
 
+  if (only_main_thread_p ())
+    {
+      *mask = non_keyboard_wait_set;
+      return;
+    }
+
   FD_ZERO (mask);
   for (fd = 0; fd <= max_desc; ++fd)
     {
@@ -628,7 +1055,7 @@ compute_non_keyboard_wait_mask (fd_set *mask)
 	  && (fd_callback_info[fd].flags & KEYBOARD_FD) == 0)
 	{
 	  FD_SET (fd, mask);
-	  fd_callback_info[fd].waiting_thread = current_thread;
+	  set_waiting_thread (fd);
 	}
     }
 }
@@ -638,6 +1065,12 @@ compute_write_mask (fd_set *mask)
 {
   int fd;
 
+  if (only_main_thread_p ())
+    {
+      *mask = write_wait_set;
+      return;
+    }
+
   FD_ZERO (mask);
   for (fd = 0; fd <= max_desc; ++fd)
     {
@@ -650,7 +1083,7 @@ compute_write_mask (fd_set *mask)
       if ((fd_callback_info[fd].flags & FOR_WRITE) != 0)
 	{
 	  FD_SET (fd, mask);
-	  fd_callback_info[fd].waiting_thread = current_thread;
+	  set_waiting_thread (fd);
 	}
     }
 }
@@ -660,10 +1093,13 @@ clear_waiting_thread_info (void)
 {
   int fd;
 
-  for (fd = 0; fd <= max_desc; ++fd)
+  for (fd = 0; 0 < num_waiting_fds && fd <= max_desc; ++fd)
     {
       if (fd_callback_info[fd].waiting_thread == current_thread)
-	fd_callback_info[fd].waiting_thread = NULL;
+	{
+	  fd_callback_info[fd].waiting_thread = NULL;
+	  num_waiting_fds--;
+	}
     }
 }
 
@@ -1327,6 +1763,66 @@ See `set-process-filter' for more info on filter functions.  */)
   return XPROCESS (process)->filter;
 }
 
+DEFUN ("set-process-message-framing", Fset_process_message_framing,
+       Sset_process_message_framing, 2, MANY, 0,
+       doc: /* Make PROCESS pass its output to its filter a message at a time.
+FRAMING says how the output is split into messages.  The only framing
+supported is `content-length', which is how JSON-RPC servers, such as
+language servers, send their messages: each message has a header of
+lines that end in CRLF, followed by an empty line, and a body with as
+many bytes as the header line `Content-Length: N' says.  The body is
+parsed as JSON, as by `json-parse-string' with arguments ARGS, and the
+filter of PROCESS is called with the resulting value instead of a
+string of output.
+
+If the header of a message has no valid `Content-Length', or its body
+isn't valid JSON, the filter is called with the text of the header or
+of the body instead.  A valid message is never a string.
+
+The output of PROCESS is then neither decoded nor inserted into its
+buffer, so PROCESS needs a filter that accepts messages.
+
+If FRAMING is nil, stop splitting the output of PROCESS into messages,
+and discard any incomplete message received so far.
+usage: (set-process-message-framing PROCESS FRAMING &rest ARGS)  */)
+  (ptrdiff_t nargs, Lisp_Object *args)
+{
+  Lisp_Object process = args[0], framing = args[1];
+  CHECK_PROCESS (process);
+  struct Lisp_Process *p = XPROCESS (process);
+
+  if (NILP (framing))
+    {
+      pset_message_framing (p, Qnil);
+      pset_message_buf (p, Qnil);
+    }
+  else if (EQ (framing, Qcontent_length))
+    {
+      Lisp_Object json_args = Flist (nargs - 2, args + 2);
+      json_check_parse_args (json_args);
+      if (NILP (p->message_framing))
+	{
+	  p->message_start = p->message_end = 0;
+	  p->message_length = -1;
+	}
+      pset_message_framing (p, Fcons (framing, json_args));
+    }
+  else
+    signal_error ("Unknown message framing", framing);
+  return framing;
+}
+
+DEFUN ("process-message-framing", Fprocess_message_framing,
+       Sprocess_message_framing, 1, 1, 0,
+       doc: /* Return how the output of PROCESS is split into messages.
+The value is nil if it isn't, or a list (FRAMING . ARGS) of the
+arguments of `set-process-message-framing'.  */)
+  (Lisp_Object process)
+{
+  CHECK_PROCESS (process);
+  return XPROCESS (process)->message_framing;
+}
+
 DEFUN ("set-process-sentinel", Fset_process_sentinel, Sset_process_sentinel,
        2, 2, 0,
        doc: /* Give PROCESS the sentinel SENTINEL; nil for default.
@@ -1999,6 +2495,7 @@ close_process_fd (int *fd_addr)
   if (0 <= fd)
     {
       *fd_addr = -1;
+      epoll_forget (fd);
       emacs_close (fd);
     }
 }
@@ -4733,11 +5230,11 @@ deactivate_process (Lisp_Object proc)
       p->read_output_skip = 0;
     }
 
-  /* Beware SIGCHLD hereabouts.  */
-
-  for (i = 0; i < PROCESS_OPEN_FDS; i++)
-    close_process_fd (&p->open_fd[i]);
+  /* The text still queued can't be sent any more.  */
+  write_queue_watch (p, false);
+  pset_write_queue (p, Qnil);
 
+  /* Stop waiting for the descriptors before closing them.  */
   inchannel = p->infd;
   if (inchannel >= 0)
     {
@@ -4758,6 +5255,11 @@ deactivate_process (Lisp_Object proc)
       if (inchannel == max_desc)
 	recompute_max_desc ();
     }
+
+  /* Beware SIGCHLD hereabouts.  */
+
+  for (i = 0; i < PROCESS_OPEN_FDS; i++)
+    close_process_fd (&p->open_fd[i]);
 }
 
 
@@ -5187,6 +5689,10 @@ wait_reading_process_output (intmax_t time_limit, int nsecs, int read_kbd,
   int channel, nfds;
   fd_set Available;
   fd_set Writeok;
+  /* The descriptors that are ready after waiting, in increasing order,
+     and their number, or -1 if any descriptor may be ready.  */
+  int ready_fds[MAX_READY_FDS];
+  int nready_fds;
   bool check_write;
   int check_delay;
   bool no_avail;
@@ -5452,6 +5958,16 @@ wait_reading_process_output (intmax_t time_limit, int nsecs, int read_kbd,
 	  FD_SET (wait_proc->infd, &Available);
 	  check_delay = 0;
           check_write = 0;
+	  /* Keep sending WAIT_PROC the text queued for it, which it
+	     may need before it can reply.  */
+	  if (0 <= wait_proc->outfd
+	      && (fd_callback_info[wait_proc->outfd].func
+		  == send_process_writable))
+	    {
+	      FD_ZERO (&Writeok);
+	      FD_SET (wait_proc->outfd, &Writeok);
+	      check_write = true;
+	    }
 	}
       else if (!NILP (wait_for_cell))
 	{
@@ -5488,6 +6004,7 @@ wait_reading_process_output (intmax_t time_limit, int nsecs, int read_kbd,
 	 triggered by processing X events).  In the latter case, set
 	 nfds to 1 to avoid breaking the loop.  */
       no_avail = 0;
+      nready_fds = -1;
       if ((read_kbd || !NILP (wait_for_cell))
 	  && detect_input_pending ())
 	{
@@ -5613,6 +6130,31 @@ wait_reading_process_output (intmax_t time_limit, int nsecs, int read_kbd,
           nfds = ns_select (max_desc + 1,
 			    &Available, (check_write ? &Writeok : 0),
 			    NULL, &timeout, NULL);
+#elif defined USE_EPOLL
+	  if (0 <= epoll_fd && only_main_thread_p ())
+	    {
+	      /* WAIT_PROC's output is waited for even if it has been
+		 stopped, or deleted from the descriptors to wait for.  */
+	      if (wait_proc && just_wait_proc && 0 <= wait_proc->infd)
+		epoll_include (wait_proc->infd);
+	      nfds = thread_select (epoll_select, max_desc + 1,
+				    &Available,
+				    (check_write ? &Writeok : 0),
+				    NULL, &timeout, NULL);
+	      /* Filters can wait again, so copy the ready descriptors
+		 before running any.  */
+	      if (0 < nfds)
+		{
+		  nready_fds = epoll_nready;
+		  memcpy (ready_fds, epoll_ready,
+			  nready_fds * sizeof *ready_fds);
+		}
+	    }
+	  else
+	    nfds = thread_select (pselect, max_desc + 1,
+				  &Available,
+				  (check_write ? &Writeok : 0),
+				  NULL, &timeout, NULL);
 #else  /* !HAVE_GLIB */
 	  nfds = thread_select (pselect, max_desc + 1,
 				&Available,
@@ -5624,6 +6166,7 @@ wait_reading_process_output (intmax_t time_limit, int nsecs, int read_kbd,
 	  /* Merge tls_available into Available. */
 	  if (tls_nfds > 0)
 	    {
+	      nready_fds = -1;
 	      if (nfds == 0 || (nfds < 0 && errno == EINTR))
 		{
 		  /* Fast path, just copy. */
@@ -5767,8 +6310,11 @@ wait_reading_process_output (intmax_t time_limit, int nsecs, int read_kbd,
       if (no_avail || nfds == 0)
 	continue;
 
-      for (channel = 0; channel <= max_desc; ++channel)
+      for (int i = 0; i < (nready_fds < 0 ? max_desc + 1 : nready_fds); i++)
         {
+	  channel = nready_fds < 0 ? i : ready_fds[i];
+	  if (max_desc < channel)
+	    break;
           struct fd_callback_data *d = &fd_callback_info[channel];
           if (d->func
 	      && ((d->flags & FOR_READ
@@ -5778,8 +6324,11 @@ wait_reading_process_output (intmax_t time_limit, int nsecs, int read_kbd,
             d->func (channel, d->data);
 	}
 
-      for (channel = 0; channel <= max_desc; channel++)
+      for (int i = 0; i < (nready_fds < 0 ? max_desc + 1 : nready_fds); i++)
 	{
+	  channel = nready_fds < 0 ? i : ready_fds[i];
+	  if (max_desc < channel)
+	    break;
 	  if (FD_ISSET (channel, &Available)
 	      && ((fd_callback_info[channel].flags & (KEYBOARD_FD | PROCESS_FD))
 		  == PROCESS_FD))
@@ -6001,6 +6550,26 @@ static void
 read_and_dispose_of_process_output (struct Lisp_Process *p, char *chars,
 				    ssize_t nbytes,
 				    struct coding_system *coding);
+static void insert_process_output (struct Lisp_Process *, Lisp_Object,
+				   char *, ptrdiff_t,
+				   struct coding_system *);
+
+/* Given a list (PROCESS CHARS NBYTES CODING), decode the output and
+   insert it as `internal-default-process-filter' would.  */
+
+static Lisp_Object
+read_process_output_insert (Lisp_Object args)
+{
+  Lisp_Object proc = XCAR (args);
+  args = XCDR (args);
+  char *chars = xmint_pointer (XCAR (args));
+  args = XCDR (args);
+  ptrdiff_t nbytes = XFIXNUM (XCAR (args));
+  struct coding_system *coding = xmint_pointer (XCAR (XCDR (args)));
+
+  insert_process_output (XPROCESS (proc), Qnil, chars, nbytes, coding);
+  return Qnil;
+}
 
 /* Read pending output from the process channel,
    starting with our buffered-ahead character if we have one.
@@ -6008,6 +6577,10 @@ read_and_dispose_of_process_output (struct Lisp_Process *p, char *chars,
    or -1 (setting errno) if there is a read error.
 
    This function reads at most read_process_output_max bytes.
+   It starts with fewer and doubles the number of bytes it reads
+   while the output keeps filling them, so that a process that
+   produces lots of output is read in large chunks without making
+   every read expensive.
    If you want to read all available subprocess output,
    you must call it repeatedly until it returns zero.
 
@@ -6026,6 +6599,13 @@ read_process_output (Lisp_Object proc, int channel)
   Lisp_Object odeactivate;
   char *chars;
 
+#ifdef DATAGRAM_SOCKETS
+  /* A datagram must be read whole.  */
+  if (!DATAGRAM_CHAN_P (channel))
+#endif
+    readmax = clip_to_bounds (min (readmax, READ_OUTPUT_SIZE_MIN),
+			      p->read_output_size, readmax);
+
   USE_SAFE_ALLOCA;
   chars = SAFE_ALLOCA (sizeof coding->carryover + readmax);
 
@@ -6060,6 +6640,11 @@ read_process_output (Lisp_Object proc, int channel)
 #endif
 	nbytes = emacs_read (channel, chars + carryover + buffered,
 			     readmax - buffered);
+      if (nbytes == readmax - buffered)
+	p->read_output_size = (readmax <= PTRDIFF_MAX / 2
+			       ? readmax * 2 : readmax);
+      else if (0 <= nbytes && nbytes < readmax / 4)
+	p->read_output_size = readmax / 2;
       if (nbytes > 0 && p->adaptive_read_buffering)
 	{
 	  int delay = p->read_output_delay;
@@ -6125,6 +6710,155 @@ read_process_output (Lisp_Object proc, int channel)
   return nbytes;
 }
 
+/* Framing process output as messages.  With `content-length'
+   framing, the output is collected in the unibyte string message_buf,
+   and each message is taken out of it and parsed before the filter is
+   called on it.  A filter that reads more output, for instance by
+   calling `accept-process-output', thus gets the messages in the order
+   they came.  */
+
+/* The longest message header accepted.  */
+enum { MESSAGE_HEADER_MAX = 4096 };
+
+/* Return the body length stated by the NBYTES bytes of message header
+   at HEADER, or -1 if it doesn't state a valid one.  */
+
+static ptrdiff_t
+message_content_length (unsigned char const *header, ptrdiff_t nbytes)
+{
+  static char const name[] = "content-length:";
+  int namelen = sizeof name - 1;
+  unsigned char const *end = header + nbytes;
+
+  for (unsigned char const *line = header, *eol; line < end; line = eol + 1)
+    {
+      eol = memchr (line, '\n', end - line);
+      if (!eol)
+	break;
+      if (eol - line <= namelen
+	  || c_strncasecmp ((char const *) line, name, namelen) != 0)
+	continue;
+
+      unsigned char const *q = line + namelen;
+      while (*q == ' ' || *q == '\t')
+	q++;
+      if (!c_isdigit (*q))
+	return -1;
+      ptrdiff_t length = 0;
+      for (; c_isdigit (*q); q++)
+	if (INT_MULTIPLY_WRAPV (length, 10, &length)
+	    || INT_ADD_WRAPV (length, *q - '0', &length)
+	    || STRING_BYTES_BOUND < length)
+	  return -1;
+      while (*q == ' ' || *q == '\t')
+	q++;
+      return *q == '\r' && q + 1 == eol ? length : -1;
+    }
+  return -1;
+}
+
+/* Return the JSON value of the message body that is ARGS[2] bytes
+   long at byte ARGS[1] of the string ARGS[0], parsed as ARGS[3] says.  */
+
+static Lisp_Object
+parse_process_message (ptrdiff_t nargs, Lisp_Object *args)
+{
+  return json_parse_bytes (SDATA (args[0]) + XFIXNUM (args[1]),
+			   XFIXNUM (args[2]), args[3]);
+}
+
+/* Return the text of the message body that parse_process_message
+   didn't parse.  */
+
+static Lisp_Object
+parse_process_message_error (Lisp_Object error, ptrdiff_t nargs,
+			     Lisp_Object *args)
+{
+  return make_string ((char const *) SDATA (args[0]) + XFIXNUM (args[1]),
+		      XFIXNUM (args[2]));
+}
+
+/* Add the NBYTES bytes at CHARS to the output of process P that is
+   framed as messages, and pass each complete message to its filter.  */
+
+static void
+dispose_of_process_messages (struct Lisp_Process *p, char const *chars,
+			     ptrdiff_t nbytes)
+{
+  Lisp_Object proc = make_lisp_proc (p);
+  ptrdiff_t pending = p->message_end - p->message_start;
+  ptrdiff_t size = STRINGP (p->message_buf) ? SBYTES (p->message_buf) : 0;
+
+  if (size - p->message_end < nbytes)
+    {
+      if (size - pending < nbytes)
+	{
+	  Lisp_Object buf = make_uninit_string (max (pending + nbytes,
+						     2 * size));
+	  if (pending)
+	    memcpy (SDATA (buf), SDATA (p->message_buf) + p->message_start,
+		    pending);
+	  pset_message_buf (p, buf);
+	}
+      else
+	memmove (SDATA (p->message_buf),
+		 SDATA (p->message_buf) + p->message_start, pending);
+      p->message_start = 0;
+      p->message_end = pending;
+    }
+  if (nbytes)
+    {
+      memcpy (SDATA (p->message_buf) + p->message_end, chars, nbytes);
+      p->message_end += nbytes;
+    }
+
+  /* The filter can change the framing, or read more output.  */
+  while (CONSP (p->message_framing) && p->message_start < p->message_end)
+    {
+      Lisp_Object buf = p->message_buf;
+      ptrdiff_t start = p->message_start;
+      ptrdiff_t avail = p->message_end - start;
+      unsigned char *data = SDATA (buf) + start;
+      Lisp_Object message;
+
+      if (p->message_length < 0)
+	{
+	  unsigned char *end = memmem (data, avail, "\r\n\r\n", 4);
+	  if (!end && avail < MESSAGE_HEADER_MAX)
+	    break;
+	  ptrdiff_t header_bytes = end ? end + 4 - data : avail;
+	  p->message_start += header_bytes;
+	  if (end)
+	    p->message_length = message_content_length (data, header_bytes);
+	  if (0 <= p->message_length)
+	    continue;
+	  message = make_string ((char const *) data, header_bytes);
+	}
+      else
+	{
+	  ptrdiff_t length = p->message_length;
+	  if (avail < length)
+	    break;
+	  p->message_start += length;
+	  p->message_length = -1;
+	  message = internal_condition_case_n
+	    (parse_process_message, 4,
+	     ((Lisp_Object [])
+	      {buf, make_fixnum (start), make_fixnum (length),
+	       XCDR (p->message_framing)}),
+	     list1 (Qjson_error), parse_process_message_error);
+	}
+
+      internal_condition_case_1 (read_process_output_call,
+				 list3 (p->filter, proc, message),
+				 !NILP (Vdebug_on_error) ? Qnil : Qerror,
+				 read_process_output_error_handler);
+    }
+
+  if (p->message_start == p->message_end)
+    p->message_start = p->message_end = 0;
+}
+
 static void
 read_and_dispose_of_process_output (struct Lisp_Process *p, char *chars,
 				    ssize_t nbytes,
@@ -6164,51 +6898,82 @@ read_and_dispose_of_process_output (struct Lisp_Process *p, char *chars,
      save the match data in a special nonrecursive fashion.  */
   running_asynch_code = 1;
 
-  decode_coding_c_string (coding, (unsigned char *) chars, nbytes, Qt);
-  text = coding->dst_object;
-  Vlast_coding_system_used = CODING_ID_NAME (coding->id);
-  /* A new coding system might be found.  */
-  if (!EQ (p->decode_coding_system, Vlast_coding_system_used))
+  if (CONSP (p->message_framing))
+    dispose_of_process_messages (p, chars, nbytes);
+  else
     {
-      pset_decode_coding_system (p, Vlast_coding_system_used);
-
-      /* Don't call setup_coding_system for
-	 proc_decode_coding_system[channel] here.  It is done in
-	 detect_coding called via decode_coding above.  */
-
-      /* If a coding system for encoding is not yet decided, we set
-	 it as the same as coding-system for decoding.
-
-	 But, before doing that we must check if
-	 proc_encode_coding_system[p->outfd] surely points to a
-	 valid memory because p->outfd will be changed once EOF is
-	 sent to the process.  */
-      if (NILP (p->encode_coding_system) && p->outfd >= 0
-	  && proc_encode_coding_system[p->outfd])
+      /* The default filter, unless it has been advised, would just
+	 insert the output into the process buffer, so decode the
+	 output straight into the buffer instead of making a string
+	 of it first.  */
+      bool direct = (EQ (outstream, Qinternal_default_process_filter)
+		     && SUBRP (XSYMBOL (outstream)->u.s.function)
+		     && nbytes > 0
+		     && BUFFERP (p->buffer)
+		     && BUFFER_LIVE_P (XBUFFER (p->buffer))
+		     && !NILP (BVAR (XBUFFER (p->buffer),
+				     enable_multibyte_characters)));
+      if (direct)
 	{
-	  pset_encode_coding_system
-	    (p, coding_inherit_eol_type (Vlast_coding_system_used, Qnil));
-	  setup_coding_system (p->encode_coding_system,
-			       proc_encode_coding_system[p->outfd]);
+	  coding->carryover_bytes = 0;
+	  internal_condition_case_1 (read_process_output_insert,
+				     list4 (make_lisp_proc (p),
+					    make_mint_ptr (chars),
+					    make_fixnum (nbytes),
+					    make_mint_ptr (coding)),
+				     !NILP (Vdebug_on_error) ? Qnil : Qerror,
+				     read_process_output_error_handler);
 	}
-    }
+      else
+	{
+	  decode_coding_c_string (coding, (unsigned char *) chars, nbytes,
+				  Qt);
+	  text = coding->dst_object;
+	}
+      Vlast_coding_system_used = CODING_ID_NAME (coding->id);
+      /* A new coding system might be found.  */
+      if (!EQ (p->decode_coding_system, Vlast_coding_system_used))
+	{
+	  pset_decode_coding_system (p, Vlast_coding_system_used);
 
-  if (coding->carryover_bytes > 0)
-    {
-      if (SCHARS (p->decoding_buf) < coding->carryover_bytes)
-	pset_decoding_buf (p, make_uninit_string (coding->carryover_bytes));
-      memcpy (SDATA (p->decoding_buf), coding->carryover,
-	      coding->carryover_bytes);
-      p->decoding_carryover = coding->carryover_bytes;
+	  /* Don't call setup_coding_system for
+	     proc_decode_coding_system[channel] here.  It is done in
+	     detect_coding called via decode_coding above.  */
+
+	  /* If a coding system for encoding is not yet decided, we set
+	     it as the same as coding-system for decoding.
+
+	     But, before doing that we must check if
+	     proc_encode_coding_system[p->outfd] surely points to a
+	     valid memory because p->outfd will be changed once EOF is
+	     sent to the process.  */
+	  if (NILP (p->encode_coding_system) && p->outfd >= 0
+	      && proc_encode_coding_system[p->outfd])
+	    {
+	      pset_encode_coding_system
+		(p, coding_inherit_eol_type (Vlast_coding_system_used, Qnil));
+	      setup_coding_system (p->encode_coding_system,
+				   proc_encode_coding_system[p->outfd]);
+	    }
+	}
+
+      if (coding->carryover_bytes > 0)
+	{
+	  if (SCHARS (p->decoding_buf) < coding->carryover_bytes)
+	    pset_decoding_buf (p, make_uninit_string (coding->carryover_bytes));
+	  memcpy (SDATA (p->decoding_buf), coding->carryover,
+		  coding->carryover_bytes);
+	  p->decoding_carryover = coding->carryover_bytes;
+	}
+      if (!direct && SBYTES (text) > 0)
+	/* FIXME: It's wrong to wrap or not based on debug-on-error, and
+	   sometimes it's simply wrong to wrap (e.g. when called from
+	   accept-process-output).  */
+	internal_condition_case_1 (read_process_output_call,
+				   list3 (outstream, make_lisp_proc (p), text),
+				   !NILP (Vdebug_on_error) ? Qnil : Qerror,
+				   read_process_output_error_handler);
     }
-  if (SBYTES (text) > 0)
-    /* FIXME: It's wrong to wrap or not based on debug-on-error, and
-       sometimes it's simply wrong to wrap (e.g. when called from
-       accept-process-output).  */
-    internal_condition_case_1 (read_process_output_call,
-			       list3 (outstream, make_lisp_proc (p), text),
-			       !NILP (Vdebug_on_error) ? Qnil : Qerror,
-			       read_process_output_error_handler);
 
   /* If we saved the match data nonrecursively, restore it now.  */
   restore_search_regs ();
@@ -6231,54 +6996,72 @@ read_and_dispose_of_process_output (struct Lisp_Process *p, char *chars,
       record_asynch_buffer_change ();
 }
 
-DEFUN ("internal-default-process-filter", Finternal_default_process_filter,
-       Sinternal_default_process_filter, 2, 2, 0,
-       doc: /* Function used as default process filter.
-This inserts the process's output into its buffer, if there is one.
-Otherwise it discards the output.  */)
-  (Lisp_Object proc, Lisp_Object text)
-{
-  struct Lisp_Process *p;
-  ptrdiff_t opoint;
-
-  CHECK_PROCESS (proc);
-  p = XPROCESS (proc);
-  CHECK_STRING (text);
+/* Insert the output of process P into its buffer, which must be
+   live, at the end-of-output marker.  The output is the string TEXT,
+   or if TEXT is nil, the NBYTES bytes at CHARS, which are decoded by
+   CODING straight into the buffer.  */
 
-  if (!NILP (p->buffer) && BUFFER_LIVE_P (XBUFFER (p->buffer)))
+static void
+insert_process_output (struct Lisp_Process *p, Lisp_Object text,
+		       char *chars, ptrdiff_t nbytes,
+		       struct coding_system *coding)
+{
+  Lisp_Object old_read_only;
+  ptrdiff_t old_begv, old_zv;
+  ptrdiff_t old_begv_byte, old_zv_byte;
+  ptrdiff_t before, before_byte;
+  ptrdiff_t opoint, opoint_byte;
+  struct buffer *b;
+
+  Fset_buffer (p->buffer);
+  opoint = PT;
+  opoint_byte = PT_BYTE;
+  old_read_only = BVAR (current_buffer, read_only);
+  old_begv = BEGV;
+  old_zv = ZV;
+  old_begv_byte = BEGV_BYTE;
+  old_zv_byte = ZV_BYTE;
+
+  bset_read_only (current_buffer, Qnil);
+
+  /* Insert new output into buffer at the current end-of-output
+     marker, thus preserving logical ordering of input and output.  */
+  if (XMARKER (p->mark)->buffer)
+    set_point_from_marker (p->mark);
+  else
+    SET_PT_BOTH (ZV, ZV_BYTE);
+  before = PT;
+  before_byte = PT_BYTE;
+
+  /* If the output marker is outside of the visible region, save
+     the restriction and widen.  */
+  if (! (BEGV <= PT && PT <= ZV))
+    Fwiden ();
+
+  if (NILP (text))
+    {
+      /* Decoding into the buffer inserts the text after the markers
+	 at point, so move them afterwards as inserting before markers
+	 would have done.  */
+      ptrdiff_t count = SPECPDL_INDEX ();
+      ptrdiff_t nchars;
+
+      prepare_to_modify_buffer (PT, PT, NULL);
+      specbind (Qinhibit_modification_hooks, Qt);
+      decode_coding_c_string (coding, (unsigned char *) chars, nbytes,
+			      Fcurrent_buffer ());
+      unbind_to (count, Qnil);
+      CHARS_MODIFF = MODIFF;
+      nchars = coding->produced_char;
+      advance_markers_over_insertion (coding->dst_pos,
+				      coding->dst_pos + nchars);
+      TEMP_SET_PT_BOTH (coding->dst_pos + nchars,
+			coding->dst_pos_byte + coding->produced);
+      signal_after_change (coding->dst_pos, 0, nchars);
+      update_compositions (coding->dst_pos, PT, CHECK_BORDER);
+    }
+  else
     {
-      Lisp_Object old_read_only;
-      ptrdiff_t old_begv, old_zv;
-      ptrdiff_t old_begv_byte, old_zv_byte;
-      ptrdiff_t before, before_byte;
-      ptrdiff_t opoint_byte;
-      struct buffer *b;
-
-      Fset_buffer (p->buffer);
-      opoint = PT;
-      opoint_byte = PT_BYTE;
-      old_read_only = BVAR (current_buffer, read_only);
-      old_begv = BEGV;
-      old_zv = ZV;
-      old_begv_byte = BEGV_BYTE;
-      old_zv_byte = ZV_BYTE;
-
-      bset_read_only (current_buffer, Qnil);
-
-      /* Insert new output into buffer at the current end-of-output
-	 marker, thus preserving logical ordering of input and output.  */
-      if (XMARKER (p->mark)->buffer)
-	set_point_from_marker (p->mark);
-      else
-	SET_PT_BOTH (ZV, ZV_BYTE);
-      before = PT;
-      before_byte = PT_BYTE;
-
-      /* If the output marker is outside of the visible region, save
-	 the restriction and widen.  */
-      if (! (BEGV <= PT && PT <= ZV))
-	Fwiden ();
-
       /* Adjust the multibyteness of TEXT to that of the buffer.  */
       if (NILP (BVAR (current_buffer, enable_multibyte_characters))
 	  != ! STRING_MULTIBYTE (text))
@@ -6289,46 +7072,63 @@ Otherwise it discards the output.  */)
 	 the buffer's mark is, and the user's next command is Meta-y.  */
       insert_from_string_before_markers (text, 0, 0,
 					 SCHARS (text), SBYTES (text), 0);
+    }
 
-      /* Make sure the process marker's position is valid when the
-	 process buffer is changed in the signal_after_change above.
-	 W3 is known to do that.  */
-      if (BUFFERP (p->buffer)
-	  && (b = XBUFFER (p->buffer), b != current_buffer))
-	set_marker_both (p->mark, p->buffer, BUF_PT (b), BUF_PT_BYTE (b));
-      else
-	set_marker_both (p->mark, p->buffer, PT, PT_BYTE);
+  /* Make sure the process marker's position is valid when the
+     process buffer is changed in the signal_after_change above.
+     W3 is known to do that.  */
+  if (BUFFERP (p->buffer)
+      && (b = XBUFFER (p->buffer), b != current_buffer))
+    set_marker_both (p->mark, p->buffer, BUF_PT (b), BUF_PT_BYTE (b));
+  else
+    set_marker_both (p->mark, p->buffer, PT, PT_BYTE);
 
-      update_mode_lines = 23;
+  update_mode_lines = 23;
 
-      /* Make sure opoint and the old restrictions
-	 float ahead of any new text just as point would.  */
-      if (opoint >= before)
-	{
-	  opoint += PT - before;
-	  opoint_byte += PT_BYTE - before_byte;
-	}
-      if (old_begv > before)
-	{
-	  old_begv += PT - before;
-	  old_begv_byte += PT_BYTE - before_byte;
-	}
-      if (old_zv >= before)
-	{
-	  old_zv += PT - before;
-	  old_zv_byte += PT_BYTE - before_byte;
-	}
+  /* Make sure opoint and the old restrictions
+     float ahead of any new text just as point would.  */
+  if (opoint >= before)
+    {
+      opoint += PT - before;
+      opoint_byte += PT_BYTE - before_byte;
+    }
+  if (old_begv > before)
+    {
+      old_begv += PT - before;
+      old_begv_byte += PT_BYTE - before_byte;
+    }
+  if (old_zv >= before)
+    {
+      old_zv += PT - before;
+      old_zv_byte += PT_BYTE - before_byte;
+    }
 
-      /* If the restriction isn't what it should be, set it.  */
-      if (old_begv != BEGV || old_zv != ZV)
-	Fnarrow_to_region (make_fixnum (old_begv), make_fixnum (old_zv));
+  /* If the restriction isn't what it should be, set it.  */
+  if (old_begv != BEGV || old_zv != ZV)
+    Fnarrow_to_region (make_fixnum (old_begv), make_fixnum (old_zv));
 
-      bset_read_only (current_buffer, old_read_only);
-      SET_PT_BOTH (opoint, opoint_byte);
-    }
+  bset_read_only (current_buffer, old_read_only);
+  SET_PT_BOTH (opoint, opoint_byte);
+}
+
+DEFUN ("internal-default-process-filter", Finternal_default_process_filter,
+       Sinternal_default_process_filter, 2, 2, 0,
+       doc: /* Function used as default process filter.
+This inserts the process's output into its buffer, if there is one.
+Otherwise it discards the output.  */)
+  (Lisp_Object proc, Lisp_Object text)
+{
+  struct Lisp_Process *p;
+
+  CHECK_PROCESS (proc);
+  p = XPROCESS (proc);
+  CHECK_STRING (text);
+
+  if (!NILP (p->buffer) && BUFFER_LIVE_P (XBUFFER (p->buffer)))
+    insert_process_output (p, text, NULL, 0, NULL);
   return Qnil;
 }
-
+
 /* Sending data to subprocess.  */
 
 /* In send_process, when a write fails temporarily,
@@ -6339,20 +7139,35 @@ Otherwise it discards the output.  */)
    handled by the write_queue element of struct process.  It is a list
    with each entry having the form
 
-   (string . (offset . length))
+   (string offset length encode . callback)
 
    where STRING is a lisp string, OFFSET is the offset into the
    string's byte sequence from which we should begin to send, and
-   LENGTH is the number of bytes left to send.  */
+   LENGTH is the number of bytes left to send.  If ENCODE is non-nil,
+   these bytes must still be encoded by the process's coding system,
+   which is done SEND_PROCESS_CHUNK bytes at a time just before they
+   are written.  If CALLBACK is non-nil, it is called with the process
+   as argument once the entry has been written.
+
+   The queue also holds the text that process-send-string and
+   process-send-region are told not to wait for.  It is written by
+   send_process_writable whenever the process can accept more.  */
+
+/* The number of bytes of text to encode at a time.  */
+enum { SEND_PROCESS_CHUNK = 64 * 1024 };
+
+/* The maximum number of entries of the write queue to write at once.  */
+enum { WRITE_QUEUE_IOVECS = 16 };
 
 /* Create a new entry in write_queue.
    INPUT_OBJ should be a buffer, string Qt, or Qnil.
-   BUF is a pointer to the string sequence of the input_obj or a C
-   string in case of Qt or Qnil.  */
+   BUF is a pointer to the string sequence of the input_obj, to the
+   text of the buffer, or a C string in case of Qt or Qnil.  */
 
 static void
 write_queue_push (struct Lisp_Process *p, Lisp_Object input_obj,
-                  const char *buf, ptrdiff_t len, bool front)
+                  const char *buf, ptrdiff_t len, bool encode,
+		  Lisp_Object callback, bool front)
 {
   ptrdiff_t offset;
   Lisp_Object entry, obj;
@@ -6362,13 +7177,30 @@ write_queue_push (struct Lisp_Process *p, Lisp_Object input_obj,
       offset = buf - SSDATA (input_obj);
       obj = input_obj;
     }
+  else if (BUFFERP (input_obj) && encode)
+    {
+      /* Copy the characters, as the buffer may change before they
+	 are encoded.  */
+      struct buffer *cur = current_buffer;
+      ptrdiff_t from_byte, to_byte;
+
+      set_buffer_internal (XBUFFER (input_obj));
+      from_byte = PTR_BYTE_POS ((unsigned char *) buf);
+      to_byte = from_byte + len;
+      obj = make_buffer_string_both (BYTE_TO_CHAR (from_byte), from_byte,
+				     BYTE_TO_CHAR (to_byte), to_byte, false);
+      set_buffer_internal (cur);
+      offset = 0;
+    }
   else
     {
       offset = 0;
       obj = make_unibyte_string (buf, len);
     }
 
-  entry = Fcons (obj, Fcons (make_fixnum (offset), make_fixnum (len)));
+  entry = Fcons (obj, Fcons (make_fixnum (offset),
+			     Fcons (make_fixnum (len),
+				    Fcons (encode ? Qt : Qnil, callback))));
 
   if (front)
     pset_write_queue (p, Fcons (entry, p->write_queue));
@@ -6376,65 +7208,14 @@ write_queue_push (struct Lisp_Process *p, Lisp_Object input_obj,
     pset_write_queue (p, nconc2 (p->write_queue, list1 (entry)));
 }
 
-/* Remove the first element in the write_queue of process P, put its
-   contents in OBJ, BUF and LEN, and return true.  If the
-   write_queue is empty, return false.  */
-
-static bool
-write_queue_pop (struct Lisp_Process *p, Lisp_Object *obj,
-		 const char **buf, ptrdiff_t *len)
-{
-  Lisp_Object entry, offset_length;
-  ptrdiff_t offset;
-
-  if (NILP (p->write_queue))
-    return 0;
-
-  entry = XCAR (p->write_queue);
-  pset_write_queue (p, XCDR (p->write_queue));
-
-  *obj = XCAR (entry);
-  offset_length = XCDR (entry);
-
-  *len = XFIXNUM (XCDR (offset_length));
-  offset = XFIXNUM (XCAR (offset_length));
-  *buf = SSDATA (*obj) + offset;
-
-  return 1;
-}
-
-/* Send some data to process PROC.
-   BUF is the beginning of the data; LEN is the number of characters.
-   OBJECT is the Lisp object that the data comes from.  If OBJECT is
-   nil or t, it means that the data comes from C string.
-
-   If OBJECT is not nil, the data is encoded by PROC's coding-system
-   for encoding before it is sent.
+/* Set up the coding system of process P for encoding the text of
+   OBJECT, which is as in send_process, and return it.  */
 
-   This function can evaluate Lisp code and can garbage collect.  */
-
-static void
-send_process (Lisp_Object proc, const char *buf, ptrdiff_t len,
-	      Lisp_Object object)
+static struct coding_system *
+setup_process_encoding (struct Lisp_Process *p, Lisp_Object object)
 {
-  struct Lisp_Process *p = XPROCESS (proc);
-  ssize_t rv;
-  struct coding_system *coding;
-
-  if (NETCONN_P (proc))
-    {
-      wait_while_connecting (proc);
-      wait_for_tls_negotiation (proc);
-    }
+  struct coding_system *coding = proc_encode_coding_system[p->outfd];
 
-  if (p->raw_status_new)
-    update_status (p);
-  if (! EQ (p->status, Qrun))
-    error ("Process %s not running", SDATA (p->name));
-  if (p->outfd < 0)
-    error ("Output file descriptor of %s is closed", SDATA (p->name));
-
-  coding = proc_encode_coding_system[p->outfd];
   Vlast_coding_system_used = CODING_ID_NAME (coding->id);
 
   if ((STRINGP (object) && STRING_MULTIBYTE (object))
@@ -6467,13 +7248,6 @@ send_process (Lisp_Object proc, const char *buf, ptrdiff_t len,
 	 or one of the subsidiary if we have not yet done it.  */
       if (CODING_REQUIRE_ENCODING (coding))
 	{
-	  if (CODING_REQUIRE_FLUSHING (coding))
-	    {
-	      /* But, before changing the coding, we must flush out data.  */
-	      coding->mode |= CODING_MODE_LAST_BLOCK;
-	      send_process (proc, "", 0, Qt);
-	      coding->mode &= CODING_MODE_LAST_BLOCK;
-	    }
 	  setup_coding_system (raw_text_coding_system
 			       (Vlast_coding_system_used),
 			       coding);
@@ -6481,74 +7255,156 @@ send_process (Lisp_Object proc, const char *buf, ptrdiff_t len,
 	}
     }
   coding->dst_multibyte = 0;
+  return coding;
+}
+
+/* Encode the first SEND_PROCESS_CHUNK bytes or so of the entry at the
+   front of the write queue of process P, which needs encoding, and
+   put the result in front of the rest of the entry.  */
 
-  if (CODING_REQUIRE_ENCODING (coding))
+static void
+write_queue_encode (struct Lisp_Process *p)
+{
+  Lisp_Object entry = XCAR (p->write_queue);
+  Lisp_Object obj = XCAR (entry), rest = XCDR (entry);
+  ptrdiff_t from_byte = XFIXNUM (XCAR (rest));
+  ptrdiff_t end_byte = from_byte + XFIXNUM (XCAR (XCDR (rest)));
+  ptrdiff_t to_byte = from_byte + min (end_byte - from_byte,
+				       SEND_PROCESS_CHUNK);
+  Lisp_Object callback = XCDR (XCDR (XCDR (rest)));
+  struct coding_system *coding = setup_process_encoding (p, obj);
+  ptrdiff_t from, to;
+
+  if (STRING_MULTIBYTE (obj))
     {
-      coding->dst_object = Qt;
-      if (BUFFERP (object))
-	{
-	  ptrdiff_t from_byte, from, to;
-	  ptrdiff_t save_pt, save_pt_byte;
-	  struct buffer *cur = current_buffer;
-
-	  set_buffer_internal (XBUFFER (object));
-	  save_pt = PT, save_pt_byte = PT_BYTE;
-
-	  from_byte = PTR_BYTE_POS ((unsigned char *) buf);
-	  from = BYTE_TO_CHAR (from_byte);
-	  to = BYTE_TO_CHAR (from_byte + len);
-	  TEMP_SET_PT_BOTH (from, from_byte);
-	  encode_coding_object (coding, object, from, from_byte,
-				to, from_byte + len, Qt);
-	  TEMP_SET_PT_BOTH (save_pt, save_pt_byte);
-	  set_buffer_internal (cur);
-	}
-      else if (STRINGP (object))
-	{
-	  encode_coding_object (coding, object, 0, 0, SCHARS (object),
-				SBYTES (object), Qt);
-	}
-      else
-	{
-	  coding->dst_object = make_unibyte_string (buf, len);
-	  coding->produced = len;
-	}
+      while (to_byte < end_byte && !CHAR_HEAD_P (SREF (obj, to_byte)))
+	to_byte++;
+      from = string_byte_to_char (obj, from_byte);
+      to = string_byte_to_char (obj, to_byte);
+    }
+  else
+    from = from_byte, to = to_byte;
+
+  coding->dst_object = Qt;
+  encode_coding_object (coding, obj, from, from_byte, to, to_byte, Qt);
 
-      len = coding->produced;
-      object = coding->dst_object;
-      buf = SSDATA (object);
+  pset_write_queue (p, XCDR (p->write_queue));
+  if (to_byte < end_byte)
+    {
+      write_queue_push (p, obj, SSDATA (obj) + to_byte, end_byte - to_byte,
+			true, callback, true);
+      callback = Qnil;
     }
+  write_queue_push (p, coding->dst_object, SSDATA (coding->dst_object),
+		    coding->produced, false, callback, true);
+}
+
+/* Start or stop calling send_process_writable when process P can
+   accept more input.  */
 
-  /* If there is already data in the write_queue, put the new data
-     in the back of queue.  Otherwise, ignore it.  */
-  if (!NILP (p->write_queue))
-    write_queue_push (p, object, buf, len, 0);
+static void
+write_queue_watch (struct Lisp_Process *p, bool watch)
+{
+  int fd = p->outfd;
 
-  do   /* while !NILP (p->write_queue) */
+  if (fd < 0 || watch == (fd_callback_info[fd].func == send_process_writable))
+    return;
+  if (watch)
+    add_write_fd (fd, send_process_writable, p);
+  else
     {
-      ptrdiff_t cur_len = -1;
-      const char *cur_buf;
-      Lisp_Object cur_object;
+      delete_write_fd (fd);
+      /* A pty or socket is read from too, so its callback stays.  */
+      fd_callback_info[fd].func = 0;
+      fd_callback_info[fd].data = 0;
+    }
+}
+
+/* Call the functions in CALLBACKS in order with process PROC.  */
+
+static void
+run_send_callbacks (Lisp_Object proc, Lisp_Object callbacks)
+{
+  ptrdiff_t count = SPECPDL_INDEX ();
+
+  /* The callbacks can run while Emacs waits for input, so shield the
+     code that waits, as for filters.  */
+  record_unwind_current_buffer ();
+  record_unwind_save_match_data ();
+  for (; CONSP (callbacks); callbacks = XCDR (callbacks))
+    call1 (XCAR (callbacks), proc);
+  unbind_to (count, Qnil);
+}
+
+/* Write the write queue of process PROC.  If WAIT, wait until all of
+   it is written, accepting input in the meantime; otherwise return
+   as soon as PROC cannot accept more.  Call the callbacks of the
+   entries that get written.
+
+   This function can evaluate Lisp code and can garbage collect.  */
+
+static void
+write_queue_flush (Lisp_Object proc, bool wait)
+{
+  struct Lisp_Process *p = XPROCESS (proc);
+
+  while (CONSP (p->write_queue))
+    {
+      struct iovec iov[WRITE_QUEUE_IOVECS];
+      int niov = 0, maxiov = WRITE_QUEUE_IOVECS;
+      ptrdiff_t written = 0;
+      ssize_t rv = 0;
+      int outfd = p->outfd, err = 0;
+      Lisp_Object tail, callbacks = Qnil;
+
+      if (outfd < 0)
+	error ("Output file descriptor of %s is closed", SDATA (p->name));
+
+      if (!NILP (XCAR (XCDR (XCDR (XCDR (XCAR (p->write_queue)))))))
+	{
+	  write_queue_encode (p);
+	  continue;
+	}
+
+#ifndef HAVE_WRITEV
+      maxiov = 1;
+#endif
+#ifdef DATAGRAM_SOCKETS
+      /* Each entry is a datagram of its own.  */
+      if (DATAGRAM_CHAN_P (outfd))
+	maxiov = 1;
+#endif
+#ifdef HAVE_GNUTLS
+      if (p->gnutls_p && p->gnutls_state)
+	maxiov = 1;
+#endif
 
-      /* If write_queue is empty, ignore it.  */
-      if (!write_queue_pop (p, &cur_object, &cur_buf, &cur_len))
+      /* Gather the encoded text at the front of the queue.  */
+      for (tail = p->write_queue; CONSP (tail) && niov < maxiov;
+	   tail = XCDR (tail))
 	{
-	  cur_len = len;
-	  cur_buf = buf;
-	  cur_object = object;
+	  Lisp_Object rest = XCDR (XCAR (tail));
+	  ptrdiff_t len = XFIXNUM (XCAR (XCDR (rest)));
+
+	  if (!NILP (XCAR (XCDR (XCDR (rest)))))
+	    break;
+	  if (len > 0)
+	    {
+	      iov[niov].iov_base = SSDATA (XCAR (XCAR (tail)))
+				   + XFIXNUM (XCAR (rest));
+	      iov[niov].iov_len = len;
+	      niov++;
+	    }
 	}
 
-      while (cur_len > 0)
+      if (niov > 0)
 	{
-	  /* Send this batch, using one or more write calls.  */
-	  ptrdiff_t written = 0;
-	  int outfd = p->outfd;
 #ifdef DATAGRAM_SOCKETS
 	  if (DATAGRAM_CHAN_P (outfd))
 	    {
 	      while (true)
 		{
-		  rv = sendto (outfd, cur_buf, cur_len, 0,
+		  rv = sendto (outfd, iov[0].iov_base, iov[0].iov_len, 0,
 			       datagram_address[outfd].sa,
 			       datagram_address[outfd].len);
 		  if (! (rv < 0 && errno == EINTR))
@@ -6559,19 +7415,39 @@ send_process (Lisp_Object proc, const char *buf, ptrdiff_t len,
 
 	      if (rv >= 0)
 		written = rv;
-	      else if (errno == EMSGSIZE)
-		report_file_error ("Sending datagram", proc);
+	      else if ((err = errno) == EMSGSIZE)
+		{
+		  pset_write_queue (p, Qnil);
+		  write_queue_watch (p, false);
+		  report_file_error ("Sending datagram", proc);
+		}
 	    }
 	  else
 #endif
 	    {
 #ifdef HAVE_GNUTLS
 	      if (p->gnutls_p && p->gnutls_state)
-		written = emacs_gnutls_write (p, cur_buf, cur_len);
+		written = emacs_gnutls_write (p, iov[0].iov_base,
+					      iov[0].iov_len);
 	      else
 #endif
-		written = emacs_write_sig (outfd, cur_buf, cur_len);
+#ifdef HAVE_WRITEV
+	      if (niov > 1)
+		{
+		  ssize_t n;
+		  while ((n = writev (outfd, iov, niov)) < 0
+			 && errno == EINTR)
+		    if (pending_signals)
+		      process_pending_signals ();
+		  written = max (n, 0);
+		}
+	      else
+#endif
+		written = emacs_write_sig (outfd, iov[0].iov_base,
+					   iov[0].iov_len);
 	      rv = (written ? 0 : -1);
+	      /* Save errno before anything below can change it.  */
+	      err = errno;
 	      if (p->read_output_delay > 0
 		  && p->adaptive_read_buffering == 1)
 		{
@@ -6580,68 +7456,181 @@ send_process (Lisp_Object proc, const char *buf, ptrdiff_t len,
 		  p->read_output_skip = 0;
 		}
 	    }
+	}
 
-	  if (rv < 0)
+      /* Drop the entries that have been written, and skip what has
+	 been written of the next one.  */
+      while (CONSP (p->write_queue))
+	{
+	  Lisp_Object rest = XCDR (XCAR (p->write_queue));
+	  ptrdiff_t len = XFIXNUM (XCAR (XCDR (rest)));
+
+	  if (!NILP (XCAR (XCDR (XCDR (rest)))))
+	    break;
+	  if (written < len)
 	    {
-	      if (would_block (errno))
-		/* Buffer is full.  Wait, accepting input;
-		   that may allow the program
-		   to finish doing output and read more.  */
+	      if (written > 0)
 		{
+		  XSETCAR (rest, make_fixnum (XFIXNUM (XCAR (rest))
+					      + written));
+		  XSETCAR (XCDR (rest), make_fixnum (len - written));
+		}
+	      break;
+	    }
+	  written -= len;
+	  pset_write_queue (p, XCDR (p->write_queue));
+	  if (!NILP (XCDR (XCDR (XCDR (rest)))))
+	    callbacks = Fcons (XCDR (XCDR (XCDR (rest))), callbacks);
+	}
+
+      if (rv < 0 && would_block (err))
+	{
 #ifdef BROKEN_PTY_READ_AFTER_EAGAIN
-		  /* A gross hack to work around a bug in FreeBSD.
-		     In the following sequence, read(2) returns
-		     bogus data:
-
-		     write(2)	 1022 bytes
-		     write(2)   954 bytes, get EAGAIN
-		     read(2)   1024 bytes in process_read_output
-		     read(2)     11 bytes in process_read_output
-
-		     That is, read(2) returns more bytes than have
-		     ever been written successfully.  The 1033 bytes
-		     read are the 1022 bytes written successfully
-		     after processing (for example with CRs added if
-		     the terminal is set up that way which it is
-		     here).  The same bytes will be seen again in a
-		     later read(2), without the CRs.  */
-
-		  if (errno == EAGAIN)
-		    {
-		      int flags = FWRITE;
-		      ioctl (p->outfd, TIOCFLUSH, &flags);
-		    }
+	  /* A gross hack to work around a bug in FreeBSD.
+	     In the following sequence, read(2) returns
+	     bogus data:
+
+	     write(2)	 1022 bytes
+	     write(2)   954 bytes, get EAGAIN
+	     read(2)   1024 bytes in process_read_output
+	     read(2)     11 bytes in process_read_output
+
+	     That is, read(2) returns more bytes than have
+	     ever been written successfully.  The 1033 bytes
+	     read are the 1022 bytes written successfully
+	     after processing (for example with CRs added if
+	     the terminal is set up that way which it is
+	     here).  The same bytes will be seen again in a
+	     later read(2), without the CRs.  */
+
+	  if (err == EAGAIN)
+	    {
+	      int flags = FWRITE;
+	      ioctl (p->outfd, TIOCFLUSH, &flags);
+	    }
 #endif /* BROKEN_PTY_READ_AFTER_EAGAIN */
 
-		  /* Put what we should have written in write_queue.  */
-		  write_queue_push (p, cur_object, cur_buf, cur_len, 1);
-		  wait_reading_process_output (0, 20 * 1000 * 1000,
-					       0, 0, Qnil, NULL, 0);
-		  /* Reread queue, to see what is left.  */
-		  break;
-		}
-	      else if (errno == EPIPE)
-		{
-		  p->raw_status_new = 0;
-		  pset_status (p, list2 (Qexit, make_fixnum (256)));
-		  p->tick = ++process_tick;
-		  deactivate_process (proc);
-		  error ("process %s no longer connected to pipe; closed it",
-			 SDATA (p->name));
-		}
-	      else
-		/* This is a real error.  */
-		report_file_error ("Writing to process", proc);
+	  /* Write the rest as soon as possible, even while
+	     waiting below.  */
+	  write_queue_watch (p, true);
+	}
+      else if (rv < 0)
+	/* The rest can't be written either.  */
+	pset_write_queue (p, Qnil);
+
+      if (NILP (p->write_queue))
+	write_queue_watch (p, false);
+
+      /* The callbacks can run any Lisp code, so call them only after
+	 the above, which uses ERR.  */
+      if (!NILP (callbacks))
+	run_send_callbacks (proc, Fnreverse (callbacks));
+
+      if (rv < 0)
+	{
+	  if (would_block (err))
+	    {
+	      /* Buffer is full.  Wait, accepting input;
+		 that may allow the program
+		 to finish doing output and read more.  */
+	      if (!wait)
+		return;
+	      wait_reading_process_output (0, 20 * 1000 * 1000,
+					   0, 0, Qnil, NULL, 0);
+	    }
+	  else if (err == EPIPE)
+	    {
+	      p->raw_status_new = 0;
+	      pset_status (p, list2 (Qexit, make_fixnum (256)));
+	      p->tick = ++process_tick;
+	      deactivate_process (proc);
+	      error ("process %s no longer connected to pipe; closed it",
+		     SDATA (p->name));
 	    }
-	  cur_buf += written;
-	  cur_len -= written;
+	  else
+	    /* This is a real error.  */
+	    report_file_errno ("Writing to process", proc, err);
 	}
     }
-  while (!NILP (p->write_queue));
+}
+
+static Lisp_Object
+send_process_writable_1 (Lisp_Object proc)
+{
+  write_queue_flush (proc, false);
+  return Qnil;
+}
+
+static Lisp_Object
+send_process_writable_error_handler (Lisp_Object error_val)
+{
+  cmd_error_internal (error_val, "error in process input: ");
+  Vinhibit_quit = Qt;
+  update_echo_area ();
+  Fsleep_for (make_fixnum (2), Qnil);
+  return Qt;
+}
+
+/* Write the write queue of the process whose data is DATA, now that
+   the process can accept more input on FD.  */
+
+static void
+send_process_writable (int fd, void *data)
+{
+  Lisp_Object proc;
+
+  XSETPROCESS (proc, data);
+  internal_condition_case_1 (send_process_writable_1, proc,
+			     !NILP (Vdebug_on_error) ? Qnil : Qerror,
+			     send_process_writable_error_handler);
+}
+
+/* Send some data to process PROC.
+   BUF is the beginning of the data; LEN is the number of characters.
+   OBJECT is the Lisp object that the data comes from.  If OBJECT is
+   nil or t, it means that the data comes from C string.
+
+   If OBJECT is not nil, the data is encoded by PROC's coding-system
+   for encoding before it is sent.
+
+   If CALLBACK is nil, wait until PROC has accepted all of the data.
+   Otherwise, return as soon as PROC can't accept more, and call
+   CALLBACK with PROC once all of the data has been written.
+
+   This function can evaluate Lisp code and can garbage collect.  */
+
+static void
+send_process (Lisp_Object proc, const char *buf, ptrdiff_t len,
+	      Lisp_Object object, Lisp_Object callback)
+{
+  struct Lisp_Process *p = XPROCESS (proc);
+  struct coding_system *coding;
+
+  if (NETCONN_P (proc))
+    {
+      wait_while_connecting (proc);
+      wait_for_tls_negotiation (proc);
+    }
+
+  if (p->raw_status_new)
+    update_status (p);
+  if (! EQ (p->status, Qrun))
+    error ("Process %s not running", SDATA (p->name));
+  if (p->outfd < 0)
+    error ("Output file descriptor of %s is closed", SDATA (p->name));
+
+  /* Text from C strings is never encoded.  */
+  coding = setup_process_encoding (p, object);
+  if (len > 0 || !NILP (callback))
+    write_queue_push (p, object, buf, len,
+		      (CODING_REQUIRE_ENCODING (coding)
+		       && (STRINGP (object) || BUFFERP (object))),
+		      callback, false);
+  write_queue_flush (proc, NILP (callback));
 }
 
 DEFUN ("process-send-region", Fprocess_send_region, Sprocess_send_region,
-       3, 3, 0,
+       3, 4, 0,
        doc: /* Send current contents of region as input to PROCESS.
 PROCESS may be a process, a buffer, the name of a process or buffer, or
 nil, indicating the current buffer's process.
@@ -6652,9 +7641,17 @@ operating system), it is sent in several bunches.  This may happen
 even for shorter regions.  Output from processes can arrive in between
 bunches.
 
+If optional argument CALLBACK is non-nil, don't wait for PROCESS to
+accept all of the region: return as soon as PROCESS can't take more,
+and send the rest whenever Emacs waits for input and PROCESS is ready
+for it.  CALLBACK is called with PROCESS as its argument once all of
+the region has been sent, which can be before this function returns.
+Text sent to PROCESS later is sent after the region.
+
 If PROCESS is a non-blocking network process that hasn't been fully
 set up yet, this function will block until socket setup has completed.  */)
-  (Lisp_Object process, Lisp_Object start, Lisp_Object end)
+  (Lisp_Object process, Lisp_Object start, Lisp_Object end,
+   Lisp_Object callback)
 {
   Lisp_Object proc = get_process (process);
   ptrdiff_t start_byte, end_byte;
@@ -6671,13 +7668,13 @@ set up yet, this function will block until socket setup has completed.  */)
     wait_while_connecting (proc);
 
   send_process (proc, (char *) BYTE_POS_ADDR (start_byte),
-		end_byte - start_byte, Fcurrent_buffer ());
+		end_byte - start_byte, Fcurrent_buffer (), callback);
 
   return Qnil;
 }
 
 DEFUN ("process-send-string", Fprocess_send_string, Sprocess_send_string,
-       2, 2, 0,
+       2, 3, 0,
        doc: /* Send PROCESS the contents of STRING as input.
 PROCESS may be a process, a buffer, the name of a process or buffer, or
 nil, indicating the current buffer's process.
@@ -6686,14 +7683,21 @@ of which depends on the process connection type and the operating
 system), it is sent in several bunches.  This may happen even for
 shorter strings.  Output from processes can arrive in between bunches.
 
+If optional argument CALLBACK is non-nil, don't wait for PROCESS to
+accept all of STRING: return as soon as PROCESS can't take more, and
+send the rest whenever Emacs waits for input and PROCESS is ready for
+it.  CALLBACK is called with PROCESS as its argument once all of
+STRING has been sent, which can be before this function returns.
+Text sent to PROCESS later is sent after STRING.
+
 If PROCESS is a non-blocking network process that hasn't been fully
 set up yet, this function will block until socket setup has completed.  */)
-  (Lisp_Object process, Lisp_Object string)
+  (Lisp_Object process, Lisp_Object string, Lisp_Object callback)
 {
   CHECK_STRING (string);
   Lisp_Object proc = get_process (process);
   send_process (proc, SSDATA (string),
-		SBYTES (string), string);
+		SBYTES (string), string, callback);
   return Qnil;
 }
 
@@ -6824,7 +7828,7 @@ process_send_signal (Lisp_Object process, int signo, Lisp_Object current_group,
 
       if (sig_char && *sig_char != CDISABLE)
 	{
-	  send_process (proc, (char *) sig_char, 1, Qnil);
+	  send_process (proc, (char *) sig_char, 1, Qnil, Qnil);
 	  return;
 	}
       /* If we can't send the signal with a character,
@@ -7132,11 +8136,13 @@ process has been transmitted to the serial port.  */)
   if (coding && CODING_REQUIRE_FLUSHING (coding))
     {
       coding->mode |= CODING_MODE_LAST_BLOCK;
-      send_process (proc, "", 0, Qnil);
+      send_process (proc, "", 0, Qnil, Qnil);
     }
+  else
+    write_queue_flush (proc, true);
 
   if (XPROCESS (proc)->pty_flag)
-    send_process (proc, "\004", 1, Qnil);
+    send_process (proc, "\004", 1, Qnil, Qnil);
   else if (EQ (XPROCESS (proc)->type, Qserial))
     {
 #ifndef WINDOWSNT
@@ -7912,6 +8918,7 @@ add_timer_wait_descriptor (int fd)
 {
   add_read_fd (fd, timerfd_callback, NULL);
   fd_callback_info[fd].flags &= ~KEYBOARD_FD;
+  update_wait_sets (fd);
 }
 
 #endif /* HAVE_TIMERFD */
@@ -7936,8 +8943,10 @@ add_keyboard_wait_descriptor (int desc)
 {
 #ifdef subprocesses /* Actually means "not MSDOS".  */
   eassert (desc >= 0 && desc < FD_SETSIZE);
+  epoll_forget (desc);
   fd_callback_info[desc].flags &= ~PROCESS_FD;
   fd_callback_info[desc].flags |= (FOR_READ | KEYBOARD_FD);
+  update_wait_sets (desc);
   if (desc > max_desc)
     max_desc = desc;
 #endif
@@ -7952,6 +8961,7 @@ delete_keyboard_wait_descriptor (int desc)
   eassert (desc >= 0 && desc < FD_SETSIZE);
 
   fd_callback_info[desc].flags &= ~(FOR_READ | KEYBOARD_FD | PROCESS_FD);
+  update_wait_sets (desc);
 
   if (desc == max_desc)
     recompute_max_desc ();
@@ -8274,6 +9284,17 @@ init_process_emacs (int sockfd)
 
   max_desc = -1;
   memset (fd_callback_info, 0, sizeof (fd_callback_info));
+  FD_ZERO (&input_wait_set);
+  FD_ZERO (&non_keyboard_wait_set);
+  FD_ZERO (&non_process_wait_set);
+  FD_ZERO (&write_wait_set);
+  num_waiting_fds = 0;
+#ifdef USE_EPOLL
+  epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  memset (epoll_events, 0, sizeof epoll_events);
+  memset (epoll_unpollable, 0, sizeof epoll_unpollable);
+  epoll_num_unpollable = 0;
+#endif
 
   num_pending_connects = 0;
 
@@ -8312,6 +9333,7 @@ syms_of_process (void)
 #ifdef subprocesses
 
   DEFSYM (Qprocessp, "processp");
+  DEFSYM (Qcontent_length, "content-length");
   DEFSYM (Qrun, "run");
   DEFSYM (Qstop, "stop");
   DEFSYM (Qsignal, "signal");
@@ -8460,9 +9482,11 @@ returns non-`nil'.  */);
 
   DEFVAR_INT ("read-process-output-max", read_process_output_max,
 	      doc: /* Maximum number of bytes to read from subprocess in a single chunk.
-Enlarge the value only if the subprocess generates very large (megabytes)
-amounts of data in one go.  */);
-  read_process_output_max = 4096;
+Emacs reads 4096 bytes at a time at first, and reads more at a time,
+up to this many bytes, from a subprocess whose output keeps coming
+faster.  Enlarge the value only if the subprocess generates very large
+(megabytes) amounts of data in one go.  */);
+  read_process_output_max = 65536;
 
   DEFSYM (Qinternal_default_interrupt_process,
 	  "internal-default-interrupt-process");
@@ -8485,6 +9509,8 @@ amounts of data in one go.  */);
   defsubr (&Sprocess_mark);
   defsubr (&Sset_process_filter);
   defsubr (&Sprocess_filter);
+  defsubr (&Sset_process_message_framing);
+  defsubr (&Sprocess_message_framing);
   defsubr (&Sset_process_sentinel);
   defsubr (&Sprocess_sentinel);
   defsubr (&Sset_process_thread);
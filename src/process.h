@@ -115,6 +115,14 @@ struct Lisp_Process
     /* Pipe process attached to the standard error of this process.  */
     Lisp_Object stderrproc;
 
+    /* How output is split into messages for the filter: nil, or
+       (FRAMING . ARGS) as given to `set-process-message-framing'.  */
+    Lisp_Object message_framing;
+
+    /* Unibyte string holding output not yet passed to the filter
+       when messages are framed.  */
+    Lisp_Object message_buf;
+
     /* The thread a process is linked to, or nil for any thread.  */
     Lisp_Object thread;
     /* After this point, there are no Lisp_Objects.  */
@@ -138,8 +146,18 @@ struct Lisp_Process
     EMACS_INT tick;
     /* Event-count of last such event reported.  */
     EMACS_INT update_tick;
+    /* The output in message_buf from byte message_start to byte
+       message_end has not yet been passed to the filter.  */
+    ptrdiff_t message_start, message_end;
+    /* Length of the message body that starts at message_start, or -1
+       if message_start is at the header of a message.  */
+    ptrdiff_t message_length;
     /* Size of carryover in decoding.  */
     int decoding_carryover;
+    /* Number of bytes to try reading from the process at a time, or 0
+       if nothing has been read yet.  Grows while the output keeps
+       filling the buffer, up to `read-process-output-max'.  */
+    ptrdiff_t read_output_size;
     /* Hysteresis to try to read process output in larger blocks.
        On some systems, e.g. GNU/Linux, Emacs is seen as
        an interactive app also when reading process output, meaning
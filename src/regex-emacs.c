@@ -29,6 +29,8 @@
 
 #include <stdlib.h>
 
+#include <flexmember.h>
+
 #include "character.h"
 #include "buffer.h"
 #include "syntax.h"
@@ -191,7 +193,13 @@ static ptrdiff_t re_match_2_internal (struct re_pattern_buffer *bufp,
 				     re_char *string2, ptrdiff_t size2,
 				     ptrdiff_t pos,
 				     struct re_registers *regs,
-				     ptrdiff_t stop);
+				     ptrdiff_t stop, ptrdiff_t fail_limit);
+static ptrdiff_t nfa_match (struct re_pattern_buffer *bufp,
+			    re_char *string1, ptrdiff_t size1,
+			    re_char *string2, ptrdiff_t size2,
+			    ptrdiff_t pos, ptrdiff_t last,
+			    struct re_registers *regs, ptrdiff_t stop,
+			    ptrdiff_t *startp);
 
 /* These are the command codes that appear in compiled regular
    expressions.  Some opcodes are followed by argument bytes.  A
@@ -3180,6 +3188,79 @@ re_search (struct re_pattern_buffer *bufp, const char *string, ptrdiff_t size,
 #define POS_ADDR_VSTRING(POS)					\
   (((POS) >= size1 ? string2 - size1 : string1) + (POS))
 
+/* Return the first position from FROM to TO at which the LEN bytes at
+   LIT occur in the virtual concatenation of STRING1 and STRING2,
+   without extending past STOP, or -1 if there is none.  */
+static ptrdiff_t
+find_literal (re_char *string1, ptrdiff_t size1,
+	      re_char *string2, ptrdiff_t size2,
+	      ptrdiff_t from, ptrdiff_t to, ptrdiff_t stop,
+	      re_char *lit, ptrdiff_t len)
+{
+  to = min (to, stop - len);
+  while (from <= to)
+    {
+      /* Look for the first byte of LIT in the current string.  */
+      re_char *d = POS_ADDR_VSTRING (from);
+      ptrdiff_t n = (from < size1 ? min (to, size1 - 1) : to) - from + 1;
+      re_char *q = memchr (d, lit[0], n);
+      if (!q)
+	{
+	  from += n;
+	  continue;
+	}
+      from += q - d;
+
+      ptrdiff_t i = 1;
+      if (from >= size1 || from + len <= size1)
+	i = memcmp (q, lit, len) == 0 ? len : 0;
+      else
+	while (i < len && *POS_ADDR_VSTRING (from + i) == lit[i])
+	  i++;
+      if (i == len)
+	return from;
+      from++;
+    }
+  return -1;
+}
+
+/* Return the position after the last newline from FROM to TO,
+   excluded, in the virtual concatenation of STRING1 and STRING2, or
+   FROM if there is none.  */
+static ptrdiff_t
+after_last_newline (re_char *string1, ptrdiff_t size1, re_char *string2,
+		    ptrdiff_t from, ptrdiff_t to)
+{
+  if (size1 < to)
+    {
+      ptrdiff_t start = max (from, size1);
+      re_char *nl = memrchr (string2 + start - size1, '\n', to - start);
+      if (nl)
+	return nl - string2 + size1 + 1;
+      to = start;
+    }
+  if (from < to)
+    {
+      re_char *nl = memrchr (string1 + from, '\n', to - from);
+      if (nl)
+	return nl - string1 + 1;
+    }
+  return from;
+}
+
+/* The number of failure points that the backtracking matcher may go
+   back to, while matching from one position, before it gives up on a
+   pattern that the automaton can match.  */
+#define BACKTRACK_LIMIT 100000
+
+/* Return how many failure points the backtracking matcher may go back
+   to when matching BUFP, or 0 if it must not give up.  */
+static ptrdiff_t
+backtrack_limit (struct re_pattern_buffer *bufp)
+{
+  return bufp->nfa && !NILP (Vregexp_automaton_matching) ? BACKTRACK_LIMIT : 0;
+}
+
 /* Using the compiled pattern in BUFP->buffer, first tries to match the
    virtual concatenation of STRING1 and STRING2, starting first at index
    STARTPOS, then at STARTPOS + 1, and so on.
@@ -3217,6 +3298,9 @@ re_search_2 (struct re_pattern_buffer *bufp, const char *str1, ptrdiff_t size1,
   bool anchored_start;
   /* Nonzero if we are searching multibyte string.  */
   bool multibyte = RE_TARGET_MULTIBYTE_P (bufp);
+  /* True if we match with BUFP->nfa rather than by backtracking.  */
+  bool use_nfa = bufp->nfa && EQ (Vregexp_automaton_matching, Qt);
+  ptrdiff_t fail_limit = backtrack_limit (bufp);
 
   /* Check for out-of-range STARTPOS.  */
   if (startpos < 0 || startpos > total_size)
@@ -3256,6 +3340,16 @@ re_search_2 (struct re_pattern_buffer *bufp, const char *str1, ptrdiff_t size1,
   /* See whether the pattern is anchored.  */
   anchored_start = (bufp->buffer[0] == begline);
 
+  /* In a forward search, look for the string that every match
+     contains with memchr, unless it is subject to translation.  Then
+     only try to match where a match can contain it.  MUST_POS is the
+     first position not before STARTPOS where that string occurs.  */
+  re_char *must = NULL;
+  ptrdiff_t must_pos = -1;
+  if (bufp->must_len > 0 && range > 0 && NILP (translate)
+      && (bufp->must_ascii || RE_MULTIBYTE_P (bufp) == multibyte))
+    must = bufp->buffer + bufp->must_offset;
+
   gl_state.object = re_match_object; /* Used by SYNTAX_TABLE_BYTE_TO_CHAR. */
   {
     ptrdiff_t charpos = SYNTAX_TABLE_BYTE_TO_CHAR (POS_AS_IN_BUFFER (startpos));
@@ -3266,6 +3360,30 @@ re_search_2 (struct re_pattern_buffer *bufp, const char *str1, ptrdiff_t size1,
   /* Loop through the string, looking for a place to start matching.  */
   for (;;)
     {
+      if (must)
+	{
+	  ptrdiff_t next = startpos;
+	  if (must_pos < startpos)
+	    {
+	      must_pos = find_literal (string1, size1, string2, size2,
+				       startpos,
+				       (bufp->must_prefix
+					? startpos + range : total_size),
+				       stop, must, bufp->must_len);
+	      if (must_pos < 0)
+		return -1;
+	    }
+	  if (bufp->must_prefix)
+	    next = must_pos;
+	  else if (bufp->must_nl_free)
+	    next = after_last_newline (string1, size1, string2,
+				       startpos, must_pos);
+	  if (next - startpos > range)
+	    return -1;
+	  range -= next - startpos;
+	  startpos = next;
+	}
+
       /* If the pattern is anchored,
 	 skip quickly past places we cannot match.
 	 Don't bother to treat startpos == 0 specially
@@ -3378,8 +3496,27 @@ re_search_2 (struct re_pattern_buffer *bufp, const char *str1, ptrdiff_t size1,
 	  && !bufp->can_be_null)
 	return -1;
 
-      val = re_match_2_internal (bufp, string1, size1, string2, size2,
-				 startpos, regs, stop);
+      if (!use_nfa)
+	{
+	  val = re_match_2_internal (bufp, string1, size1, string2, size2,
+				     startpos, regs, stop, fail_limit);
+	  if (val < -2 || (val == -2 && fail_limit))
+	    {
+	      /* Backtracking takes too long: stop doing it.  */
+	      use_nfa = true;
+	      continue;
+	    }
+	}
+      else if (range > 0)
+	{
+	  /* Look for a match starting anywhere in the range at once.  */
+	  val = nfa_match (bufp, string1, size1, string2, size2,
+			   startpos, startpos + range, regs, stop, &startpos);
+	  return val < 0 ? -1 : startpos;
+	}
+      else
+	val = nfa_match (bufp, string1, size1, string2, size2,
+			 startpos, startpos, regs, stop, &startpos);
 
       if (val >= 0)
 	return startpos;
@@ -3571,6 +3708,188 @@ skip_noops (re_char *p, re_char *pend)
   return p;
 }
 
+/* Return the address of the operation that follows the one at P.  */
+static re_char *
+next_op (re_char *p)
+{
+  switch (*p)
+    {
+    case exactn:
+    case anychar:
+    case charset:
+    case charset_not:
+    case syntaxspec:
+    case notsyntaxspec:
+    case categoryspec:
+    case notcategoryspec:
+      return skip_one_char (p);
+
+    case start_memory:
+    case stop_memory:
+    case duplicate:
+      return p + 2;
+
+    case jump:
+    case on_failure_jump:
+    case on_failure_keep_string_jump:
+    case on_failure_jump_loop:
+    case on_failure_jump_nastyloop:
+    case on_failure_jump_smart:
+      return p + 3;
+
+    case succeed_n:
+    case jump_n:
+    case set_number_at:
+      return p + 5;
+
+    default:
+      return p + 1;
+    }
+}
+
+/* Return true if none of the operations from P to PEND can match a
+   newline.  Syntax and category tests, and back references, are
+   assumed to match one.  */
+static bool
+nl_free_p (re_char *p, re_char *pend)
+{
+  for (; p < pend; p = next_op (p))
+    switch (*p)
+      {
+      case exactn:
+	if (memchr (p + 2, '\n', p[1]))
+	  return false;
+	break;
+
+      case charset:
+      case charset_not:
+	{
+	  bool in_bitmap = (CHARSET_BITMAP_SIZE (p) > '\n' / BYTEWIDTH
+			    && (p[2 + '\n' / BYTEWIDTH]
+				& (1 << ('\n' % BYTEWIDTH))));
+	  bool classes = (CHARSET_RANGE_TABLE_EXISTS_P (p)
+			  && CHARSET_RANGE_TABLE_BITS (p) != 0);
+	  if ((re_opcode_t) *p == charset ? in_bitmap || classes : !in_bitmap)
+	    return false;
+	}
+	break;
+
+      case syntaxspec:
+      case notsyntaxspec:
+      case categoryspec:
+      case notcategoryspec:
+      case duplicate:
+	return false;
+
+      default:
+	break;
+      }
+  return true;
+}
+
+/* Find a string that every match of the pattern compiled in BUFP
+   contains, and set the 'must_' fields of BUFP accordingly.
+
+   This follows the operations that every match goes through, skipping
+   over optional and repeated parts and over alternatives, and picks
+   the longest 'exactn' among them.  It stops at the first operation it
+   does not understand, which is always safe.  */
+static void
+analyze_literal (struct re_pattern_buffer *bufp)
+{
+  re_char *p = bufp->buffer, *pend = p + bufp->used;
+  bool prefix = true;
+  int mcnt;
+
+  bufp->must_len = 0;
+
+  while (p < pend)
+    switch (*p)
+      {
+      case exactn:
+	if (p[1] > bufp->must_len)
+	  {
+	    bufp->must_len = p[1];
+	    bufp->must_offset = p + 2 - bufp->buffer;
+	    bufp->must_prefix = prefix;
+	    bufp->must_nl_free = nl_free_p (bufp->buffer, p);
+	    bufp->must_ascii = true;
+	    for (int i = 0; i < p[1]; i++)
+	      if (!ASCII_CHAR_P (p[2 + i]))
+		bufp->must_ascii = false;
+	  }
+	FALLTHROUGH;
+      case anychar:
+      case charset:
+      case charset_not:
+      case syntaxspec:
+      case notsyntaxspec:
+      case categoryspec:
+      case notcategoryspec:
+      case duplicate:
+	prefix = false;
+	FALLTHROUGH;
+      case no_op:
+      case start_memory:
+      case stop_memory:
+      case begline:
+      case endline:
+      case begbuf:
+      case endbuf:
+      case wordbeg:
+      case wordend:
+      case wordbound:
+      case notwordbound:
+      case symbeg:
+      case symend:
+      case at_dot:
+	p = next_op (p);
+	break;
+
+      case jump:
+	/* This skips the body of a non-greedy loop.  */
+	p++;
+	EXTRACT_NUMBER_AND_INCR (mcnt, p);
+	if (mcnt < 0)
+	  return;
+	p += mcnt;
+	prefix = false;
+	break;
+
+      case on_failure_jump:
+      case on_failure_keep_string_jump:
+      case on_failure_jump_loop:
+      case on_failure_jump_nastyloop:
+      case on_failure_jump_smart:
+	p++;
+	EXTRACT_NUMBER_AND_INCR (mcnt, p);
+	prefix = false;
+	if (mcnt > 0)
+	  {
+	    /* The code from P to the destination is either the first
+	       of several alternatives, which ends with a jump past the
+	       last one, or a part that can be skipped.  */
+	    re_char *dest = p + mcnt, *last = p;
+	    for (re_char *q = p; q < dest; q = next_op (q))
+	      last = q;
+	    p = dest;
+	    if ((re_opcode_t) *last == jump)
+	      {
+		last++;
+		EXTRACT_NUMBER (mcnt, last);
+		if (mcnt > 0)
+		  p += mcnt;
+	      }
+	  }
+	/* Otherwise, this ends a non-greedy loop, whose body was
+	   already followed.  */
+	break;
+
+      default:
+	return;
+      }
+}
+
 /* Test if C matches charset op.  *PP points to the charset or charset_not
    opcode.  When the function finishes, *PP will be advanced past that opcode.
    C is character to test (possibly after translations) and CORIG is original
@@ -3851,12 +4170,55 @@ re_match_2 (struct re_pattern_buffer *bufp,
   charpos = SYNTAX_TABLE_BYTE_TO_CHAR (POS_AS_IN_BUFFER (pos));
   SETUP_SYNTAX_TABLE_FOR_OBJECT (re_match_object, charpos, 1);
 
-  result = re_match_2_internal (bufp, (re_char *) string1, size1,
-				(re_char *) string2, size2,
-				pos, regs, stop);
+  if (bufp->nfa && EQ (Vregexp_automaton_matching, Qt))
+    result = -3;
+  else
+    result = re_match_2_internal (bufp, (re_char *) string1, size1,
+				  (re_char *) string2, size2,
+				  pos, regs, stop, backtrack_limit (bufp));
+  if (result < -2 || (result == -2 && backtrack_limit (bufp)))
+    {
+      ptrdiff_t start;
+      result = nfa_match (bufp, (re_char *) string1, size1,
+			  (re_char *) string2, size2,
+			  pos, pos, regs, stop, &start);
+    }
   return result;
 }
 
+/* Make sure that REGS has room for NUM_REGS registers, as specified
+   by BUFP->regs_allocated.  */
+
+static void
+allocate_regs (struct re_pattern_buffer *bufp, struct re_registers *regs,
+	       ptrdiff_t num_regs)
+{
+  /* Have the register data arrays been allocated?	*/
+  if (bufp->regs_allocated == REGS_UNALLOCATED)
+    { /* No.  So allocate them with malloc.  */
+      ptrdiff_t n = max (RE_NREGS, num_regs);
+      regs->start = xnmalloc (n, sizeof *regs->start);
+      regs->end = xnmalloc (n, sizeof *regs->end);
+      regs->num_regs = n;
+      bufp->regs_allocated = REGS_REALLOCATE;
+    }
+  else if (bufp->regs_allocated == REGS_REALLOCATE)
+    { /* Yes.  If we need more elements than were already
+	 allocated, reallocate them.  If we need fewer, just
+	 leave it alone.  */
+      ptrdiff_t n = regs->num_regs;
+      if (n < num_regs)
+	{
+	  n = max (n + (n >> 1), num_regs);
+	  regs->start = xnrealloc (regs->start, n, sizeof *regs->start);
+	  regs->end = xnrealloc (regs->end, n, sizeof *regs->end);
+	  regs->num_regs = n;
+	}
+    }
+  else
+    eassert (bufp->regs_allocated == REGS_FIXED);
+}
+
 static void
 unwind_re_match (void *ptr)
 {
@@ -3870,7 +4232,8 @@ static ptrdiff_t
 re_match_2_internal (struct re_pattern_buffer *bufp,
 		     re_char *string1, ptrdiff_t size1,
 		     re_char *string2, ptrdiff_t size2,
-		     ptrdiff_t pos, struct re_registers *regs, ptrdiff_t stop)
+		     ptrdiff_t pos, struct re_registers *regs, ptrdiff_t stop,
+		     ptrdiff_t fail_limit)
 {
   eassume (0 <= size1);
   eassume (0 <= size2);
@@ -4142,31 +4505,7 @@ re_match_2_internal (struct re_pattern_buffer *bufp,
 	  /* If caller wants register contents data back, do it.  */
 	  if (regs)
 	    {
-	      /* Have the register data arrays been allocated?	*/
-	      if (bufp->regs_allocated == REGS_UNALLOCATED)
-		{ /* No.  So allocate them with malloc.  */
-		  ptrdiff_t n = max (RE_NREGS, num_regs);
-		  regs->start = xnmalloc (n, sizeof *regs->start);
-		  regs->end = xnmalloc (n, sizeof *regs->end);
-		  regs->num_regs = n;
-		  bufp->regs_allocated = REGS_REALLOCATE;
-		}
-	      else if (bufp->regs_allocated == REGS_REALLOCATE)
-		{ /* Yes.  If we need more elements than were already
-		     allocated, reallocate them.  If we need fewer, just
-		     leave it alone.  */
-		  ptrdiff_t n = regs->num_regs;
-		  if (n < num_regs)
-		    {
-		      n = max (n + (n >> 1), num_regs);
-		      regs->start
-			= xnrealloc (regs->start, n, sizeof *regs->start);
-		      regs->end = xnrealloc (regs->end, n, sizeof *regs->end);
-		      regs->num_regs = n;
-		    }
-		}
-	      else
-		eassert (bufp->regs_allocated == REGS_FIXED);
+	      allocate_regs (bufp, regs, num_regs);
 
 	      /* Convert the pointer data in 'regstart' and 'regend' to
 		 indices.  Register zero has to be set differently,
@@ -4240,6 +4579,11 @@ re_match_2_internal (struct re_pattern_buffer *bufp,
 		int pat_charlen, buf_charlen;
 		int pat_ch, buf_ch;
 
+		if (d == dend && dend == end_match_2)
+		  {
+		    d = dfail;
+		    goto fail;
+		  }
 		PREFETCH ();
 		if (multibyte)
 		  pat_ch = string_char_and_length (p, &pat_charlen);
@@ -4267,6 +4611,11 @@ re_match_2_internal (struct re_pattern_buffer *bufp,
 		int pat_charlen;
 		int pat_ch, buf_ch;
 
+		if (d == dend && dend == end_match_2)
+		  {
+		    d = dfail;
+		    goto fail;
+		  }
 		PREFETCH ();
 		if (multibyte)
 		  {
@@ -5013,6 +5362,15 @@ re_match_2_internal (struct re_pattern_buffer *bufp,
       if (!FAIL_STACK_EMPTY ())
 	{
 	  re_char *str, *pat;
+
+	  /* Give up if this takes too long.  */
+	  if (fail_limit && --fail_limit == 0)
+	    {
+	      unbind_to (count, Qnil);
+	      SAFE_FREE ();
+	      return -3;
+	    }
+
 	  /* A restart point is known.  Restore to that state.  */
 	  DEBUG_PRINT ("\nFAIL:\n");
 	  POP_FAILURE_POINT (str, pat);
@@ -5094,6 +5452,671 @@ bcmp_translate (re_char *s1, re_char *s2, ptrdiff_t len,
   return p1 != p1_end || p2 != p2_end;
 }
 
+/* Matching without backtracking.
+
+   The backtracking matcher can take time exponential in the length
+   of the text: matching "\\(a\\|aa\\)*b" against a long line of a's
+   tries every way to split the line into a's and aa's.  It can also
+   overflow its failure stack on long texts.
+
+   Patterns that use no back references, no intervals, and no syntax
+   or word boundary tests can instead be matched by simulating an
+   automaton built from the compiled pattern, in a single pass over
+   the text.  The simulation keeps at most one thread per instruction
+   of the automaton, so it takes time proportional to the product of
+   the sizes of the pattern and of the text.  The threads are kept in
+   the order in which the backtracking matcher would try the same
+   paths, and a path reaching an instruction already reached in the
+   same circumstances is dropped, as it cannot match in any way that
+   the earlier one cannot.  So the match found, and its registers, are
+   those that the backtracking matcher finds.  */
+
+enum nfa_opcode
+  {
+    /* Match the character X in multibyte text, or Y in unibyte text.  */
+    NFA_CHAR,
+    /* Match any character except newline.  */
+    NFA_ANY,
+    /* Match the 'charset' or 'charset_not' at offset X in the
+       compiled pattern.  */
+    NFA_SET,
+    /* Match a character of category X, or not of category X.  */
+    NFA_CATEGORY,
+    NFA_NOTCATEGORY,
+    /* The instructions above consume a character, the ones below do
+       not.  */
+    /* Continue at X.  */
+    NFA_JUMP,
+    /* Continue at X, and failing that, at Y.  */
+    NFA_SPLIT,
+    /* Like NFA_SPLIT, but continue only at Y if this is reached again
+       while matching X, without consuming any text.  This is what
+       'on_failure_jump_loop' does.  */
+    NFA_LOOP,
+    /* Record the position in register slot X.  */
+    NFA_SAVE,
+    /* Check the condition X, which is 'begline', 'endline', 'begbuf',
+       'endbuf' or 'at_dot'.  */
+    NFA_ASSERT,
+    /* The match succeeds.  */
+    NFA_MATCH
+  };
+
+struct nfa_inst
+{
+  enum nfa_opcode op;
+  int x, y;
+};
+
+struct re_nfa
+{
+  /* The number of instructions, how many of them consume a character
+     or succeed, and how many are NFA_LOOPs.  */
+  int ninsts, nthreads, nloops;
+
+  struct nfa_inst insts[FLEXIBLE_ARRAY_MEMBER];
+};
+
+/* Set BUFP->nfa to an automaton that matches the compiled pattern in
+   BUFP, if it can be built.  POSIX is true if the pattern looks for
+   the longest match.  */
+
+static void
+build_nfa (struct re_pattern_buffer *bufp, bool posix)
+{
+  re_char *p, *pstart = bufp->buffer, *pend = pstart + bufp->used;
+  bool multibyte = RE_MULTIBYTE_P (bufp);
+  int n = 0;
+
+  xfree (bufp->nfa);
+  bufp->nfa = NULL;
+  if (posix || INT_MAX - 1 < bufp->used)
+    return;
+
+  /* Check that the pattern has no operations we cannot simulate, and
+     number the instructions of the automaton.  INDEX maps the offset
+     of each operation in the pattern to its first instruction.  */
+  USE_SAFE_ALLOCA;
+  int *index;
+  SAFE_NALLOCA (index, 1, bufp->used + 1);
+  for (p = pstart; p < pend; p = next_op (p))
+    {
+      index[p - pstart] = n;
+      switch (*p)
+	{
+	case no_op:
+	  break;
+
+	case exactn:
+	  for (re_char *q = p + 2; q < p + 2 + p[1];
+	       q += multibyte ? BYTES_BY_CHAR_HEAD (*q) : 1)
+	    n++;
+	  break;
+
+	case succeed:
+	case anychar:
+	case charset:
+	case charset_not:
+	case categoryspec:
+	case notcategoryspec:
+	case start_memory:
+	case stop_memory:
+	case begline:
+	case endline:
+	case begbuf:
+	case endbuf:
+	case at_dot:
+	case jump:
+	case on_failure_jump:
+	case on_failure_keep_string_jump:
+	case on_failure_jump_smart:
+	case on_failure_jump_loop:
+	  n++;
+	  break;
+
+	default:
+	  SAFE_FREE ();
+	  return;
+	}
+    }
+  index[bufp->used] = n++;
+
+  struct re_nfa *nfa = xmalloc (FLEXSIZEOF (struct re_nfa, insts,
+					    n * sizeof *nfa->insts));
+  struct nfa_inst *inst = nfa->insts;
+  nfa->ninsts = n;
+  nfa->nthreads = nfa->nloops = 0;
+  for (p = pstart; p < pend; p = next_op (p))
+    {
+      int mcnt;
+      switch (*p)
+	{
+	case no_op:
+	  break;
+
+	case exactn:
+	  for (re_char *q = p + 2; q < p + 2 + p[1]; inst++)
+	    {
+	      int c, len;
+	      inst->op = NFA_CHAR;
+	      if (multibyte)
+		{
+		  c = string_char_and_length (q, &len);
+		  inst->x = c;
+		  inst->y = RE_CHAR_TO_UNIBYTE (c);
+		}
+	      else
+		{
+		  len = 1;
+		  inst->x = RE_CHAR_TO_MULTIBYTE (*q);
+		  inst->y = *q;
+		}
+	      q += len;
+	      nfa->nthreads++;
+	    }
+	  break;
+
+	case succeed:
+	  inst++->op = NFA_MATCH;
+	  nfa->nthreads++;
+	  break;
+
+	case anychar:
+	  inst++->op = NFA_ANY;
+	  nfa->nthreads++;
+	  break;
+
+	case charset:
+	case charset_not:
+	  inst->op = NFA_SET;
+	  inst++->x = p - pstart;
+	  nfa->nthreads++;
+	  break;
+
+	case categoryspec:
+	case notcategoryspec:
+	  inst->op = *p == categoryspec ? NFA_CATEGORY : NFA_NOTCATEGORY;
+	  inst++->x = p[1];
+	  nfa->nthreads++;
+	  break;
+
+	case start_memory:
+	case stop_memory:
+	  inst->op = NFA_SAVE;
+	  inst++->x = 2 * p[1] + (*p == stop_memory);
+	  break;
+
+	case begline:
+	case endline:
+	case begbuf:
+	case endbuf:
+	case at_dot:
+	  inst->op = NFA_ASSERT;
+	  inst++->x = *p;
+	  break;
+
+	case jump:
+	  EXTRACT_NUMBER (mcnt, p + 1);
+	  inst->op = NFA_JUMP;
+	  inst++->x = index[p + 3 + mcnt - pstart];
+	  break;
+
+	default:
+	  EXTRACT_NUMBER (mcnt, p + 1);
+	  inst->op = *p == on_failure_jump_loop ? NFA_LOOP : NFA_SPLIT;
+	  nfa->nloops += inst->op == NFA_LOOP;
+	  inst->x = index[p + 3 - pstart];
+	  inst++->y = index[p + 3 + mcnt - pstart];
+	  break;
+	}
+    }
+  inst->op = NFA_MATCH;
+  nfa->nthreads++;
+
+  SAFE_FREE ();
+  bufp->nfa = nfa;
+}
+
+/* The threads of the simulation that reached the same position in the
+   text: the instruction each of them waits at, and its registers,
+   in the order of their priority.  */
+
+struct nfa_threads
+{
+  int n;
+  int *pc;
+  ptrdiff_t *regs;
+};
+
+/* The state of the simulation of an automaton.  */
+
+struct nfa_sim
+{
+  struct re_nfa *nfa;
+
+  /* The text.  */
+  re_char *string1, *string2;
+  ptrdiff_t size1, size2;
+
+  /* The number of register slots of each thread: two per register.
+     Slot 0 holds the start of the match.  */
+  ptrdiff_t nslots;
+
+  /* The registers of the thread being followed.  */
+  ptrdiff_t *regs;
+
+  /* Paths that reach the same instruction at the same position in the
+     same context can only match in the same ways, so only the first
+     of them is followed.  The context of a path is the set of
+     NFA_LOOPs that it iterates without consuming any text: each
+     context that occurs gets a new number.  CONTEXT is the context of
+     the path being followed, BASE the number of the empty context at
+     the current position, and LAST_CONTEXT the last number given.
+     All the paths that reach an instruction that consumes a character
+     or succeeds have the same future, though.  */
+  ptrdiff_t context, base, last_context;
+
+  /* For each instruction, the last context in which a path reached
+     it, and whether it is an NFA_LOOP that the path being followed
+     iterates.  */
+  ptrdiff_t *reached;
+  bool *looping;
+
+  /* The paths still to be followed, see 'nfa_add'.  */
+  struct nfa_frame
+  {
+    /* An instruction to continue at, or the register slot to restore
+       to VAL, or the NFA_LOOP to stop iterating, going back to
+       context VAL.  */
+    enum { NFA_FOLLOW, NFA_RESTORE, NFA_UNLOOP } what;
+    int arg;
+    ptrdiff_t val;
+  } *stack;
+};
+
+/* Address of POS in the virtual concatenation of the text of SIM.  */
+#define NFA_POS_ADDR(sim, pos)						\
+  ((pos) >= (sim)->size1						\
+   ? (sim)->string2 + ((pos) - (sim)->size1) : (sim)->string1 + (pos))
+
+/* Return true if condition OP holds at POS in the text of SIM.  */
+
+static bool
+nfa_assert (struct nfa_sim *sim, re_opcode_t op, ptrdiff_t pos)
+{
+  ptrdiff_t total = sim->size1 + sim->size2;
+  switch (op)
+    {
+    case begline:
+      return pos == 0 || *NFA_POS_ADDR (sim, pos - 1) == '\n';
+    case endline:
+      return pos == total || *NFA_POS_ADDR (sim, pos) == '\n';
+    case begbuf:
+      return pos == 0;
+    case endbuf:
+      return pos == total;
+    case at_dot:
+      return PTR_BYTE_POS (NFA_POS_ADDR (sim, pos)) == PT_BYTE;
+    default:
+      emacs_abort ();
+    }
+}
+
+/* Follow, at position POS in the text of SIM, all the paths from
+   instruction PC that do not consume any text, with registers REGS,
+   and add the threads that they lead to to THREADS, in order.  */
+
+static void
+nfa_add (struct nfa_sim *sim, struct nfa_threads *threads, int pc,
+	 ptrdiff_t pos, ptrdiff_t *regs)
+{
+  struct nfa_inst *insts = sim->nfa->insts;
+  struct nfa_frame *sp = sim->stack;
+  ptrdiff_t *r = sim->regs;
+
+  memcpy (r, regs, sim->nslots * sizeof *r);
+  sim->context = sim->base;
+  *sp++ = (struct nfa_frame) { NFA_FOLLOW, pc };
+  while (sp > sim->stack)
+    {
+      struct nfa_frame *f = --sp;
+      switch (f->what)
+	{
+	case NFA_RESTORE:
+	  r[f->arg] = f->val;
+	  continue;
+	case NFA_UNLOOP:
+	  sim->looping[f->arg] = false;
+	  sim->context = f->val;
+	  continue;
+	case NFA_FOLLOW:
+	  pc = f->arg;
+	  break;
+	}
+
+      for (;;)
+	{
+	  struct nfa_inst *inst = &insts[pc];
+
+	  /* An empty iteration of a loop ends it.  */
+	  if (inst->op == NFA_LOOP && sim->looping[pc])
+	    {
+	      pc = inst->y;
+	      continue;
+	    }
+	  ptrdiff_t context = (inst->op < NFA_JUMP || inst->op == NFA_MATCH
+			       ? sim->base : sim->context);
+	  if (sim->reached[pc] == context)
+	    break;
+	  sim->reached[pc] = context;
+
+	  switch (inst->op)
+	    {
+	    case NFA_JUMP:
+	      pc = inst->x;
+	      continue;
+
+	    case NFA_SPLIT:
+	      *sp++ = (struct nfa_frame) { NFA_FOLLOW, inst->y };
+	      pc = inst->x;
+	      continue;
+
+	    case NFA_LOOP:
+	      *sp++ = (struct nfa_frame) { NFA_FOLLOW, inst->y };
+	      *sp++ = (struct nfa_frame) { NFA_UNLOOP, pc, sim->context };
+	      sim->looping[pc] = true;
+	      sim->context = ++sim->last_context;
+	      pc = inst->x;
+	      continue;
+
+	    case NFA_SAVE:
+	      *sp++ = (struct nfa_frame) { NFA_RESTORE, inst->x, r[inst->x] };
+	      r[inst->x] = pos;
+	      pc++;
+	      continue;
+
+	    case NFA_ASSERT:
+	      if (nfa_assert (sim, inst->x, pos))
+		{
+		  pc++;
+		  continue;
+		}
+	      break;
+
+	    default:
+	      threads->pc[threads->n] = pc;
+	      memcpy (threads->regs + threads->n * sim->nslots, r,
+		      sim->nslots * sizeof *r);
+	      threads->n++;
+	      break;
+	    }
+	  break;
+	}
+    }
+}
+
+/* Return true if a match of BUFP can start at D, according to its
+   fastmap.  */
+
+static bool
+fastmap_start_p (struct re_pattern_buffer *bufp, re_char *d)
+{
+  Lisp_Object translate = bufp->translate;
+  int c;
+
+  if (RE_TARGET_MULTIBYTE_P (bufp))
+    c = CHAR_LEADING_CODE (TRANSLATE (STRING_CHAR (d)));
+  else
+    {
+      int ch = RE_CHAR_TO_MULTIBYTE (*d);
+      int translated = TRANSLATE (ch);
+      c = *d;
+      if (translated != ch && (ch = RE_CHAR_TO_UNIBYTE (translated)) >= 0)
+	c = ch;
+    }
+  return bufp->fastmap[c];
+}
+
+/* Match BUFP->nfa against the virtual concatenation of STRING1 and
+   STRING2, starting at POS, or failing that at the next character
+   positions up to LAST, without consuming any text past STOP.  If
+   there is a match, set *STARTP to its start and REGS as
+   're_match_2_internal' does, and return its length; otherwise,
+   return -1.  */
+
+static ptrdiff_t
+nfa_match (struct re_pattern_buffer *bufp,
+	   re_char *string1, ptrdiff_t size1,
+	   re_char *string2, ptrdiff_t size2,
+	   ptrdiff_t pos, ptrdiff_t last,
+	   struct re_registers *regs, ptrdiff_t stop, ptrdiff_t *startp)
+{
+  struct re_nfa *nfa = bufp->nfa;
+  struct nfa_inst *insts = nfa->insts;
+  Lisp_Object translate = bufp->translate;
+  bool target_multibyte = RE_TARGET_MULTIBYTE_P (bufp);
+  ptrdiff_t total = size1 + size2;
+  ptrdiff_t num_regs = bufp->re_nsub + 1;
+  bool use_fastmap = (bufp->fastmap && bufp->fastmap_accurate
+		      && !bufp->can_be_null);
+  struct nfa_sim sim = { nfa, string1, string2, size1, size2, 2 * num_regs };
+  struct nfa_threads list[2];
+  struct nfa_threads *cur = &list[0], *next = &list[1];
+  ptrdiff_t *match = NULL, match_end = -1;
+  USE_SAFE_ALLOCA;
+
+  SAFE_NALLOCA (sim.regs, 1, sim.nslots * (2 * nfa->nthreads + 3));
+  ptrdiff_t *start_regs = sim.regs + sim.nslots;
+  match = start_regs + sim.nslots;
+  for (int i = 0; i < 2; i++)
+    {
+      list[i].n = 0;
+      list[i].regs = match + sim.nslots * (1 + i * nfa->nthreads);
+      SAFE_NALLOCA (list[i].pc, 1, nfa->nthreads);
+    }
+  SAFE_NALLOCA (sim.reached, 1, nfa->ninsts);
+  SAFE_NALLOCA (sim.looping, 1, nfa->ninsts);
+  /* A path can have pending alternatives in each of the contexts
+     from its position on, and at most two per instruction in each.  */
+  SAFE_NALLOCA (sim.stack, 2 * (nfa->nloops + 1), nfa->ninsts + 1);
+  for (int i = 0; i < nfa->ninsts; i++)
+    {
+      sim.reached[i] = 0;
+      sim.looping[i] = false;
+    }
+  sim.base = sim.last_context = 1;
+  for (ptrdiff_t i = 0; i < sim.nslots; i++)
+    start_regs[i] = -1;
+
+  ptrdiff_t count = SPECPDL_INDEX ();
+  if (!current_buffer->text->inhibit_shrinking)
+    {
+      record_unwind_protect_ptr (unwind_re_match, current_buffer);
+      current_buffer->text->inhibit_shrinking = 1;
+    }
+
+  for (int steps = 0; ; steps++)
+    {
+      if ((steps & 0xfff) == 0)
+	maybe_quit ();
+
+      /* Start a new thread here, after all others, unless a match
+	 has already been found.  */
+      if (match_end < 0 && pos <= last
+	  && (!use_fastmap
+	      || (pos < total
+		  && fastmap_start_p (bufp, NFA_POS_ADDR (&sim, pos)))))
+	{
+	  start_regs[0] = pos;
+	  nfa_add (&sim, cur, 0, pos, start_regs);
+	}
+
+      if (pos == total || (cur->n == 0 && (match_end >= 0 || pos >= last)))
+	{
+	  /* Only threads waiting at the end of the pattern remain.  */
+	  for (int i = 0; i < cur->n; i++)
+	    if (insts[cur->pc[i]].op == NFA_MATCH)
+	      {
+		memcpy (match, cur->regs + i * sim.nslots,
+			sim.nslots * sizeof *match);
+		match_end = pos;
+		break;
+	      }
+	  break;
+	}
+
+      /* Advance every thread past the character at POS.  */
+      re_char *d = NFA_POS_ADDR (&sim, pos);
+      int len;
+      int corig = RE_STRING_CHAR_AND_LENGTH (d, len, target_multibyte);
+      ptrdiff_t npos = pos + len;
+
+      next->n = 0;
+      sim.base = ++sim.last_context;
+      for (int i = 0; i < cur->n; i++)
+	{
+	  struct nfa_inst *inst = &insts[cur->pc[i]];
+	  ptrdiff_t *tregs = cur->regs + i * sim.nslots;
+	  bool ok;
+
+	  if (inst->op == NFA_MATCH)
+	    {
+	      /* The threads after this one have lower priority.  */
+	      memcpy (match, tregs, sim.nslots * sizeof *match);
+	      match_end = pos;
+	      break;
+	    }
+	  if (stop <= pos)
+	    continue;
+
+	  switch (inst->op)
+	    {
+	    case NFA_CHAR:
+	      if (target_multibyte)
+		ok = TRANSLATE (corig) == inst->x;
+	      else
+		{
+		  int c = RE_CHAR_TO_MULTIBYTE (corig);
+		  if (!CHAR_BYTE8_P (c))
+		    {
+		      c = RE_CHAR_TO_UNIBYTE (TRANSLATE (c));
+		      if (c < 0)
+			c = corig;
+		    }
+		  else
+		    c = corig;
+		  ok = c == inst->y;
+		}
+	      break;
+
+	    case NFA_ANY:
+	      ok = TRANSLATE (corig) != '\n';
+	      break;
+
+	    case NFA_SET:
+	      {
+		/* Do what the 'charset' case of re_match_2_internal
+		   does.  */
+		bool unibyte_char = false;
+		int c = corig, c1;
+		re_char *p = bufp->buffer + inst->x;
+		if (target_multibyte)
+		  {
+		    c = TRANSLATE (c);
+		    c1 = RE_CHAR_TO_UNIBYTE (c);
+		    if (c1 >= 0)
+		      {
+			unibyte_char = true;
+			c = c1;
+		      }
+		  }
+		else
+		  {
+		    c1 = RE_CHAR_TO_MULTIBYTE (c);
+		    if (! CHAR_BYTE8_P (c1))
+		      {
+			c1 = RE_CHAR_TO_UNIBYTE (TRANSLATE (c1));
+			if (c1 >= 0)
+			  {
+			    unibyte_char = true;
+			    c = c1;
+			  }
+		      }
+		    else
+		      unibyte_char = true;
+		  }
+		ok = execute_charset (&p, c, corig, unibyte_char);
+	      }
+	      break;
+
+	    case NFA_CATEGORY:
+	    case NFA_NOTCATEGORY:
+	      {
+		int c = target_multibyte ? corig : RE_CHAR_TO_MULTIBYTE (corig);
+		ok = (!CHAR_HAS_CATEGORY (c, inst->x)
+		      == (inst->op == NFA_NOTCATEGORY));
+	      }
+	      break;
+
+	    default:
+	      emacs_abort ();
+	    }
+
+	  if (ok)
+	    nfa_add (&sim, next, cur->pc[i] + 1, npos, tregs);
+	}
+
+      struct nfa_threads *tem = cur;
+      cur = next;
+      next = tem;
+      pos = npos;
+
+      /* Skip quickly to the next place where a match can start.  */
+      if (cur->n == 0 && match_end < 0 && use_fastmap)
+	while (pos < last && pos < total
+	       && !fastmap_start_p (bufp, NFA_POS_ADDR (&sim, pos)))
+	  {
+	    pos += (target_multibyte
+		    ? BYTES_BY_CHAR_HEAD (*NFA_POS_ADDR (&sim, pos)) : 1);
+	    sim.base = ++sim.last_context;
+	  }
+    }
+
+  unbind_to (count, Qnil);
+
+  if (match_end < 0)
+    {
+      SAFE_FREE ();
+      return -1;
+    }
+
+  if (regs)
+    {
+      allocate_regs (bufp, regs, num_regs);
+      if (regs->num_regs > 0)
+	{
+	  regs->start[0] = match[0];
+	  regs->end[0] = match_end;
+	}
+      for (ptrdiff_t reg = 1; reg < num_regs; reg++)
+	{
+	  if (match[2 * reg + 1] < 0)
+	    regs->start[reg] = regs->end[reg] = -1;
+	  else
+	    {
+	      regs->start[reg] = match[2 * reg];
+	      regs->end[reg] = match[2 * reg + 1];
+	    }
+	}
+      for (ptrdiff_t reg = num_regs; reg < regs->num_regs; reg++)
+	regs->start[reg] = regs->end[reg] = -1;
+    }
+
+  *startp = match[0];
+  SAFE_FREE ();
+  return match_end - *startp;
+}
+
 /* Entry points for GNU code.  */
 
 /* re_compile_pattern is the GNU regular expression compiler: it
@@ -5119,6 +6142,10 @@ re_compile_pattern (const char *pattern, ptrdiff_t length,
 		       bufp);
 
   if (!ret)
-    return NULL;
+    {
+      analyze_literal (bufp);
+      build_nfa (bufp, posix_backtracking);
+      return NULL;
+    }
   return re_error_msgid[ret];
 }
@@ -91,6 +91,14 @@ struct re_pattern_buffer
 	/* Number of subexpressions found by the compiler.  */
   ptrdiff_t re_nsub;
 
+	/* If positive, the length of a string of bytes that every match
+	   contains, and the offset of that string in 'buffer'.  */
+  ptrdiff_t must_len, must_offset;
+
+	/* The automaton that can match this pattern without
+	   backtracking, or zero if there is none.  */
+  struct re_nfa *nfa;
+
         /* True if and only if this pattern can match the empty string.
            Well, in truth it's used only in 're_search_2', to see
            whether or not we should use the fastmap, so we don't set
@@ -118,6 +126,16 @@ struct re_pattern_buffer
   /* If true, multi-byte form in the target of match should be
      recognized as a multibyte character.  */
   bool_bf target_multibyte : 1;
+
+  /* If true, every match starts with the string at 'must_offset'.  */
+  bool_bf must_prefix : 1;
+
+  /* If true, the part of a match before that string cannot contain
+     a newline.  */
+  bool_bf must_nl_free : 1;
+
+  /* If true, that string contains only ASCII characters.  */
+  bool_bf must_ascii : 1;
 };
 
 /* Declarations for routines.  */
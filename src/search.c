@@ -21,6 +21,8 @@ along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
 
 #include <config.h>
 
+#include <stdint.h>
+
 #include "lisp.h"
 #include "character.h"
 #include "buffer.h"
@@ -33,13 +35,19 @@ along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
 
 #include "regex-emacs.h"
 
-#define REGEXP_CACHE_SIZE 20
+/* Default and minimum values of `regexp-cache-size'.  */
+#define REGEXP_CACHE_SIZE 64
+#define REGEXP_CACHE_MIN 8
 
 /* If the regexp is non-nil, then the buffer contains the compiled form
    of that regexp, suitable for searching.  */
 struct regexp_cache
 {
-  struct regexp_cache *next;
+  /* The neighbors of this entry in the list ordered by recency of use,
+     and the next entry in the same bucket of searchbuf_hash.  */
+  struct regexp_cache *next, *prev, *hash_next;
+  /* Hash code of the regexp and its compilation parameters.  */
+  EMACS_UINT hash;
   Lisp_Object regexp, f_whitespace_regexp;
   /* Syntax table for which the regexp applies.  We need this because
      of character classes.  If this is t, then the compiled pattern is valid
@@ -53,11 +61,18 @@ struct regexp_cache
   bool busy;
 };
 
-/* The instances of that struct.  */
-static struct regexp_cache searchbufs[REGEXP_CACHE_SIZE];
+/* The instances of that struct, and their number.  */
+static struct regexp_cache *searchbufs;
+static int searchbufs_size;
+
+/* The head of the doubly-linked list of instances; points to the most
+   recently used buffer.  The tail is the least recently used one.  */
+static struct regexp_cache *searchbuf_head, *searchbuf_tail;
 
-/* The head of the linked list; points to the most recently used buffer.  */
-static struct regexp_cache *searchbuf_head;
+/* Hash table of the instances that hold a compiled regexp, chained
+   through their hash_next fields.  Its size is a power of 2.  */
+static struct regexp_cache **searchbuf_hash;
+static int searchbuf_hash_size;
 
 static void set_search_regs (ptrdiff_t, ptrdiff_t);
 static void save_search_regs (void);
@@ -150,6 +165,135 @@ shrink_regexp_cache (void)
       }
 }
 
+/* Mark the Lisp objects in the regexp cache.
+   This is called from garbage collection.  */
+
+void
+mark_regexp_cache (void)
+{
+  for (int i = 0; i < searchbufs_size; i++)
+    {
+      mark_object (searchbufs[i].regexp);
+      mark_object (searchbufs[i].f_whitespace_regexp);
+      mark_object (searchbufs[i].syntax_table);
+    }
+}
+
+/* Move CP to the front of the list of cache entries if FRONT,
+   otherwise to its back.  */
+
+static void
+move_searchbuf (struct regexp_cache *cp, bool front)
+{
+  if (cp->prev)
+    cp->prev->next = cp->next;
+  else
+    searchbuf_head = cp->next;
+  if (cp->next)
+    cp->next->prev = cp->prev;
+  else
+    searchbuf_tail = cp->prev;
+
+  if (front)
+    {
+      cp->prev = NULL;
+      cp->next = searchbuf_head;
+      if (searchbuf_head)
+	searchbuf_head->prev = cp;
+      else
+	searchbuf_tail = cp;
+      searchbuf_head = cp;
+    }
+  else
+    {
+      cp->next = NULL;
+      cp->prev = searchbuf_tail;
+      if (searchbuf_tail)
+	searchbuf_tail->next = cp;
+      else
+	searchbuf_head = cp;
+      searchbuf_tail = cp;
+    }
+}
+
+/* Forget the regexp compiled in CP, if any.  */
+
+static void
+uncache_regexp (struct regexp_cache *cp)
+{
+  if (!NILP (cp->regexp))
+    {
+      struct regexp_cache **p
+	= &searchbuf_hash[cp->hash & (searchbuf_hash_size - 1)];
+      while (*p != cp)
+	p = &(*p)->hash_next;
+      *p = cp->hash_next;
+      cp->regexp = Qnil;
+    }
+}
+
+/* Return the hash code of PATTERN compiled with TRANSLATE and POSIX.
+   The syntax table is not part of it, as a compiled pattern can be
+   valid for any syntax table.  */
+
+static EMACS_UINT
+regexp_cache_hash (Lisp_Object pattern, Lisp_Object translate, bool posix)
+{
+  EMACS_UINT hash = hash_string (SSDATA (pattern), SBYTES (pattern));
+  hash = sxhash_combine (hash, XHASH (translate));
+  return sxhash_combine (hash, posix << 1 | STRING_MULTIBYTE (pattern));
+}
+
+/* Allocate a regexp cache of SIZE entries, all empty.  */
+
+static void
+init_regexp_cache (int size)
+{
+  searchbufs = xzalloc (size * sizeof *searchbufs);
+  searchbufs_size = size;
+  for (searchbuf_hash_size = 1; searchbuf_hash_size < 2 * size; )
+    searchbuf_hash_size *= 2;
+  searchbuf_hash = xzalloc (searchbuf_hash_size * sizeof *searchbuf_hash);
+
+  for (int i = 0; i < size; ++i)
+    {
+      searchbufs[i].buf.allocated = 100;
+      searchbufs[i].buf.buffer = xmalloc (100);
+      searchbufs[i].buf.fastmap = searchbufs[i].fastmap;
+      searchbufs[i].regexp = Qnil;
+      searchbufs[i].f_whitespace_regexp = Qnil;
+      searchbufs[i].busy = false;
+      searchbufs[i].syntax_table = Qnil;
+      searchbufs[i].prev = i == 0 ? 0 : &searchbufs[i - 1];
+      searchbufs[i].next = i == size - 1 ? 0 : &searchbufs[i + 1];
+    }
+  searchbuf_head = &searchbufs[0];
+  searchbuf_tail = &searchbufs[size - 1];
+}
+
+/* Reallocate the regexp cache if `regexp-cache-size' has changed,
+   unless some of its entries are in use.  */
+
+static void
+resize_regexp_cache (void)
+{
+  int size = clip_to_bounds (REGEXP_CACHE_MIN, regexp_cache_size, 0x10000);
+  if (size == searchbufs_size)
+    return;
+  for (int i = 0; i < searchbufs_size; i++)
+    if (searchbufs[i].busy)
+      return;
+
+  for (int i = 0; i < searchbufs_size; i++)
+    {
+      xfree (searchbufs[i].buf.buffer);
+      xfree (searchbufs[i].buf.nfa);
+    }
+  xfree (searchbufs);
+  xfree (searchbuf_hash);
+  init_regexp_cache (size);
+}
+
 /* Clear the regexp cache w.r.t. a particular syntax table,
    because it was changed.
    There is no danger of memory leak here because re_compile_pattern
@@ -160,12 +304,17 @@ clear_regexp_cache (void)
 {
   int i;
 
-  for (i = 0; i < REGEXP_CACHE_SIZE; ++i)
+  for (i = 0; i < searchbufs_size; ++i)
     /* It's tempting to compare with the syntax-table we've actually changed,
        but it's not sufficient because char-table inheritance means that
        modifying one syntax-table can change others at the same time.  */
-    if (!searchbufs[i].busy && !EQ (searchbufs[i].syntax_table, Qt))
-      searchbufs[i].regexp = Qnil;
+    if (!searchbufs[i].busy && !EQ (searchbufs[i].syntax_table, Qt)
+	&& !NILP (searchbufs[i].regexp))
+      {
+	uncache_regexp (&searchbufs[i]);
+	/* Reuse the now empty entry first.  */
+	move_searchbuf (&searchbufs[i], false);
+      }
 }
 
 static void
@@ -198,53 +347,51 @@ static struct regexp_cache *
 compile_pattern (Lisp_Object pattern, struct re_registers *regp,
 		 Lisp_Object translate, bool posix, bool multibyte)
 {
-  struct regexp_cache *cp, **cpp, **lru_nonbusy;
-
-  for (cpp = &searchbuf_head, lru_nonbusy = NULL; ; cpp = &cp->next)
+  struct regexp_cache *cp;
+  EMACS_UINT hash;
+
+  resize_regexp_cache ();
+
+  hash = regexp_cache_hash (pattern, translate, posix);
+  for (cp = searchbuf_hash[hash & (searchbuf_hash_size - 1)];
+       cp; cp = cp->hash_next)
+    if (cp->hash == hash
+	&& SCHARS (cp->regexp) == SCHARS (pattern)
+	&& !cp->busy
+	&& STRING_MULTIBYTE (cp->regexp) == STRING_MULTIBYTE (pattern)
+	&& !NILP (Fstring_equal (cp->regexp, pattern))
+	&& EQ (cp->buf.translate, translate)
+	&& cp->posix == posix
+	&& (EQ (cp->syntax_table, Qt)
+	    || EQ (cp->syntax_table, BVAR (current_buffer, syntax_table)))
+	&& !NILP (Fequal (cp->f_whitespace_regexp, Vsearch_spaces_regexp))
+	&& cp->buf.charset_unibyte == charset_unibyte)
+      break;
+
+  if (cp)
+    regexp_cache_hits++;
+  else
     {
-      cp = *cpp;
-      if (!cp->busy)
-        lru_nonbusy = cpp;
-      /* Entries are initialized to nil, and may be set to nil by
-	 compile_pattern_1 if the pattern isn't valid.  Don't apply
-	 string accessors in those cases.  However, compile_pattern_1
-	 is only applied to the cache entry we pick here to reuse.  So
-	 nil should never appear before a non-nil entry.  */
-      if (NILP (cp->regexp))
-	goto compile_it;
-      if (SCHARS (cp->regexp) == SCHARS (pattern)
-          && !cp->busy
-	  && STRING_MULTIBYTE (cp->regexp) == STRING_MULTIBYTE (pattern)
-	  && !NILP (Fstring_equal (cp->regexp, pattern))
-	  && EQ (cp->buf.translate, translate)
-	  && cp->posix == posix
-	  && (EQ (cp->syntax_table, Qt)
-	      || EQ (cp->syntax_table, BVAR (current_buffer, syntax_table)))
-	  && !NILP (Fequal (cp->f_whitespace_regexp, Vsearch_spaces_regexp))
-	  && cp->buf.charset_unibyte == charset_unibyte)
-	break;
-
-      /* If we're at the end of the cache, compile into the last
-	 (least recently used) non-busy cell in the cache.  */
-      if (cp->next == 0)
-	{
-          if (!lru_nonbusy)
-            error ("Too much matching reentrancy");
-          cpp = lru_nonbusy;
-          cp = *cpp;
-	compile_it:
-          eassert (!cp->busy);
-	  compile_pattern_1 (cp, pattern, translate, posix);
-	  break;
-	}
+      /* Compile into the least recently used non-busy cell in the
+	 cache.  */
+      for (cp = searchbuf_tail; cp && cp->busy; cp = cp->prev)
+	continue;
+      if (!cp)
+	error ("Too much matching reentrancy");
+      regexp_cache_misses++;
+      uncache_regexp (cp);
+      compile_pattern_1 (cp, pattern, translate, posix);
+      cp->hash = hash;
+      struct regexp_cache **bucket
+	= &searchbuf_hash[hash & (searchbuf_hash_size - 1)];
+      cp->hash_next = *bucket;
+      *bucket = cp;
     }
 
-  /* When we get here, cp (aka *cpp) contains the compiled pattern,
+  /* When we get here, cp contains the compiled pattern,
      either because we found it in the cache or because we just compiled it.
      Move it to the front of the queue to mark it as most recently used.  */
-  *cpp = cp->next;
-  cp->next = searchbuf_head;
-  searchbuf_head = cp;
+  move_searchbuf (cp, true);
 
   /* Advise the searching functions about the space we have allocated
      for register data.  */
@@ -257,7 +404,7 @@ compile_pattern (Lisp_Object pattern, struct re_registers *regp,
   return cp;
 }
 
-
+
 static Lisp_Object
 looking_at_1 (Lisp_Object string, bool posix)
 {
@@ -623,6 +770,123 @@ newline_cache_on_off (struct buffer *buf)
 }
 
 
+/* Counting newlines in bulk.  */
+
+#if defined __x86_64__ && (5 <= __GNUC__ || defined __clang__)
+# define COUNT_NEWLINES_X86 true
+# include <immintrin.h>
+#endif
+
+/* Return the number of newlines in the N bytes at P, examining one
+   word at a time.  */
+
+static ptrdiff_t
+count_newlines_word (unsigned char const *p, ptrdiff_t n)
+{
+  uint_fast64_t const ones = 0x0101010101010101;
+  uint_fast64_t const low7 = 0x7f7f7f7f7f7f7f7f;
+  ptrdiff_t count = 0;
+
+  while (8 <= n)
+    {
+      /* Each byte of ACC counts the newlines in the corresponding
+	 byte of up to 255 words.  */
+      int words = min (n / 8, 255);
+      uint_fast64_t acc = 0;
+      n -= words * 8;
+      for (; 0 < words; words--, p += 8)
+	{
+	  uint64_t w;
+	  memcpy (&w, p, 8);
+	  /* Newlines turn into zero bytes, and only the zero bytes of
+	     X lack their top bit in Y.  */
+	  uint_fast64_t x = w ^ ('\n' * ones);
+	  uint_fast64_t y = ((x & low7) + low7) | x;
+	  acc += (~y >> 7) & ones;
+	}
+      acc = (acc & 0x00ff00ff00ff00ff) + ((acc >> 8) & 0x00ff00ff00ff00ff);
+      count += (acc * 0x0001000100010001) >> 48;
+    }
+
+  for (; 0 < n; n--)
+    count += *p++ == '\n';
+  return count;
+}
+
+#ifdef COUNT_NEWLINES_X86
+
+/* Like count_newlines_word, but examine 16 bytes at a time.  SSE2 is
+   always available on x86-64.  */
+
+static ptrdiff_t
+count_newlines_sse2 (unsigned char const *p, ptrdiff_t n)
+{
+  __m128i const nl = _mm_set1_epi8 ('\n'), zero = _mm_setzero_si128 ();
+  ptrdiff_t count = 0;
+
+  while (16 <= n)
+    {
+      /* Comparisons yield -1 for each newline, so subtracting them
+	 counts newlines in each byte of ACC; sum those up before any
+	 of them can overflow.  */
+      int vectors = min (n / 16, 255);
+      __m128i acc = zero;
+      n -= vectors * 16;
+      for (; 0 < vectors; vectors--, p += 16)
+	acc = _mm_sub_epi8 (acc,
+			    _mm_cmpeq_epi8 (_mm_loadu_si128 ((__m128i const *) p),
+					    nl));
+      __m128i sum = _mm_sad_epu8 (acc, zero);
+      count += _mm_cvtsi128_si64 (sum) + _mm_extract_epi16 (sum, 4);
+    }
+
+  return count + count_newlines_word (p, n);
+}
+
+/* Like count_newlines_sse2, but examine 32 bytes at a time.  Call
+   this only if the CPU supports AVX2.  */
+
+static ptrdiff_t __attribute__ ((target ("avx2")))
+count_newlines_avx2 (unsigned char const *p, ptrdiff_t n)
+{
+  __m256i const nl = _mm256_set1_epi8 ('\n'), zero = _mm256_setzero_si256 ();
+  ptrdiff_t count = 0;
+
+  while (32 <= n)
+    {
+      int vectors = min (n / 32, 255);
+      __m256i acc = zero;
+      n -= vectors * 32;
+      for (; 0 < vectors; vectors--, p += 32)
+	acc = _mm256_sub_epi8 (acc,
+			       _mm256_cmpeq_epi8
+			       (_mm256_loadu_si256 ((__m256i const *) p), nl));
+      __m256i sum = _mm256_sad_epu8 (acc, zero);
+      count += (_mm256_extract_epi64 (sum, 0) + _mm256_extract_epi64 (sum, 1)
+		+ _mm256_extract_epi64 (sum, 2) + _mm256_extract_epi64 (sum, 3));
+    }
+
+  return count + count_newlines_sse2 (p, n);
+}
+
+#endif	/* COUNT_NEWLINES_X86 */
+
+/* Return the number of newlines in the N contiguous bytes at P, using
+   the fastest method that this CPU supports.  The choice is made at
+   run time, as the dumped Emacs may run on another machine.  */
+
+ptrdiff_t
+count_newlines (unsigned char const *p, ptrdiff_t n)
+{
+#ifdef COUNT_NEWLINES_X86
+  if (__builtin_cpu_supports ("avx2"))
+    return count_newlines_avx2 (p, n);
+  return count_newlines_sse2 (p, n);
+#else
+  return count_newlines_word (p, n);
+#endif
+}
+
 /* Search for COUNT newlines between START/START_BYTE and END/END_BYTE.
 
    If COUNT is positive, search forwards; END must be >= START.
@@ -775,6 +1039,20 @@ find_newline (ptrdiff_t start, ptrdiff_t start_byte, ptrdiff_t end,
 
 	  for (cursor = base; cursor < 0; cursor = next)
 	    {
+	      /* When looking for many newlines, skip whole blocks
+		 that have fewer of them than are still wanted.  */
+	      while (1 < count && NEWLINE_BLOCK_SIZE <= - cursor)
+		{
+		  ptrdiff_t n = count_newlines (lim_addr + cursor,
+						NEWLINE_BLOCK_SIZE);
+		  if (count <= n)
+		    break;
+		  count -= n;
+		  cursor += NEWLINE_BLOCK_SIZE;
+		  if (allow_quit)
+		    maybe_quit ();
+		}
+
               /* The dumb loop.  */
 	      unsigned char *nl = memchr (lim_addr + cursor, '\n', - cursor);
 	      next = nl ? nl - lim_addr : 0;
@@ -884,6 +1162,19 @@ find_newline (ptrdiff_t start, ptrdiff_t start_byte, ptrdiff_t end,
 
 	  for (cursor = base; 0 < cursor; cursor = prev)
             {
+	      while (count < -1 && NEWLINE_BLOCK_SIZE <= cursor)
+		{
+		  ptrdiff_t n = count_newlines (ceiling_addr + cursor
+						- NEWLINE_BLOCK_SIZE,
+						NEWLINE_BLOCK_SIZE);
+		  if (- count <= n)
+		    break;
+		  count += n;
+		  cursor -= NEWLINE_BLOCK_SIZE;
+		  if (allow_quit)
+		    maybe_quit ();
+		}
+
 	      unsigned char *nl = memrchr (ceiling_addr, '\n', cursor);
 	      prev = nl ? nl - ceiling_addr : -1;
 
@@ -3319,13 +3610,6 @@ static void syms_of_search_for_pdumper (void);
 void
 syms_of_search (void)
 {
-  for (int i = 0; i < REGEXP_CACHE_SIZE; ++i)
-    {
-      staticpro (&searchbufs[i].regexp);
-      staticpro (&searchbufs[i].f_whitespace_regexp);
-      staticpro (&searchbufs[i].syntax_table);
-    }
-
   /* Error condition used for failing searches.  */
   DEFSYM (Qsearch_failed, "search-failed");
 
@@ -3373,6 +3657,42 @@ do not set the match data.  The proper way to use this variable
 is to bind it with `let' around a small expression.  */);
   Vinhibit_changing_match_data = Qnil;
 
+  DEFVAR_INT ("regexp-cache-size", regexp_cache_size,
+	      doc: /* Number of compiled regexps that searching functions cache.
+Searching and matching functions compile each regexp they use, and keep
+the most recently used compiled regexps for reuse.  A larger value can
+avoid recompiling regexps when many different ones are used in turn,
+as by font-lock keywords, at the cost of more memory.  Values below 8
+mean 8.  See also `regexp-cache-hits' and `regexp-cache-misses'.  */);
+  regexp_cache_size = REGEXP_CACHE_SIZE;
+
+  DEFVAR_INT ("regexp-cache-hits", regexp_cache_hits,
+	      doc: /* Number of times a compiled regexp was found in the cache.
+See `regexp-cache-size'.  */);
+  regexp_cache_hits = 0;
+
+  DEFVAR_INT ("regexp-cache-misses", regexp_cache_misses,
+	      doc: /* Number of times a regexp was compiled for the cache.
+This includes the regexps that turned out to be invalid.  See
+`regexp-cache-size'.  */);
+  regexp_cache_misses = 0;
+
+  DEFSYM (Qfallback, "fallback");
+  DEFVAR_LISP ("regexp-automaton-matching", Vregexp_automaton_matching,
+	       doc: /* Whether to match regexps without backtracking.
+Regexps that use no back references, no repetition intervals such as
+\{2,3\}, and no syntax or word boundary constructs can be matched by
+simulating an automaton, in time proportional to the sizes of the
+regexp and of the text, whereas backtracking can take exponential time
+or overflow its stack.  The automaton finds the same matches, but is
+slower for most regexps.
+
+If t, match such regexps with the automaton.  If nil, never use it.
+Any other value means to use it only when backtracking takes too long
+or overflows its stack.  Posix matching functions such as
+`posix-string-match' always backtrack.  */);
+  Vregexp_automaton_matching = Qfallback;
+
   defsubr (&Slooking_at);
   defsubr (&Sposix_looking_at);
   defsubr (&Sstring_match);
@@ -3397,16 +3717,5 @@ is to bind it with `let' around a small expression.  */);
 static void
 syms_of_search_for_pdumper (void)
 {
-  for (int i = 0; i < REGEXP_CACHE_SIZE; ++i)
-    {
-      searchbufs[i].buf.allocated = 100;
-      searchbufs[i].buf.buffer = xmalloc (100);
-      searchbufs[i].buf.fastmap = searchbufs[i].fastmap;
-      searchbufs[i].regexp = Qnil;
-      searchbufs[i].f_whitespace_regexp = Qnil;
-      searchbufs[i].busy = false;
-      searchbufs[i].syntax_table = Qnil;
-      searchbufs[i].next = (i == REGEXP_CACHE_SIZE-1 ? 0 : &searchbufs[i+1]);
-    }
-  searchbuf_head = &searchbufs[0];
+  init_regexp_cache (REGEXP_CACHE_SIZE);
 }
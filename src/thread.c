@@ -1079,6 +1079,15 @@ main_thread_p (const void *ptr)
   return ptr == &main_thread.s;
 }
 
+/* Return true if the main thread is the only thread.  */
+
+bool
+only_main_thread_p (void)
+{
+  /* New threads are pushed in front of the main thread.  */
+  return all_threads == &main_thread.s;
+}
+
 bool
 in_current_thread (void)
 {
@@ -293,6 +293,7 @@ extern void maybe_reacquire_global_lock (void);
 extern void init_threads (void);
 extern void syms_of_threads (void);
 extern bool main_thread_p (const void *);
+extern bool only_main_thread_p (void);
 extern bool in_current_thread (void);
 
 typedef int select_func (int, fd_set *, fd_set *, fd_set *,
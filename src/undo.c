@@ -126,11 +126,15 @@ record_insert (ptrdiff_t beg, ptrdiff_t length)
 static void
 record_marker_adjustments (ptrdiff_t from, ptrdiff_t to)
 {
+  struct itree_node *node;
+
   prepare_record ();
 
-  for (struct Lisp_Marker *m = BUF_MARKERS (current_buffer); m; m = m->next)
+  ITREE_FOREACH (node, BUF_MARKER_TREE (current_buffer), from, to + 1,
+		 ASCENDING)
     {
-      ptrdiff_t charpos = m->charpos;
+      struct Lisp_Marker *m = XMARKER (node->data);
+      ptrdiff_t charpos = node->begin;
       eassert (charpos <= Z);
 
       if (from <= charpos && charpos <= to)
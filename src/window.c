@@ -3989,6 +3989,8 @@ set_window_buffer (Lisp_Object window, Lisp_Object buffer,
   w->window_end_pos = 0;
   w->window_end_vpos = 0;
   w->last_cursor_vpos = 0;
+  xfree (w->line_layout_cache);
+  w->line_layout_cache = NULL;
 
   if (!(keep_margins_p && samebuf))
     { /* If we're not actually changing the buffer, don't reset hscroll
@@ -4121,6 +4123,9 @@ If OBJECT is a buffer or buffer name, force redisplay of all windows
 displaying that buffer.  */)
   (Lisp_Object object)
 {
+  invalidate_line_layout_caches ();
+  clear_face_merge_caches ();
+
   if (NILP (object))
     {
       windows_or_buffers_changed = 29;
@@ -4232,6 +4237,8 @@ make_parent_window (Lisp_Object window, bool horflag)
   memcpy ((char *) p + sizeof (union vectorlike_header),
 	  (char *) o + sizeof (union vectorlike_header),
 	  word_size * VECSIZE (struct window));
+  /* The line layout cache still belongs to O.  */
+  p->line_layout_cache = NULL;
   /* P's buffer slot may change from nil to a buffer...  */
   adjust_window_count (p, 1);
   XSETWINDOW (parent, p);
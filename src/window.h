@@ -219,6 +219,10 @@ struct window
     struct glyph_matrix *current_matrix;
     struct glyph_matrix *desired_matrix;
 
+    /* Layout of buffer lines move_it_to has recently stepped over;
+       see xdisp.c.  Freed together with the glyph matrices.  */
+    struct line_layout_cache *line_layout_cache;
+
     /* The two Lisp_Object fields below are marked in a special way,
        which is why they're placed after `current_matrix'.  */
     /* A list of <buffer, window-start, window-point> triples listing
@@ -459,6 +459,7 @@ along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.  */
 #include "intervals.h"
 #include "coding.h"
 #include "region-cache.h"
+#include "line-index.h"
 #include "font.h"
 #include "fontset.h"
 #include "blockinput.h"
@@ -877,6 +878,7 @@ This function may be passed to `add-variable-watcher'.  */)
 {
   bset_update_mode_line (current_buffer);
   current_buffer->prevent_redisplay_optimizations_p = true;
+  invalidate_line_layout_caches ();
   return Qnil;
 }
 
@@ -1138,7 +1140,6 @@ static enum move_it_result
 static void get_visually_first_element (struct it *);
 static void compute_stop_pos (struct it *);
 static int face_before_or_after_it_pos (struct it *, bool);
-static ptrdiff_t next_overlay_change (ptrdiff_t);
 static int handle_display_spec (struct it *, Lisp_Object, Lisp_Object,
 				Lisp_Object, struct text_pos *, ptrdiff_t, bool);
 static int handle_single_display_spec (struct it *, Lisp_Object, Lisp_Object,
@@ -4057,38 +4058,6 @@ compute_stop_pos (struct it *it)
 }
 
 
-/* Return the position of the next overlay change after POS in
-   current_buffer.  Value is point-max if no overlay change
-   follows.  This is like `next-overlay-change' but doesn't use
-   xmalloc.  */
-
-static ptrdiff_t
-next_overlay_change (ptrdiff_t pos)
-{
-  ptrdiff_t i, noverlays;
-  ptrdiff_t endpos;
-  Lisp_Object *overlays;
-  USE_SAFE_ALLOCA;
-
-  /* Get all overlays at the given position.  */
-  GET_OVERLAYS_AT (pos, overlays, noverlays, &endpos, true);
-
-  /* If any of these overlays ends before endpos,
-     use its ending point instead.  */
-  for (i = 0; i < noverlays; ++i)
-    {
-      Lisp_Object oend;
-      ptrdiff_t oendpos;
-
-      oend = OVERLAY_END (overlays[i]);
-      oendpos = OVERLAY_POSITION (oend);
-      endpos = min (endpos, oendpos);
-    }
-
-  SAFE_FREE ();
-  return endpos;
-}
-
 /* How many characters forward to search for a display property or
    display string.  Searching too far forward makes the bidi display
    sluggish, especially in small windows.  */
@@ -5527,7 +5496,7 @@ handle_single_display_spec (struct it *it, Lisp_Object spec, Lisp_Object object,
 	 overlay's display string/image twice.  */
       if (!NILP (overlay))
 	{
-	  ptrdiff_t ovendpos = OVERLAY_POSITION (OVERLAY_END (overlay));
+	  ptrdiff_t ovendpos = OVERLAY_END (overlay);
 
 	  /* Some borderline-sane Lisp might call us with the current
 	     buffer narrowed so that overlay-end is outside the
@@ -6275,17 +6244,16 @@ load_overlay_strings (struct it *it, ptrdiff_t charpos)
     }									\
   while (false)
 
-  /* Process overlay before the overlay center.  */
-  for (struct Lisp_Overlay *ov = current_buffer->overlays_before;
-       ov; ov = ov->next)
+  /* Process the overlays that start or end at CHARPOS; they all
+     intersect [CHARPOS - 1, CHARPOS + 1).  */
+  struct itree_node *node;
+  ITREE_FOREACH (node, current_buffer->overlays, charpos - 1, charpos + 1,
+		 ASCENDING)
     {
-      Lisp_Object overlay = make_lisp_ptr (ov, Lisp_Vectorlike);
+      Lisp_Object overlay = node->data;
       eassert (OVERLAYP (overlay));
-      ptrdiff_t start = OVERLAY_POSITION (OVERLAY_START (overlay));
-      ptrdiff_t end = OVERLAY_POSITION (OVERLAY_END (overlay));
-
-      if (end < charpos)
-	break;
+      ptrdiff_t start = node->begin;
+      ptrdiff_t end = node->end;
 
       /* Skip this overlay if it doesn't start or end at IT's current
 	 position.  */
@@ -6317,47 +6285,6 @@ load_overlay_strings (struct it *it, ptrdiff_t charpos)
 	RECORD_OVERLAY_STRING (overlay, str, true);
     }
 
-  /* Process overlays after the overlay center.  */
-  for (struct Lisp_Overlay *ov = current_buffer->overlays_after;
-       ov; ov = ov->next)
-    {
-      Lisp_Object overlay = make_lisp_ptr (ov, Lisp_Vectorlike);
-      eassert (OVERLAYP (overlay));
-      ptrdiff_t start = OVERLAY_POSITION (OVERLAY_START (overlay));
-      ptrdiff_t end = OVERLAY_POSITION (OVERLAY_END (overlay));
-
-      if (start > charpos)
-	break;
-
-      /* Skip this overlay if it doesn't start or end at IT's current
-	 position.  */
-      if (end != charpos && start != charpos)
-	continue;
-
-      /* Skip this overlay if it doesn't apply to IT->w.  */
-      Lisp_Object window = Foverlay_get (overlay, Qwindow);
-      if (WINDOWP (window) && XWINDOW (window) != it->w)
-	continue;
-
-      /* If the text ``under'' the overlay is invisible, it has a zero
-	 dimension, and both before- and after-strings apply.  */
-      Lisp_Object invisible = Foverlay_get (overlay, Qinvisible);
-      int invis = TEXT_PROP_MEANS_INVISIBLE (invisible);
-
-      /* If overlay has a non-empty before-string, record it.  */
-      Lisp_Object str;
-      if ((start == charpos || (end == charpos && invis != 0))
-	  && (str = Foverlay_get (overlay, Qbefore_string), STRINGP (str))
-	  && SCHARS (str))
-	RECORD_OVERLAY_STRING (overlay, str, false);
-
-      /* If overlay has a non-empty after-string, record it.  */
-      if ((end == charpos || (start == charpos && invis != 0))
-	  && (str = Foverlay_get (overlay, Qafter_string), STRINGP (str))
-	  && SCHARS (str))
-	RECORD_OVERLAY_STRING (overlay, str, true);
-    }
-
 #undef RECORD_OVERLAY_STRING
 
   /* Sort entries.  */
@@ -6723,6 +6650,54 @@ pop_it (struct it *it)
 			  Moving over lines
  ***********************************************************************/
 
+/* Return the number of characters between the virtual line starts
+   of the long lines that IT displays, or zero if IT doesn't break
+   long lines into virtual lines.  A virtual line start is where
+   redisplay begins to lay out a line that is longer than
+   `long-line-threshold', instead of at the real start of the line
+   far behind: this way, the work done to display and to move over
+   such lines depends on the size of the window and not on the length
+   of the line.  The virtual line starts are a whole number of screen
+   lines apart, so that, for text whose characters are all one column
+   wide, they fall at the start of the same screen lines as when the
+   line is laid out from its real start.  */
+
+static ptrdiff_t
+long_line_chunk (struct it *it)
+{
+  if (!FIXNATP (Vlong_line_threshold) || it->line_wrap == TRUNCATE)
+    return 0;
+
+  EMACS_INT threshold = XFIXNAT (Vlong_line_threshold);
+  int width = ((it->last_visible_x - it->first_visible_x)
+	       / FRAME_COLUMN_WIDTH (it->f));
+  if (width <= 0 || threshold < width)
+    return 0;
+  return threshold - threshold % width;
+}
+
+/* Return the start of the line that IT displays at CHARPOS and
+   BYTEPOS, and store its byte position in *START_BYTE.  This is
+   the position after the newline before CHARPOS, unless that is
+   more than `long-line-threshold' characters back, in which case it
+   is the virtual line start (see long_line_chunk) at or before
+   CHARPOS.  */
+
+static ptrdiff_t
+find_line_start (struct it *it, ptrdiff_t charpos, ptrdiff_t bytepos,
+		 ptrdiff_t *start_byte)
+{
+  ptrdiff_t start = find_newline_no_quit (charpos, bytepos, -1, start_byte);
+  ptrdiff_t chunk = long_line_chunk (it);
+
+  if (chunk > 0 && charpos - start > XFIXNAT (Vlong_line_threshold))
+    {
+      start += (charpos - start) / chunk * chunk;
+      *start_byte = CHAR_TO_BYTE (start);
+    }
+  return start;
+}
+
 /* Set IT's current position to the previous line start.  */
 
 static void
@@ -6731,7 +6706,7 @@ back_to_previous_line_start (struct it *it)
   ptrdiff_t cp = IT_CHARPOS (*it), bp = IT_BYTEPOS (*it);
 
   dec_both (&cp, &bp);
-  IT_CHARPOS (*it) = find_newline_no_quit (cp, bp, -1, &IT_BYTEPOS (*it));
+  IT_CHARPOS (*it) = find_line_start (it, cp, bp, &IT_BYTEPOS (*it));
 }
 
 
@@ -6882,6 +6857,11 @@ back_to_previous_visible_line_start (struct it *it)
       if (IT_CHARPOS (*it) <= BEGV)
 	break;
 
+      /* A virtual line start of a long line has no newline before it
+	 to check.  */
+      if (FETCH_BYTE (IT_BYTEPOS (*it) - 1) != '\n')
+	break;
+
       /* If selective > 0, then lines indented more than its value are
 	 invisible.  */
       if (it->selective > 0
@@ -6927,7 +6907,7 @@ back_to_previous_visible_line_start (struct it *it)
 	    && !NILP (val = get_char_property_and_overlay
 		      (make_fixnum (pos), Qdisplay, Qnil, &overlay))
 	    && (OVERLAYP (overlay)
-		? (beg = OVERLAY_POSITION (OVERLAY_START (overlay)))
+		? (beg = OVERLAY_START (overlay))
 		: get_property_and_range (pos, Qdisplay, &val, &beg, &end, Qnil)))
 	  {
 	    RESTORE_IT (it, it, it2data);
@@ -6950,7 +6930,8 @@ back_to_previous_visible_line_start (struct it *it)
 
   eassert (IT_CHARPOS (*it) >= BEGV);
   eassert (IT_CHARPOS (*it) == BEGV
-	   || FETCH_BYTE (IT_BYTEPOS (*it) - 1) == '\n');
+	   || FETCH_BYTE (IT_BYTEPOS (*it) - 1) == '\n'
+	   || long_line_chunk (it) > 0);
   CHECK_IT (it);
 }
 
@@ -8396,9 +8377,9 @@ get_visually_first_element (struct it *it)
       if (string_p)
 	it->bidi_it.charpos = it->bidi_it.bytepos = 0;
       else
-	it->bidi_it.charpos = find_newline_no_quit (IT_CHARPOS (*it),
-						    IT_BYTEPOS (*it), -1,
-						    &it->bidi_it.bytepos);
+	it->bidi_it.charpos = find_line_start (it, IT_CHARPOS (*it),
+					       IT_BYTEPOS (*it),
+					       &it->bidi_it.bytepos);
       bidi_paragraph_init (it->paragraph_embedding, &it->bidi_it, true);
       do
 	{
@@ -9817,6 +9798,181 @@ move_it_in_display_line (struct it *it,
 }
 
 
+/* Every window remembers the layout of the buffer lines move_it_to
+   has recently stepped over as a whole.  An entry says that the text
+   from START, the beginning of a logical line, up to END, where the
+   next logical line begins, occupies DVPOS screen lines and DY
+   pixels, and that the widest of those lines is MAX_X pixels wide.
+   With that, move_it_to can step over the line by reseating the
+   iterator at END instead of producing all of its glyphs again.
+
+   An entry is only good while the buffer text, text properties and
+   overlays, and the window and buffer parameters recorded in struct
+   line_layout_cache stay the same; when any of them changes, the
+   whole cache is thrown away.  Changes that cannot be detected that
+   way, such as new face definitions or new values of the variables
+   watched by set-buffer-redisplay, call
+   invalidate_line_layout_caches.  Char-tables that affect the layout,
+   like glyphless-char-display and char-width-table, can be changed
+   in place, so the cache also records char_table_modiff.  Display
+   tables hold glyph vectors that Lisp can change behind our back, so
+   the cache is not used at all while a display table is in effect.  */
+
+struct line_layout
+{
+  ptrdiff_t start, end, end_byte;
+  int dy, dvpos, max_x, last_height;
+
+  /* The horizontal extent of the text area and the bidi_p flag of
+     the iterator that recorded this entry.  window_text_pixel_size
+     uses different values than the rest of the display code.  */
+  int first_visible_x, last_visible_x;
+  bool bidi_p;
+};
+
+enum { LINE_LAYOUT_CACHE_BITS = 8 };
+
+struct line_layout_cache
+{
+  /* What the entries below depend on.  */
+  struct buffer *buffer;
+  modiff_count modiff, overlay_modiff;
+  ptrdiff_t begv, zv;
+  EMACS_INT generation, char_table_modiff;
+  int column_width, line_height, extra_line_spacing, tab_width;
+  ptrdiff_t selective;
+  int base_face_id;
+  enum line_wrap_method line_wrap;
+  bidi_dir_t paragraph_embedding;
+  bool multibyte_p, ctl_arrow_p;
+
+  struct line_layout entries[1 << LINE_LAYOUT_CACHE_BITS];
+};
+
+/* Incremented whenever something happens that might change the
+   layout of buffer text in ways struct line_layout_cache does not
+   capture.  */
+static EMACS_INT line_layout_generation;
+
+void
+invalidate_line_layout_caches (void)
+{
+  line_layout_generation++;
+}
+
+/* Return true if the entries of cache C can still be trusted.  */
+
+static bool
+line_layout_cache_valid_p (struct line_layout_cache *c)
+{
+  return (c->buffer == current_buffer
+	  && c->modiff == MODIFF
+	  && c->overlay_modiff == OVERLAY_MODIFF
+	  && c->generation == line_layout_generation
+	  && c->char_table_modiff == char_table_modiff);
+}
+
+/* Return the line layout cache of IT's window, discarding what it
+   holds if it was recorded for a different buffer state or different
+   display parameters.  Return NULL if IT should not use the cache.  */
+
+static struct line_layout_cache *
+get_line_layout_cache (struct it *it)
+{
+  struct window *w = it->w;
+  struct frame *f = it->f;
+  struct line_layout_cache *c = w->line_layout_cache;
+
+  /* Line numbers make a line's layout depend on where the line is
+     and where point is.  */
+  if (!BUFFERP (it->object) || !NILP (Vdisplay_line_numbers) || it->dp)
+    return NULL;
+
+  if (!c)
+    {
+      c = w->line_layout_cache = xmalloc (sizeof *c);
+      c->buffer = NULL;
+    }
+
+  if (!(line_layout_cache_valid_p (c)
+	&& c->begv == BEGV
+	&& c->zv == ZV
+	&& c->column_width == FRAME_COLUMN_WIDTH (f)
+	&& c->line_height == FRAME_LINE_HEIGHT (f)
+	&& c->extra_line_spacing == it->extra_line_spacing
+	&& c->tab_width == it->tab_width
+	&& c->selective == it->selective
+	&& c->base_face_id == it->base_face_id
+	&& c->line_wrap == it->line_wrap
+	&& c->paragraph_embedding == it->paragraph_embedding
+	&& c->multibyte_p == it->multibyte_p
+	&& c->ctl_arrow_p == it->ctl_arrow_p))
+    {
+      c->buffer = current_buffer;
+      c->modiff = MODIFF;
+      c->overlay_modiff = OVERLAY_MODIFF;
+      c->begv = BEGV;
+      c->zv = ZV;
+      c->generation = line_layout_generation;
+      c->char_table_modiff = char_table_modiff;
+      c->column_width = FRAME_COLUMN_WIDTH (f);
+      c->line_height = FRAME_LINE_HEIGHT (f);
+      c->extra_line_spacing = it->extra_line_spacing;
+      c->tab_width = it->tab_width;
+      c->selective = it->selective;
+      c->base_face_id = it->base_face_id;
+      c->line_wrap = it->line_wrap;
+      c->paragraph_embedding = it->paragraph_embedding;
+      c->multibyte_p = it->multibyte_p;
+      c->ctl_arrow_p = it->ctl_arrow_p;
+      for (int i = 0; i < ARRAYELTS (c->entries); i++)
+	c->entries[i].start = 0;
+    }
+
+  return c;
+}
+
+/* Return the slot of cache C for the line starting at START.  */
+
+static struct line_layout *
+line_layout_slot (struct line_layout_cache *c, ptrdiff_t start)
+{
+  uint32_t hash = (uint32_t) start * 2654435761u;
+  return &c->entries[hash >> (32 - LINE_LAYOUT_CACHE_BITS)];
+}
+
+/* Return the entry of cache C describing the line that starts at
+   IT's position, or NULL if there is none.  */
+
+static struct line_layout *
+find_line_layout (struct line_layout_cache *c, struct it *it)
+{
+  struct line_layout *l = line_layout_slot (c, IT_CHARPOS (*it));
+  if (l->start == IT_CHARPOS (*it)
+      && l->first_visible_x == it->first_visible_x
+      && l->last_visible_x == it->last_visible_x
+      && l->bidi_p == it->bidi_p
+      && l->end <= it->end_charpos)
+    return l;
+  return NULL;
+}
+
+/* Return true if IT is about to lay out a logical line from its
+   beginning, at the left edge of the window.  */
+
+static bool
+line_layout_boundary_p (struct it *it)
+{
+  return (it->method == GET_FROM_BUFFER
+	  && it->sp == 0
+	  && it->current_x == 0
+	  && it->continuation_lines_width == 0
+	  && it->current.dpvec_index < 0
+	  && (IT_CHARPOS (*it) == BEGV
+	      || FETCH_BYTE (IT_BYTEPOS (*it) - 1) == '\n'));
+}
+
+
 /* Move IT forward until it satisfies one or more of the criteria in
    TO_CHARPOS, TO_X, TO_Y, and TO_VPOS.
 
@@ -9840,9 +9996,78 @@ move_it_to (struct it *it, ptrdiff_t to_charpos, int to_x, int to_y, int to_vpos
   void *backup_data = NULL;
   ptrdiff_t orig_charpos = -1;
   enum it_method orig_method = NUM_IT_METHODS;
+  struct line_layout_cache *layout_cache = get_line_layout_cache (it);
+  /* The line being recorded in LAYOUT_CACHE, if any, and the position
+     of IT where it started.  LAYOUT_MAX_X is the value of
+     MAX_CURRENT_X for the lines before it.  */
+  ptrdiff_t layout_start = 0;
+  int layout_y = 0, layout_vpos = 0, layout_max_x = 0;
 
   for (;;)
     {
+      if (layout_cache && line_layout_boundary_p (it))
+	{
+	  struct line_layout *l;
+
+	  /* Running fontification-functions can change the buffer
+	     under our feet.  */
+	  if (!line_layout_cache_valid_p (layout_cache))
+	    layout_cache = NULL;
+	  else if (layout_start > 0 && layout_start < IT_CHARPOS (*it))
+	    {
+	      l = line_layout_slot (layout_cache, layout_start);
+	      l->start = layout_start;
+	      l->end = IT_CHARPOS (*it);
+	      l->end_byte = IT_BYTEPOS (*it);
+	      l->dy = it->current_y - layout_y;
+	      l->dvpos = it->vpos - layout_vpos;
+	      l->max_x = max_current_x;
+	      l->last_height = last_height;
+	      l->first_visible_x = it->first_visible_x;
+	      l->last_visible_x = it->last_visible_x;
+	      l->bidi_p = it->bidi_p;
+	    }
+	  layout_max_x = max (layout_max_x, max_current_x);
+	  max_current_x = 0;
+	  layout_start = 0;
+
+	  /* Step over the whole line if we know its layout and we
+	     wouldn't stop anywhere in it.  */
+	  if (layout_cache
+	      && (l = find_line_layout (layout_cache, it)) != NULL
+	      && (to_charpos >= l->end
+		  || ((op & (MOVE_TO_VPOS | MOVE_TO_Y))
+		      && !(op & MOVE_TO_POS)))
+	      && (!(op & MOVE_TO_VPOS)
+		  || it->vpos + l->dvpos <= to_vpos)
+	      && (!(op & MOVE_TO_Y)
+		  || to_y < it->current_y
+		  || to_y >= it->current_y + l->dy))
+	    {
+	      struct text_pos pos;
+
+	      /* Leave IT in the state it would have after consuming
+		 the line's newline, with the stop at POS not yet
+		 handled.  */
+	      SET_TEXT_POS (pos, l->end, l->end_byte);
+	      reseat_1 (it, pos, true);
+	      if (it->bidi_p)
+		it->prev_stop = l->end;
+	      it->current_y += l->dy;
+	      it->vpos += l->dvpos;
+	      layout_max_x = max (layout_max_x, l->max_x);
+	      last_height = l->last_height;
+	      continue;
+	    }
+
+	  if (layout_cache)
+	    {
+	      layout_start = IT_CHARPOS (*it);
+	      layout_y = it->current_y;
+	      layout_vpos = it->vpos;
+	    }
+	}
+
       orig_charpos = IT_CHARPOS (*it);
       orig_method = it->method;
       if (op & MOVE_TO_VPOS)
@@ -10100,7 +10325,6 @@ move_it_to (struct it *it, ptrdiff_t to_charpos, int to_x, int to_y, int to_vpos
 	}
 
       /* Reset/increment for the next run.  */
-      recenter_overlay_lists (current_buffer, IT_CHARPOS (*it));
       it->current_x = line_start_x;
       line_start_x = 0;
       it->hpos = 0;
@@ -10137,6 +10361,8 @@ move_it_to (struct it *it, ptrdiff_t to_charpos, int to_x, int to_y, int to_vpos
       last_height = it->max_ascent + it->max_descent;
     }
 
+  max_current_x = max (max_current_x, layout_max_x);
+
   if (backup_data)
     bidi_unshelve_cache (backup_data, true);
 
@@ -10254,7 +10480,7 @@ move_it_vertically_backward (struct it *it, int dy)
 	  ptrdiff_t cp = IT_CHARPOS (*it), bp = IT_BYTEPOS (*it);
 
 	  dec_both (&cp, &bp);
-	  cp = find_newline_no_quit (cp, bp, -1, NULL);
+	  cp = find_line_start (it, cp, bp, &bp);
 	  move_it_to (it, cp, -1, -1, -1, MOVE_TO_POS);
 	}
       bidi_unshelve_cache (it3data, true);
@@ -22851,6 +23077,23 @@ static ptrdiff_t
 display_count_lines_logically (ptrdiff_t start_byte, ptrdiff_t limit_byte,
 			       ptrdiff_t count, ptrdiff_t *byte_pos_ptr)
 {
+  /* The line index can count the lines of a large stretch of text
+     much faster, if only newlines end lines.  It does not care about
+     narrowing.  */
+  if (count > 0 && limit_byte - start_byte > 256 * 1024
+      && (NILP (BVAR (current_buffer, selective_display))
+	  || FIXNUMP (BVAR (current_buffer, selective_display))))
+    {
+      ptrdiff_t nlines = (buffer_newlines_before (current_buffer, limit_byte)
+			  - buffer_newlines_before (current_buffer,
+						    start_byte));
+      if (nlines < count)
+	{
+	  *byte_pos_ptr = limit_byte;
+	  return nlines;
+	}
+    }
+
   if (!display_line_numbers_widen || (BEGV == BEG && ZV == Z))
     return display_count_lines (start_byte, limit_byte, count, byte_pos_ptr);
 
@@ -23312,13 +23555,6 @@ display_line (struct it *it, int cursor_vpos)
   it->tab_offset = 0;
   it->line_number_produced_p = false;
 
-  /* Arrange the overlays nicely for our purposes.  Usually, we call
-     display_line on only one line at a time, in which case this
-     can't really hurt too much, or we call it on lines which appear
-     one after another in the buffer, in which case all calls to
-     recenter_overlay_lists but the first will be pretty cheap.  */
-  recenter_overlay_lists (current_buffer, IT_CHARPOS (*it));
-
   /* If we are going to display the cursor's line, account for the
      hscroll of that line.  We subtract the window's min_hscroll,
      because that was already accounted for in init_iterator.  */
@@ -26932,6 +27168,15 @@ display_count_lines (ptrdiff_t start_byte,
 		}
 	      else
 		{
+		  while (1 < count
+			 && NEWLINE_BLOCK_SIZE <= ceiling_addr - cursor)
+		    {
+		      ptrdiff_t n = count_newlines (cursor, NEWLINE_BLOCK_SIZE);
+		      if (count <= n)
+			break;
+		      count -= n;
+		      cursor += NEWLINE_BLOCK_SIZE;
+		    }
 		  cursor = memchr (cursor, '\n', ceiling_addr - cursor);
 		  if (! cursor)
 		    break;
@@ -26971,6 +27216,16 @@ display_count_lines (ptrdiff_t start_byte,
 		}
 	      else
 		{
+		  while (count < -1
+			 && NEWLINE_BLOCK_SIZE <= cursor - ceiling_addr)
+		    {
+		      ptrdiff_t n = count_newlines (cursor - NEWLINE_BLOCK_SIZE,
+						    NEWLINE_BLOCK_SIZE);
+		      if (- count <= n)
+			break;
+		      count += n;
+		      cursor -= NEWLINE_BLOCK_SIZE;
+		    }
 		  cursor = memrchr (ceiling_addr, '\n', cursor - ceiling_addr);
 		  if (! cursor)
 		    break;
@@ -33604,7 +33859,7 @@ note_mouse_highlight (struct frame *f, int x, int y)
       if (BUFFERP (object))
 	{
 	  /* Put all the overlays we want in a vector in overlay_vec.  */
-	  GET_OVERLAYS_AT (pos, overlay_vec, noverlays, NULL, false);
+	  GET_OVERLAYS_AT (pos, overlay_vec, noverlays, NULL);
 	  /* Sort overlays into increasing priority order.  */
 	  noverlays = sort_overlays (overlay_vec, noverlays, w);
 	}
@@ -33632,7 +33887,7 @@ note_mouse_highlight (struct frame *f, int x, int y)
 	  || (!hlinfo->mouse_face_hidden
 	      && OVERLAYP (hlinfo->mouse_face_overlay)
 	      /* It's possible the overlay was deleted (Bug#35273).  */
-              && XMARKER (OVERLAY_START (hlinfo->mouse_face_overlay))->buffer
+              && OVERLAY_BUFFER (hlinfo->mouse_face_overlay)
               && mouse_face_overlay_overlaps (hlinfo->mouse_face_overlay)))
 	{
 	  /* Find the highest priority overlay with a mouse-face.  */
@@ -34922,6 +35177,20 @@ If the average length of the lines near point is bigger than this, then the
 line number may be omitted from the mode line.  */);
   line_number_display_limit_width = 200;
 
+  DEFVAR_LISP ("long-line-threshold", Vlong_line_threshold,
+    doc: /* Line length (in characters) beyond which redisplay cuts lines short.
+When a continued line is longer than this, redisplay lays it out from
+one of a series of points inside the line that are about this many
+characters apart, instead of from the start of the line.  Moving over
+the text and displaying it then take a time that depends on the size
+of the window, not on the length of the line.  The points fall at the
+start of a screen line when every character of the line is one column
+wide; otherwise, the screen lines near them can break at a different
+place than they would if the whole line were laid out.
+A value of nil means always lay out lines from their start.
+This has no effect on truncated lines.  */);
+  Vlong_line_threshold = make_fixnum (10000);
+
   DEFVAR_BOOL ("highlight-nonselected-windows", highlight_nonselected_windows,
     doc: /* Non-nil means highlight region even in nonselected windows.  */);
   highlight_nonselected_windows = false;
@@ -335,6 +335,16 @@ static int clear_font_table_count;
 
 bool face_change;
 
+/* Incremented whenever the definition of a Lisp face changes.  Cached
+   face merges made before that are not used.  */
+
+static EMACS_INT lface_change_count;
+
+/* Set by filter_face_ref when the result of a merge depends on the
+   window, which makes it unsuitable for caching.  */
+
+static bool face_ref_filtered;
+
 /* True means don't display bold text if a face's foreground
    and background colors are the inverse of the default colors of the
    display.   This is a kluge to suppress `bold black' foreground text
@@ -721,11 +731,31 @@ Optional THOROUGHLY non-nil means try to free unused fonts, too.  */)
   (Lisp_Object thoroughly)
 {
   clear_face_cache (!NILP (thoroughly));
+  clear_face_merge_caches ();
   face_change = true;
+  lface_change_count++;
   windows_or_buffers_changed = 53;
   return Qnil;
 }
 
+DEFUN ("face-merge-cache-stats", Fface_merge_cache_stats,
+       Sface_merge_cache_stats, 0, 1, 0,
+       doc: /* Return statistics about merging faces on FRAME.
+FRAME nil or omitted means the selected frame.
+
+The value is an alist ((hits . HITS) (misses . MISSES)).  HITS is the
+number of times the display code found the face for a combination of
+`face' properties among the faces it merged before, and MISSES is the
+number of times it had to merge the faces.  */)
+  (Lisp_Object frame)
+{
+  struct face_cache *c = FRAME_FACE_CACHE (decode_live_frame (frame));
+  struct face_merge_cache *mc = c ? c->merge_cache : NULL;
+
+  return list2 (Fcons (Qhits, make_int (mc ? mc->hits : 0)),
+		Fcons (Qmisses, make_int (mc ? mc->misses : 0)));
+}
+
 
 /***********************************************************************
 			      X Pixmaps
@@ -2480,6 +2510,7 @@ filter_face_ref (Lisp_Object face_ref,
     if (!NILP (face_ref))
       goto err;
 
+    face_ref_filtered = true;
     return evaluate_face_filter (filter, w, ok, err_msgs)
       ? filtered_face_ref : Qnil;
   }
@@ -2878,6 +2909,7 @@ Value is a vector of face attributes.  */)
 
   CHECK_SYMBOL (face);
   global_lface = lface_from_face_name (NULL, face, false);
+  lface_change_count++;
 
   if (!NILP (frame))
     {
@@ -2994,6 +3026,8 @@ The value is TO.  */)
   Lisp_Object lface, copy;
   struct frame *f;
 
+  lface_change_count++;
+
   CHECK_SYMBOL (from);
   CHECK_SYMBOL (to);
 
@@ -3063,6 +3097,7 @@ FRAME 0 means change the face on all frames, and change the default
   CHECK_SYMBOL (attr);
 
   face = resolve_face_name (face, true);
+  lface_change_count++;
 
   /* If FRAME is 0, change face on all frames, and change the
      default for new frames.  */
@@ -3668,6 +3703,8 @@ update_face_from_frame_parameter (struct frame *f, Lisp_Object param,
   if (NILP (f->face_alist))
     return;
 
+  lface_change_count++;
+
   if (EQ (param, Qforeground_color))
     {
       face = Qdefault;
@@ -4108,6 +4145,7 @@ Default face attributes override any local face attributes.  */)
   CHECK_LIVE_FRAME (frame);
   global_lface = lface_from_face_name (NULL, face, true);
   local_lface = lface_from_face_name (f, face, false);
+  lface_change_count++;
   if (NILP (local_lface))
     local_lface = Finternal_make_lisp_face (face, frame);
 
@@ -4581,6 +4619,7 @@ make_face_cache (struct frame *f)
   c->size = 50;
   c->used = 0;
   c->faces_by_id = xmalloc (c->size * sizeof *c->faces_by_id);
+  c->merge_cache = NULL;
   c->f = f;
   c->menu_face_changed_p = menu_face_changed_default;
   return c;
@@ -4616,6 +4655,37 @@ clear_face_gcs (struct face_cache *c)
 
 #endif /* HAVE_WINDOW_SYSTEM */
 
+/* Forget the face merges cached in face cache C.  */
+
+static void
+clear_face_merge_cache (struct face_cache *c)
+{
+  if (c->merge_cache)
+    {
+      for (int i = 0; i < ARRAYELTS (c->merge_cache->entries); i++)
+	c->merge_cache->entries[i].base_face_id = -1;
+      c->merge_cache->generation = lface_change_count;
+    }
+}
+
+/* Forget the face merges cached on all frames.  Face specs in text
+   properties and overlays can be changed in place without anything
+   telling us; force-window-update and clear-face-cache call this to
+   make redisplay see such changes.  */
+
+void
+clear_face_merge_caches (void)
+{
+  Lisp_Object tail, frame;
+
+  FOR_EACH_FRAME (tail, frame)
+    {
+      struct face_cache *c = FRAME_FACE_CACHE (XFRAME (frame));
+      if (c)
+	clear_face_merge_cache (c);
+    }
+}
+
 /* Free all realized faces in face cache C, including basic faces.
    C may be null.  If faces are freed, make sure the frame's current
    matrix is marked invalid, so that a display caused by an expose
@@ -4643,6 +4713,8 @@ free_realized_faces (struct face_cache *c)
       /* Forget the escape-glyph and glyphless-char faces.  */
       forget_escape_and_glyphless_faces ();
       c->used = 0;
+      clear_face_merge_cache (c);
+      invalidate_line_layout_caches ();
       size = FACE_CACHE_BUCKETS_SIZE * sizeof *c->buckets;
       memset (c->buckets, 0, size);
 
@@ -4690,6 +4762,7 @@ free_face_cache (struct face_cache *c)
       free_realized_faces (c);
       xfree (c->buckets);
       xfree (c->faces_by_id);
+      xfree (c->merge_cache);
       xfree (c);
     }
 }
@@ -4788,6 +4861,9 @@ uncache_face (struct face_cache *c, struct face *face)
   c->faces_by_id[face->id] = NULL;
   if (face->id == c->used)
     --c->used;
+
+  /* A cached merge may have this face as result or base.  */
+  clear_face_merge_cache (c);
 }
 
 
@@ -6353,6 +6429,119 @@ compute_char_face (struct frame *f, int ch, Lisp_Object prop)
   return face_id;
 }
 
+/* Return the pair of entries of the face merge cache of frame F that
+   may hold the merge of the NSPECS face specs in SPECS into the face
+   BASE_FACE_ID, passing ATTR_FILTER to merge_face_ref.  The more
+   recently used entry comes first.  */
+
+static struct face_merge *
+face_merge_set (struct frame *f, int base_face_id,
+		Lisp_Object *specs, int nspecs,
+		enum lface_attribute_index attr_filter)
+{
+  struct face_cache *c = FRAME_FACE_CACHE (f);
+
+  if (!c->merge_cache)
+    {
+      c->merge_cache = xmalloc (sizeof *c->merge_cache);
+      c->merge_cache->hits = c->merge_cache->misses = 0;
+      clear_face_merge_cache (c);
+    }
+  else if (c->merge_cache->generation != lface_change_count)
+    clear_face_merge_cache (c);
+
+  EMACS_UINT hash = sxhash_combine (base_face_id, attr_filter);
+  for (int i = 0; i < nspecs; i++)
+    hash = sxhash_combine (hash, XHASH (specs[i]));
+  uint32_t h = hash ^ (hash >> 31);
+  h = (uint32_t) (h * 2654435761u) >> (32 - FACE_MERGE_CACHE_BITS + 1);
+  return &c->merge_cache->entries[2 * h];
+}
+
+/* Return true if the cached face merge M is the merge of the NSPECS
+   face specs in SPECS into face BASE_FACE_ID with ATTR_FILTER.  */
+
+static bool
+face_merge_match_p (struct face_merge *m, int base_face_id,
+		    Lisp_Object *specs, int nspecs,
+		    enum lface_attribute_index attr_filter)
+{
+  if (m->base_face_id != base_face_id
+      || m->nspecs != nspecs
+      || m->attr_filter != attr_filter)
+    return false;
+  for (int i = 0; i < nspecs; i++)
+    if (!EQ (m->specs[i], specs[i]))
+      return false;
+  return true;
+}
+
+/* Return the ID of a realized face on frame F whose attributes are
+   those of face BASE with the NSPECS face specs in SPECS merged into
+   them, in order.  W and ATTR_FILTER are passed to merge_face_ref.
+
+   The same few combinations of face specs recur over and over in a
+   buffer, so the results are cached in F's face cache.  */
+
+static int
+merge_face_specs (struct window *w, struct frame *f, struct face *base,
+		  Lisp_Object *specs, ptrdiff_t nspecs,
+		  enum lface_attribute_index attr_filter)
+{
+  Lisp_Object attrs[LFACE_VECTOR_SIZE];
+  struct face_merge *m = NULL;
+  bool ok = true;
+  int face_id, i;
+
+  /* Face remappings can be changed in place without anything telling
+     us, so merges that might involve them are not cached.  */
+  if (nspecs <= FACE_MERGE_MAX_SPECS && NILP (Vface_remapping_alist))
+    {
+      struct face_merge_cache *mc;
+
+      m = face_merge_set (f, base->id, specs, nspecs, attr_filter);
+      mc = FRAME_FACE_CACHE (f)->merge_cache;
+      if (face_merge_match_p (&m[0], base->id, specs, nspecs, attr_filter))
+	{
+	  mc->hits++;
+	  return m[0].face_id;
+	}
+      if (face_merge_match_p (&m[1], base->id, specs, nspecs, attr_filter))
+	{
+	  struct face_merge hit = m[1];
+	  m[1] = m[0];
+	  m[0] = hit;
+	  mc->hits++;
+	  return hit.face_id;
+	}
+      mc->misses++;
+    }
+
+  memcpy (attrs, base->lface, sizeof attrs);
+  face_ref_filtered = false;
+  for (i = 0; i < nspecs; i++)
+    ok &= merge_face_ref (w, f, specs[i], attrs, true, NULL, attr_filter);
+
+  /* Look up a realized face with the given face attributes,
+     or realize a new one for ASCII characters.  */
+  face_id = lookup_face (f, attrs);
+
+  /* Don't cache merges that depend on the window, or that failed
+     and should be complained about again.  */
+  if (m && ok && !face_ref_filtered)
+    {
+      m[1] = m[0];
+      m->base_face_id = base->id;
+      m->nspecs = nspecs;
+      m->attr_filter = attr_filter;
+      for (i = 0; i < nspecs; i++)
+	m->specs[i] = specs[i];
+      m->face_id = face_id;
+    }
+
+  return face_id;
+}
+
 /* Return the face ID associated with buffer position POS for
    displaying ASCII characters.  Return in *ENDPTR the position at
    which a different face is needed, as far as text properties and
@@ -6383,14 +6572,14 @@ face_at_buffer_position (struct window *w, ptrdiff_t pos,
                          enum lface_attribute_index attr_filter)
 {
   struct frame *f = XFRAME (w->frame);
-  Lisp_Object attrs[LFACE_VECTOR_SIZE];
   Lisp_Object prop, position;
-  ptrdiff_t i, noverlays;
-  Lisp_Object *overlay_vec;
+  ptrdiff_t i, noverlays, nspecs;
+  Lisp_Object *overlay_vec, *specs;
   ptrdiff_t endpos;
   Lisp_Object propname = mouse ? Qmouse_face : Qface;
   Lisp_Object limit1, end;
   struct face *default_face;
+  int face_id;
 
   /* W must display the current buffer.  We could write this function
      to use the frame and buffer of W, but right now it doesn't.  */
@@ -6413,7 +6602,7 @@ face_at_buffer_position (struct window *w, ptrdiff_t pos,
   {
     ptrdiff_t next_overlay;
 
-    GET_OVERLAYS_AT (pos, overlay_vec, noverlays, &next_overlay, false);
+    GET_OVERLAYS_AT (pos, overlay_vec, noverlays, &next_overlay);
     if (next_overlay < endpos)
       endpos = next_overlay;
   }
@@ -6421,8 +6610,6 @@ face_at_buffer_position (struct window *w, ptrdiff_t pos,
   *endptr = endpos;
 
   {
-    int face_id;
-
     if (base_face_id >= 0)
       {
 	face_id = base_face_id;
@@ -6448,14 +6635,14 @@ face_at_buffer_position (struct window *w, ptrdiff_t pos,
       return default_face->id;
     }
 
-  /* Begin with attributes from the default face.  */
-  memcpy (attrs, default_face->lface, sizeof(attrs));
-
-  /* Merge in attributes specified via text properties.  */
+  /* Collect the face specs to merge into the default face, beginning
+     with the one specified via text properties.  */
+  SAFE_NALLOCA (specs, 1, noverlays + 1);
+  nspecs = 0;
   if (!NILP (prop))
-    merge_face_ref (w, f, prop, attrs, true, NULL, attr_filter);
+    specs[nspecs++] = prop;
 
-  /* Now merge the overlay data.  */
+  /* Now the overlay data.  */
   noverlays = sort_overlays (overlay_vec, noverlays, w);
   /* For mouse-face, we need only the single highest-priority face
      from the overlays, if any.  */
@@ -6463,7 +6650,6 @@ face_at_buffer_position (struct window *w, ptrdiff_t pos,
     {
       for (prop = Qnil, i = noverlays - 1; i >= 0 && NILP (prop); --i)
 	{
-	  Lisp_Object oend;
 	  ptrdiff_t oendpos;
 
 	  prop = Foverlay_get (overlay_vec[i], propname);
@@ -6472,12 +6658,11 @@ face_at_buffer_position (struct window *w, ptrdiff_t pos,
 	      /* Overlays always take priority over text properties,
 		 so discard the mouse-face text property, if any, and
 		 use the overlay property instead.  */
-	      memcpy (attrs, default_face->lface, sizeof attrs);
-	      merge_face_ref (w, f, prop, attrs, true, NULL, attr_filter);
+	      specs[0] = prop;
+	      nspecs = 1;
 	    }
 
-	  oend = OVERLAY_END (overlay_vec[i]);
-	  oendpos = OVERLAY_POSITION (oend);
+	  oendpos = OVERLAY_END (overlay_vec[i]);
 	  if (oendpos < endpos)
 	    endpos = oendpos;
 	}
@@ -6486,16 +6671,14 @@ face_at_buffer_position (struct window *w, ptrdiff_t pos,
     {
       for (i = 0; i < noverlays; i++)
 	{
-	  Lisp_Object oend;
 	  ptrdiff_t oendpos;
 
 	  prop = Foverlay_get (overlay_vec[i], propname);
 
 	  if (!NILP (prop))
-	    merge_face_ref (w, f, prop, attrs, true, NULL, attr_filter);
+	    specs[nspecs++] = prop;
 
-	  oend = OVERLAY_END (overlay_vec[i]);
-	  oendpos = OVERLAY_POSITION (oend);
+	  oendpos = OVERLAY_END (overlay_vec[i]);
 	  if (oendpos < endpos)
 	    endpos = oendpos;
 	}
@@ -6503,11 +6686,10 @@ face_at_buffer_position (struct window *w, ptrdiff_t pos,
 
   *endptr = endpos;
 
+  face_id = merge_face_specs (w, f, default_face, specs, nspecs,
+			      attr_filter);
   SAFE_FREE ();
-
-  /* Look up a realized face with the given face attributes,
-     or realize a new one for ASCII characters.  */
-  return lookup_face (f, attrs);
+  return face_id;
 }
 
 /* Return the face ID at buffer position POS for displaying ASCII
@@ -6904,6 +7086,8 @@ syms_of_xfaces (void)
 
   /* Property for basic faces which other faces cannot inherit.  */
   DEFSYM (Qface_no_inherit, "face-no-inherit");
+  DEFSYM (Qhits, "hits");
+  DEFSYM (Qmisses, "misses");
 
   /* Error symbol for wrong_type_argument in load_pixmap.  */
   DEFSYM (Qbitmap_spec_p, "bitmap-spec-p");
@@ -7037,6 +7221,7 @@ syms_of_xfaces (void)
   defsubr (&Sshow_face_resources);
 #endif /* GLYPH_DEBUG */
   defsubr (&Sclear_face_cache);
+  defsubr (&Sface_merge_cache_stats);
   defsubr (&Stty_suppress_bold_inverse_default_colors);
 
 #if defined DEBUG_X_COLORS && defined HAVE_X_WINDOWS
@@ -13421,6 +13421,10 @@ x_delete_terminal (struct terminal *terminal)
     xim_close_dpy (dpyinfo);
 #endif
 
+  /* No more input on this descriptor.  Say so before it is closed
+     below.  */
+  delete_keyboard_wait_descriptor (dpyinfo->connection);
+
   /* Normally, the display is available...  */
   if (dpyinfo->display)
     {
@@ -13474,8 +13478,6 @@ x_delete_terminal (struct terminal *terminal)
   else if (dpyinfo->connection >= 0)
     emacs_close (dpyinfo->connection);
 
-  /* No more input on this descriptor.  */
-  delete_keyboard_wait_descriptor (dpyinfo->connection);
   /* Mark as dead. */
   dpyinfo->connection = -1;
 
@@ -58,3 +58,17 @@
     (with-silent-modifications
       (put-text-property (point-min) (point-max) 'fontified t))
     (jit-lock-fontify-now (point-min) (point-max))))
+
+(ert-deftest jit-lock-async-fontifies-in-a-thread ()
+  (skip-unless (featurep 'threads))
+  (ert-with-test-buffer (:name "xxx")
+    (jit-lock-tests--setup-buffer)
+    (insert "aaabbbcccddd")
+    (let ((jit-lock-async t))
+      (jit-lock-function (point-min)))
+    (should (eq (get-text-property (point-min) 'fontified) 'defer))
+    (while jit-lock--async-timer
+      (jit-lock--async-refresh)
+      (when jit-lock--async-thread
+        (thread-join jit-lock--async-thread)))
+    (should-not (text-property-not-all (point-min) (point-max) 'fontified t))))
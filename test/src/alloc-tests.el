@@ -58,3 +58,88 @@
     (dolist (c (list 10003 ?b 128 ?c ?d (max-char) ?e))
       (aset s 0 c)
       (should (equal s (make-string 1 c))))))
+
+(ert-deftest alloc-tests-minor-gc ()
+  "Check that minor collections don't free objects stored in old conses."
+  (let ((gc-minor-collections t)
+        (gc-cons-threshold 100000)
+        (old (make-list 100 nil))
+        (vec (make-vector 100 nil))
+        (minor gcs-minor-done))
+    ;; Make OLD an old cons that minor collections do not trace.
+    (garbage-collect)
+    (dotimes (i 20000)
+      (let ((j (% i 100)))
+        (setcar (nthcdr j old) (list i (* i 1.5) (number-to-string i)))
+        (aset vec j (cons (- i) (car (nthcdr j old))))))
+    (should (> gcs-minor-done minor))
+    (dotimes (j 100)
+      (let ((elt (nth j old))
+            (i (+ j 19900)))
+        (should (equal elt (list i (* i 1.5) (number-to-string i))))
+        (should (equal (aref vec j) (cons (- i) elt)))))
+    (let ((stats (assq 'collections (garbage-collect))))
+      (should (= (nth 1 stats) gcs-minor-done))
+      (should (floatp (nth 2 stats)))
+      (should (= (+ (nth 1 stats) (nth 3 stats)) gcs-done)))))
+
+(ert-deftest alloc-tests-parallel-gc ()
+  "Check that collections with helper threads keep everything reachable."
+  (let ((gc-parallel-threads 2)
+        (tree nil))
+    (dotimes (i 20000)
+      (push (list i (* i 1.5) (number-to-string i)
+                  (propertize "p" 'n i) (vector i) (list (list i)))
+            tree))
+    (garbage-collect)
+    (let ((gc-cons-threshold 100000))
+      (dotimes (_ 10)
+        (make-list 10000 nil)))
+    (garbage-collect)
+    (let ((i 20000))
+      (dolist (elt tree)
+        (setq i (1- i))
+        (should (equal elt (list i (* i 1.5) (number-to-string i)
+                                 "p" (vector i) (list (list i)))))
+        (should (eq (get-text-property 0 'n (nth 3 elt)) i))))))
+
+(ert-deftest alloc-tests-lazy-sweep ()
+  "Check that lazily swept blocks are swept before being reused."
+  (let ((gc-lazy-sweep t)
+        (tree nil))
+    (dotimes (i 20000)
+      (push (list i (* i 1.5)) tree))
+    (dotimes (_ 5)
+      (make-list 50000 1.0))
+    (let ((stats (garbage-collect)))
+      (should (> (nth 2 (assq 'unswept-blocks stats)) 0)))
+    (let ((gc-cons-threshold 100000))
+      (dotimes (_ 10)
+        (make-list 10000 2.5)))
+    (let ((i 20000))
+      (dolist (elt tree)
+        (setq i (1- i))
+        (should (equal elt (list i (* i 1.5))))))))
+
+(ert-deftest alloc-tests-lazy-sweep-reuses-garbage ()
+  "Check that the garbage in unswept blocks is reused for new conses."
+  (let ((gc-lazy-sweep t)
+        (gc-cons-threshold most-positive-fixnum)
+        (keep nil))
+    (make-list 200000 nil)
+    (let* ((stats (garbage-collect))
+           (conses (assq 'conses stats))
+           (capacity (+ (nth 2 conses) (nth 3 conses)))
+           (unswept (nth 2 (assq 'unswept-blocks stats)))
+           (info (memory-info)))
+      (should (> unswept 0))
+      (when info
+        (should (> (nth 4 info) 0)))
+      ;; These conses fit in the garbage of the unswept blocks, so no
+      ;; new block should be needed for them.
+      (setq keep (make-list 100000 t))
+      (when info
+        (should (< (nth 4 (memory-info)) (nth 4 info))))
+      (setq conses (assq 'conses (garbage-collect)))
+      (should (<= (+ (nth 2 conses) (nth 3 conses)) capacity))
+      (should (= (length keep) 100000)))))
@@ -1334,4 +1334,34 @@ with parameters from the *Messages* buffer modification."
   (with-temp-buffer
     (should (assq 'buffer-undo-list (buffer-local-variables)))))
 
+;; Overlays are kept in an interval tree, so looking up the overlays at
+;; a position and editing the text should not get noticeably slower as
+;; the number of overlays in the buffer grows.
+(defun buffer-tests--overlay-benchmark (n)
+  "Return the time for overlay queries and edits with N overlays."
+  (with-temp-buffer
+    (insert (make-string (* 2 n) ?x))
+    (dotimes (i n)
+      (make-overlay (1+ (* 2 i)) (+ 5 (* 2 i))))
+    (should (= (length (overlays-in (point-min) (point-max))) n))
+    (let ((mid (1+ n)))
+      (should (= (length (overlays-at mid)) 2))
+      (should (= (next-overlay-change mid) (+ 2 mid)))
+      (car (benchmark-run 1000
+             (overlays-at mid)
+             (next-overlay-change mid)
+             (previous-overlay-change mid)
+             (goto-char mid)
+             (insert "y")
+             (delete-char -1))))))
+
+(ert-deftest buffer-tests-overlay-scaling ()
+  "Check that overlay operations scale to 100k overlays."
+  :tags '(:expensive-test)
+  (let ((small (buffer-tests--overlay-benchmark 1000))
+        (large (buffer-tests--overlay-benchmark 100000)))
+    ;; A linear representation is about 100 times slower here; leave
+    ;; plenty of slack for noisy machines.
+    (should (< large (* 20 (max small 0.001))))))
+
 ;;; buffer-tests.el ends here
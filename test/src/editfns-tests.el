@@ -389,4 +389,86 @@
       (translate-region-internal (point-min) (point-max) tt)
       (should (string-equal (buffer-string) "*")))))
 
+;;; Line numbers.
+
+(defun editfns-tests--newlines (from to)
+  "Count the newlines between FROM and TO without the line index."
+  (save-excursion
+    (save-restriction
+      (narrow-to-region from to)
+      (goto-char (point-min))
+      (let ((lines (- (buffer-size) (forward-line (buffer-size)))))
+        (if (bolp) lines (1- lines))))))
+
+(defun editfns-tests--check-lines ()
+  "Check line numbers and line positions in the current buffer."
+  (dotimes (_ 5)
+    (let ((pos (+ (point-min) (random (1+ (- (point-max) (point-min)))))))
+      (should (= (line-number-at-pos pos)
+                 (1+ (editfns-tests--newlines (point-min) pos))))
+      (should (= (line-number-at-pos pos t)
+                 (save-restriction
+                   (widen)
+                   (1+ (editfns-tests--newlines 1 pos)))))
+      (let* ((line (line-number-at-pos pos))
+             (start (save-excursion (goto-char pos) (line-beginning-position))))
+        (should (= (buffer-line-position line)
+                   (if (= line 1) (point-min) start))))))
+  (let ((lines (line-number-at-pos (point-max))))
+    (should-not (buffer-line-position (1+ lines)))
+    (should (= (buffer-line-position lines t)
+               (save-excursion
+                 (save-restriction
+                   (widen)
+                   (goto-char (point-min))
+                   (forward-line (1- lines))
+                   (point)))))))
+
+(ert-deftest editfns-tests-line-numbers ()
+  "Check that line numbers stay right while the text changes."
+  (with-temp-buffer
+    (dotimes (_ 3000)
+      (insert (make-string (random 150) (if (zerop (random 4)) ?é ?x)) "\n"))
+    (let ((indirect (make-indirect-buffer (current-buffer) " *indirect*")))
+      (unwind-protect
+          (dotimes (i 60)
+            (let ((from (1+ (random (buffer-size))))
+                  (to (1+ (random (buffer-size)))))
+              (pcase (random 7)
+                (0 (goto-char from)
+                   (insert (make-string (random 20000) ?\n)))
+                (1 (goto-char from)
+                   (insert "ab\nü\n"))
+                (2 (delete-region from (min (point-max) (+ from (random 50000)))))
+                (3 (subst-char-in-region (min from to) (max from to) ?x ?\n))
+                (4 (subst-char-in-region (min from to) (max from to) ?\n ?x))
+                (5 (with-current-buffer indirect
+                     (goto-char from)
+                     (insert "\n\n\n")))
+                (6 (upcase-region (min from to) (max from to))))
+              (when (= i 30)
+                (set-buffer-multibyte nil))
+              (if (zerop (random 2))
+                  (editfns-tests--check-lines)
+                (save-restriction
+                  (narrow-to-region (min from to (point-max))
+                                    (min (max from to) (point-max)))
+                  (editfns-tests--check-lines)))))
+        (kill-buffer indirect)))
+    (should-error (buffer-line-position 0) :type 'args-out-of-range)))
+
+(ert-deftest editfns-tests-line-number-selective-display ()
+  "Check that carriage returns end lines when `selective-display' is t."
+  (with-temp-buffer
+    (insert "a\rb\nc\r\nd\re")
+    (should (= (line-number-at-pos (point-max)) 3))
+    (setq selective-display t)
+    (should (= (line-number-at-pos 1) 1))
+    (should (= (line-number-at-pos 3) 1))
+    (should (= (line-number-at-pos 5) 3))
+    (should (= (line-number-at-pos (point-max)) 4))
+    (narrow-to-region 5 (point-max))
+    (should (= (line-number-at-pos (point-max)) 2))
+    (should (= (line-number-at-pos (point-max) t) 4))))
+
 ;;; editfns-tests.el ends here
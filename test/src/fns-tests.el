@@ -860,6 +860,110 @@
        (puthash k k h)))
     (should (= 100 (hash-table-count h)))))
 
+;; Keep the keys of the tests below distinct under `eq', `eql' and
+;; `equal' alike, except for the strings, which only `equal' can tell
+;; apart from copies.
+(defun fns-tests--hash-table-key (test)
+  (let ((n (random 300)))
+    (pcase (random 3)
+      (0 n)
+      (1 (if (eq test 'eq) (- n) (* n 0.5)))
+      (_ (if (eq test 'equal) (format "k%d" n) (list n))))))
+
+(defun fns-tests--check-hash-table (h model)
+  "Check that hash table H has the entries of the alist MODEL."
+  (let ((seen nil))
+    (maphash (lambda (k v) (push (cons k v) seen)) h)
+    (should (equal (list (hash-table-count h) (length seen))
+                   (list (length model) (length model)))))
+  (should (equal (mapcar (lambda (entry) (gethash (car entry) h 'none))
+                         model)
+                 (mapcar #'cdr model))))
+
+(ert-deftest test-hash-table-random-operations ()
+  "Check hash tables against alists through random changes."
+  (random "fns-tests")
+  (dolist (test '(eq eql equal))
+    (dolist (threshold '(0.8125 1.0))
+      (let ((h (make-hash-table :test test :size 1
+                                :rehash-threshold threshold))
+            (model nil)
+            (keys nil))
+        (dotimes (i 3000)
+          (let ((key (if (and keys (zerop (random 3)))
+                         (nth (random (length keys)) keys)
+                       (fns-tests--hash-table-key test))))
+            (push key keys)
+            (let ((entry (assoc key model (symbol-function test))))
+              (if (zerop (random 3))
+                  (progn (remhash key h)
+                         (setq model (delq entry model)))
+                (puthash key i h)
+                (if entry
+                    (setcdr entry i)
+                  (push (cons key i) model)))))
+          (when (zerop (% i 300))
+            (fns-tests--check-hash-table h model)
+            (fns-tests--check-hash-table (copy-hash-table h) model)))
+        (fns-tests--check-hash-table h model)
+        (clrhash h)
+        (fns-tests--check-hash-table h nil)
+        (puthash 'a 1 h)
+        (fns-tests--check-hash-table h '((a . 1)))))))
+
+(ert-deftest test-hash-table-insertion-order ()
+  "Check that `maphash' visits new entries in order, and reuses freed ones."
+  (let ((h (make-hash-table :test 'equal :size 3))
+        (keys (mapcar (lambda (i) (format "%d" i)) (number-sequence 0 99)))
+        (order nil))
+    (dolist (key keys)
+      (puthash key t h))
+    (maphash (lambda (k _) (push k order)) h)
+    (should (equal (nreverse order) keys))
+    (remhash "50" h)
+    (puthash "new" t h)
+    (setq order nil)
+    (maphash (lambda (k _) (push k order)) h)
+    (should (equal (nth 50 (nreverse order)) "new"))))
+
+(ert-deftest test-hash-table-crowded-keys ()
+  "Check hash tables whose keys have hash codes close to each other."
+  (let ((h (make-hash-table :test 'equal))
+        (n 20000))
+    (dotimes (i n)
+      (puthash (format "key%d" i) i h)
+      (puthash i (- i) h))
+    (dotimes (i n)
+      (when (cl-oddp i)
+        (remhash (format "key%d" i) h)))
+    (should (= (hash-table-count h) (+ n (/ n 2))))
+    (dotimes (i n)
+      (should (eq (gethash (format "key%d" i) h 'none)
+                  (if (cl-oddp i) 'none i)))
+      (should (eq (gethash i h) (- i))))))
+
+(ert-deftest test-hash-table-weak-sweep ()
+  "Check that weak tables stay consistent when GC removes entries."
+  (dolist (weakness '(key value key-or-value key-and-value))
+    (let* ((h (make-hash-table :test 'eq :weakness weakness))
+           (kept nil))
+      (dotimes (i 2000)
+        (let ((key (list i)) (value (list (- i))))
+          (when (zerop (% i 3))
+            (push (cons key value) kept))
+          (puthash key value h)))
+      (garbage-collect)
+      (should (<= (length kept) (hash-table-count h)))
+      (dolist (entry kept)
+        (should (eq (gethash (car entry) h) (cdr entry))))
+      ;; Every remaining entry can still be found.
+      (let ((found 0))
+        (maphash (lambda (k v)
+                   (when (eq (gethash k h) v)
+                     (setq found (1+ found))))
+                 h)
+        (should (= found (hash-table-count h)))))))
+
 (ert-deftest test-sxhash-equal ()
   (should (= (sxhash-equal (* most-positive-fixnum most-negative-fixnum))
 	     (sxhash-equal (* most-positive-fixnum most-negative-fixnum))))
@@ -876,6 +980,24 @@
   (should (= (sxhash-equal (record 'a (make-string 10 ?a)))
 	     (sxhash-equal (record 'a (make-string 10 ?a))))))
 
+(ert-deftest test-sxhash-equal-strings ()
+  "Check the hash codes of strings of lengths around word sizes."
+  (let ((codes nil))
+    (dotimes (n 40)
+      (let ((s (make-string n ?a)))
+        (should (= (sxhash-equal s) (sxhash-equal (copy-sequence s))))
+        (push (sxhash-equal s) codes)
+        ;; Changing any byte, the last one included, changes the hash.
+        (when (> n 0)
+          (dolist (i (list 0 (/ n 2) (1- n)))
+            (let ((t1 (copy-sequence s)))
+              (aset t1 i ?b)
+              (should-not (= (sxhash-equal t1) (sxhash-equal s))))))))
+    ;; Strings of NUL bytes differ only by their lengths.
+    (dotimes (n 40)
+      (push (sxhash-equal (make-string n 0)) codes))
+    (should (= (length (delete-dups codes)) 79))))
+
 (ert-deftest test-secure-hash ()
   (should (equal (secure-hash 'md5    "foobar")
                  "3858f62230ac3c915f300c664312c63f"))
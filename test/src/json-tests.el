@@ -308,5 +308,191 @@ Test with both unibyte and multibyte strings."
     (puthash 1 2 table)
     (should-error (json-serialize table) :type 'wrong-type-argument)))
 
+;; The parser reads buffer text on both sides of the gap.
+(ert-deftest json-parse-buffer/gap ()
+  (let ((json "[\"abcdefghijklmnop\\n\", \"αβγδ\", 12345, {\"key\": -6.5e3}]")
+        (lisp ["abcdefghijklmnop\n" "αβγδ" 12345 ((key . -6500.0))]))
+    (dolist (multibyte '(t nil))
+      (dotimes (i (length json))
+        (with-temp-buffer
+          (set-buffer-multibyte multibyte)
+          (insert (if multibyte json (encode-coding-string json 'utf-8)))
+          ;; Put the gap at each byte of the JSON text.
+          (goto-char (1+ i))
+          (insert "x")
+          (delete-char -1)
+          (goto-char 1)
+          (should (equal (json-parse-buffer :object-type 'alist) lisp))
+          (should (eobp)))))))
+
+(ert-deftest json-parse-buffer/state ()
+  (let ((state (json-make-parse-state))
+        (json "{\"a\": [1, \"]}\\\"\", {\"b\": null}],\n \"c\": \"\\\\\"}")
+        (lisp '(:a [1 "]}\"" (:b :null)] :c "\\")))
+    (with-temp-buffer
+      ;; Add the text a byte at a time, as a process filter would.
+      (dotimes (i (length json))
+        (goto-char (point-max))
+        (insert (aref json i))
+        (goto-char 1)
+        (if (< i (1- (length json)))
+            (should (eq (car (should-error (json-parse-buffer :state state)
+                                           :type 'json-end-of-file))
+                        'json-end-of-file))
+          (should (equal (json-parse-buffer :state state :object-type 'plist)
+                         lisp))
+          (should (eobp))))
+      ;; The state doesn't apply to the next value.
+      (save-excursion (insert "\n[2"))
+      (should-error (json-parse-buffer :state state) :type 'json-end-of-file)
+      (save-excursion (goto-char (point-max)) (insert "]"))
+      (should (equal (json-parse-buffer :state state) [2]))
+      (save-excursion (insert " x"))
+      (should-error (json-parse-buffer :state state) :type 'json-parse-error))
+    (should-error (json-parse-buffer :state 'foo)
+                  :type 'wrong-type-argument)))
+
+(ert-deftest json-parse-buffer/state-after-change ()
+  (let ((state (json-make-parse-state)))
+    (with-temp-buffer
+      (insert "[[[[1")
+      (goto-char 1)
+      (should-error (json-parse-buffer :state state) :type 'json-end-of-file)
+      (erase-buffer)
+      (insert "[1,2,3]")
+      (goto-char 1)
+      (should (equal (json-parse-buffer :state state) [1 2 3]))
+      (erase-buffer)
+      (insert "[[1")
+      (goto-char 1)
+      (should-error (json-parse-buffer :state state) :type 'json-end-of-file)
+      ;; Change the text before the end without changing its size.
+      (subst-char-in-region 1 3 ?\[ ?\s)
+      (save-excursion (goto-char (point-max)) (insert "[]"))
+      (should-error (json-parse-buffer :state state) :type 'json-parse-error)
+      (erase-buffer)
+      (insert "[[1")
+      (goto-char 1)
+      (should-error (json-parse-buffer :state state) :type 'json-end-of-file)
+      (save-excursion (goto-char 3) (delete-char -1) (goto-char (point-max))
+                      (insert "]"))
+      (should (equal (json-parse-buffer :state state) [1])))))
+
+(ert-deftest json-parse-buffer/state-scalar ()
+  (let ((state (json-make-parse-state)))
+    (with-temp-buffer
+      (insert "\"hello\"")
+      (goto-char 1)
+      (should-error (json-parse-buffer :state state) :type 'json-parse-error)
+      (erase-buffer)
+      (insert "\"hel")
+      (goto-char 1)
+      (should-error (json-parse-buffer :state state) :type 'json-parse-error))))
+
+(ert-deftest json-parse-string/numbers ()
+  (should (equal (json-parse-string
+                  "[0, -0, 1.5, -2e3, 4E-2, 123456789012345678, 1e400]")
+                 (vector 0 0 1.5 -2000.0 0.04 123456789012345678 1.0e+INF)))
+  (should (equal (json-parse-string "[123456789012345678901234567890]")
+                 [123456789012345678901234567890]))
+  (dolist (bad '("[01]" "[1.]" "[.5]" "[1e]" "[-]" "[+1]" "[0x1]"))
+    (should-error (json-parse-string bad) :type 'json-parse-error)))
+
+(ert-deftest json-serialize/numbers ()
+  (should (equal (json-serialize [0.1 1.0 -0.0 1e20 123456789012345678901234567890])
+                 "[0.1,1.0,-0.0,1e+20,123456789012345678901234567890]"))
+  (should-error (json-serialize [1.0e+INF]) :type 'wrong-type-argument)
+  (should-error (json-serialize [0.0e+NaN]) :type 'wrong-type-argument))
+
+(ert-deftest json-parse-string/duplicate-keys ()
+  "Check that the last value of a key counts, at the place of its first."
+  (dolist (n '(3 20))
+    (let* ((keys (number-sequence 1 n))
+           (json (concat "{"
+                         (mapconcat (lambda (i) (format "\"k%d\": %d" i i))
+                                    keys ", ")
+                         ", \"k2\": \"last\"}")))
+      (should (equal (json-parse-string json :object-type 'alist)
+                     (mapcar (lambda (i)
+                               (cons (intern (format "k%d" i))
+                                     (if (= i 2) "last" i)))
+                             keys)))
+      (let ((table (json-parse-string json)))
+        (should (= (hash-table-count table) n))
+        (should (equal (gethash "k2" table) "last"))))))
+
+(ert-deftest json-serialize/duplicate-keys ()
+  (let ((alist (mapcar (lambda (i) (cons (intern (format "k%d" (% i 13))) i))
+                       (number-sequence 0 40))))
+    (should (equal (json-parse-string (json-serialize alist)
+                                      :object-type 'alist)
+                   (seq-take alist 13)))))
+
+(ert-deftest json-roundtrip/random ()
+  "Serialize and parse random objects."
+  (let ((random-string
+         (lambda ()
+           (apply #'string
+                  (mapcar (lambda (_)
+                            (pcase (random 4)
+                              (0 (1+ (random 127)))
+                              (1 (+ #x80 (random #x700)))
+                              (2 (+ #xE000 (random #x1000)))
+                              (_ (+ #x10000 (random #x10000)))))
+                          (make-list (random 30) nil))))))
+    (cl-labels ((random-value
+                 (depth)
+                 (pcase (random (if (> depth 3) 5 7))
+                   (0 (funcall random-string))
+                   (1 (- (random 2000000) 1000000))
+                   (2 (/ (random 1000000) 128.0))
+                   (3 (nth (random 3) '(t :null :false)))
+                   (4 (funcall random-string))
+                   (5 (apply #'vector
+                             (mapcar (lambda (_) (random-value (1+ depth)))
+                                     (make-list (random 6) nil))))
+                   (_ (let ((i 0))
+                        (mapcar (lambda (_)
+                                  (cons (intern (format "key%d" (cl-incf i)))
+                                        (random-value (1+ depth))))
+                                (make-list (random 6) nil)))))))
+      (dotimes (_ 200)
+        (let* ((value (vector (random-value 0)))
+               (json (json-serialize value)))
+          (should (equal (json-parse-string json :object-type 'alist)
+                         value))
+          (with-temp-buffer
+            (json-insert value)
+            (should (equal (buffer-string) json))
+            (goto-char 1)
+            (should (equal (json-parse-buffer :object-type 'alist) value))))))))
+
+(ert-deftest json-parse-buffer/benchmark ()
+  "Measure parsing and serializing a large JSON text."
+  :tags '(:expensive-test)
+  (let* ((item (json-parse-string
+                "{\"uri\": \"file:///home/user/src/project/module.c\",
+                  \"range\": {\"start\": {\"line\": 120, \"character\": 4},
+                             \"end\": {\"line\": 120, \"character\": 17}},
+                  \"message\": \"unused variable ‘x’\", \"severity\": 2,
+                  \"tags\": [1], \"deprecated\": false}"
+                :object-type 'plist))
+         (value (make-vector 100000 item))
+         json)
+    (message "json-serialize: %.3fs"
+             (car (benchmark-run 5 (setq json (json-serialize value)))))
+    (message "json-parse-string over %d bytes: %.3fs"
+             (string-bytes json)
+             (car (benchmark-run 5 (json-parse-string json
+                                                      :object-type 'plist))))
+    (with-temp-buffer
+      (insert json)
+      (message "json-parse-buffer: %.3fs"
+               (car (benchmark-run 5
+                      (goto-char 1)
+                      (json-parse-buffer :object-type 'plist))))
+      (goto-char 1)
+      (should (equal (json-parse-buffer :object-type 'plist) value)))))
+
 (provide 'json-tests)
 ;;; json-tests.el ends here
@@ -57,4 +57,166 @@
     (set-marker marker-2 marker-1)
     (should (goto-char marker-2))))
 
+;; Converting between character and byte positions.
+
+(defun marker-tests--random-text (n)
+  "Return a string of N random characters of various byte lengths."
+  (with-temp-buffer
+    (dotimes (_ n)
+      (insert (aref "xxxxé中😀\n" (random 8))))
+    (buffer-string)))
+
+(defun marker-tests--bytes (pos)
+  "Return the byte position of POS, counted from the beginning."
+  (save-restriction
+    (widen)
+    (1+ (string-bytes (buffer-substring-no-properties (point-min) pos)))))
+
+(defun marker-tests--check-positions ()
+  "Check conversions at random positions of the current buffer."
+  (dotimes (_ 5)
+    (let* ((pos (1+ (random (1+ (buffer-size)))))
+           (bytes (marker-tests--bytes pos)))
+      (should (= (position-bytes pos) bytes))
+      (should (= (byte-to-position bytes) pos)))))
+
+(ert-deftest marker-tests-position-bytes ()
+  "Check conversions between character and byte positions while editing."
+  (with-temp-buffer
+    (insert (marker-tests--random-text 300000))
+    (let ((markers (mapcar (lambda (_) (copy-marker (1+ (random (buffer-size)))))
+                           (make-list 1000 nil)))
+          (indirect (make-indirect-buffer (current-buffer) " *indirect*")))
+      (unwind-protect
+          (dotimes (i 60)
+            (let ((from (1+ (random (buffer-size))))
+                  (to (1+ (random (buffer-size)))))
+              (pcase (random 6)
+                (0 (goto-char from)
+                   (insert (marker-tests--random-text (random 70000))))
+                (1 (delete-region from (min (point-max) (+ from (random 20000)))))
+                (2 (with-current-buffer indirect
+                     (goto-char from)
+                     (insert (marker-tests--random-text (random 1000)))))
+                (3 (subst-char-in-region (min from to) (max from to) ?x ?y))
+                (4 (let ((a (sort (list from to (1+ (random (buffer-size)))
+                                        (1+ (random (buffer-size))))
+                                  #'<)))
+                     (transpose-regions (nth 0 a) (nth 1 a) (nth 2 a) (nth 3 a)
+                                        (zerop (random 2)))))
+                (5 (goto-char from)
+                   (upcase-region from (min (point-max) (+ from 1000))))))
+            (when (= i 30)
+              (set-buffer-multibyte nil)
+              (marker-tests--check-positions)
+              (set-buffer-multibyte t))
+            ;; Keep point and the gap away from the positions to check.
+            (goto-char (point-min))
+            (marker-tests--check-positions)
+            (dolist (m markers)
+              (should (<= (point-min) m (point-max)))))
+        (kill-buffer indirect)))))
+
+(ert-deftest marker-tests-position-bytes-benchmark ()
+  "Measure conversions between positions in a buffer with many markers."
+  :tags '(:expensive-test)
+  (with-temp-buffer
+    (insert (marker-tests--random-text 1000000))
+    (let ((text (buffer-string)))
+      (dotimes (_ 9)
+        (insert text)))
+    (let ((markers (mapcar (lambda (_) (copy-marker (1+ (random (buffer-size)))))
+                           (make-list 100000 nil)))
+          (positions (mapcar (lambda (_) (1+ (random (buffer-size))))
+                             (make-list 1000 nil))))
+      (goto-char (point-min))
+      (message "%d conversions with %d markers over %d characters: %.3fs"
+               (* 2 (length positions)) (length markers) (buffer-size)
+               (car (benchmark-run 1
+                      (dolist (pos positions)
+                        (should (= (byte-to-position (position-bytes pos))
+                                   pos))))))
+      (setcdr (nthcdr 99 positions) nil)
+      (message "%d conversions after as many insertions: %.3fs"
+               (length positions)
+               (car (benchmark-run 1
+                      (dolist (pos positions)
+                        (goto-char pos)
+                        (insert "é")
+                        (position-bytes (- (point-max) pos)))))))))
+
+;; Keeping markers in a tree.
+
+(defun marker-tests--check-markers (markers)
+  "Check MARKERS, a list of (MARKER . POSITION), against their positions."
+  (should (equal (mapcar (lambda (elt) (marker-position (car elt))) markers)
+                 (mapcar #'cdr markers)))
+  (should (equal (delq nil (mapcar (lambda (elt)
+                                     (buffer-has-markers-at (cdr elt)))
+                                   markers))
+                 (make-list (length markers) t))))
+
+(ert-deftest marker-tests-adjust ()
+  "Check the adjustment of many markers to random insertions and deletions."
+  (with-temp-buffer
+    (insert (make-string 2000 ?x))
+    (let ((markers nil))
+      (dotimes (_ 500)
+        (let ((pos (1+ (random (1+ (buffer-size))))))
+          (push (cons (copy-marker pos (zerop (random 2))) pos) markers)))
+      (dotimes (i 300)
+        (let ((from (1+ (random (1+ (buffer-size)))))
+              (n (random 50)))
+          (pcase (random 5)
+            (0 (goto-char from)
+               (insert (make-string n ?y))
+               (dolist (elt markers)
+                 (when (or (> (cdr elt) from)
+                           (and (= (cdr elt) from)
+                                (marker-insertion-type (car elt))))
+                   (setcdr elt (+ (cdr elt) n)))))
+            (1 (goto-char from)
+               (insert-before-markers (make-string n ?y))
+               (dolist (elt markers)
+                 (when (>= (cdr elt) from)
+                   (setcdr elt (+ (cdr elt) n)))))
+            (2 (let ((to (min (point-max) (+ from n))))
+                 (delete-region from to)
+                 (dolist (elt markers)
+                   (setcdr elt (cond ((> (cdr elt) to)
+                                      (- (cdr elt) (- to from)))
+                                     ((> (cdr elt) from) from)
+                                     (t (cdr elt)))))))
+            (3 (let ((elt (nth (random (length markers)) markers)))
+                 (set-marker (car elt) from)
+                 (setcdr elt from)))
+            (4 (let ((elt (nth (random (length markers)) markers)))
+                 ;; Forget about a marker, and let GC take it.
+                 (setq markers (delq elt markers))
+                 (when (zerop (random 2))
+                   (set-marker (car elt) nil)))))
+          (when (zerop (% i 50))
+            (garbage-collect))
+          (marker-tests--check-markers markers))))))
+
+(ert-deftest marker-tests-adjust-benchmark ()
+  "Measure editing a buffer with many markers."
+  :tags '(:expensive-test)
+  (with-temp-buffer
+    (insert (make-string 1000000 ?x))
+    (let ((markers (mapcar (lambda (_) (copy-marker (1+ (random (buffer-size)))))
+                           (make-list 100000 nil))))
+      (message "1000 insertions and deletions with %d markers: %.3fs"
+               (length markers)
+               (car (benchmark-run 1
+                      (dotimes (_ 1000)
+                        (goto-char (1+ (random (buffer-size))))
+                        (insert "abc")
+                        (delete-char -2)))))
+      (message "Unchaining %d markers: %.3fs"
+               (length markers)
+               (car (benchmark-run 1
+                      (dolist (m markers)
+                        (set-marker m nil))))))))
+
 ;;; marker-tests.el ends here.
@@ -0,0 +1,129 @@
+;;; pdumper-tests.el --- tests for pdumper.c functions -*- lexical-binding: t -*-
+
+;; Copyright (C) 2020 Free Software Foundation, Inc.
+
+;; This file is part of GNU Emacs.
+
+;; GNU Emacs is free software: you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; GNU Emacs is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.
+
+;;; Code:
+
+(require 'ert)
+
+(defun pdumper-tests--dump-file ()
+  "Return the name of the dump file this Emacs started from, or nil."
+  (let ((file (and (fboundp 'pdumper-stats)
+                   (cdr (assq 'dump-file-name (pdumper-stats))))))
+    (and file (file-readable-p file) file)))
+
+(defun pdumper-tests--run (dump-file form)
+  "Evaluate FORM in a batch Emacs started from DUMP-FILE.
+Return a cons of the exit status and the output of that Emacs."
+  (with-temp-buffer
+    (let ((status
+           (call-process (expand-file-name invocation-name
+                                           invocation-directory)
+                         nil t nil "--batch" "-Q" "--dump-file" dump-file
+                         "--eval" (prin1-to-string form))))
+      (cons status (buffer-string)))))
+
+(defun pdumper-tests--make-overlay-dump (dir)
+  "Make an overlay dump in the directory DIR.
+Copy the dump file of this Emacs there as \"base.pdmp\", and make
+\"overlay.pdmp\" in an Emacs started from that copy, after changing
+some of its variables, functions and buffers."
+  (let ((base (expand-file-name "base.pdmp" dir))
+        (overlay (expand-file-name "overlay.pdmp" dir)))
+    (copy-file (pdumper-tests--dump-file) base)
+    (should (equal (car (pdumper-tests--run
+                         base
+                         `(progn
+                            (defvar pdumper-tests--list (list 1 "two" 3.0))
+                            (setq-default fill-column 91)
+                            (defun pdumper-tests--double (x) (* 2 x))
+                            (defvar pdumper-tests--table
+                              (make-hash-table :test 'equal))
+                            (dotimes (i 100)
+                              (puthash (format "key%d" i) i
+                                       pdumper-tests--table))
+                            (with-current-buffer
+                                (get-buffer-create "pdumper-tests")
+                              (insert "Dumped text"))
+                            (dump-emacs-portable ,overlay nil t))))
+                   0))
+    (should (< (file-attribute-size (file-attributes overlay))
+               (file-attribute-size (file-attributes base))))))
+
+(ert-deftest pdumper-tests-overlay-dump ()
+  "Check that an overlay dump restores what changed since the base dump."
+  (skip-unless (pdumper-tests--dump-file))
+  (let ((dir (make-temp-file "pdumper-tests" t)))
+    (unwind-protect
+        (progn
+          (pdumper-tests--make-overlay-dump dir)
+          (let ((result
+                 (pdumper-tests--run
+                  (expand-file-name "overlay.pdmp" dir)
+                  '(progn
+                     (garbage-collect)
+                     (princ
+                      (format
+                       "\n%S\n"
+                       (list pdumper-tests--list
+                             (default-value 'fill-column)
+                             (pdumper-tests--double 21)
+                             (gethash "key42" pdumper-tests--table)
+                             (hash-table-count pdumper-tests--table)
+                             (with-current-buffer "pdumper-tests"
+                               (buffer-string))
+                             (file-name-nondirectory
+                              (cdr (assq 'base-dump-file-name
+                                         (pdumper-stats)))))))))))
+            (should (equal (car result) 0))
+            (should (equal (car (read-from-string
+                                 (cdr result)
+                                 (string-match "^(" (cdr result))))
+                           '((1 "two" 3.0) 91 42 42 100 "Dumped text"
+                             "base.pdmp")))))
+      (delete-directory dir t))))
+
+(ert-deftest pdumper-tests-overlay-dump-bad-base ()
+  "Check that an overlay dump is not loaded with another base dump."
+  (skip-unless (pdumper-tests--dump-file))
+  (let* ((dir (make-temp-file "pdumper-tests" t))
+         (base (expand-file-name "base.pdmp" dir))
+         (overlay (expand-file-name "overlay.pdmp" dir)))
+    (unwind-protect
+        (progn
+          (pdumper-tests--make-overlay-dump dir)
+          ;; Put another dump in place of the base dump.
+          (should (equal (car (pdumper-tests--run
+                               base
+                               `(progn
+                                  (defvar pdumper-tests--other t)
+                                  (dump-emacs-portable ,(concat base "2")))))
+                         0))
+          (rename-file (concat base "2") base t)
+          (let ((result (pdumper-tests--run overlay '(kill-emacs 0))))
+            (should-not (equal (car result) 0))
+            (should (string-search "base dump file missing or changed"
+                                   (cdr result))))
+          (delete-file base)
+          (let ((result (pdumper-tests--run overlay '(kill-emacs 0))))
+            (should-not (equal (car result) 0))
+            (should (string-search "base dump file missing or changed"
+                                   (cdr result)))))
+      (delete-directory dir t))))
+
+;;; pdumper-tests.el ends here
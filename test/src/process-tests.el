@@ -182,6 +182,169 @@
         (accept-process-output proc))   ; Read "Two".
       (should (equal (buffer-string) "0> one\n1> two\n2> ")))))
 
+;; Output framed by `Content-Length' headers, as JSON-RPC servers
+;; send it.
+(defun process-tests--frame (body)
+  (format "Content-Length: %d\r\n\r\n%s" (string-bytes body) body))
+
+(ert-deftest process-test-message-framing ()
+  "Test splitting the output of a process into JSON messages."
+  (skip-unless (executable-find "cat"))
+  (let* ((messages nil)
+         (proc (make-process :name "test proc" :command '("cat")
+                             :connection-type 'pipe :coding 'binary
+                             :filter (lambda (_proc message)
+                                       (push message messages))))
+         (body (encode-coding-string "{\"a\": [1, \"é\"]}" 'utf-8))
+         (stream (concat (process-tests--frame body)
+                         "Content-Type: json\r\ncontent-length:  "
+                         (number-to-string (length body)) " \r\n\r\n"
+                         body
+                         (process-tests--frame "[1,")
+                         "X: y\r\n\r\n"
+                         (process-tests--frame "[]")
+                         (process-tests--frame "[true]"))))
+    (unwind-protect
+        (progn
+          (set-process-query-on-exit-flag proc nil)
+          (should-error (set-process-message-framing proc 'foo))
+          (should-error (set-process-message-framing
+                         proc 'content-length :object-type 'foo))
+          (set-process-message-framing proc 'content-length
+                                       :object-type 'alist)
+          (should (equal (process-message-framing proc)
+                         '(content-length :object-type alist)))
+          ;; Send the messages in small pieces.
+          (let ((i 0))
+            (while (< i (length stream))
+              (process-send-string
+               proc (substring stream i (min (+ i 7) (length stream))))
+              (setq i (+ i 7))))
+          (let ((deadline (+ (float-time) 10)))
+            (while (and (< (length messages) 6) (< (float-time) deadline))
+              (accept-process-output proc 1)))
+          (should (equal (nreverse messages)
+                         '(((a . [1 "é"])) ((a . [1 "é"])) "[1,"
+                           "X: y\r\n\r\n" [] [t])))
+          (set-process-message-framing proc nil)
+          (should-not (process-message-framing proc)))
+      (delete-process proc))))
+
+;; The default filter decodes the output straight into the buffer.
+(ert-deftest process-test-default-filter-insertion ()
+  "Test inserting output split in the middle of characters."
+  (skip-unless (executable-find "cat"))
+  (dolist (test '((utf-8-unix "aé€\r\n𝄞b\n" "aé€\r\n𝄞b\n")
+                  (utf-8 "aé€\r\n𝄞b\r\n" "aé€\n𝄞b\n")
+                  (latin-1 "aé\nb" "aé\nb")))
+    (with-temp-buffer
+      (insert "<>")
+      (let* ((text (apply #'concat (make-list 500 (nth 1 test))))
+             (stream (encode-coding-string text (car test)))
+             (proc (make-process :name "test proc" :command '("cat")
+                                 :buffer (current-buffer)
+                                 :connection-type 'pipe
+                                 :coding (car test)
+                                 :sentinel #'ignore))
+             (marker (copy-marker 2))
+             (overlay (make-overlay 1 2))
+             (changes 0))
+        (add-hook 'after-change-functions
+                  (lambda (beg end _len)
+                    (setq changes (+ changes (- end beg))))
+                  nil t)
+        (set-marker (process-mark proc) 2)
+        (goto-char (point-min))
+        (unwind-protect
+            (progn
+              (set-process-query-on-exit-flag proc nil)
+              (let ((i 0))
+                (while (< i (length stream))
+                  (process-send-string
+                   proc (substring stream i (min (+ i 7) (length stream))))
+                  (setq i (+ i 7))))
+              (process-send-eof proc)
+              (while (accept-process-output proc 10)))
+          (delete-process proc))
+        (let ((expected (apply #'concat (make-list 500 (nth 2 test)))))
+          (should (equal (buffer-substring 2 (1- (point-max))) expected))
+          (should (= (point) (point-min)))
+          (should (= (process-mark proc) (1- (point-max))))
+          (should (= marker (process-mark proc)))
+          (should (= (overlay-end overlay) (process-mark proc)))
+          (should (= changes (length expected))))))))
+
+(ert-deftest process-test-send-callback ()
+  "Test sending text to a process without waiting for it."
+  (skip-unless (executable-find "cat"))
+  (dolist (coding '(utf-8-unix utf-8-dos iso-2022-7bit))
+    (with-temp-buffer
+      (let* ((text (apply #'concat (make-list 20000 "aé€\nあ漢b\n")))
+             (output (generate-new-buffer " *output*"))
+             (proc (make-process :name "test proc" :command '("cat")
+                                 :buffer output
+                                 :connection-type 'pipe
+                                 :coding coding
+                                 :sentinel #'ignore))
+             (done nil))
+        (insert text)
+        (unwind-protect
+            (progn
+              (set-process-query-on-exit-flag proc nil)
+              (process-send-string proc text
+                                   (lambda (p) (push (list 'string p) done)))
+              ;; The pipe can't take all of it at once.
+              (should-not done)
+              (process-send-region proc (point-min) (point-max)
+                                   (lambda (p) (push (list 'region p) done)))
+              ;; The region is sent as it was when it was queued.
+              (erase-buffer)
+              (process-send-string proc "end\n")
+              (should (equal done `((region ,proc) (string ,proc))))
+              (process-send-eof proc)
+              (while (accept-process-output proc 10))
+              (with-current-buffer output
+                (should (equal (buffer-substring-no-properties
+                                (point-min) (point-max))
+                               (concat text text "end\n")))))
+          (delete-process proc)
+          (kill-buffer output))))))
+
+(ert-deftest process-test-many-idle-processes ()
+  "Test waiting for output while many processes are idle.
+Descriptors of deleted processes are reused by new ones."
+  (skip-unless (executable-find "cat"))
+  (let ((idle nil)
+        (output nil))
+    (unwind-protect
+        (let ((make (lambda (filter)
+                      (let ((proc (make-process :name "test proc"
+                                                :command '("cat")
+                                                :connection-type 'pipe
+                                                :filter filter
+                                                :sentinel #'ignore)))
+                        (set-process-query-on-exit-flag proc nil)
+                        proc))))
+          (dotimes (_ 50)
+            (push (funcall make #'ignore) idle))
+          (dotimes (i 20)
+            ;; Replace an idle process, and talk to a new process that
+            ;; may get the descriptors of the one just deleted.
+            (delete-process (pop idle))
+            (setq idle (append idle (list (funcall make #'ignore))))
+            (let* ((done nil)
+                   (proc (funcall make (lambda (_proc string)
+                                         (push string output)
+                                         (setq done t)))))
+              (process-send-string proc (format "%d\n" i))
+              (while (and (not done) (accept-process-output proc 10)))
+              (should done)
+              (delete-process proc)))
+          (should (equal (apply #'concat (nreverse output))
+                         (mapconcat (lambda (i) (format "%d\n" i))
+                                    (number-sequence 0 19) ""))))
+      (mapc #'delete-process idle))))
+
 (ert-deftest start-process-should-not-modify-arguments ()
   "`start-process' must not modify its arguments in-place."
   ;; See bug#21831.
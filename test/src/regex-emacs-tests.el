@@ -803,4 +803,133 @@ This evaluates the TESTS test cases from glibc."
   (should-not (string-match "å" "\xe5"))
   (should-not (string-match "[å]" "\xe5")))
 
+(ert-deftest regexp-partial-string-at-end ()
+  "Test that a string cut off by the end of the text is not matched."
+  (should (equal (string-match "\\(?:ab\\)*" "a") 0))
+  (should (equal (match-end 0) 0))
+  (should (equal (string-match "\\(?:ab\\)*" "ba" 1) 1))
+  (should (equal (match-end 0) 1))
+  (should (equal (string-match "x\\(?:ab\\)*" "xaba") 0))
+  (should (equal (match-end 0) 3))
+  (should (equal (string-match "\\(?:éb\\)*" "éé") 0))
+  (should (equal (match-end 0) 0))
+  (with-temp-buffer
+    (insert "xa")
+    (goto-char (point-min))
+    (should (looking-at "x\\(?:ab\\)*"))
+    (should (equal (match-end 0) 2))))
+
+(ert-deftest regexp-search-required-string ()
+  "Test searching for regexps that every match of which contains a string."
+  (let ((case-fold-search nil))
+    (with-temp-buffer
+      (insert "foo\nbar baz\nx TODO: y\n\u00e9t\u00e9 TODO:z\n")
+      ;; Put the gap in the middle of a string to look for.
+      (goto-char 20)
+      (insert "Q")
+      (delete-char -1)
+      (goto-char (point-min))
+      (should (re-search-forward "TODO:.*" nil t))
+      (should (equal (match-string 0) "TODO: y"))
+      (should (re-search-forward "TODO:.*" nil t))
+      (should (equal (match-string 0) "TODO:z"))
+      (should-not (re-search-forward "TODO:.*" nil t))
+      ;; The match can start before the string, but not before the
+      ;; newline that precedes it.
+      (goto-char (point-min))
+      (should (re-search-forward "[^ \n]* TODO:" nil t))
+      (should (equal (match-string 0) "x TODO:"))
+      (should (re-search-forward "[^ \n]* TODO:" nil t))
+      (should (equal (match-string 0) "\u00e9t\u00e9 TODO:"))
+      ;; Here it can start before the newline.
+      (goto-char (point-min))
+      (should (re-search-forward "bar[^x]*x TODO" nil t))
+      (should (= (match-beginning 0) 5))
+      (goto-char (point-min))
+      (should (re-search-forward "\\(?:baz\\|qux\\)\n" nil t))
+      (should (= (match-beginning 0) 9))))
+  (should (= (string-match "b\\(?:c\\|d\\)*e" "abcdcdeb") 1))
+  (should-not (string-match "ab*c" "abbbbd"))
+  (should (= (string-match "x\\{2\\}y" "xyxxy") 2)))
+
+;; The cache of compiled regexps lives in search.c.
+(ert-deftest regexp-cache ()
+  "Test the hit and miss counters and the resizing of the regexp cache."
+  (let ((regexps (mapcar (lambda (i) (format "x%dy" i)) (number-sequence 0 99)))
+        (regexp-cache-size 200))
+    (dolist (re regexps)
+      (should-not (string-match re "")))
+    (let ((hits regexp-cache-hits)
+          (misses regexp-cache-misses))
+      (dolist (re regexps)
+        (should (string-match re (concat "a" re))))
+      (should (= regexp-cache-hits (+ hits 100)))
+      (should (= regexp-cache-misses misses)))
+    ;; The same regexp compiled without case folding is another entry.
+    (let ((misses regexp-cache-misses)
+          (case-fold-search (not case-fold-search)))
+      (should (string-match "x0y" "ax0y"))
+      (should (= regexp-cache-misses (1+ misses))))
+    (let ((regexp-cache-size 10)
+          (misses regexp-cache-misses))
+      (dolist (re regexps)
+        (should (string-match re (concat "a" re))))
+      (should (= regexp-cache-misses (+ misses 100))))))
+
+;; The automaton that matches without backtracking lives in
+;; regex-emacs.c too.
+(defconst regex-tests-automaton-regexps
+  '("a*" "\\(ab\\)*" "\\(?:ab\\)*" "a+b" "\\(a\\|ab\\)\\(c\\|bcd\\)\\(d*\\)"
+    "\\(a\\|aa\\)*b" "\\(a*\\)*b" "\\(a*\\)+$" "\\(?:\\(a\\)\\|b\\)*"
+    "\\(a\\|\\(b\\)??\\)+" "\\(\\(?:a\\|.\\)\\|\\(b\\)??\\)+" "a*?b" "\\(a+?\\)\\(a*\\)"
+    "a??b" "^\\(a\\|b\\)+$" "\\`a\\|b\\'" "[^a\n]+" "[[:alpha:]]+ [[:space:]]*"
+    "\\(é\\|ü\\)+" "\\cg*a" "\\Cg+" "\\(\\)" "" "$" "^" "\n\\(.*\\)")
+  "Regexps whose matches the automaton must find as backtracking does.")
+
+(defconst regex-tests-automaton-texts
+  '("" "a" "ab" "aab" "abcd" "abcdd" "aaab\nab" "ba ba\n b" "\nééüa"
+    "AbA aB\n" "αβa")
+  "Texts on which to compare the automaton with backtracking.")
+
+(defun regex-tests-automaton-compare (fun)
+  "Check that FUN returns the same with and without the automaton."
+  (should (equal (let ((regexp-automaton-matching nil)) (funcall fun))
+                 (let ((regexp-automaton-matching t)) (funcall fun)))))
+
+(ert-deftest regexp-automaton-matching ()
+  "Test that matching with the automaton finds what backtracking finds."
+  (dolist (case-fold-search '(nil t))
+    (dolist (re regex-tests-automaton-regexps)
+      (dolist (text regex-tests-automaton-texts)
+        (dolist (string (list text (encode-coding-string text 'utf-8)))
+          (dotimes (start (1+ (length string)))
+            (regex-tests-automaton-compare
+             (lambda () (and (string-match re string start) (match-data))))))
+        (with-temp-buffer
+          (insert text)
+          ;; Put the gap in the middle of the text.
+          (goto-char (/ (point-max) 2))
+          (insert "x")
+          (delete-char -1)
+          (dotimes (i (1+ (buffer-size)))
+            (dolist (fun (list (lambda () (re-search-forward re nil t))
+                               (lambda () (re-search-backward re nil t))
+                               (lambda () (looking-at re))))
+              (regex-tests-automaton-compare
+               (lambda ()
+                 (goto-char (1+ i))
+                 (and (funcall fun) (match-data t)))))))))))
+
+(ert-deftest regexp-automaton-matching-fallback ()
+  "Test that the automaton takes over when backtracking takes too long."
+  (let ((regexp-automaton-matching 'fallback))
+    (should-not (string-match "\\(a\\|aa\\)*b" (make-string 5000 ?a)))
+    (should (= (string-match "\\(?:x\\|y\\)*[zw]"
+                             (concat (make-string 200000 ?x) "z"))
+               0))
+    (should (= (match-end 0) 200001)))
+  (let ((regexp-automaton-matching nil))
+    (should-error (string-match "\\(?:x\\|y\\)*[zw]"
+                                (concat (make-string 200000 ?x) "z")))))
+
 ;;; regex-emacs-tests.el ends here
@@ -0,0 +1,107 @@
+;;; search-tests.el --- tests for search.c functions -*- lexical-binding: t -*-
+
+;; Copyright (C) 2020 Free Software Foundation, Inc.
+
+;; This file is part of GNU Emacs.
+
+;; GNU Emacs is free software: you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; GNU Emacs is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with GNU Emacs.  If not, see <https://www.gnu.org/licenses/>.
+
+;;; Code:
+
+(require 'ert)
+
+(defun search-tests--random-lines (n)
+  "Insert N random lines, some of them empty and some very long."
+  (dotimes (_ n)
+    (insert (make-string (pcase (random 10)
+                           (0 0)
+                           (1 (random 20000))
+                           (_ (random 100)))
+                         (if (zerop (random 5)) ?é ?x))
+            "\n")))
+
+(defun search-tests--count-newlines (from to)
+  "Count the newlines between FROM and TO one at a time."
+  (save-excursion
+    (goto-char from)
+    (let ((n 0))
+      (while (search-forward "\n" to t)
+        (setq n (1+ n)))
+      n)))
+
+(ert-deftest search-tests-count-lines ()
+  "Check line counting and motion over many lines."
+  ;; Make the random lines and positions the same in every run.
+  (random "search-tests")
+  (dolist (cache '(nil t))
+    (with-temp-buffer
+      (setq cache-long-scans cache)
+      (search-tests--random-lines 2000)
+      (dotimes (_ 20)
+        ;; Move the gap somewhere random.
+        (goto-char (1+ (random (buffer-size))))
+        (insert "a")
+        (let* ((from (1+ (random (buffer-size))))
+               (to (1+ (random (buffer-size))))
+               (lo (min from to))
+               (hi (max from to))
+               (n (search-tests--count-newlines lo hi)))
+          (should (= (count-lines lo hi)
+                     (if (or (= lo hi) (= (char-before hi) ?\n))
+                         n
+                       (1+ n))))
+          ;; Moving by zero lines goes to the beginning of the line.
+          (when (> n 0)
+            (goto-char lo)
+            (should (= (forward-line n) 0))
+            (should (= (search-tests--count-newlines lo (point)) n))
+            (goto-char hi)
+            (should (= (forward-line (- n)) 0))
+            (should (bolp))
+            (should (= (search-tests--count-newlines (point) hi) n)))
+          (goto-char (point-min))
+          (should (= (forward-line (buffer-size))
+                     (- (buffer-size)
+                        (search-tests--count-newlines (point-min)
+                                                      (point-max))
+                        (if (bolp) 0 1)))))))))
+
+(ert-deftest search-tests-count-lines-benchmark ()
+  "Measure counting the lines of a large buffer."
+  :tags '(:expensive-test)
+  (with-temp-buffer
+    (dotimes (_ 200000)
+      (insert (make-string (random 200) ?x) "\n"))
+    (let ((text (buffer-string)))
+      (dotimes (_ 4)
+        (insert text)))
+    ;; Put the gap in the middle.
+    (goto-char (/ (point-max) 2))
+    (insert "\n")
+    (let ((lines (search-tests--count-newlines (point-min) (point-max)))
+          count)
+      (message "count-lines over %d bytes: %.3fs"
+               (buffer-size)
+               (car (benchmark-run 10
+                      (setq count (count-lines (point-min) (point-max))))))
+      (should (= count lines))
+      (goto-char (point-max))
+      (message "forward-line backwards over %d lines: %.3fs"
+               lines
+               (car (benchmark-run 10
+                      (goto-char (point-max))
+                      (forward-line (- lines)))))
+      (should (bobp)))))
+
+;;; search-tests.el ends here
@@ -72,4 +72,101 @@
     (should (equal (nth 0 posns) (nth 1 posns)))
     (should (equal (nth 1 posns) (nth 2 posns)))))
 
+(ert-deftest xdisp-tests--long-line-layout ()
+  "Laying out text in a long line gives the same results as usual."
+  (with-temp-buffer
+    (set-window-buffer nil (current-buffer))
+    (insert (make-string 2000000 ?x))
+    (let* ((from 1000017)
+           (layout (lambda ()
+                     (window-text-pixel-size nil from (+ from 1000)))))
+      ;; Starting the layout inside the line gives the same result as
+      ;; starting it at the beginning of the line.
+      (should (equal (funcall layout)
+                     (let ((long-line-threshold nil))
+                       (funcall layout)))))))
+
+(ert-deftest xdisp-tests--long-line-layout-time ()
+  "Laying out text in a long line takes time bounded by the window size."
+  :tags '(:expensive-test)
+  (with-temp-buffer
+    (set-window-buffer nil (current-buffer))
+    (insert (make-string 2000000 ?x))
+    (let* ((from 1000017)
+           (layout (lambda ()
+                     (window-text-pixel-size nil from (+ from 1000))))
+           (time (car (benchmark-run 5 (funcall layout))))
+           (full-time (let ((long-line-threshold nil))
+                        (car (benchmark-run 5 (funcall layout))))))
+      (should (< (* 10 time) full-time)))))
+
+(ert-deftest xdisp-tests--line-layout-cache ()
+  "Laying out the same text again gives the same results as before."
+  (with-temp-buffer
+    (set-window-buffer nil (current-buffer))
+    (dotimes (i 50)
+      (insert (make-string (* 7 i) ?x) "\t" (number-to-string i) "\n"))
+    (let* ((layout (lambda ()
+                     (list (window-text-pixel-size nil 1 (point-max))
+                           (window-text-pixel-size nil 300 4000)
+                           (window-text-pixel-size nil 1 (point-max) 50))))
+           (first (funcall layout)))
+      (should (equal (funcall layout) first))
+      (force-window-update)
+      (should (equal (funcall layout) first))
+      ;; Changes in the text and in overlays are seen.
+      (goto-char 500)
+      (insert (make-string 300 ?y) "\n")
+      (let ((second (funcall layout)))
+        (should-not (equal second first))
+        (force-window-update)
+        (should (equal (funcall layout) second))
+        (overlay-put (make-overlay 600 3000) 'invisible t)
+        (let ((third (funcall layout)))
+          (should-not (equal third second))
+          (force-window-update)
+          (should (equal (funcall layout) third)))))))
+
+;; A killed buffer's storage can be reused for a new buffer, which the
+;; line layout cache must not mistake for the killed one.
+(ert-deftest xdisp-tests--line-layout-cache-killed-buffer ()
+  "Laying out text in a new buffer doesn't use layouts of killed ones."
+  (dotimes (i 20)
+    ;; Texts of the same length, so that only the storage tells the
+    ;; buffers apart, but with lines of different lengths.
+    (let ((text (make-string 2000 ?x)))
+      (dotimes (j (/ 2000 (+ i 10)))
+        (aset text (* j (+ i 10)) ?\n))
+      (with-temp-buffer
+        (set-window-buffer nil (current-buffer))
+        (insert text)
+        (let ((size (window-text-pixel-size nil 1 (point-max))))
+          (force-window-update)
+          (should (equal (window-text-pixel-size nil 1 (point-max))
+                         size)))))
+    (garbage-collect)))
+
+;; An in-place change to a table that affects the layout must not be
+;; masked by the line layout cache.
+(ert-deftest xdisp-tests--line-layout-cache-tables ()
+  "Laying out text again sees changes to display tables and char-tables."
+  (with-temp-buffer
+    (set-window-buffer nil (current-buffer))
+    (dotimes (_ 10)
+      (insert "abc\n"))
+    (setq buffer-display-table (make-display-table))
+    (let ((size (window-text-pixel-size)))
+      (should (equal (window-text-pixel-size) size))
+      (aset buffer-display-table ?a (make-vector 200 ?z))
+      (should-not (equal (window-text-pixel-size) size))
+      (aset buffer-display-table ?a nil)
+      (should (equal (window-text-pixel-size) size))
+      (setq buffer-display-table nil)
+      (should (equal (window-text-pixel-size) size))
+      (let ((glyphless-char-display (copy-sequence glyphless-char-display)))
+        (should (equal (window-text-pixel-size) size))
+        (aset glyphless-char-display ?b 'zero-width)
+        (should-not (equal (window-text-pixel-size) size)))
+      (should (equal (window-text-pixel-size) size)))))
+
 ;;; xdisp-tests.el ends here
@@ -47,4 +47,42 @@
                  '(66 655 65535)))
   (should (equal (color-values-from-color-spec "rgbi:0/0.5/10") nil)))
 
+;; Check that face_at_buffer_position caches the faces it merges, and
+;; forgets them when face definitions change.
+(ert-deftest xfaces-face-merge-cache ()
+  (make-face 'xfaces-tests--face)
+  (with-temp-buffer
+    (set-window-buffer nil (current-buffer))
+    (dotimes (_ 100)
+      (insert (propertize "foo" 'face 'xfaces-tests--face) " "
+              (propertize "bar" 'face '(italic xfaces-tests--face)) "\n"))
+    (let* ((count (lambda (key) (alist-get key (face-merge-cache-stats))))
+           (hits (funcall count 'hits))
+           misses)
+      (window-text-pixel-size nil 1 (point-max))
+      (should (>= (funcall count 'hits) (+ hits 190)))
+      (setq misses (funcall count 'misses))
+      (set-face-attribute 'xfaces-tests--face nil :underline t)
+      (window-text-pixel-size nil 1 (point-max))
+      (should (> (funcall count 'misses) misses)))))
+
+;; Face specs changed in place are not noticed by the cache, but
+;; force-window-update and clear-face-cache make it forget them.
+(ert-deftest xfaces-face-merge-cache-clear ()
+  (with-temp-buffer
+    (set-window-buffer nil (current-buffer))
+    (dotimes (_ 100)
+      (insert (propertize "foo" 'face '(:weight bold)) "\n"))
+    (let ((misses (lambda ()
+                    (window-text-pixel-size nil 1 (point-max))
+                    (alist-get 'misses (face-merge-cache-stats)))))
+      (funcall misses)
+      (let ((count (funcall misses)))
+        (should (= (funcall misses) count))
+        (force-window-update)
+        (should (> (funcall misses) count)))
+      (let ((count (funcall misses)))
+        (clear-face-cache)
+        (should (> (funcall misses) count))))))
+
 (provide 'xfaces-tests)